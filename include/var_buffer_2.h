@@ -15,18 +15,216 @@
 #define VB2_FLOAT "float"
 #define VB2_DOUBLE "double"
 #define VB2_LONG "long"
+#define VB2_BYTE "byte"
+
+// Wide columns: a whole array or struct is one variable, copied with a single memcpy per tick
+// and read back as a 2-D array (ticks x elements) or as records of the struct's fields.
+// Usage:
+//    double state[1000];
+//    vb2_track_variable(&state, "state", "m", "state vector", VB2_ARRAY(VB2_DOUBLE, 1000));
+//    struct pose { double x, y; float heading; } pose;
+//    vb2_track_variable(&pose, "pose", "", "robot pose", VB2_STRUCT);
+//    vb2_track_field(&pose, "pose", x, VB2_DOUBLE);  // Optional, lets readers name the members
+#define VB2_ARRAY(type, count) type "[" VB2_STRINGIFY(count) "]" // count is an integer literal or a macro for one
+#define VB2_STRINGIFY(x) #x
+#define VB2_STRUCT "struct"                         // Stored as "byte[sizeof]"
+
+enum vb2_write_mode {
+    VB2_WRITE_SYNC = 0, // Full buffers are written inline by vb2_record_all (default)
+    VB2_WRITE_ASYNC,    // Full buffers are handed to a background writer thread
+    VB2_WRITE_MMAP      // Samples are copied straight into a shared mapping of the pre-sized file
+};
+
+enum vb2_async_policy {
+    VB2_ASYNC_BLOCK = 0, // Wait for the writer to return a buffer (default)
+    VB2_ASYNC_DROP,      // Discard the full buffer, the "DROPPED" section lists the samples missing
+    VB2_ASYNC_GROW       // Allocate another staging buffer
+};
+
+enum vb2_clock {
+    VB2_CLOCK_NONE = 0,      // No timestamp column (default)
+    VB2_CLOCK_MONOTONIC_RAW, // clock_gettime(CLOCK_MONOTONIC_RAW) in ns
+    VB2_CLOCK_TSC            // Time stamp counter, calibrated against CLOCK_MONOTONIC_RAW over the recording
+};
+
+#define VB2_TIME_NAME "__time" // Name of the timestamp column
+
+enum vb2_record_mode {
+    VB2_RECORD_LINEAR = 0, // Stop recording once max_history samples are stored (default)
+    VB2_RECORD_RING,       // Keep the last max_history samples, overwriting the oldest
+    VB2_RECORD_STREAM      // Append chunks as they fill, the file grows with the data and max_history is unused
+};
 
 void vb2_init();
 void vb2_enable_log();
 int  vb2_open(const char *filename);
 void vb2_close();
-void vb2_add_variable(const char *name, const char *unit, const char *description, const char *type, void *var_ptr, uint8_t var_size);
+void vb2_add_variable(const char *name, const char *unit, const char *description, const char *type, void *var_ptr, size_t var_size);
+void vb2_add_field(const char *variable, const char *field, const char *type, size_t offset);
 void vb2_start(size_t max_history);
 void vb2_record_all();
+void vb2_flush_all();
 void vb2_end();
 
+// Flight recorder, configure before vb2_start
+// Usage:
+//    vb2_set_record_mode(VB2_RECORD_RING);   // Always on, the file holds the last max_history samples
+//    vb2_set_record_mode(VB2_RECORD_STREAM); // Never stops, the file grows chunk by chunk
+void   vb2_set_record_mode(enum vb2_record_mode mode);
+
+// Async recording, configure before vb2_start
+// Usage:
+//    vb2_set_write_mode(VB2_WRITE_ASYNC);
+//    vb2_set_async_policy(VB2_ASYNC_BLOCK, 3); // Triple buffered
+void   vb2_set_write_mode(enum vb2_write_mode mode);
+void   vb2_set_async_policy(enum vb2_async_policy policy, size_t buffer_count);
+size_t vb2_async_stalls();  // Times vb2_record_all waited for a free staging buffer
+size_t vb2_async_dropped(); // Bytes discarded by VB2_ASYNC_DROP
+
+// Memory mapped recording, configure before vb2_start
+// Usage:
+//    vb2_set_write_mode(VB2_WRITE_MMAP);
+//    vb2_set_mmap_writeback(4096); // Writer thread starts writeback every 4096 rows
+void   vb2_set_mmap_writeback(size_t interval_rows);
+
+// Summary index, configure before vb2_start
+// Keeps min/max/sum of every rows-sized run of each numeric column as the SUMMARY section so readers
+// can downsample or search a column without touching its data. pyramid != 0 also saves merged
+// levels (VB_PYRAMID_FANOUT entries each) as the PYRAMID section. rows = 0 disables it (default).
+void   vb2_set_summary(size_t rows, int pyramid);
+
+// Self instrumentation, compiled in with -DVB2_STATS_ENABLED (make STATS=1), free otherwise.
+// vb2_get_stats returns -1 and zeroes stats when it is compiled out. The counters of a session
+// are saved as the STATS section at vb2_end and reset for the next one.
+#define VB_STATS_BUCKETS 32 // Bucket k of a histogram counts durations in [2^k, 2^(k+1)) ns
+
+struct VB_Histogram {
+    uint64_t count[VB_STATS_BUCKETS];
+    uint64_t total_ns;
+    uint64_t max_ns;
+};
+
+struct VB_Stats {
+    uint64_t records;                   // vb2_record_all calls that stored a row
+    uint64_t dropped_rows;              // vb2_record_all calls past max_history in linear mode
+    uint64_t flushes;                   // Class flushes, every column of a size class at once
+    uint64_t writes;                    // Buffers written to the file by fwrite or pwrite
+    uint64_t bytes_written;             // Bytes of those buffers
+    uint64_t stalls;                    // Times VB2_WRITE_ASYNC waited for a free buffer
+    uint64_t log_flushes;               // Log buffer writes
+    uint64_t log_bytes;                 // Bytes of log written
+    struct VB_Histogram record_ns;      // Sampled, one in VB2_STATS_SAMPLE (16) vb2_record_all calls
+    struct VB_Histogram flush_ns;       // Every class flush
+    struct VB_Histogram write_ns;       // Every fwrite/pwrite of a buffer
+    struct VB_Histogram log_flush_ns;   // Every log buffer write
+};
+typedef struct VB_Stats vb2_stats;
+
+int    vb2_get_stats(vb2_stats *stats);
+void   vb2_reset_stats();
+
+// Timestamp column, configure before vb2_start
+// Every vb2_record_all reads the clock into a "long" column named VB2_TIME_NAME
+// and the file gets a CLOCK section to convert it to seconds.
+void   vb2_enable_timestamps(enum vb2_clock clock);
+
+// Lossless compression of int/long (delta of delta) and float/double (xor) columns.
+// Only applies in VB2_RECORD_STREAM, fixed layouts reserve the raw size anyway.
+void   vb2_set_compression(int enabled);
+
+// Live tailing, configure before vb2_start. Every interval_rows rows the recorder writes out what
+// it has staged and publishes the row count in the file, so a reader can follow the recording with
+// vb2_reader_refresh() / VB2Reader.refresh(). Linear and ring modes only, stream mode files can be
+// read up to their last chunk anyway. 0 disables it (default).
+void   vb2_set_live(size_t interval_rows);
+
+// Shared memory telemetry, configure before vb2_start. Every vb2_record_all also copies the selected
+// variables (all of them if none are selected) into a ring of slot_count rows in the POSIX shm
+// segment name, for dashboards to follow with vb2_shm_open() / VB2ShmReader. Consumers never block
+// or slow the recorder: rows they did not copy in time are overwritten. The segment is recreated
+// by every vb2_start and removed by vb2_close.
+// Usage:
+//    vb2_set_shm("robot_telemetry", 1024);
+//    vb2_shm_select("position");
+int    vb2_set_shm(const char *name, size_t slot_count);
+int    vb2_shm_select(const char *variable);
+
+// File rotation, configure before vb2_start. The recording moves on from run.vb2 to run.0001.vb2,
+// run.0002.vb2, ... once the current file holds rows rows, bytes bytes of samples or has been recorded
+// into for seconds, whichever comes first (0 leaves a limit out, all 0 turns rotation off). A linear
+// file also rotates once it holds max_history rows instead of dropping them, each file reserves
+// max_history rows whatever the other limits. A background thread opens and sizes the next file
+// ahead of time and saves the finished one, vb2_record_all only switches over.
+// Every file gets a SEGMENT section with its position in the rotation and its first row.
+void   vb2_set_rotation(size_t rows, size_t bytes, double seconds);
+size_t vb2_rotation_stalls(); // Rotations that had to wait for the next file to be ready
+
+// Triggered capture, configure before vb2_start. Only the rows around events are stored: every
+// vb2_record_all evaluates the triggers, keeps the row in memory among the last pre rows and stores
+// those, the row itself and post more once an event fires. An event fires on the row a trigger's
+// condition starts to hold or after vb2_trigger(), the window stays open while a condition holds.
+// Events are saved as the TRIGGERS section (VB2Reader.trigger_events(), vb2_reader_triggers()),
+// rows are stored window after window. Linear and stream modes, a linear file reserves max_history rows.
+// Usage:
+//    vb2_set_trigger_window(1000, 5000);
+//    vb2_add_trigger("current", VB2_TRIGGER_ABOVE, 12.5);  // After tracking "current"
+//    vb2_add_trigger("fault", VB2_TRIGGER_NOT_EQUAL, 0);
+enum vb2_trigger_op {
+    VB2_TRIGGER_ABOVE = 0, // value > threshold
+    VB2_TRIGGER_BELOW,     // value < threshold
+    VB2_TRIGGER_EQUAL,     // value == threshold
+    VB2_TRIGGER_NOT_EQUAL  // value != threshold, e.g. a fault flag against 0
+};
+
+void   vb2_set_trigger_window(size_t pre, size_t post);
+int    vb2_add_trigger(const char *variable, enum vb2_trigger_op op, double threshold); // Index, -1 if not an int, long, float or double
+void   vb2_trigger();        // Fires an event on the next vb2_record_all
+size_t vb2_trigger_events(); // Events fired this session
+
+// Sampled columns, configure before vb2_start. A slow variable can be stored every divisor rows or
+// only when it changes by more than deadband, instead of every row. Each sample goes with the row it
+// was taken on in a "__row:<name>" column, and the SAMPLED section lists the columns, so readers
+// rebuild an array aligned with the rows by holding the last sample (VB2Reader.aligned(),
+// vb2_reader_read_aligned()). Arrays and structs compare their bytes, deadband is ignored for them.
+// Linear and stream modes, ring and live files record every column on every row.
+// Usage:
+//    vb2_set_divisor("temperature", 100);       // After tracking "temperature"
+//    vb2_set_change_only("mode", 0);            // Any change
+//    vb2_set_change_only("pressure", 0.5);      // Moves of more than 0.5
+#define VB2_ROW_PREFIX "__row:"
+
+int    vb2_set_divisor(const char *variable, size_t divisor);       // -1 if not a registered variable, 0 or 1 for every row
+int    vb2_set_change_only(const char *variable, double deadband);  // -1 if not a registered variable, negative for every row
+
+// Compact headers, configure before vb2_start. Saves each variable as 32 bytes plus its strings
+// instead of a fixed ~800 byte header, for files with many variables (readers of this version only).
+void   vb2_set_compact_headers(int enabled);
+
+// Bulk registration, for tens of thousands of variables
+// Usage:
+//    vb2_variable vars[] = {
+//        { "x", "m", "position", VB2_DOUBLE, &x, sizeof(x) },
+//        { "v", "m/s", "velocity", VB2_DOUBLE, &v, sizeof(v) },
+//    };
+//    vb2_add_variables(vars, 2);  // Returns how many were accepted
+// vb2_reserve_variables(n) sizes the registry up front when variables are added one by one.
+struct VB_Variable {
+    const char *name;
+    const char *unit;
+    const char *description;
+    const char *type;
+    void    *var_ptr;
+    size_t   var_size;
+};
+typedef struct VB_Variable vb2_variable;
+
+size_t vb2_add_variables(const vb2_variable *variables, size_t count);
+int    vb2_reserve_variables(size_t capacity);
+
 #define vb2_track_variable(var, name, unit, description, type) \
     vb2_add_variable((name), (unit), (description), (type), (void *)(var), sizeof(*var))
+#define vb2_track_field(var, name, field, type) \
+    vb2_add_field((name), #field, (type), offsetof(__typeof__(*(var)), field))
 
 enum severity {
     VB_LOG_DEBUG = 0, // Debug level logging
@@ -53,4 +251,115 @@ void vb_log_write(enum severity level, size_t lineno, const char *file, const ch
 void vb_log_flush();
 void vb_log_close();
 
+// Binary logging
+// VB_BLOG() does not format on the hot path. The first call at a call site registers the format string,
+// after that a call copies a format id, the level, the tick and the raw arguments into the log buffer.
+// The .log file is formatted offline with tools/vb2_log_decode or read_binary_log() in py/vb2_reader.py.
+// VB_DEBUG() and friends still work in binary mode, their messages are formatted and stored as text records.
+// fmt must be a string literal. %s arguments are kept up to 200 bytes, %n and %Lf fall back to text records.
+// Usage:
+//    vb_log_set_binary(1);                   // Before vb2_enable_log() or vb_log_init()
+//    VB_BLOG(VB_LOG_INFO, "x %f after %d steps", x, steps);
+void vb_log_set_binary(int binary);
+
+// Log events
+// vb2_enable_log_events() replaces the .log file: the log records (binary, as above) are kept with the
+// recording and vb2_end() saves them in the .vb2 file with an index by tick and timestamp, so a reader
+// fetches the events of a range of ticks with a binary search (VB2Reader.events(), vb2_reader_events()).
+// Usage:
+//    vb2_open("test.vb2");
+//    vb2_enable_log_events();                // Instead of vb2_enable_log()
+//    VB_BLOG(VB_LOG_WARNING, "limit hit at %f", x);
+void vb2_enable_log_events();
+
+#define VBR_BLOG(rec, level, fmt, ...) do { \
+        static uint32_t vb2_blog_site_; \
+        uint32_t vb2_blog_id_ = __atomic_load_n(&vb2_blog_site_, __ATOMIC_ACQUIRE); \
+        if (vb2_blog_id_ == 0) { \
+            vb2_blog_id_ = vb2_blog_register(fmt, __FILE__, __LINE__); \
+            __atomic_store_n(&vb2_blog_site_, vb2_blog_id_, __ATOMIC_RELEASE); \
+        } \
+        vb2r_blog_write((rec), (level), vb2_blog_id_, __LINE__, __FILE__, fmt, ##__VA_ARGS__); \
+    } while (0)
+#define VB_BLOG(level, fmt, ...) VBR_BLOG(vb2_default(), level, fmt, ##__VA_ARGS__)
+
+// Recorder instances
+// The functions above all work on a default recorder. Loops that run on their own thread create
+// their own recorder and use the vb2r_* equivalents, nothing on the hot path is shared between them.
+// Usage:
+//    vb2_set_session_dir("run_42");          // Optional, relative filenames are opened in here
+//    vb2_recorder *fast = vb2_recorder_create();
+//    vb2r_open(fast, "fast_loop.vb2");
+//    vb2r_track_variable(fast, &x, "x", "m", "position", VB2_DOUBLE);
+//    vb2r_start(fast, 100000);
+//    ... vb2r_record_all(fast); ...
+//    vb2r_end(fast);
+//    vb2_recorder_destroy(fast);
+typedef struct VB_Recorder vb2_recorder;
+
+vb2_recorder *vb2_recorder_create();
+void          vb2_recorder_destroy(vb2_recorder *rec);
+vb2_recorder *vb2_default(); // The recorder behind the vb2_* functions
+int           vb2_set_session_dir(const char *dir); // Call before starting any recorder threads
+
+void   vb2r_init(vb2_recorder *rec);
+void   vb2r_enable_log(vb2_recorder *rec);
+void   vb2r_enable_log_events(vb2_recorder *rec);
+int    vb2r_open(vb2_recorder *rec, const char *filename);
+void   vb2r_close(vb2_recorder *rec);
+void   vb2r_add_variable(vb2_recorder *rec, const char *name, const char *unit, const char *description, const char *type, void *var_ptr, size_t var_size);
+size_t vb2r_add_variables(vb2_recorder *rec, const vb2_variable *variables, size_t count);
+int    vb2r_reserve_variables(vb2_recorder *rec, size_t capacity);
+void   vb2r_set_compact_headers(vb2_recorder *rec, int enabled);
+void   vb2r_set_live(vb2_recorder *rec, size_t interval_rows);
+int    vb2r_set_shm(vb2_recorder *rec, const char *name, size_t slot_count);
+int    vb2r_shm_select(vb2_recorder *rec, const char *variable);
+void   vb2r_set_rotation(vb2_recorder *rec, size_t rows, size_t bytes, double seconds);
+size_t vb2r_rotation_stalls(vb2_recorder *rec);
+void   vb2r_set_trigger_window(vb2_recorder *rec, size_t pre, size_t post);
+int    vb2r_add_trigger(vb2_recorder *rec, const char *variable, enum vb2_trigger_op op, double threshold);
+void   vb2r_trigger(vb2_recorder *rec);
+size_t vb2r_trigger_events(vb2_recorder *rec);
+int    vb2r_set_divisor(vb2_recorder *rec, const char *variable, size_t divisor);
+int    vb2r_set_change_only(vb2_recorder *rec, const char *variable, double deadband);
+void   vb2r_add_field(vb2_recorder *rec, const char *variable, const char *field, const char *type, size_t offset);
+void   vb2r_start(vb2_recorder *rec, size_t max_history);
+void   vb2r_record_all(vb2_recorder *rec);
+void   vb2r_flush_all(vb2_recorder *rec);
+void   vb2r_end(vb2_recorder *rec);
+void   vb2r_set_record_mode(vb2_recorder *rec, enum vb2_record_mode mode);
+void   vb2r_set_write_mode(vb2_recorder *rec, enum vb2_write_mode mode);
+void   vb2r_set_async_policy(vb2_recorder *rec, enum vb2_async_policy policy, size_t buffer_count);
+size_t vb2r_async_stalls(vb2_recorder *rec);
+size_t vb2r_async_dropped(vb2_recorder *rec);
+void   vb2r_set_mmap_writeback(vb2_recorder *rec, size_t interval_rows);
+void   vb2r_set_compression(vb2_recorder *rec, int enabled);
+void   vb2r_enable_timestamps(vb2_recorder *rec, enum vb2_clock clock);
+void   vb2r_set_summary(vb2_recorder *rec, size_t rows, int pyramid);
+int    vb2r_get_stats(vb2_recorder *rec, vb2_stats *stats);
+void   vb2r_reset_stats(vb2_recorder *rec);
+
+#define vb2r_track_variable(rec, var, name, unit, description, type) \
+    vb2r_add_variable((rec), (name), (unit), (description), (type), (void *)(var), sizeof(*var))
+#define vb2r_track_field(rec, var, name, field, type) \
+    vb2r_add_field((rec), (name), #field, (type), offsetof(__typeof__(*(var)), field))
+
+#define VBR_DEBUG(rec, fmt, ...)   vb2r_log_write((rec), VB_LOG_DEBUG, __LINE__, __FILE__, fmt, ##__VA_ARGS__)
+#define VBR_INFO(rec, fmt, ...)    vb2r_log_write((rec), VB_LOG_INFO, __LINE__, __FILE__, fmt, ##__VA_ARGS__)
+#define VBR_WARNING(rec, fmt, ...) vb2r_log_write((rec), VB_LOG_WARNING, __LINE__, __FILE__, fmt, ##__VA_ARGS__)
+#define VBR_ERROR(rec, fmt, ...)   vb2r_log_write((rec), VB_LOG_ERROR, __LINE__, __FILE__, fmt, ##__VA_ARGS__)
+#define VBR_FATAL(rec, fmt, ...)   vb2r_log_write((rec), VB_LOG_FATAL, __LINE__, __FILE__, fmt, ##__VA_ARGS__)
+
+void vb2r_log_init(vb2_recorder *rec, const char *filename);
+void vb2r_log_set_echo(vb2_recorder *rec, int echo_stdout, int echo_stderr);
+void vb2r_log_set_level(vb2_recorder *rec, enum severity level);
+void vb2r_log_write(vb2_recorder *rec, enum severity level, size_t lineno, const char *file, const char *fmt, ...);
+void vb2r_log_flush(vb2_recorder *rec);
+void vb2r_log_close(vb2_recorder *rec);
+void vb2r_log_set_binary(vb2_recorder *rec, int binary);
+
+uint32_t vb2_blog_register(const char *fmt, const char *file, uint32_t line); // Used by VBR_BLOG
+void vb2r_blog_write(vb2_recorder *rec, enum severity level, uint32_t id, size_t lineno, const char *file, const char *fmt, ...)
+    __attribute__((format(printf, 6, 7)));
+
 #endif // VAR_BUFFER_2_H
\ No newline at end of file
@@ -0,0 +1,246 @@
+#ifndef VB2_READER_H
+#define VB2_READER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+    Native reader for files written by var_buffer_2.c.
+    The file is mapped read only and columns are handed out as views into the mapping,
+    so pulling a few columns out of a file with thousands of variables only touches the
+    pages of those columns. Views stay valid until vb2_reader_close().
+*/
+
+enum vb2_type {
+    VB2_TYPE_UNKNOWN = 0,
+    VB2_TYPE_INT,    // int32_t
+    VB2_TYPE_LONG,   // int64_t
+    VB2_TYPE_FLOAT,  // float
+    VB2_TYPE_DOUBLE, // double
+    VB2_TYPE_BYTE    // uint8_t, the rows of struct columns
+};
+
+#define VB2_FLAG_RING      0x1 // Columns are circular
+#define VB2_FLAG_CHUNKED   0x2 // Stream mode, columns are stored as chunks
+#define VB2_FLAG_TIMESTAMP 0x4 // A "__time" column and a "CLOCK" section are present
+#define VB2_FLAG_COMPACT   0x8 // Headers are saved with a string table (vb2_set_compact_headers)
+#define VB2_FLAG_LIVE      0x10 // Rows are published while recording (vb2_set_live)
+
+typedef struct VB2_Reader vb2_reader;
+
+struct vb2_column {
+    const char   *name;         // Points into the mapping
+    const char   *unit;
+    const char   *description;
+    const char   *type;         // Type as written, e.g. "double:xor"
+    enum vb2_type base;         // Element type, without the codec suffix or the array shape
+    uint8_t       codec;        // 0 raw, 1 delta of delta, 2 xor (stream mode chunks only)
+    size_t        var_size;     // Bytes per sample
+    size_t        elements;     // Elements per sample, 1 for scalars and N for "double[N]"
+    size_t        count;        // Samples recorded
+};
+
+struct vb2_view {
+    const void   *data;         // First sample
+    size_t        count;        // Samples in the view
+    size_t        stride;       // Bytes between consecutive samples
+    enum vb2_type type;
+};
+
+// Entry of the SUMMARY (level 0) and PYRAMID (levels 1..) sections, see vb2_set_summary
+struct vb2_summary {
+    size_t        block;        // Column index
+    size_t        level;
+    size_t        first_row;
+    size_t        rows;
+    double        min;
+    double        max;
+    double        sum;
+};
+
+// Member of a struct column, see vb2_add_field
+struct vb2_field {
+    size_t        block;        // Column index
+    size_t        offset;       // Of the member in the row
+    char          name[32];
+    char          type[16];     // Scalar or array type, e.g. "double" or "float[3]"
+};
+
+// "SEGMENT" section of the files of a rotation (vb2_set_rotation), see vb2_reader_section
+struct vb2_segment {
+    size_t        index;        // Position in the rotation, 0 for the file given to vb2_open
+    size_t        first_row;    // Rows recorded into the earlier files
+    size_t        rows;         // vb2_record_all calls recorded into this one
+    size_t        reserved;
+};
+
+// Sample i of a view as the C type it was recorded with, e.g. vb2_view_at(view, double, 10)
+#define vb2_view_at(view, ctype, i) (*(const ctype *)((const uint8_t *)(view).data + (size_t)(i) * (view).stride))
+// Row i of an array or struct column, e.g. vb2_view_row(view, double, 10)[42] or vb2_view_row(view, struct pose, 10)->x
+#define vb2_view_row(view, ctype, i) ((const ctype *)((const uint8_t *)(view).data + (size_t)(i) * (view).stride))
+
+// Usage:
+// vb2_reader *rd = vb2_reader_open("test.vb2");
+// int col = vb2_reader_find(rd, "position");
+// struct vb2_view view;
+// if (vb2_reader_view(rd, col, 0, vb2_reader_column(rd, col)->count, 1, &view) == 0) {
+//     for (size_t i = 0; i < view.count; i++) printf("%f\n", vb2_view_at(view, double, i));
+// }
+// vb2_reader_close(rd);
+
+vb2_reader *vb2_reader_open(const char *filename); // NULL if the file is missing or not a VB2 file
+void   vb2_reader_close(vb2_reader *rd);
+
+size_t vb2_reader_column_count(const vb2_reader *rd);
+int    vb2_reader_find(const vb2_reader *rd, const char *name); // Column index, -1 if missing
+const struct vb2_column *vb2_reader_column(const vb2_reader *rd, int col);
+size_t vb2_reader_flags(const vb2_reader *rd);                  // VB2_FLAG_* bits of the master header
+
+// Zero copy view of rows [first, first + count * step) taking every step-th sample.
+// Rows are in recording order. Returns -1 if the range is not stored contiguously
+// (it crosses the wrap of a ring or a chunk boundary, or the chunk is compressed),
+// vb2_reader_read() handles those.
+int    vb2_reader_view(const vb2_reader *rd, int col, size_t first, size_t count, size_t step, struct vb2_view *view);
+
+// Ring files: the stored samples as the older and the newer part, newer is empty until the ring wraps.
+// Linear files return everything as the older part. Chunked files return -1.
+int    vb2_reader_segments(const vb2_reader *rd, int col, struct vb2_view segments[2]);
+
+// Live files (vb2_set_live): picks up the rows published since the last refresh (or the open) and
+// returns how many there are, they are the last rows of every column. Columns grow, a ring's window
+// moves and earlier views may be stale afterwards. Once the recording ends the file is mapped again
+// with its saved headers and sections. Returns -1 for files that are not live.
+// A ring leaves its oldest interval rows out while recording: the writer may be overwriting them.
+// A reader that falls further behind gets 0 from vb2_reader_read() for rows the writer lapped since
+// the refresh and should refresh and read again. Views and segments are not checked.
+// Usage:
+//    while (vb2_reader_live(rd)) {
+//        long rows = vb2_reader_refresh(rd);
+//        size_t count = vb2_reader_column(rd, col)->count;
+//        vb2_reader_read(rd, col, count - rows, rows, 1, out);
+//        usleep(100000);
+//    }
+long   vb2_reader_refresh(vb2_reader *rd);
+int    vb2_reader_live(const vb2_reader *rd); // Still being recorded as of the last refresh
+
+// Chunked (stream mode) files: chunk i of a column and the row of its first sample.
+// Compressed chunks are decoded into a buffer owned by the reader that the next decode reuses.
+size_t vb2_reader_chunk_count(vb2_reader *rd, int col);
+int    vb2_reader_chunk(vb2_reader *rd, int col, size_t i, struct vb2_view *view, size_t *first_row);
+
+// Copies rows [first, first + count * step) taking every step-th sample into out, whatever the layout.
+// Returns the number of samples copied, fewer than count if the column ends first.
+size_t vb2_reader_read(vb2_reader *rd, int col, size_t first, size_t count, size_t step, void *out);
+
+// Summary entries of a column at a level in row order, NULL if the file has none.
+// Downsampling or searching a column through these reads kilobytes instead of the column.
+const struct vb2_summary *vb2_reader_summary(const vb2_reader *rd, int col, size_t level, size_t *count);
+
+// Members of a struct column in offset order, NULL if none were described
+const struct vb2_field *vb2_reader_fields(const vb2_reader *rd, int col, size_t *count);
+
+// Data of an appended section such as "CHUNKS" or "CLOCK", NULL if the file has none.
+const void *vb2_reader_section(const vb2_reader *rd, const char *tag, size_t *size);
+
+// Event of a triggered capture (vb2_set_trigger_window). The file stores the windows one after
+// another, rows [first_row, first_row + rows) are the window the event is in.
+struct vb2_trigger_event {
+    uint64_t      tick;         // vb2_record_all call of the session it fired on
+    uint64_t      row;          // Row of that sample in this file
+    uint64_t      first_row;    // Window, pre-trigger rows included
+    uint64_t      rows;
+    int32_t       trigger;      // Index vb2_add_trigger returned, -1 for vb2_trigger
+    int32_t       block;        // Column of the trigger's variable, -1 for vb2_trigger
+    double        value;        // Of that variable when it fired
+    uint32_t      op;           // enum vb2_trigger_op of var_buffer_2.h
+    uint32_t      continued;    // Fired in an earlier file of the rotation, row is 0
+};
+
+// Events in the order they fired, NULL if the file has none
+const struct vb2_trigger_event *vb2_reader_triggers(const vb2_reader *rd, size_t *count);
+
+// Samples a VB2_ASYNC_DROP writer discarded. Linear and ring columns hold stale data there, chunked
+// files have no chunk for them. Rows count from the start of the file in the column's own samples,
+// a ring's from the first row recorded, before it wraps.
+struct vb2_dropped {
+    size_t        block;        // Column
+    size_t        first_row;
+    size_t        rows;
+};
+
+// Ranges in the order they were dropped, NULL if the file has none
+const struct vb2_dropped *vb2_reader_dropped(const vb2_reader *rd, size_t *count);
+
+// Entry of the SAMPLED section for a variable stored at a divisor or on change (vb2_set_divisor,
+// vb2_set_change_only). Its column holds one sample per store and the column index holds, as int64,
+// the row each was taken on, named VB2_ROW_PREFIX followed by the variable's name.
+#define VB2_ROW_PREFIX "__row:"
+
+struct vb2_sampling {
+    size_t        block;        // Column of the samples
+    size_t        index;        // Column of their rows
+    size_t        divisor;      // 1 if every row was a candidate
+    size_t        change_only;
+    double        deadband;
+    size_t        rows;         // Rows of the file, the length of the aligned column
+};
+
+// Sampling of a column, NULL if it has a sample per row
+const struct vb2_sampling *vb2_reader_sampling(const vb2_reader *rd, int col);
+// Rows of a column once aligned, its count unless it is sampled
+size_t vb2_reader_aligned_count(const vb2_reader *rd, int col);
+// Copies rows [first, first + count) with a sample per row into out, a sampled column repeating its
+// last sample until the next one. Returns the number of rows copied, like vb2_reader_read.
+size_t vb2_reader_read_aligned(vb2_reader *rd, int col, size_t first, size_t count, void *out);
+
+// An event logged with vb2_enable_log_events
+struct vb2_event {
+    uint64_t      tick;         // Row being recorded when it was logged
+    int64_t       time;         // Raw clock of the "__time" column when logged, 0 without timestamps
+    int           level;        // enum severity of var_buffer_2.h
+    const char   *file;         // Points into the mapping, NULL if the record is damaged
+    uint32_t      line;
+};
+
+// Events are numbered in tick order. vb2_reader_event_range() finds the events logged at ticks
+// [first_tick, last_tick] with a binary search: they are *first .. *first + returned count - 1.
+size_t vb2_reader_event_count(const vb2_reader *rd);
+size_t vb2_reader_event_range(const vb2_reader *rd, uint64_t first_tick, uint64_t last_tick, size_t *first);
+// Event i and its message formatted into message (truncated to size bytes), -1 if there is no event i
+int    vb2_reader_event(vb2_reader *rd, size_t i, struct vb2_event *event, char *message, size_t size);
+
+// Shared memory telemetry (vb2_set_shm): rows of the selected variables, packed in schema order
+// at the offsets vb2_shm_column() gives. The recorder never waits for consumers, rows a consumer
+// did not copy before the ring came around are reported as missed.
+// Usage:
+//    vb2_shm_reader *shm = vb2_shm_open("robot_telemetry");   // NULL until the recorder started
+//    size_t offset;
+//    const struct vb2_column *col = vb2_shm_column(shm, vb2_shm_find(shm, "position"), &offset);
+//    uint8_t *row = malloc(vb2_shm_row_size(shm));
+//    struct vb2_shm_row info;
+//    if (vb2_shm_latest(shm, &info, row) == 0) printf("%f\n", *(double *)(row + offset));
+typedef struct VB2_Shm_Reader vb2_shm_reader;
+
+struct vb2_shm_row {
+    uint64_t      tick;         // Row number in the recording
+    int64_t       time;         // Raw clock of the "__time" column, 0 without timestamps
+};
+
+vb2_shm_reader *vb2_shm_open(const char *name);
+void   vb2_shm_close(vb2_shm_reader *shm);
+size_t vb2_shm_column_count(const vb2_shm_reader *shm);
+int    vb2_shm_find(const vb2_shm_reader *shm, const char *name);      // Column index, -1 if not published
+const struct vb2_column *vb2_shm_column(const vb2_shm_reader *shm, int col, size_t *offset); // offset in the row
+size_t vb2_shm_row_size(const vb2_shm_reader *shm);
+int    vb2_shm_ended(const vb2_shm_reader *shm);                        // The recording of this segment is over
+// Newest row, -1 if there is none yet
+int    vb2_shm_latest(vb2_shm_reader *shm, struct vb2_shm_row *info, void *row);
+// Rows from *cursor on, oldest first, at most max_rows of them into rows (and info if not NULL).
+// Advances *cursor past them, *missed counts the rows that were overwritten before they were copied.
+size_t vb2_shm_read(vb2_shm_reader *shm, uint64_t *cursor, struct vb2_shm_row *info, void *rows, size_t max_rows, uint64_t *missed);
+
+// Formats a binary log (vb2_log_set_binary) into the lines the text log would have held.
+// Returns the number of lines written, -1 if in is not a binary log.
+long   vb2_log_decode(FILE *in, FILE *out);
+
+#endif // VB2_READER_H
@@ -0,0 +1,74 @@
+#ifndef VB2_SCHEMA_H
+#define VB2_SCHEMA_H
+#include <stddef.h>
+
+#include "var_buffer_2.h"
+
+/*
+    Compile time schemas for fixed telemetry sets.
+    The set is listed once as an X-macro, VB2_SCHEMA() expands it into a packed snapshot struct and
+    straight-line functions to fill, register and record it. The snapshot is recorded as a single
+    struct column with a FIELDS entry per member, so vb2_record_all() does one memcpy of the whole
+    row per tick instead of a copy per variable, and every reader splits it back into its members.
+
+    Usage:
+    #define ROBOT_SCHEMA(X, A) \
+        X(double, position, "m",   "Joint position") \
+        X(float,  current,  "A",   "Motor current")  \
+        X(int,    state,    "",    "Controller state") \
+        A(double, joints, 6, "rad", "Joint angles")
+    VB2_SCHEMA(robot, ROBOT_SCHEMA)
+
+    struct robot_snapshot snapshot;
+    struct robot_sources sources = { &position, &current, &state, &joints };
+    robot_track(rec, "robot", &snapshot);            // Before vb2r_start
+    ...
+    robot_record(rec, &snapshot, &sources);          // Instead of vb2r_record_all, loads each source once
+
+    X(type, name, unit, description) is a scalar, A(type, name, count, unit, description) an array of
+    count elements. type is one of int, long, float and double, which are also the VB2 type names.
+    robot_track_columns(rec, &snapshot) registers a column per member instead, with its unit and
+    description, laid out as separate vb2r_track_variable calls would; recording then copies per column.
+*/
+
+#define VB2_SCHEMA_MEMBER(type, name, unit, description)              type name;
+#define VB2_SCHEMA_ARRAY_MEMBER(type, name, count, unit, description) type name[count];
+#define VB2_SCHEMA_SOURCE(type, name, unit, description)              const type *name;
+#define VB2_SCHEMA_ARRAY_SOURCE(type, name, count, unit, description) const type (*name)[count];
+#define VB2_SCHEMA_GATHER(type, name, unit, description)              snapshot->name = *sources->name;
+#define VB2_SCHEMA_ARRAY_GATHER(type, name, count, unit, description) memcpy(snapshot->name, *sources->name, sizeof(snapshot->name));
+#define VB2_SCHEMA_FIELD(type, name, unit, description) \
+    vb2r_add_field(rec, variable, #name, #type, offsetof(__typeof__(*snapshot), name));
+#define VB2_SCHEMA_ARRAY_FIELD(type, name, count, unit, description) \
+    vb2r_add_field(rec, variable, #name, VB2_ARRAY(#type, count), offsetof(__typeof__(*snapshot), name));
+#define VB2_SCHEMA_COLUMN(type, name, unit, description) \
+    { #name, unit, description, #type, (void *)&snapshot->name, sizeof(snapshot->name) },
+#define VB2_SCHEMA_ARRAY_COLUMN(type, name, count, unit, description) \
+    { #name, unit, description, VB2_ARRAY(#type, count), (void *)&snapshot->name, sizeof(snapshot->name) },
+
+#define VB2_SCHEMA(prefix, schema)                                                                     \
+    struct __attribute__((packed)) prefix##_snapshot {                                                 \
+        schema(VB2_SCHEMA_MEMBER, VB2_SCHEMA_ARRAY_MEMBER)                                             \
+    };                                                                                                 \
+    struct prefix##_sources {                                                                          \
+        schema(VB2_SCHEMA_SOURCE, VB2_SCHEMA_ARRAY_SOURCE)                                             \
+    };                                                                                                 \
+    static inline void prefix##_gather(struct prefix##_snapshot *snapshot, const struct prefix##_sources *sources) { \
+        schema(VB2_SCHEMA_GATHER, VB2_SCHEMA_ARRAY_GATHER)                                             \
+    }                                                                                                  \
+    /* One struct column named variable, with a FIELDS entry per member */                             \
+    static inline void prefix##_track(vb2_recorder *rec, const char *variable, struct prefix##_snapshot *snapshot) { \
+        vb2r_add_variable(rec, variable, "", #prefix, VB2_STRUCT, (void *)snapshot, sizeof(*snapshot)); \
+        schema(VB2_SCHEMA_FIELD, VB2_SCHEMA_ARRAY_FIELD)                                               \
+    }                                                                                                  \
+    /* A column per member, returns how many were added */                                             \
+    static inline size_t prefix##_track_columns(vb2_recorder *rec, struct prefix##_snapshot *snapshot) { \
+        const vb2_variable columns[] = { schema(VB2_SCHEMA_COLUMN, VB2_SCHEMA_ARRAY_COLUMN) };         \
+        return vb2r_add_variables(rec, columns, sizeof(columns) / sizeof(columns[0]));                 \
+    }                                                                                                  \
+    static inline void prefix##_record(vb2_recorder *rec, struct prefix##_snapshot *snapshot, const struct prefix##_sources *sources) { \
+        prefix##_gather(snapshot, sources);                                                            \
+        vb2r_record_all(rec);                                                                          \
+    }
+
+#endif // VB2_SCHEMA_H
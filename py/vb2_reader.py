@@ -1,23 +1,63 @@
-import ctypes,sys,mmap,argparse
+import ctypes,sys,mmap,argparse,re,struct,os,glob
+from concurrent.futures import ThreadPoolExecutor
 try: import numpy as np
 except ImportError: 
     print("Numpy is not installed, some features may not work.")
     np = None
 
+VB2_VERSION = 1001 # Newest file format this reader understands
+
+# Slots of VB2MasterHeader.reserved
+VB2_RESERVED_FLAGS    = 0
+VB2_RESERVED_WRAP     = 1
+VB2_RESERVED_SECTIONS = 2
+
+VB2_FLAG_RING    = 0x1 # Columns are circular, oldest sample at the wrap position
+VB2_FLAG_CHUNKED = 0x2 # Columns are stored as chunks listed in the "CHUNKS" section
+VB2_FLAG_TIMESTAMP = 0x4 # VB2_TIME_NAME holds the clock at each record, see the "CLOCK" section
+VB2_FLAG_COMPACT = 0x8 # VB2CompactHeader entries and a string table replace the VB2Header array
+VB2_FLAG_LIVE    = 0x10 # A VB2Live record after the headers publishes the rows written so far
+
+VB2_TIME_NAME = "__time"
+
+VB2_CLOCK_NONE, VB2_CLOCK_MONOTONIC_RAW, VB2_CLOCK_TSC = 0, 1, 2
+
 STR_TYPE_TO_CTYPE = {
     'long': ctypes.c_long,
     'int': ctypes.c_int,
     'float': ctypes.c_float,
     'double': ctypes.c_double,
+    'byte': ctypes.c_uint8,
 }
 
+STR_TYPE_TO_CTYPE_SIZE = lambda type_name: ctypes.sizeof(STR_TYPE_TO_CTYPE[type_name])
+
 STR_TYPE_TO_NPTYPE = {
     'long'  : np.int64   if np else None,
     'int'   : np.int32   if np else None,
     'float' : np.float32 if np else None,
     'double': np.float64 if np else None,
+    'byte'  : np.uint8   if np else None,
 }
 
+def parse_type(type_name):
+    """ ('double', 1000) for "double[1000]", ('double', 1) for "double" or "double:xor". """
+    base = type_name.split(':')[0]
+    if base.endswith(']') and '[' in base:
+        base, count = base[:-1].split('[')
+        return base, int(count)
+    return base, 1
+
+def type_ctype(type_name):
+    """ ctypes type of one sample, an array type for array columns. """
+    base, count = parse_type(type_name)
+    return STR_TYPE_TO_CTYPE[base] if count == 1 else STR_TYPE_TO_CTYPE[base] * count
+
+def type_dtype(type_name):
+    """ numpy dtype of one sample, a (base, (count,)) subarray for array columns so arrays read as 2-D. """
+    base, count = parse_type(type_name)
+    return np.dtype(STR_TYPE_TO_NPTYPE[base]) if count == 1 else np.dtype((STR_TYPE_TO_NPTYPE[base], (count,)))
+
 class VB2MasterHeader(ctypes.Structure):
     _pack_ = 8 # Ensure 8-byte alignment
     _fields_ = [
@@ -30,11 +70,57 @@ class VB2MasterHeader(ctypes.Structure):
     @property
     def magic(self) -> str:
         return self._magic.decode('utf-8').strip('\x00')
+    @property
+    def flags(self) -> int:
+        return self.reserved[VB2_RESERVED_FLAGS]
+    @property
+    def is_ring(self) -> bool:
+        return bool(self.flags & VB2_FLAG_RING)
+    @property
+    def is_chunked(self) -> bool:
+        return bool(self.flags & VB2_FLAG_CHUNKED)
+    @property
+    def is_compact(self) -> bool:
+        return bool(self.flags & VB2_FLAG_COMPACT)
+    @property
+    def is_live(self) -> bool:
+        return bool(self.flags & VB2_FLAG_LIVE)
+    @property
+    def wrap(self) -> int:
+        return self.reserved[VB2_RESERVED_WRAP] if self.is_ring else 0
+    @property
+    def sections(self) -> int:
+        return self.reserved[VB2_RESERVED_SECTIONS]
     
     def __str__(self):
-        return f"VB2MasterHeader(magic={self.magic}, version={self.version}, block_count={self.block_count}, max_history={self.max_history})"
+        return f"VB2MasterHeader(magic={self.magic}, version={self.version}, block_count={self.block_count}, max_history={self.max_history}, flags={self.flags}, wrap={self.wrap})"
+
+class VB2Column:
+    """ Properties derived from the name, unit, description, type, offset and count of a header. """
+    @property
+    def base_type(self) -> str:
+        """ Element type, without the codec suffix or the array shape. """
+        return parse_type(self.type)[0]
+    @property
+    def elements(self) -> int:
+        """ Elements per sample, 1 for scalars and N for "double[N]". """
+        return parse_type(self.type)[1]
+    @property
+    def ctype(self):
+        return type_ctype(self.type)
+    @property
+    def var_size(self) -> int:
+        return ctypes.sizeof(self.ctype)
+    @property
+    def codec(self) -> str:
+        """ 'xor', 'dod' or '' for raw columns. """
+        return self.type.split(':')[1] if ':' in self.type else ''
+    def __str__(self):
+        return (f"VB2Header(name={self.name}, unit={self.unit}, "
+                f"description={self.description}, type={self.type}, "
+                f"offset={self.offset}, count={self.count})")
 
-class VB2Header(ctypes.Structure):
+class VB2Header(VB2Column, ctypes.Structure):
     _pack_ = 8  # Ensure 8-byte alignment
     _fields_ = [
         ('_name', ctypes.c_char * 256),
@@ -62,10 +148,314 @@ class VB2Header(ctypes.Structure):
     @property
     def count(self) -> int:
         return self._count
-    def __str__(self):
-        return (f"VB2Header(name={self.name}, unit={self.unit}, "
-                f"description={self.description}, type={self.type}, "
-                f"offset={self.offset}, count={self.count})")
+    @count.setter
+    def count(self, value):
+        self._count = value
+
+class VB2CompactHeader(ctypes.Structure):
+    """ Variable header of VB2_FLAG_COMPACT files, the strings are offsets into the table after the headers. """
+    _pack_ = 8
+    _fields_ = [
+        ('name'       , ctypes.c_uint32),
+        ('unit'       , ctypes.c_uint32),
+        ('description', ctypes.c_uint32),
+        ('type'       , ctypes.c_uint32),
+        ('offset'     , ctypes.c_size_t),
+        ('count'      , ctypes.c_size_t),
+    ]
+
+class VB2Live(ctypes.Structure):
+    """ Rows published by a live recording, between the headers and the data. """
+    _pack_ = 8
+    _fields_ = [
+        ('rows'    , ctypes.c_uint64),
+        ('interval', ctypes.c_uint64),
+        ('ended'   , ctypes.c_uint64),
+        ('reserved', ctypes.c_uint64),
+    ]
+
+VB2_SHM_MAGIC    = b"VB2SHM"
+VB2_SHM_VERSION  = 1
+VB2_SHM_RECORDING, VB2_SHM_ENDED = 1, 2
+
+class VB2ShmHeader(ctypes.Structure):
+    """ Start of a shared memory telemetry segment (vb2_set_shm), followed by a VB2Header per column
+        whose offset is the offset in the row, then slot_count slots of slot_size bytes. """
+    _pack_ = 8
+    _fields_ = [
+        ('magic'       , ctypes.c_char * 8),
+        ('version'     , ctypes.c_uint64),
+        ('column_count', ctypes.c_uint64),
+        ('row_size'    , ctypes.c_uint64),
+        ('slot_count'  , ctypes.c_uint64),
+        ('slot_size'   , ctypes.c_uint64),
+        ('slots'       , ctypes.c_uint64),
+        ('clock'       , ctypes.c_uint64),
+        ('state'       , ctypes.c_uint64),
+        ('reserved'    , ctypes.c_uint64 * 6),
+        ('head'        , ctypes.c_uint64), # Rows published, on its own cache line
+        ('padding'     , ctypes.c_uint64 * 7),
+    ]
+
+# Slot header, the row follows. sequence is 2 * tick + 2 once row tick is complete, odd while it is written.
+SHM_SLOT_DTYPE_FIELDS = [('sequence', '<u8'), ('tick', '<u8'), ('time', '<i8'), ('reserved', '<u8')]
+
+class VB2StringHeader(VB2Column):
+    """ A compact header with its strings resolved, used like VB2Header. """
+    __slots__ = ('name', 'unit', 'description', 'type', 'offset', 'count')
+    def __init__(self, name, unit, description, type, offset, count):
+        self.name, self.unit, self.description, self.type, self.offset, self.count = name, unit, description, type, offset, count
+
+VB2_PLANE_ZERO   = 0
+VB2_PLANE_SPARSE = 1
+VB2_PLANE_RAW    = 2
+
+def decode_chunk(buffer, codec, rows, np_type):
+    """ Decodes a compressed chunk (see var_buffer_2.c for the layout) into a new array. """
+    if np is None:
+        raise NotImplementedError("Compressed columns require numpy.")
+    size  = np.dtype(np_type).itemsize
+    data  = np.frombuffer(buffer, dtype=np.uint8)
+    modes = data[:size]
+    pos   = size
+    planes = np.zeros((rows, size), dtype=np.uint8)
+    for k in range(size):
+        if modes[k] == VB2_PLANE_SPARSE:
+            bitmap_size = (rows + 7) // 8
+            present = np.unpackbits(data[pos:pos + bitmap_size], bitorder='little')[:rows].astype(bool)
+            pos += bitmap_size
+            nonzero = int(present.sum())
+            planes[present, k] = data[pos:pos + nonzero]
+            pos += nonzero
+        elif modes[k] == VB2_PLANE_RAW:
+            planes[:, k] = data[pos:pos + rows]
+            pos += rows
+    utype = np.uint32 if size == 4 else np.uint64
+    samples = planes.view('<u%d' % size).ravel().astype(utype)
+    if codec == 'xor':
+        values = np.bitwise_xor.accumulate(samples)
+    elif codec == 'dod':
+        dod = (samples >> utype(1)) ^ (utype(0) - (samples & utype(1))) # Undo zigzag, wraps like the C side
+        values = np.cumsum(np.cumsum(dod, dtype=utype), dtype=utype)
+    else:
+        raise ValueError(f"Unknown codec '{codec}'")
+    return values.view(np_type)
+
+class VB2Field(ctypes.Structure):
+    """ Member of a struct column, entry of the FIELDS section. """
+    _pack_ = 8
+    _fields_ = [
+        ('block'  , ctypes.c_size_t),
+        ('offset' , ctypes.c_size_t),
+        ('_name'  , ctypes.c_char * 32),
+        ('_type'  , ctypes.c_char * 16),
+    ]
+    @property
+    def name(self) -> str:
+        return self._name.decode('utf-8').strip('\x00')
+    @property
+    def type(self) -> str:
+        return self._type.decode('utf-8').strip('\x00')
+
+class VB2ChunkHeader(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('block'    , ctypes.c_size_t),
+        ('first_row', ctypes.c_size_t),
+        ('rows'     , ctypes.c_size_t),
+        ('size'     , ctypes.c_size_t),
+    ]
+
+class VB2ChunkIndex(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('chunk' , VB2ChunkHeader  ),
+        ('offset', ctypes.c_size_t),
+    ]
+
+class VB2Section(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('_tag'  , ctypes.c_char * 8),
+        ('offset', ctypes.c_size_t  ),
+        ('size'  , ctypes.c_size_t  ),
+    ]
+    @property
+    def tag(self) -> str:
+        return self._tag.decode('utf-8').strip('\x00')
+
+class VB2ClockInfo(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('source'          , ctypes.c_size_t),
+        ('start_ticks'     , ctypes.c_size_t),
+        ('start_realtime'  , ctypes.c_size_t),
+        ('ticks_per_second', ctypes.c_double),
+    ]
+
+class VB2Segment(ctypes.Structure):
+    """ "SEGMENT" section of the files of a rotation (vb2_set_rotation). """
+    _pack_ = 8
+    _fields_ = [
+        ('index'    , ctypes.c_size_t), # Position in the rotation, 0 for the file given to vb2_open
+        ('first_row', ctypes.c_size_t), # Rows recorded into the earlier files
+        ('rows'     , ctypes.c_size_t), # vb2_record_all calls recorded into this one
+        ('reserved' , ctypes.c_size_t),
+    ]
+
+class VB2Summary(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('block'    , ctypes.c_size_t),
+        ('level'    , ctypes.c_size_t),
+        ('first_row', ctypes.c_size_t),
+        ('rows'     , ctypes.c_size_t),
+        ('min'      , ctypes.c_double),
+        ('max'      , ctypes.c_double),
+        ('sum'      , ctypes.c_double),
+    ]
+
+LOG_EVENT_DTYPE = np.dtype([('tick', np.uint64), ('time', np.int64), ('offset', np.uint64)]) if np else None # LOGINDEX entry
+
+TRIGGER_EVENT_DTYPE = np.dtype([('tick', np.uint64), ('row', np.uint64), ('first_row', np.uint64), ('rows', np.uint64),
+                                ('trigger', np.int32), ('block', np.int32), ('value', np.float64),
+                                ('op', np.uint32), ('continued', np.uint32)]) if np else None # TRIGGERS entry
+
+SAMPLING_DTYPE = np.dtype([('block', np.uint64), ('index', np.uint64), ('divisor', np.uint64), ('change_only', np.uint64),
+                           ('deadband', np.float64), ('rows', np.uint64)]) if np else None # SAMPLED entry
+
+DROPPED_DTYPE = np.dtype([('block', np.uint64), ('first_row', np.uint64), ('rows', np.uint64)]) if np else None # DROPPED entry
+
+VB2_ROW_PREFIX = "__row:" # Row index column of a sampled variable, vb2_set_divisor() and vb2_set_change_only()
+
+SUMMARY_DTYPE = np.dtype([(name, np.uint64 if ctype is ctypes.c_size_t else np.float64) for name, ctype in VB2Summary._fields_]) if np else None
+
+VB2_STATS_BUCKETS = 32 # Bucket k counts durations in [2^k, 2^(k+1)) ns
+
+class VB2Histogram(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('count'   , ctypes.c_uint64 * VB2_STATS_BUCKETS),
+        ('total_ns', ctypes.c_uint64),
+        ('max_ns'  , ctypes.c_uint64),
+    ]
+    def percentile(self, p) -> float:
+        """ Upper bound in ns of the bucket holding the p-th percentile (0..1). """
+        total = sum(self.count)
+        seen = 0
+        for k, n in enumerate(self.count):
+            seen += n
+            if total and seen >= p * total:
+                return float(2 ** (k + 1))
+        return 0.0
+
+class VB2Stats(ctypes.Structure):
+    _pack_ = 8
+    _fields_ = [
+        ('records'      , ctypes.c_uint64),
+        ('dropped_rows' , ctypes.c_uint64),
+        ('flushes'      , ctypes.c_uint64),
+        ('writes'       , ctypes.c_uint64),
+        ('bytes_written', ctypes.c_uint64),
+        ('stalls'       , ctypes.c_uint64),
+        ('log_flushes'  , ctypes.c_uint64),
+        ('log_bytes'    , ctypes.c_uint64),
+        ('record_ns'    , VB2Histogram),
+        ('flush_ns'     , VB2Histogram),
+        ('write_ns'     , VB2Histogram),
+        ('log_flush_ns' , VB2Histogram),
+    ]
+
+# Binary log, see vb2_log_set_binary
+VB2_BLOG_MAGIC  = b"VB2BLOG\x00"
+VB2_BLOG_FORMAT = 0 # Record defines a format id
+VB2_BLOG_TEXT   = 1 # Record holds a message formatted when it was logged
+VB2_LOG_LEVELS  = ("DEBUG", "INFO", "WARNING", "ERROR", "FATAL")
+
+BLOG_RECORD = struct.Struct("<IBxHQ")  # id, level, payload size, tick
+BLOG_CONVERSION = re.compile(r"%([-+ #0']*(?:\*|\d+)?(?:\.(?:\*|\d*))?)[hlzjtq]*([diouxXcfFeEgGaAsp%])")
+
+def _blog_format(fmt, types, payload):
+    """ printf with the raw arguments of a binary record, mirrors vb2_rd_blog_format. """
+    pos = 0
+    args = iter(types)
+    def take(kind):
+        nonlocal pos
+        if kind == 'i':
+            value, = struct.unpack_from("<i", payload, pos); pos += 4
+        elif kind == 'l':
+            value, = struct.unpack_from("<q", payload, pos); pos += 8
+        elif kind == 'd':
+            value, = struct.unpack_from("<d", payload, pos); pos += 8
+        elif kind == 'p':
+            value, = struct.unpack_from("<Q", payload, pos); pos += 8
+        else:
+            length, = struct.unpack_from("<H", payload, pos)
+            value = payload[pos + 2:pos + 2 + length].decode('utf-8', 'replace'); pos += 2 + length
+        return value
+    def convert(match):
+        flags, conversion = match.groups()
+        if conversion == '%':
+            return '%'
+        kind_stars = [take(next(args)) for _ in range(flags.count('*'))]
+        kind = next(args)
+        value = take(kind)
+        if conversion in 'ouxX' and kind in 'il':
+            value &= (1 << (32 if kind == 'i' else 64)) - 1 # C prints these unsigned
+        if conversion == 'p':
+            return ('%' + flags + 's') % (hex(value) if value else '(nil)')
+        if conversion in 'aA':
+            return ('%' + flags + 's') % float(value).hex()
+        if conversion == 'c':
+            value = chr(value & 0xff)
+        if '#' in flags and conversion in 'oxX' and (value == 0 or conversion == 'o'):
+            # C writes 0 for %#x of 0, and 017 where Python writes 0o17
+            value = '0' + format(value, 'o') if conversion == 'o' and value else '0'
+            flags, conversion = flags.replace('#', '').replace('0', ''), 's'
+        return ('%' + flags + conversion) % tuple(kind_stars + [value])
+    return BLOG_CONVERSION.sub(convert, fmt)
+
+def decode_binary_log(data, formats=None):
+    """ Yields (tick, level, file, line, message) for each record of binary log data (after the file header).
+        Definitions are collected into formats, pass one to decode records defined elsewhere. """
+    formats = {} if formats is None else formats
+    view = memoryview(data)
+    pos = 0
+    while pos + BLOG_RECORD.size <= len(view):
+        record_id, level, size, tick = BLOG_RECORD.unpack_from(view, pos)
+        payload = bytes(view[pos + BLOG_RECORD.size:pos + BLOG_RECORD.size + size])
+        if len(payload) < size:
+            break # Truncated, the process died before the log was flushed
+        pos += BLOG_RECORD.size + size
+        if record_id == VB2_BLOG_FORMAT:
+            format_id, line, count = struct.unpack_from("<IIB", payload)
+            types = payload[9:9 + count].decode()
+            file, fmt = payload[9 + count:].split(b'\0')[:2]
+            formats[format_id] = (file.decode(), line, types, fmt.decode('utf-8', 'replace'))
+            continue
+        if record_id == VB2_BLOG_TEXT:
+            line, = struct.unpack_from("<I", payload)
+            file, _, message = payload[4:].partition(b'\0')
+            yield tick, level, file.decode(), line, message.decode('utf-8', 'replace')
+        elif record_id in formats:
+            file, line, types, fmt = formats[record_id]
+            yield tick, level, file, line, _blog_format(fmt, types, payload)
+        else:
+            yield tick, level, "?", 0, f"<undefined format {record_id}>"
+
+def read_binary_log(filename):
+    """ Entries of a binary .log file as (tick, level, file, line, message) tuples. """
+    with open(filename, 'rb') as f:
+        data = f.read()
+    if data[:8] != VB2_BLOG_MAGIC:
+        raise ValueError(f"{filename} is not a binary log")
+    return list(decode_binary_log(data[16:]))
+
+def format_log_entry(entry):
+    """ An entry in the layout of the text log. """
+    tick, level, file, line, message = entry
+    name = VB2_LOG_LEVELS[level] if level < len(VB2_LOG_LEVELS) else VB2_LOG_LEVELS[0]
+    return f"{'[%d]' % tick:>6} {name:<7} {file}[{line}]: {message}"
 
 class VB2Reader:
     def __init__(self, filename):
@@ -74,22 +464,111 @@ class VB2Reader:
         self.mmap_obj = None
         self.master_header = None
         self.vars = {}
+        self.blocks = {}      # name -> block index
+        self.sections = {}    # tag -> VB2Section
+        self.chunk_index = {} # block index -> [VB2ChunkIndex], chunked files only
+        self.clock = None     # VB2ClockInfo, files recorded with timestamps
+        self.stats = None     # VB2Stats, files recorded with VB2_STATS_ENABLED
+        self.segment = None   # VB2Segment, files of a rotation
+        self.sampling = {}    # name -> SAMPLED entry, variables stored at a divisor or on change
+        self.log_formats = None # Format id -> definition, read from LOGFMT on the first events() call
+        self.fields = {}      # block index -> [VB2Field], struct columns described with vb2_add_field
+        self.data_start = 0   # End of the headers, where stream mode chunks begin
+        self.live = None      # VB2Live of a file that was still being recorded at the last refresh
+        self.live_rows = 0    # Rows published at the last refresh
         self.opened_vars = {}
         
 
     def open(self):
         self.file = open(self.filename, 'rb')
+        self.map_file()
+        self.load()
+
+    def map_file(self):
         # Check windows or unix style
         if sys.platform.startswith('win'):
             self.mmap_obj = mmap.mmap(self.file.fileno(), 0, access=mmap.ACCESS_READ)
         else:
             self.mmap_obj = mmap.mmap(self.file.fileno(), 0, flags=mmap.ACCESS_READ, prot=mmap.PROT_READ)
+
+    def load(self):
         self.master_header = VB2MasterHeader.from_buffer_copy(self.mmap_obj, 0)
+        if self.master_header.version > VB2_VERSION:
+            print(f"VB2 file version {self.master_header.version} is newer than this reader ({VB2_VERSION}).")
         self.get_all_vars()
+        self.get_sections()
+        if self.master_header.is_chunked:
+            self.get_chunks()
+        if 'CLOCK' in self.sections:
+            self.clock = VB2ClockInfo.from_buffer_copy(self.mmap_obj, self.sections['CLOCK'].offset)
+        if 'STATS' in self.sections:
+            self.stats = VB2Stats.from_buffer_copy(self.mmap_obj, self.sections['STATS'].offset)
+        if 'SEGMENT' in self.sections:
+            self.segment = VB2Segment.from_buffer_copy(self.mmap_obj, self.sections['SEGMENT'].offset)
+        if 'FIELDS' in self.sections:
+            section = self.sections['FIELDS']
+            for field in (VB2Field * (section.size // ctypes.sizeof(VB2Field))).from_buffer_copy(self.mmap_obj, section.offset):
+                self.fields.setdefault(field.block, []).append(field)
+        if 'SAMPLED' in self.sections:
+            for entry in np.frombuffer(bytes(self.section_bytes('SAMPLED')), dtype=SAMPLING_DTYPE):
+                self.sampling[self.variable_name(int(entry['block']))] = entry
+        self.live = None
+        if self.master_header.is_live:
+            live = VB2Live.from_buffer_copy(self.mmap_obj, self.data_start)
+            self.live_rows = live.rows
+            if not live.ended:
+                self.live = live
+                self.set_live_rows(live.rows) # Header counts are not saved yet
+
+    def set_live_rows(self, rows):
+        """ Column counts and wrap once rows are published. A ring leaves out its oldest interval rows,
+            the writer may already be overwriting them. """
+        max_history = self.master_header.max_history
+        stored, wrap = min(rows, max_history), 0
+        if self.master_header.is_ring:
+            stored = min(rows, max_history - min(self.live.interval, max_history))
+            wrap = (rows - stored) % max_history
+        for header in self.vars.values():
+            header.count = stored
+        self.master_header.reserved[VB2_RESERVED_WRAP] = wrap
+        self.live_rows = rows
+        self.opened_vars.clear()
+
+    def refresh(self):
+        """ Live files (vb2_set_live): picks up the rows published since the last refresh and returns how
+            many there are, they are the last rows of every variable. Views taken before may be stale.
+            Once the recording ends the file is mapped again with its saved headers and sections.
+            Returns None for files that are not live. """
+        if self.live is None:
+            return None if not self.master_header.is_live else 0
+        previous = self.live_rows
+        ended = ctypes.c_uint64.from_buffer_copy(self.mmap_obj, self.data_start + VB2Live.ended.offset).value
+        rows = ctypes.c_uint64.from_buffer_copy(self.mmap_obj, self.data_start + VB2Live.rows.offset).value # After ended, as the writer stores them in the other order
+        if ended:
+            # The old mapping may still be exported to numpy views, it goes once they do
+            self.opened_vars.clear()
+            self.vars.clear()
+            self.blocks.clear()
+            self.sections.clear()
+            self.fields.clear()
+            self.log_formats = None
+            self.map_file()
+            self.load()
+        else:
+            self.set_live_rows(rows)
+        count = next(iter(self.vars.values())).count if self.vars else 0
+        return min(self.live_rows - previous, count)
 
     def close(self):
         self.opened_vars.clear()
         self.vars.clear()
+        self.blocks.clear()
+        self.sections.clear()
+        self.chunk_index.clear()
+        self.clock = None
+        self.stats = None
+        self.log_formats = None
+        self.fields.clear()
         self.master_header = None
         if self.mmap_obj:
             self.mmap_obj.close()
@@ -97,33 +576,556 @@ class VB2Reader:
             self.file.close()
 
     def get_all_vars(self):
-        for i in range(self.master_header.block_count):
-            offset = ctypes.sizeof(VB2MasterHeader) + i * ctypes.sizeof(VB2Header)
-            header = VB2Header.from_buffer_copy(self.mmap_obj, offset)
-            self.vars[header.name] = header
+        count = self.master_header.block_count
+        offset = ctypes.sizeof(VB2MasterHeader)
+        if self.master_header.is_compact:
+            headers = self.get_compact_headers()
+        else:
+            headers = (VB2Header * count).from_buffer_copy(self.mmap_obj, offset)
+            self.data_start = offset + count * ctypes.sizeof(VB2Header)
+        for i, header in enumerate(headers):
+            name = header.name # Decoded on every access for VB2Header
+            self.vars[name] = header
+            self.blocks[name] = i
+
+    def get_compact_headers(self):
+        """ Resolves the strings of compact headers, the rest of the reader sees them as VB2Header. """
+        count = self.master_header.block_count
+        table = ctypes.sizeof(VB2MasterHeader) + count * ctypes.sizeof(VB2CompactHeader)
+        size = ctypes.c_size_t.from_buffer_copy(self.mmap_obj, table).value
+        strings, at = {}, 0
+        for string in self.mmap_obj[table + ctypes.sizeof(ctypes.c_size_t):table + ctypes.sizeof(ctypes.c_size_t) + size].split(b'\x00'):
+            strings[at] = string.decode('utf-8')
+            at += len(string) + 1
+        self.data_start = table + ctypes.sizeof(ctypes.c_size_t) + ((size + 7) & ~7)
+        entries = struct.iter_unpack('@4I2N', self.mmap_obj[ctypes.sizeof(VB2MasterHeader):table]) # VB2CompactHeader, without a ctypes object per entry
+        return [VB2StringHeader(strings[name], strings[unit], strings[description], strings[type], offset, count)
+                for name, unit, description, type, offset, count in entries]
+
+    def get_sections(self):
+        offset = self.master_header.sections
+        if offset == 0:
+            return # Older file or nothing appended
+        count = ctypes.c_size_t.from_buffer_copy(self.mmap_obj, offset).value
+        offset += ctypes.sizeof(ctypes.c_size_t)
+        for i in range(count):
+            section = VB2Section.from_buffer_copy(self.mmap_obj, offset + i * ctypes.sizeof(VB2Section))
+            self.sections[section.tag] = section
+
+    def dtype(self, key):
+        """ numpy dtype of one sample of a variable. Arrays are subarrays, so columns read as (ticks, elements);
+            struct columns with FIELDS read as structured records, without them as (ticks, bytes). """
+        header = self.vars[key]
+        fields = self.fields.get(self.blocks[key])
+        if fields:
+            return np.dtype({'names'   : [f.name for f in fields],
+                             'formats' : [type_dtype(f.type) for f in fields],
+                             'offsets' : [f.offset for f in fields],
+                             'itemsize': header.var_size})
+        return type_dtype(header.type)
+
+    def section_bytes(self, tag):
+        """ Zero copy view of a section's data. """
+        section = self.sections[tag]
+        return memoryview(self.mmap_obj)[section.offset:section.offset + section.size]
+
+    def get_chunks(self):
+        if 'CHUNKS' in self.sections:
+            section = self.sections['CHUNKS']
+            entries = (VB2ChunkIndex * (section.size // ctypes.sizeof(VB2ChunkIndex))).from_buffer_copy(self.mmap_obj, section.offset)
+        else:
+            entries = self.scan_chunks() # Recording was not ended, walk the chunk headers instead
+        for entry in entries:
+            self.chunk_index.setdefault(entry.chunk.block, []).append(entry)
+
+    def scan_chunks(self):
+        entries = []
+        sizes = {i: h.var_size for h, i in ((h, self.blocks[n]) for n, h in self.vars.items())}
+        offset = self.data_start
+        while offset + ctypes.sizeof(VB2ChunkHeader) <= len(self.mmap_obj):
+            chunk = VB2ChunkHeader.from_buffer_copy(self.mmap_obj, offset)
+            data = offset + ctypes.sizeof(VB2ChunkHeader)
+            if chunk.block not in sizes or chunk.rows == 0 or chunk.size > chunk.rows * sizes[chunk.block] or data + chunk.size > len(self.mmap_obj):
+                break # Torn or unwritten chunk, everything before it is good
+            entries.append(VB2ChunkIndex(chunk, data))
+            offset = data + ((chunk.size + 7) & ~7)
+        return entries
+
+    def chunks(self, key):
+        """ Returns the chunks of a stream mode variable as a list of zero copy views,
+            compressed chunks are decoded into new arrays. """
+        if key not in self.vars:
+            raise KeyError(f"Variable '{key}' not found in the VB2 file.")
+        header = self.vars[key]
+        views = []
+        item_size = header.var_size
+        for entry in self.chunk_index.get(self.blocks[key], []):
+            if entry.chunk.size < entry.chunk.rows * item_size:
+                views.append(decode_chunk(self.mmap_obj[entry.offset:entry.offset + entry.chunk.size], header.codec, entry.chunk.rows, STR_TYPE_TO_NPTYPE[header.base_type]))
+            elif np and STR_TYPE_TO_NPTYPE.get(header.base_type, None) is not None:
+                views.append(np.frombuffer(self.mmap_obj, dtype=self.dtype(key), count=entry.chunk.rows, offset=entry.offset))
+            else:
+                views.append((header.ctype * entry.chunk.rows).from_buffer_copy(self.mmap_obj, entry.offset))
+        return views
     
+    def segments(self, key):
+        """ Returns the stored samples as (older, newer), zero copy views with numpy.
+            newer is empty unless the file is a ring that has wrapped. """
+        if key not in self.vars:
+            raise KeyError(f"Variable '{key}' not found in the VB2 file.")
+        header = self.vars[key]
+        var_type = header.base_type
+        slots = self.master_header.max_history if self.master_header.is_ring else header.count # A ring column always spans max_history rows
+        wrap = self.master_header.wrap if self.master_header.wrap < slots else 0
+        older = min(header.count, slots - wrap)
+        if np:
+            np_type = STR_TYPE_TO_NPTYPE.get(var_type, None)
+            if np_type is not None:
+                data = np.frombuffer(self.mmap_obj, dtype=self.dtype(key), count=slots, offset=header.offset)
+                return data[wrap:wrap + older], data[:header.count - older]
+        ctype = header.ctype
+        size = ctypes.sizeof(ctype)
+        newer = (ctype * (header.count - older)).from_buffer_copy(self.mmap_obj, header.offset)
+        older = (ctype * older).from_buffer_copy(self.mmap_obj, header.offset + wrap * size)
+        return older, newer
+
     def __getitem__(self, key):
         if key in self.opened_vars:
             return self.opened_vars[key]
+        if key in self.vars and self.master_header.is_chunked:
+            views = self.chunks(key)
+            if len(views) == 1:
+                data = views[0] # Zero copy view
+            elif np and (len(views) == 0 or isinstance(views[0], np.ndarray)):
+                data = np.concatenate(views) if views else np.empty(0, dtype=self.dtype(key))
+            else:
+                ctype = self.vars[key].ctype
+                data = (ctype * sum(len(v) for v in views))(*[x for v in views for x in v])
+            self.opened_vars[key] = data
+            return data
         if key in self.vars:
-            header = self.vars[key]
-            var_type = header.type
-            if np:
-                np_type = STR_TYPE_TO_NPTYPE.get(var_type, None)
-                if np_type is not None:
-                    data_offset = header.offset
-                    data = np.frombuffer(self.mmap_obj, dtype=np_type, count=header.count, offset=data_offset)
-                    self.opened_vars[key] = data
-                    return data
+            older, newer = self.segments(key)
+            if len(newer) == 0:
+                data = older # Zero copy view
+            elif np and isinstance(older, np.ndarray):
+                data = np.concatenate((older, newer)) # Wrapped ring, one copy into chronological order
             else:
-                ctype = STR_TYPE_TO_CTYPE[var_type]
-                data_offset = header.offset
-                data = (ctype * header.count).from_buffer_copy(self.mmap_obj, data_offset)
-                self.opened_vars[key] = data
+                data = (older._type_ * (len(older) + len(newer)))(*older, *newer)
+            self.opened_vars[key] = data
             return data
         else:
             raise KeyError(f"Variable '{key}' not found in the VB2 file.")
 
+    def rows(self, key, first, last):
+        """ Samples [first, last) of a variable, only touching the chunks or ring segments they are in. """
+        if key not in self.vars:
+            raise KeyError(f"Variable '{key}' not found in the VB2 file.")
+        if not self.master_header.is_chunked:
+            older, newer = self.segments(key)
+            split = len(older)
+            if last <= split:
+                return older[first:last]
+            if first >= split:
+                return newer[first - split:last - split]
+            return np.concatenate((older[first:], newer[:last - split]))
+        header = self.vars[key]
+        item_size = header.var_size
+        parts = []
+        for entry in self.chunk_index.get(self.blocks[key], []):
+            chunk = entry.chunk
+            if chunk.first_row + chunk.rows <= first or chunk.first_row >= last:
+                continue
+            if chunk.size < chunk.rows * item_size:
+                data = decode_chunk(self.mmap_obj[entry.offset:entry.offset + chunk.size], header.codec, chunk.rows, STR_TYPE_TO_NPTYPE[header.base_type])
+            else:
+                data = np.frombuffer(self.mmap_obj, dtype=self.dtype(key), count=chunk.rows, offset=entry.offset)
+            parts.append(data[max(first - chunk.first_row, 0):last - chunk.first_row])
+        if len(parts) == 1:
+            return parts[0]
+        return np.concatenate(parts) if parts else np.empty(0, dtype=self.dtype(key))
+
+    def aligned(self, key, first=0, last=None):
+        """ Rows [first, last) of a variable, one sample per row. A sampled variable holds its last sample
+            until the next one, found through its VB2_ROW_PREFIX column, the others are read as they are. """
+        if key not in self.vars:
+            raise KeyError(f"Variable '{key}' not found in the VB2 file.")
+        entry = self.sampling.get(key)
+        if entry is None:
+            return self.rows(key, first, self.vars[key].count if last is None else last)
+        rows = int(entry['rows'])
+        last = rows if last is None else min(last, rows)
+        values = np.asarray(self[key])
+        if last <= first or len(values) == 0:
+            return np.empty((0,) + values.shape[1:], dtype=values.dtype)
+        index = np.asarray(self[self.variable_name(int(entry['index']))])
+        samples = np.searchsorted(index, np.arange(first, last), side='right') - 1
+        return values[np.maximum(samples, 0)] # Every file starts with a sample, row 0 always has one
+
+    def summary(self, key, level=0):
+        """ Summary entries of a variable as a numpy structured array (block, level, first_row, rows, min, max, sum).
+            Level 0 comes from the SUMMARY section, higher levels from PYRAMID. """
+        tag = 'SUMMARY' if level == 0 else 'PYRAMID'
+        if tag not in self.sections:
+            raise KeyError(f"File has no {tag} section.")
+        entries = np.frombuffer(self.section_bytes(tag), dtype=SUMMARY_DTYPE)
+        block = self.blocks[key]
+        # Sorted by block (then level), so the entries of one block are a contiguous run
+        lo = np.searchsorted(entries['block'], block, side='left')
+        hi = np.searchsorted(entries['block'], block, side='right')
+        entries = entries[lo:hi]
+        return entries[entries['level'] == level] if level > 0 else entries
+
+    def summary_levels(self, key):
+        """ Summary levels available for a variable, finest first. """
+        levels = [self.summary(key, 0)] if 'SUMMARY' in self.sections else []
+        if 'PYRAMID' in self.sections:
+            pyramid = self.summary(key, 1) if len(levels) else None
+            level = 1
+            while pyramid is not None and len(pyramid) > 0:
+                levels.append(pyramid)
+                level += 1
+                pyramid = self.summary(key, level)
+        return levels
+
+    def downsample(self, key, points, first=0, last=None):
+        """ Min/max/mean envelope of rows [first, last) in about `points` buckets.
+            Uses the coarsest summary level that still has `points` entries in the range and only
+            reads the raw column when the range is shorter than that. Returns (row, min, max, mean). """
+        last = self.vars[key].count if last is None else last
+        for entries in reversed(self.summary_levels(key)):
+            in_range = entries[(entries['first_row'] + entries['rows'] > first) & (entries['first_row'] < last)]
+            if len(in_range) >= points:
+                return (in_range['first_row'], in_range['min'], in_range['max'], in_range['sum'] / in_range['rows'])
+        data = np.asarray(self.rows(key, first, last), dtype=np.float64)
+        step = max(1, -(-len(data) // points))
+        starts = np.arange(0, len(data), step)
+        return (starts + first, np.minimum.reduceat(data, starts), np.maximum.reduceat(data, starts),
+                np.add.reduceat(data, starts) / np.diff(np.append(starts, len(data))))
+
+    def find_exceeding(self, key, threshold):
+        """ Rows where a variable is above threshold. Only the runs whose summary max exceeds
+            it are read, descending the pyramid to narrow them down first. """
+        levels = self.summary_levels(key)
+        if not levels:
+            data = np.asarray(self[key])
+            return np.nonzero(data > threshold)[0]
+        candidates = None
+        for entries in reversed(levels):
+            hits = entries[entries['max'] > threshold]
+            if candidates is not None:
+                # Keep the finer entries inside a coarser hit
+                starts, ends = candidates
+                index = np.searchsorted(starts, hits['first_row'], side='right') - 1
+                inside = (index >= 0) & (hits['first_row'] < ends[np.maximum(index, 0)])
+                hits = hits[inside]
+            candidates = (hits['first_row'], hits['first_row'] + hits['rows'])
+        rows = [first + np.nonzero(np.asarray(self.rows(key, int(first), int(end))) > threshold)[0]
+                for first, end in zip(*candidates)]
+        return np.concatenate(rows) if rows else np.empty(0, dtype=np.int64)
+
+    def times(self):
+        """ Timestamps in seconds since vb2_start, add clock.start_realtime / 1e9 for wall time. """
+        if VB2_TIME_NAME not in self.vars:
+            raise KeyError("File was recorded without timestamps.")
+        ticks = self[VB2_TIME_NAME]
+        ticks_per_second = self.clock.ticks_per_second if self.clock else 1e9
+        start = self.clock.start_ticks if self.clock else (ticks[0] if len(ticks) else 0)
+        if np:
+            return (np.asarray(ticks) - np.int64(start)) / ticks_per_second
+        return [(t - start) / ticks_per_second for t in ticks]
+
+    def time_slice(self, t0, t1, names=None):
+        """ Samples recorded in [t0, t1) seconds since vb2_start, as {name: view}.
+            Binary search on the raw timestamp column, views stay zero copy where the column is. """
+        if np is None:
+            raise RuntimeError("time_slice requires numpy.")
+        if VB2_TIME_NAME not in self.vars:
+            raise KeyError("File was recorded without timestamps.")
+        ticks = np.asarray(self[VB2_TIME_NAME])
+        ticks_per_second = self.clock.ticks_per_second if self.clock else 1e9
+        start = self.clock.start_ticks if self.clock else (int(ticks[0]) if len(ticks) else 0)
+        lo = np.searchsorted(ticks, start + int(t0 * ticks_per_second), side='left')
+        hi = np.searchsorted(ticks, start + int(t1 * ticks_per_second), side='left')
+        names = [n for n in self.vars if n != VB2_TIME_NAME] if names is None else names
+        return {name: self[name][lo:hi] for name in names}
+
+    def event_index(self):
+        """ LOGINDEX entries (tick, raw time, offset into LOG) in tick order, empty without log events. """
+        if 'LOGINDEX' not in self.sections:
+            return np.zeros(0, dtype=LOG_EVENT_DTYPE)
+        return np.frombuffer(bytes(self.section_bytes('LOGINDEX')), dtype=LOG_EVENT_DTYPE)
+
+    def events(self, first_tick=0, last_tick=None):
+        """ Events logged with vb2_enable_log_events at ticks [first_tick, last_tick], in order, as
+            (tick, seconds since vb2_start or None without timestamps, level, file, line, message).
+            Binary search on the index, only the records in the range are decoded. """
+        if np is None:
+            raise RuntimeError("events requires numpy.")
+        index = self.event_index()
+        lo = np.searchsorted(index['tick'], first_tick, side='left')
+        hi = len(index) if last_tick is None else np.searchsorted(index['tick'], last_tick, side='right')
+        if lo >= hi:
+            return []
+        if self.log_formats is None:
+            self.log_formats = {}
+            if 'LOGFMT' in self.sections:
+                for _ in decode_binary_log(bytes(self.section_bytes('LOGFMT')), self.log_formats):
+                    pass
+        log = self.section_bytes('LOG')
+        ticks_per_second = self.clock.ticks_per_second if self.clock else None
+        events = []
+        for entry in index[lo:hi]:
+            offset = int(entry['offset'])
+            size = BLOG_RECORD.unpack_from(log, offset)[2]
+            record = bytes(log[offset:offset + BLOG_RECORD.size + size])
+            for tick, level, file, line, message in decode_binary_log(record, self.log_formats):
+                seconds = (int(entry['time']) - self.clock.start_ticks) / ticks_per_second if ticks_per_second else None
+                events.append((tick, seconds, level, file, line, message))
+        del log
+        return events
+
+    def trigger_events(self):
+        """ Events of a triggered capture (vb2_set_trigger_window) in the order they fired, as a numpy
+            structured array (tick, row, first_row, rows, trigger, block, value, op, continued).
+            block is the column of the trigger's variable, see variable_name(), -1 for vb2_trigger(). """
+        if 'TRIGGERS' not in self.sections:
+            return np.zeros(0, dtype=TRIGGER_EVENT_DTYPE)
+        return np.frombuffer(bytes(self.section_bytes('TRIGGERS')), dtype=TRIGGER_EVENT_DTYPE)
+
+    def dropped(self):
+        """ Samples VB2_ASYNC_DROP discarded, as a numpy structured array (block, first_row, rows).
+            Rows count from the start of the file in the column's own samples, a ring's before it wraps. """
+        if 'DROPPED' not in self.sections:
+            return np.zeros(0, dtype=DROPPED_DTYPE)
+        return np.frombuffer(bytes(self.section_bytes('DROPPED')), dtype=DROPPED_DTYPE)
+
+    def variable_name(self, block):
+        """ Name of the variable in column block. """
+        return next(name for name, index in self.blocks.items() if index == block)
+
+    def trigger_window(self, key, event):
+        """ Samples of a variable in the window of trigger event number event, pre-trigger rows included. """
+        entry = self.trigger_events()[event]
+        return self.rows(key, int(entry['first_row']), int(entry['first_row'] + entry['rows']))
+
+
+def natural_key(path):
+    """ Sort key that puts "run.vb2" before "run2.vb2" and "run2.vb2" before "run10.vb2". """
+    return [int(part) if part.isdigit() else part for part in re.split(r'(\d+)', os.path.splitext(path)[0])]
+
+class VB2DatasetColumn:
+    """ One variable across every file of a VB2Dataset, rows numbered from the start of the first file.
+        Nothing is read until it is indexed: column[a:b] only touches the files, chunks and pages of rows [a, b).
+        A sampled variable has one value per row as VB2Reader.aligned() gives it, each file holds its own samples. """
+    def __init__(self, dataset, key, parts):
+        self.dataset = dataset
+        self.key = key
+        self.parts = parts # [(reader, first row in the dataset, rows)] in dataset order
+        self.dtype = parts[0][0].dtype(key)
+        self.count = parts[-1][1] + parts[-1][2]
+
+    def __len__(self):
+        return self.count
+
+    @property
+    def shape(self):
+        return (self.count,) + self.dtype.shape
+
+    def __getitem__(self, index):
+        if isinstance(index, slice):
+            first, last, step = index.indices(self.count)
+            if step < 0:
+                return self.dataset.rows(self.key, last + 1, first + 1)[::step]
+            return self.dataset.rows(self.key, first, last, step)
+        index = int(index) + (self.count if int(index) < 0 else 0)
+        if not 0 <= index < self.count:
+            raise IndexError(f"Row {index} is out of range for '{self.key}' ({self.count} rows).")
+        return self.dataset.rows(self.key, index, index + 1)[0]
+
+    def __array__(self, dtype=None, copy=None):
+        data = self.dataset.rows(self.key, 0, self.count)
+        return data if dtype is None else data.astype(dtype)
+
+    def __str__(self):
+        return f"{self.key}: {self.count} rows in {len(self.parts)} files, {self.dtype}"
+
+class VB2Dataset:
+    """ Many VB2 files read as one recording: the files of a rotation (vb2_set_rotation) or successive sessions.
+        Only the headers and section tables are read when opening. Each variable is a VB2DatasetColumn spanning
+        every file it is in, indexing one decodes just the rows asked for, with the files read in parallel.
+        Files are ordered by their SEGMENT section when they have one (run.vb2, run.0001.vb2, ...) and by name otherwise.
+        Usage:
+            dataset = VB2Dataset("logs/*.vb2")
+            dataset.open()
+            position = dataset["position"]          # Lazy, nothing read yet
+            window = position[1000000:1001000]     # numpy array of those rows only
+            dataset.close() """
+    def __init__(self, pattern, workers=None):
+        self.pattern = pattern  # Glob, directory or list of files
+        self.workers = workers  # Threads decoding files in parallel, one per core by default
+        self.readers = []       # VB2Reader of each file, in dataset order
+        self.vars = {}          # name -> VB2DatasetColumn
+        self.executor = None
+
+    def files(self):
+        if isinstance(self.pattern, (list, tuple)):
+            return list(self.pattern)
+        if os.path.isdir(self.pattern):
+            return glob.glob(os.path.join(self.pattern, '*.vb2'))
+        return glob.glob(self.pattern)
+
+    def open(self):
+        if np is None:
+            raise RuntimeError("VB2Dataset requires numpy.")
+        for filename in self.files():
+            reader = VB2Reader(filename)
+            reader.open()
+            self.readers.append(reader)
+        def order(reader):
+            segment = reader.segment
+            if segment is None or segment.index == 0:
+                return natural_key(reader.filename), 0
+            # run.0003.vb2 follows run.vb2, whatever sorts between their names
+            stem = re.sub(r'\.\d+(\.[^./]*)?$', r'\1', reader.filename)
+            return natural_key(stem), segment.index
+        self.readers.sort(key=order)
+        parts = {}
+        for reader in self.readers:
+            for name, header in reader.vars.items():
+                if name.startswith(VB2_ROW_PREFIX):
+                    continue # Read through the sampled variable it indexes
+                entry = reader.sampling.get(name)
+                count = header.count if entry is None else int(entry['rows'])
+                if count == 0:
+                    continue
+                previous = parts.setdefault(name, [])
+                first = previous[-1][1] + previous[-1][2] if previous else 0
+                if previous and reader.dtype(name) != previous[0][0].dtype(name):
+                    raise ValueError(f"'{name}' is {reader.dtype(name)} in {reader.filename} and {previous[0][0].dtype(name)} in {previous[0][0].filename}.")
+                previous.append((reader, first, count))
+        self.vars = {name: VB2DatasetColumn(self, name, p) for name, p in parts.items()}
+        if len(self.readers) > 1 and self.workers != 1:
+            self.executor = ThreadPoolExecutor(max_workers=self.workers) # numpy releases the GIL while copying and decoding
+
+    def close(self):
+        if self.executor:
+            self.executor.shutdown()
+            self.executor = None
+        self.vars.clear()
+        for reader in self.readers:
+            reader.close()
+        self.readers.clear()
+
+    def __getitem__(self, key):
+        if key not in self.vars:
+            raise KeyError(f"Variable '{key}' not found in the dataset.")
+        return self.vars[key]
+
+    def rows(self, key, first, last, step=1):
+        """ Samples [first, last) of a variable taking every step-th, copied from each file straight into the result. """
+        column = self[key]
+        first, last = max(first, 0), min(last, column.count)
+        out = np.empty(max(0, -(-(last - first) // step)), dtype=column.dtype)
+        jobs = []
+        for reader, start, count in column.parts:
+            if start + count <= first or start >= last:
+                continue
+            lo = first + -(-(max(first, start) - first) // step) * step # First row of the file that is a multiple of step from first
+            if lo < min(last, start + count):
+                jobs.append((reader, lo - start, min(last, start + count) - start, (lo - first) // step))
+        def copy(job):
+            reader, lo, hi, at = job
+            data = (reader.aligned(key, lo, hi) if key in reader.sampling else reader.rows(key, lo, hi))[::step]
+            out[at:at + len(data)] = data
+        if self.executor and len(jobs) > 1:
+            list(self.executor.map(copy, jobs))
+        else:
+            for job in jobs:
+                copy(job)
+        return out
+
+
+class VB2ShmReader:
+    """ Consumer of the shared memory telemetry ring of a running recorder (vb2_set_shm).
+        The recorder never waits for consumers: read() reports the rows it overwrote before they were copied.
+        Usage:
+            shm = VB2ShmReader("robot_telemetry")
+            cursor = shm.head
+            while not shm.ended:
+                rows, cursor, missed = shm.read(cursor)
+                plot(rows['tick'], rows['row']['position'])
+    """
+    def __init__(self, name):
+        if np is None:
+            raise RuntimeError("VB2ShmReader requires numpy.")
+        with open('/dev/shm/' + name.lstrip('/'), 'rb') as f:
+            self.mmap_obj = mmap.mmap(f.fileno(), 0, flags=mmap.MAP_SHARED, prot=mmap.PROT_READ)
+        self.header = VB2ShmHeader.from_buffer_copy(self.mmap_obj, 0)
+        header = self.header
+        if (header.state == 0 or header.magic != VB2_SHM_MAGIC or header.version != VB2_SHM_VERSION or
+            header.slot_count == 0 or header.slot_count & (header.slot_count - 1) or
+            header.slots + header.slot_count * header.slot_size > len(self.mmap_obj)):
+            self.close()
+            raise ValueError(f"{name} is not a VB2 telemetry segment.")
+        schema = (VB2Header * header.column_count).from_buffer_copy(self.mmap_obj, ctypes.sizeof(VB2ShmHeader))
+        self.columns = {column.name: column for column in schema}
+        # A row as the recorder packs it, struct columns read as their bytes
+        self.dtype = np.dtype({'names'  : list(self.columns),
+                               'formats': [type_dtype(column.type) for column in schema],
+                               'offsets': [column.offset for column in schema],
+                               'itemsize': header.row_size})
+        slot_header = np.dtype(SHM_SLOT_DTYPE_FIELDS)
+        self.slot_dtype = np.dtype({'names'  : [n for n, _ in SHM_SLOT_DTYPE_FIELDS] + ['row'],
+                                    'formats': [t for _, t in SHM_SLOT_DTYPE_FIELDS] + [self.dtype],
+                                    'offsets': [slot_header.fields[n][1] for n, _ in SHM_SLOT_DTYPE_FIELDS] + [slot_header.itemsize],
+                                    'itemsize': header.slot_size})
+        self.slots = np.frombuffer(self.mmap_obj, dtype=self.slot_dtype, count=header.slot_count, offset=header.slots)
+
+    def close(self):
+        self.slots = None
+        if self.mmap_obj:
+            self.mmap_obj.close()
+            self.mmap_obj = None
+
+    @property
+    def head(self) -> int:
+        """ Rows published so far, the next row's tick. """
+        return ctypes.c_uint64.from_buffer_copy(self.mmap_obj, VB2ShmHeader.head.offset).value
+
+    @property
+    def ended(self) -> bool:
+        return ctypes.c_uint64.from_buffer_copy(self.mmap_obj, VB2ShmHeader.state.offset).value == VB2_SHM_ENDED
+
+    def _copy(self, ticks):
+        """ Slots of ticks copied out, with a mask of the rows that were complete and unchanged while copying. """
+        index = ticks & (self.header.slot_count - 1)
+        copied = self.slots[index] # Fancy indexing copies
+        sequence = self.slots['sequence'][index]
+        valid = (copied['sequence'] == 2 * ticks + 2) & (sequence == copied['sequence'])
+        return copied, valid
+
+    def latest(self):
+        """ Newest row as (tick, raw time, row), None if there is none yet. """
+        for _ in range(4):
+            head = self.head
+            if head == 0:
+                return None
+            copied, valid = self._copy(np.array([head - 1], dtype=np.uint64))
+            if valid[0]:
+                return int(copied['tick'][0]), int(copied['time'][0]), copied['row'][0]
+        return None # The recorder lapped the slot every time
+
+    def read(self, cursor, max_rows=None):
+        """ Rows from tick cursor on, oldest first, as (slots, cursor, missed): a structured array with the
+            'tick', 'time' and 'row' of each, the cursor to continue from and the rows that were overwritten. """
+        head = self.head
+        first = max(cursor, head - self.header.slot_count) if head > self.header.slot_count else cursor
+        last = head if max_rows is None else min(head, first + max_rows)
+        ticks = np.arange(first, max(first, last), dtype=np.uint64)
+        copied, valid = self._copy(ticks)
+        rows = copied[valid][['tick', 'time', 'row']]
+        return rows, max(cursor, last), (first - cursor if first > cursor else 0) + int((~valid).sum())
+
 
 # Example usage:
 # This part is for demonstration purposes and can be removed in production code.
@@ -133,7 +1135,12 @@ if __name__ == "__main__":
         sys.exit(1)
     parser = argparse.ArgumentParser(description="Read VB2 files and extract variables.")
     parser.add_argument('filename', type=str, help='Path to the VB2 file to read', default='test.vb2', nargs='?')
+    parser.add_argument('--log', type=str, help='Print a binary log file instead and exit', default=None)
     args = parser.parse_args()
+    if args.log:
+        for entry in read_binary_log(args.log):
+            print(format_log_entry(entry))
+        sys.exit(0)
     # Example usage
     import matplotlib.pyplot as plt
     reader = VB2Reader(args.filename) # filename='test.vb2' by default
@@ -1,12 +1,22 @@
-
+#define _GNU_SOURCE // sync_file_range
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdarg.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define VB_HAVE_TSC 1
+#endif
 
 /*
     Attempting to keep the object file isolated from the header file 
@@ -22,13 +32,21 @@
 */
 
 #ifndef VB_MAX_VAR_SIZE
-    #define VB_MAX_VAR_SIZE 8 // Maximum size of a variable in bytes
+    #define VB_MAX_VAR_SIZE 8 // Maximum size of a scalar variable in bytes, larger ones are wide columns
+#endif
+
+#ifndef VB_WIDE_BUFFER_SIZE
+    #define VB_WIDE_BUFFER_SIZE 0x10000 // Staging buffer of a wide column (arrays and structs), at least one row
 #endif
 
 #ifndef VB_BUFFER_SIZE
     #define VB_BUFFER_SIZE 0x1000 // Buffer size of 1 page
 #endif
 
+#ifndef VB_ASYNC_BUFFER_COUNT
+    #define VB_ASYNC_BUFFER_COUNT 2 // Staging buffers per variable in async mode (2 = double buffered)
+#endif
+
 #ifndef VB_LOG_BUFFER_SIZE
     #define VB_LOG_BUFFER_SIZE 0x4000 // Buffer size of 1 page
 #endif
@@ -36,24 +54,92 @@
     #define VB_LOG_BUFFER_OVERFLOW 0x1000 // Buffer size of 1 page
 #endif
 
+#ifndef VB_BLOG_MAX_FORMATS
+    #define VB_BLOG_MAX_FORMATS 4096 // Call sites of VB_BLOG, later ones are logged as text records
+#endif
+#define VB_BLOG_MAX_ARGS   16  // Arguments of one binary log format
+#define VB_BLOG_MAX_STRING 200 // Bytes kept of a %s argument, keeps a record inside VB_LOG_BUFFER_OVERFLOW
+
 #ifdef VB2_DEBUG_ENABLED
     #define VB_DEBUG(fmt, ...) printf("DEBUG[%d]: " fmt "\n", __LINE__, ##__VA_ARGS__)
 #else
     #define VB_DEBUG(fmt, ...) (void)0 // No-op if debugging is disabled
 #endif
 
-#define VB2_VERSION_MINOR 0 // Version of the variable buffer system
+#ifdef VB2_STATS_ENABLED
+    #ifndef VB2_STATS_SAMPLE
+        #define VB2_STATS_SAMPLE 16 // Time one vb2_record_all in this many, a power of two
+    #endif
+#endif
+#define VB_STATS_BUCKETS 32 // Bucket k of a histogram counts durations in [2^k, 2^(k+1)) ns
+
+#define VB2_VERSION_MINOR 1 // Version of the variable buffer system
 #define VB2_VERSION_MAJOR 1 // Major version of the variable buffer system
 #define VB2_VERSION (VB2_VERSION_MAJOR * 1000 + VB2_VERSION_MINOR) // Combined version number
 
 #define VB2_MAGIC "VB2" // Magic number to identify the variable buffer file format
 
+// Slots of VB_Master_Header.reserved
+#define VB2_RESERVED_FLAGS 0 // VB2_FLAG_* bits describing the layout
+#define VB2_RESERVED_WRAP  1 // Ring mode: row index of the oldest sample in every column
+#define VB2_RESERVED_SECTIONS 2 // Offset of the VB_Section table, 0 if the file has no sections
+
+#define VB2_FLAG_RING    0x1 // Columns are circular, read from the wrap position to the end then from the start
+#define VB2_FLAG_CHUNKED 0x2 // Columns are stored as VB_Chunk_Header prefixed chunks listed in the "CHUNKS" section
+#define VB2_FLAG_TIMESTAMP 0x4 // A VB2_TIME_NAME column holds the clock at every vb2_record_all, see the "CLOCK" section
+#define VB2_FLAG_COMPACT 0x8 // VB_Compact_Header entries and a string table replace the VB_Header array
+#define VB2_FLAG_LIVE    0x10 // A VB_Live record after the headers publishes the rows written so far
+
+#define VB2_TIME_NAME "__time" // Name of the timestamp column
+#define VB2_ROW_PREFIX "__row:" // Prefixed to the name of a sampled column for its row index column
+
+/*
+Compressed columns (stream mode only) append the codec to VB_Header.type, e.g. "double:xor".
+A chunk is encoded when VB_Chunk_Header.size < rows * var_size, otherwise it holds raw samples.
+Encoded chunk:
+    [uint8 plane_mode[var_size]]
+    [plane 0][plane 1]...[plane var_size-1]
+Samples are first transformed (xor: v[i] ^ v[i-1], dod: zigzag of the delta of deltas, with
+v[-1] = 0 so every chunk decodes on its own), then byte k of every transformed sample forms plane k.
+    VB_PLANE_ZERO   nothing stored, every byte is 0
+    VB_PLANE_SPARSE bitmap of rows+7/8 bytes (LSB first) then the non-zero bytes in order
+    VB_PLANE_RAW    rows bytes
+*/
+#define VB_CODEC_NONE 0 // Raw samples
+#define VB_CODEC_DOD  1 // Delta of delta, for "int" and "long"
+#define VB_CODEC_XOR  2 // XOR with the previous sample, for "float" and "double"
+
+#define VB_PLANE_ZERO   0
+#define VB_PLANE_SPARSE 1
+#define VB_PLANE_RAW    2
+
+#define VB_KIND_OTHER  0 // Summaries are only kept for the numeric types below
+#define VB_KIND_INT    1
+#define VB_KIND_LONG   2
+#define VB_KIND_FLOAT  3
+#define VB_KIND_DOUBLE 4
+
+#ifndef VB_PYRAMID_FANOUT
+    #define VB_PYRAMID_FANOUT 16 // Entries of one pyramid level merged into one entry of the next
+#endif
+
+#define VB_ENCODE_MAX_ROWS (VB_STAGING_SIZE / 4 + 1) // Most rows a staging buffer of 4 byte samples holds
+
+#define VB_SWAP(a, b) do { __typeof__(a) swapped = (a); (a) = (b); (b) = swapped; } while (0)
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    #define VB_ROTATION_CLOCK CLOCK_MONOTONIC_COARSE // A few ns to read, time limits are checked every vb2_record_all
+#else
+    #define VB_ROTATION_CLOCK CLOCK_MONOTONIC
+#endif
+
 /*
+[VB_Master_Header]
 [VB_Header 1]
 [VB_Header 2]
 [VB_Header 3]
 ...
-[VB_Header 1]
+[VB_Header N]
 [ VB_DATA 1 ]
 [    ...    ]
 [    ...    ]
@@ -67,6 +153,28 @@
 [ VB_DATA N ]
 [    ...    ]
 [    ...    ]
+[ Section 1 ]   Optional sections, 8 byte aligned
+[    ...    ]
+[ VB_Section_Table ] Pointed to by reserved[VB2_RESERVED_SECTIONS]
+
+Stream mode (VB2_FLAG_CHUNKED) replaces the VB_DATA regions with chunks appended as they fill
+[VB_Chunk_Header][data ... padded to 8 bytes]
+[VB_Chunk_Header][data ... padded to 8 bytes]
+...
+and a "CHUNKS" section holding one VB_Chunk_Index per chunk.
+
+Compact headers (VB2_FLAG_COMPACT) replace the fixed size VB_Header array, so the header region
+scales with the length of the names instead of ~800 bytes per variable
+[VB_Master_Header]
+[VB_Compact_Header 1]
+...
+[VB_Compact_Header N]
+[size_t string table size][strings, '\0' terminated, padded to 8 bytes]
+[ VB_DATA 1 ]
+...
+
+Live files (VB2_FLAG_LIVE, fixed layouts only) put a VB_Live record between the headers and
+VB_DATA 1. Header counts are only saved at vb2_end, until then readers go by VB_Live.rows.
 */
 
 #pragma pack(push, 8) // Ensure standard 8-byte alignment for the structures
@@ -75,7 +183,19 @@ struct VB_Master_Header {
     size_t   version;         // Version of the file format
     size_t   block_count;     // Number of variable blocks in the file
     size_t   max_history;     // Maximum history size for the variable buffer
-    size_t   reserved[3];     // Reserved for future use
+    size_t   reserved[3];     // Indexed by VB2_RESERVED_*, zero in files that don't use them
+};
+
+/*
+Wide columns hold a whole array or struct per row. The header type gives the element type and count,
+"double[1000]", so readers split a row without more metadata; structs are "byte[sizeof]" and the
+"FIELDS" section describes their members, sorted by block then offset.
+*/
+struct VB_Field {
+    size_t   block;            // Index of the struct column
+    size_t   offset;           // Of the member in the row
+    char     name[32];
+    char     type[16];         // Scalar or array type, as for a column
 };
 
 struct VB_Header {
@@ -87,13 +207,337 @@ struct VB_Header {
     size_t   count;            // Count of the variable data
 };
 
+struct VB_Compact_Header {
+    uint32_t name;             // Offsets into the string table, 0 is the empty string
+    uint32_t unit;
+    uint32_t description;
+    uint32_t type;
+    size_t   offset;           // As in VB_Header
+    size_t   count;
+};
+
+// Shared with readers through the page cache. rows is stored with release ordering once every
+// row below it is in the file, readers load it with acquire ordering before touching the data.
+struct VB_Live {
+    uint64_t rows;             // Rows written, counting from the start of the session (ring mode keeps counting)
+    uint64_t interval;         // Rows between updates, the writer may be rewriting this many rows past rows
+    uint64_t ended;            // Set once vb2_end has saved the headers and sections
+    uint64_t reserved;
+};
+
+/*
+Shared memory telemetry (vb2_set_shm), a POSIX shm segment separate from the file
+[VB_Shm_Header]
+[VB_Header 1]   Schema of the published variables, offset is the offset in the row, count is 0
+...
+[VB_Header N]
+[VB_Shm_Slot][row]   slot_count slots, row r goes to slot r % slot_count
+...
+Each slot is a seqlock: sequence is 2 * tick + 1 while the row is written and 2 * tick + 2 once
+it is complete. head counts the rows published. Consumers check the sequence around their copy
+and drop rows that changed under them, the recorder never waits for anyone.
+*/
+#define VB_SHM_MAGIC     "VB2SHM"
+#define VB_SHM_VERSION   1
+#define VB_SHM_RECORDING 1
+#define VB_SHM_ENDED     2
+
+struct VB_Shm_Header {
+    char     magic[8];
+    uint64_t version;
+    uint64_t column_count;     // VB_Header entries after this header
+    uint64_t row_size;         // Bytes of one row
+    uint64_t slot_count;       // Rows kept, a power of two
+    uint64_t slot_size;        // VB_Shm_Slot and its row, 8 byte aligned
+    uint64_t slots;            // Offset of the first slot
+    uint64_t clock;            // VB2_CLOCK_* of VB_Shm_Slot.time, 0 if rows carry no time
+    uint64_t state;            // VB_SHM_RECORDING, VB_SHM_ENDED once vb2_end is done
+    uint64_t reserved[6];
+    uint64_t head;             // Rows published, on a cache line of its own
+    uint64_t padding[7];
+};
+
+struct VB_Shm_Slot {
+    uint64_t sequence;
+    uint64_t tick;             // Row number in the recording
+    int64_t  time;             // Raw clock of the VB2_TIME_NAME column, 0 without timestamps
+    uint64_t reserved;
+};
+
+// Registration descriptor for vb2_add_variables
+struct VB_Variable {
+    const char *name;
+    const char *unit;
+    const char *description;
+    const char *type;
+    void    *var_ptr;
+    size_t   var_size;
+};
+
+// Cold per-variable metadata, only touched when registering, flushing and saving headers.
+// vb2_record_all works from the hot table below.
 struct VB_Block_Proxy{
     struct VB_Header header;            // Header information for the variable buffer
     void    *var_ptr;               // Pointer to the data of the variable
-    uint8_t  var_size;              // Size of the data in bytes
+    size_t   var_size;              // Size of the data in bytes, a whole row of array and struct columns
+    uint8_t  codec;                 // VB_CODEC_* applied to each chunk in stream mode
+    uint8_t  kind;                  // VB_KIND_* of the type, decides how samples are summarized
+    uint8_t  sampling;              // VB_SAMPLED_* this session, set by vb2_start
+    uint8_t  change_only;           // vb2_set_change_only: store a sample once the value moved by more than deadband
+    double   deadband;
+    size_t   divisor;               // vb2_set_divisor: store a sample every divisor rows, 0 or 1 for every row
+    size_t   index;                 // VB_SAMPLED_VALUES: block of the row index column
+    size_t   capacity;              // Rows reserved for the column in linear and ring files
     size_t   offset;                    // Offset of the memory block in the file
-    uint8_t  buffer[VB_BUFFER_SIZE+VB_MAX_VAR_SIZE];// Buffer to hold the variable data , +VB_MAX_VAR_SIZE to reduce overflow risk
-    size_t   buffer_offset;          // Current offset in the buffer for writing data
+};
+
+#define VB_SAMPLED_NONE   0 // A sample every row
+#define VB_SAMPLED_VALUES 1 // Samples of the rows vb2_set_divisor and vb2_set_change_only select
+#define VB_SAMPLED_INDEX  2 // Row of each sample of a VB_SAMPLED_VALUES column
+
+// Entry of the "SAMPLED" section, one per VB_SAMPLED_VALUES column. Row r of the recording holds
+// the last sample whose row index is r or less.
+struct VB_Sampling {
+    size_t   block;
+    size_t   index;                     // Block of its row index column
+    size_t   divisor;
+    size_t   change_only;
+    double   deadband;
+    size_t   rows;                      // Rows of the file, the length of the column once aligned
+};
+
+// Columns of the same size advance together, so each class keeps a single write cursor
+// and vb2_record_all runs one tight copy loop per class over the packed src/dst arrays.
+struct VB_Hot_Class {
+    size_t       var_size;              // Bytes per sample of every column in the class
+    size_t       count;                 // Number of columns in the class
+    size_t       fill;                  // Bytes written to each column since the last flush
+    size_t       limit;                 // Flush once fill reaches this many bytes
+    size_t       stride;                // Bytes between staging buffers of the class, chunk prefix included
+    size_t       flushed_rows;          // Rows already handed to the file, first row of the next chunk
+    size_t       summarized;            // Bytes of fill already covered by VB_Summary entries
+    const void **src;                   // Variable pointer of each column
+    uint8_t    **dst;                   // Staging buffer (or mapped column) of each column
+    size_t      *block;                 // Index into VB_File.blocks of each column
+};
+
+// A sampled column (VB_SAMPLED_VALUES) and its row index, each a class of one column of their own
+struct VB_Sampled {
+    size_t       values;                // Class of the column
+    size_t       index;                 // Class of the row index column
+    size_t       divisor;
+    size_t       countdown;             // Rows until the next sample is due, 1 at the start of a file
+    int          change_only;
+    int          stored;                // A sample is in this file, last holds it
+    double       deadband;
+    uint8_t      kind;
+    uint8_t     *last;                  // Last sample stored, for change_only
+};
+
+struct VB_Hot_Table {
+    struct VB_Hot_Class *classes;       // One class per distinct variable size, then two per sampled column
+    size_t       class_count;           // Number of classes
+    size_t       dense_count;           // Classes recorded every row, the first ones
+    const void **src;                   // All class src arrays, back to back
+    uint8_t    **dst;                   // All class dst arrays, back to back
+    size_t      *block;                 // All class block arrays, back to back
+    struct VB_Sampled *sampled;
+    size_t       sampled_count;
+    uint8_t     *last;                  // Slab of every VB_Sampled.last
+};
+
+enum vb2_write_mode {
+    VB2_WRITE_SYNC = 0, // Full buffers are written inline by vb2_record_all
+    VB2_WRITE_ASYNC,    // Full buffers are handed to a background writer thread
+    VB2_WRITE_MMAP      // Samples are copied straight into a shared mapping of the pre-sized file
+};
+
+enum vb2_async_policy {
+    VB2_ASYNC_BLOCK = 0, // Wait for the writer to return a buffer
+    VB2_ASYNC_DROP,      // Discard the full buffer, the "DROPPED" section lists the samples missing
+    VB2_ASYNC_GROW       // Allocate another staging buffer
+};
+
+enum vb2_clock {
+    VB2_CLOCK_NONE = 0,      // No timestamp column
+    VB2_CLOCK_MONOTONIC_RAW, // clock_gettime(CLOCK_MONOTONIC_RAW) in ns
+    VB2_CLOCK_TSC            // Time stamp counter, calibrated against CLOCK_MONOTONIC_RAW over the recording
+};
+
+enum vb2_record_mode {
+    VB2_RECORD_LINEAR = 0, // Stop recording once max_history samples are stored
+    VB2_RECORD_RING,       // Keep the last max_history samples, overwriting the oldest
+    VB2_RECORD_STREAM      // Append chunks as they fill, the file grows with the data and max_history is unused
+};
+
+enum vb2_trigger_op {
+    VB2_TRIGGER_ABOVE = 0, // value > threshold
+    VB2_TRIGGER_BELOW,     // value < threshold
+    VB2_TRIGGER_EQUAL,     // value == threshold
+    VB2_TRIGGER_NOT_EQUAL  // value != threshold, e.g. a fault flag against 0
+};
+
+#define VB_STAGING_SIZE (VB_BUFFER_SIZE+VB_MAX_VAR_SIZE) // +VB_MAX_VAR_SIZE to reduce overflow risk
+#define VB_CHUNK_PREFIX (sizeof(size_t) * 4)             // Room for a VB_Chunk_Header in front of each staging buffer
+#define VB_STAGING_STRIDE (VB_CHUNK_PREFIX+VB_STAGING_SIZE)
+
+struct VB_Async_Job {
+    uint8_t *buffer;                    // Full staging buffer, returned to the free list once written
+    size_t   pool;                      // Free list the buffer goes back to
+    size_t   lead;                      // Bytes in front of buffer that are written too (chunk header)
+    size_t   size;                      // Number of bytes to write, starting at buffer - lead
+    size_t   offset;                    // Offset in the file to write to
+    int      fd;                        // File written to, the previous one for buffers queued before a rotation
+};
+
+// Stack of staging buffers of one size
+struct VB_Pool {
+    uint8_t        **free_buffers;      // Buffers ready to be swapped in, past their chunk prefix
+    size_t           free_count;        // Number of buffers in free_buffers
+    size_t           free_capacity;     // Capacity of free_buffers
+    size_t           stride;            // Bytes of each buffer, chunk prefix included
+};
+
+struct VB_Async {
+    pthread_t        thread;            // Writer thread
+    pthread_mutex_t  lock;              // Protects everything below
+    pthread_cond_t   job_ready;         // Signalled when a job is queued or the writer should stop
+    pthread_cond_t   job_done;          // Signalled when the writer returns a buffer
+    int              running;           // Writer thread is alive
+    int              stop;              // Writer thread should exit once the queue is empty
+    int              fd;                // File descriptor the writer uses with pwrite
+    enum vb2_async_policy policy;       // What to do when no free buffer is available
+    size_t           buffer_count;      // Staging buffers per variable
+    struct VB_Async_Job *jobs;          // Ring of queued jobs
+    size_t           job_capacity;      // Capacity of the job ring
+    size_t           job_head;          // Index of the oldest queued job
+    size_t           job_count;         // Number of queued jobs
+    size_t           writing;           // Jobs taken by the writer but not finished
+    struct VB_Pool  *pools;             // Free buffers of each hot class, buffer sizes differ between classes
+    size_t           pool_count;
+    uint8_t        **grown;             // Buffers allocated by VB2_ASYNC_GROW, as returned by malloc
+    size_t           grown_count;       // Number of grown buffers
+    size_t           stalls;            // Times the recorder waited for a free buffer
+    size_t           dropped;           // Bytes discarded by VB2_ASYNC_DROP
+    size_t           writeback_rows;    // Rows the recorder asked to start writing back (VB2_WRITE_MMAP)
+    size_t           synced_rows;       // Rows the writer has already started writing back
+    uint64_t         live_rows;         // Rows to publish once the queue has been written, 0 if none
+    uint64_t         submitted;         // Jobs queued since the writer started
+    uint64_t         completed;         // Jobs written, in queue order
+    uint64_t         rotations;         // Files switched to, a writeback started before a switch is not counted as synced
+};
+
+struct VB_Clock_Info {
+    size_t   source;                    // VB2_CLOCK_* the timestamp column was read from
+    size_t   start_ticks;               // Clock value at vb2_start
+    size_t   start_realtime;            // CLOCK_REALTIME at vb2_start in ns since the epoch
+    double   ticks_per_second;          // Calibration, 1e9 for the clock_gettime sources
+};
+
+struct VB_Shm {
+    char     name[256];                 // Segment name, "" when the sink is off
+    size_t   slot_count;
+    char   **selected;                  // Names given to vb2_shm_select, every variable if none
+    size_t   selected_count;
+    struct   VB_Shm_Header *header;     // Mapping of the segment, NULL when not recording
+    size_t   size;                      // Of the mapping
+    const void **src;                   // Published variables
+    size_t  *offset;                    // In the row
+    size_t  *var_size;
+    size_t   count;
+};
+
+// State of file rotation (vb2_set_rotation). The recorder's own holds the limits and the rotation
+// thread, the spare recorders that carry prepared and finished files only use the per file part.
+struct VB_Rotation {
+    size_t   rows;                      // Limits, 0 when unused
+    size_t   bytes;
+    uint64_t ns;
+    size_t   limit_rows;                // Rows after which the current file rotates, from rows, bytes and max_history
+    size_t   limit_bytes;               // Stream mode: file size at which it rotates, 0 when unused
+    uint64_t deadline;                  // VB_ROTATION_CLOCK time the current file rotates at, 0 without a time limit
+    char     stem[4096];                // Filename given to vb2_open without its extension
+    char     extension[16];
+    struct   VB_Block_Proxy *blocks;    // Registry as of vb2_start, every spare gets a copy
+    size_t   block_count;
+    struct   VB_Field *fields;
+    size_t   field_count;
+    struct   VB_Compact_Header *compact_headers;
+    char    *strings;
+    size_t   string_size;
+    size_t   data_end;                  // Size of a file before chunks and sections are appended
+    int      mapped;                    // Files are recorded through a mapping (VB2_WRITE_MMAP)
+    pthread_t thread;                   // Prepares the next file and finishes the previous ones
+    pthread_mutex_t lock;               // Protects spare, retired and the flags below
+    pthread_cond_t  work;               // Signalled when the thread has something to do
+    pthread_cond_t  ready;              // Signalled when a spare is ready or could not be prepared
+    int      running;
+    int      stop;
+    int      failed;                    // The last spare could not be opened, rotation is off
+    struct   VB_Recorder *spare;        // Next file, opened and sized, NULL while it is being prepared
+    struct   VB_Recorder **retired;     // Files switched away from, oldest first, waiting to be saved
+    size_t   retired_count;
+    size_t   retired_capacity;
+    size_t   stalls;                    // Rotations that waited for the spare
+    int      enabled;                   // Per file: save a "SEGMENT" section
+    size_t   index;                     // Per file: position in the rotation, 0 for the file given to vb2_open
+    size_t   first_row;                 // Per file: rows recorded into the earlier files
+    uint64_t jobs;                      // Per file: async jobs queued for it, written before it is saved
+};
+
+// "SEGMENT" section of every file of a rotation, readers put the files back in order with it
+struct VB_Segment {
+    size_t   index;                     // Position in the rotation, 0 for the file given to vb2_open
+    size_t   first_row;                 // Rows recorded into the earlier files
+    size_t   rows;                      // vb2_record_all calls recorded into this one
+    size_t   reserved;
+};
+
+// Entry of the "TRIGGERS" section, one per event of a triggered capture (vb2_set_trigger_window)
+struct VB_Trigger_Event {
+    uint64_t tick;                      // vb2_record_all call of the session it fired on
+    uint64_t row;                       // Row of that sample in this file
+    uint64_t first_row;                 // Window it belongs to, pre-trigger rows included
+    uint64_t rows;
+    int32_t  trigger;                   // Index vb2_add_trigger returned, -1 for vb2_trigger
+    int32_t  block;                     // Column of the trigger's variable, -1 for vb2_trigger
+    double   value;                     // Of that variable when it fired
+    uint32_t op;                        // enum vb2_trigger_op of the trigger
+    uint32_t continued;                 // Fired in an earlier file of the rotation, row is 0
+};
+
+struct VB_Trigger {
+    size_t   block;                     // Index into VB_File.blocks of the variable compared
+    enum vb2_trigger_op op;
+    double   threshold;
+    int      active;                    // Condition held on the previous vb2_record_all
+    int      fired;                     // Condition started to hold on this one
+};
+
+// Triggered capture: only the rows around events are stored. Rows outside every window go into
+// a ring of the last pre rows, an event stores those, its own row and post more rows after the
+// last row on which a condition held.
+struct VB_Capture {
+    size_t   pre;                       // Rows kept before an event
+    size_t   post;                      // Rows stored after the conditions stop holding
+    int      configured;                // vb2_set_trigger_window or vb2_add_trigger was called
+    int      enabled;                   // Capturing this session, set by vb2_start
+    int      manual;                    // vb2_trigger was called since the last vb2_record_all
+    struct   VB_Trigger *triggers;
+    size_t   trigger_count;
+    uint8_t *history;                   // Ring of pre rows, columns packed in hot table order
+    size_t   row_size;
+    size_t   head;                      // Slot the next row goes to
+    size_t   held;                      // Rows in the ring
+    int      open;                      // A window is being stored
+    int      replaying;                 // Writing out the pre-trigger rows, rotation waits until they are all in one file
+    size_t   remaining;                 // Rows of it still to store if no condition holds again
+    size_t   window_first;              // Its first row in this file
+    size_t   window_event;              // Its first entry in events
+    struct   VB_Trigger_Event *events;  // Events of this file, saved as the "TRIGGERS" section
+    size_t   event_count;
+    size_t   event_capacity;
+    size_t   total;                     // Events of the session, across rotated files
 };
 
 struct VB_File{
@@ -102,8 +546,100 @@ struct VB_File{
     struct   VB_Master_Header master_header; // Master header information for the variable buffer file
     struct   VB_Block_Proxy *blocks;    // Pointer to the variable blocks in the buffer
     size_t   block_count;               // Number of variable blocks in the buffer
+    size_t   block_capacity;            // Capacity of blocks, grown geometrically
+    int      compact;                   // Save compact headers, see VB2_FLAG_COMPACT
+    struct   VB_Compact_Header *compact_headers; // Built by vb2_start when compact, NULL otherwise
+    char    *strings;                   // String table of the compact headers
+    size_t   string_size;               // Bytes of strings in use
     size_t   max_history;
     size_t   current_history;           // Current size of the history buffer
+    enum vb2_record_mode record_mode;   // What happens once max_history is reached
+    struct   VB_Hot_Table hot;          // Packed copy table used by vb2_record_all
+    uint8_t *staging;                   // Slab holding every staging buffer
+    enum vb2_write_mode write_mode;     // How full buffers reach the file
+    uint8_t *map;                       // Shared mapping of the whole file for VB2_WRITE_MMAP
+    size_t   map_size;                  // Size of the mapping in bytes
+    size_t   writeback_interval;        // Rows between writeback kicks in VB2_WRITE_MMAP, 0 leaves it to the kernel
+    struct   VB_Async async;            // Background writer state for VB2_WRITE_ASYNC
+    size_t   append_offset;             // End of the data, where chunks and sections are appended
+    struct   VB_Chunk_Index *chunks;    // Every chunk written in stream mode
+    size_t   chunk_count;               // Number of chunks written
+    size_t   chunk_capacity;            // Capacity of chunks
+    struct   VB_Dropped *drops;         // Samples VB2_ASYNC_DROP discarded, saved as the "DROPPED" section
+    size_t   drop_count;
+    size_t   drop_capacity;
+    struct   VB_Section *sections;      // Sections appended since vb2_start
+    size_t   section_count;             // Number of sections
+    size_t   section_table;             // Offset of the saved VB_Section_Table, 0 until vb2_end
+    enum vb2_clock clock;               // Source of the timestamp column
+    int64_t  timestamp;                 // Clock value of the current vb2_record_all, recorded as VB2_TIME_NAME
+    struct   VB_Clock_Info clock_info;  // Calibration saved as the "CLOCK" section
+    uint64_t start_ns;                  // CLOCK_MONOTONIC_RAW at vb2_start, for calibrating the TSC
+    int      compress;                  // Encode chunks of numeric columns in stream mode
+    size_t   summary_rows;              // Rows per VB_Summary entry, 0 disables the summary index
+    int      summary_pyramid;           // Also save the merged levels as the "PYRAMID" section
+    struct   VB_Summary *summaries;     // Level 0 entries since vb2_start
+    size_t   summary_count;             // Number of entries
+    size_t   summary_capacity;          // Capacity of summaries
+    uint64_t *encode_samples;           // Scratch of VB_ENCODE_MAX_ROWS transformed samples
+    uint8_t  *encode_out;               // Scratch of VB_STAGING_SIZE bytes for the encoded chunk
+    struct   VB_Field *fields;          // Layout of struct columns, saved as the "FIELDS" section
+    size_t   field_count;
+    size_t   live_interval;             // Rows between VB_Live updates, 0 disables live mode
+    size_t   live_offset;               // Offset of the VB_Live record in the file, 0 if the session is not live
+    struct   VB_Live *live;             // VB_Live in a shared mapping of its page, NULL when not recording
+    uint8_t *live_page;                 // Start of that mapping
+    size_t   live_page_size;
+    struct   VB_Shm shm;                // Shared memory telemetry sink
+    struct   VB_Rotation rotation;      // File rotation, see vb2_set_rotation
+    struct   VB_Capture capture;        // Triggered capture, see vb2_set_trigger_window
+    uint64_t ticks;                     // vb2_record_all calls of the session, stored or not
+};
+struct VB_Chunk_Header {
+    size_t   block;                     // Index of the variable the chunk belongs to
+    size_t   first_row;                 // Row of the first sample in the chunk
+    size_t   rows;                      // Number of samples in the chunk
+    size_t   size;                      // Bytes of data following the header, before padding
+};
+
+struct VB_Chunk_Index {
+    struct VB_Chunk_Header chunk;       // Copy of the chunk header
+    size_t   offset;                    // Offset in the file of the chunk data
+};
+
+// Entry of the "DROPPED" section, samples VB2_ASYNC_DROP discarded when the writer had no free buffer.
+// Linear and ring columns keep whatever the file held there, stream mode writes no chunk for them.
+// Rows count from the start of the file in the column's own samples, a ring's before it wraps.
+struct VB_Dropped {
+    size_t   block;                     // Index of the variable
+    size_t   first_row;                 // First sample discarded
+    size_t   rows;                      // Samples discarded
+};
+
+/*
+Summary entries of the "SUMMARY" section cover at most summary_rows rows of one column, sorted by
+block then first_row. Rows are in recording order, ring files count from the oldest stored sample.
+The optional "PYRAMID" section holds levels 1.. in the same order, each entry merging up to
+VB_PYRAMID_FANOUT entries of the level below.
+*/
+struct VB_Summary {
+    size_t   block;                     // Index of the variable
+    size_t   level;                     // 0 in SUMMARY, pyramid level in PYRAMID
+    size_t   first_row;                 // First row covered
+    size_t   rows;                      // Rows covered
+    double   min;                       // Smallest sample
+    double   max;                       // Largest sample
+    double   sum;                       // Sum of the samples, mean = sum / rows
+};
+
+struct VB_Section {
+    char     tag[8];                    // Name of the section, e.g. "CHUNKS"
+    size_t   offset;                    // Offset in the file of the section data
+    size_t   size;                      // Size of the section data in bytes
+};
+
+struct VB_Section_Table {
+    size_t   count;                     // Number of VB_Section entries that follow
 };
 #pragma pack(pop) // Restore the previous packing alignment
 enum severity {
@@ -114,6 +650,57 @@ enum severity {
     VB_LOG_FATAL      // Fatal error logging
 };  
 
+/*
+Binary log (vb2_log_set_binary), the .log file then holds
+[VB_Blog_Header][VB_Blog_Record + payload][VB_Blog_Record + payload]...
+    id VB_BLOG_FORMAT  payload defines a format before its first use in the file:
+                       uint32 id, uint32 line, uint8 arg_count, char types[arg_count], file\0, fmt\0
+    id VB_BLOG_TEXT    payload is a message formatted on the spot: uint32 line, file\0, message
+    id >= VB_BLOG_FIRST_ID  payload is the raw arguments of that format, by type
+                       'i' int32, 'l' int64, 'd' double, 'p' pointer as uint64, 's' uint16 length + bytes
+*/
+#define VB_BLOG_MAGIC    "VB2BLOG"
+#define VB_BLOG_VERSION  1
+#define VB_BLOG_FORMAT   0
+#define VB_BLOG_TEXT     1
+#define VB_BLOG_FIRST_ID 2
+
+#pragma pack(push, 8)
+struct VB_Blog_Header {
+    char     magic[8];                  // VB_BLOG_MAGIC
+    uint32_t version;                   // VB_BLOG_VERSION
+    uint32_t reserved;
+};
+
+struct VB_Blog_Record {
+    uint32_t id;                        // Format id, or VB_BLOG_FORMAT / VB_BLOG_TEXT
+    uint8_t  level;                     // enum severity
+    uint8_t  reserved;
+    uint16_t size;                      // Bytes of payload following the record
+    uint64_t tick;                      // current_history when logged
+};
+#pragma pack(pop)
+
+/*
+Log events (vb2_enable_log_events) keep the records in memory instead of a .log file and vb2_end saves
+    "LOG"      the records, VB_BLOG_TEXT and format ids only
+    "LOGINDEX" a VB_Log_Event per record in tick order, binary search it for the events of a tick range
+    "LOGFMT"   a VB_BLOG_FORMAT record for every format id used in "LOG"
+*/
+struct VB_Log_Event {
+    uint64_t tick;                      // current_history when logged
+    int64_t  time;                      // Clock of the timestamp column when logged, 0 without one
+    uint64_t offset;                    // Of the record in the "LOG" section
+};
+
+struct VB_Blog_Format {
+    const char *fmt;                    // String literal of the call site
+    const char *file;
+    uint32_t line;
+    uint8_t  arg_count;
+    char     types[VB_BLOG_MAX_ARGS];   // Type of each argument, see above
+};
+
 struct VB_LOG {
     enum severity level;                // Current log level
     char     filename[4096+6];            // Name of the log file
@@ -122,311 +709,3505 @@ struct VB_LOG {
     int      echo_to_stdout;          // Flag to indicate if logs should be echoed to stdout
     int      echo_to_stderr;          // Flag to indicate if logs should be echoed to stderr
     FILE    *fp;                        // File pointer for the log file
+    int      binary;                    // Write VB_Blog_Records instead of text
+    uint8_t  defined[VB_BLOG_MAX_FORMATS / 8]; // Formats already defined in this log file
+    int      events;                    // Records go to the .vb2 file instead of fp
+    uint8_t *event_data;                // Records written so far, the "LOG" section
+    size_t   event_size;
+    size_t   event_data_capacity;
+    struct VB_Log_Event *event_index;   // The "LOGINDEX" section
+    size_t   event_count;
+    size_t   event_capacity;
+};
+
+/*
+Self instrumentation, only collected when built with VB2_STATS_ENABLED (make STATS=1).
+Everything is a uint64_t so the struct is saved as is as the "STATS" section.
+The write counters are updated by the writer thread in VB2_WRITE_ASYNC, with atomics.
+*/
+struct VB_Histogram {
+    uint64_t count[VB_STATS_BUCKETS];   // log2 buckets of ns
+    uint64_t total_ns;                  // Sum of the timed durations
+    uint64_t max_ns;                    // Longest timed duration
+};
+
+struct VB_Stats {
+    uint64_t records;                   // vb2_record_all calls that stored a row
+    uint64_t dropped_rows;              // vb2_record_all calls past max_history in linear mode
+    uint64_t flushes;                   // Class flushes, every column of a size class at once
+    uint64_t writes;                    // Buffers written to the file by fwrite or pwrite
+    uint64_t bytes_written;             // Bytes of those buffers
+    uint64_t stalls;                    // Times VB2_WRITE_ASYNC waited for a free buffer
+    uint64_t log_flushes;               // Log buffer writes
+    uint64_t log_bytes;                 // Bytes of log written
+    struct VB_Histogram record_ns;      // One in VB2_STATS_SAMPLE vb2_record_all calls
+    struct VB_Histogram flush_ns;       // Every class flush
+    struct VB_Histogram write_ns;       // Every fwrite/pwrite of a buffer
+    struct VB_Histogram log_flush_ns;   // Every log buffer write
+};
+
+// One recording and its log. Each thread that records owns its own recorder,
+// nothing on the hot path is shared between recorders.
+struct VB_Recorder {
+    struct VB_File file;                // Recording state
+    struct VB_LOG  log;                 // Text log that accompanies the recording
+    struct VB_Stats stats;              // Zero unless built with VB2_STATS_ENABLED
 };
 
-struct VB_LOG  vb_log;
-struct VB_File vb_file;
+struct VB_Recorder vb2_default_recorder; // Instance behind the vb2_* and vb_log_* functions
+char vb2_session_dir[4096];              // Relative filenames are opened in here, empty for the working directory
+
+// ***********************************************
+//              Self instrumentation
+// ***********************************************
+#ifdef VB2_STATS_ENABLED
+static inline uint64_t vb2_stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline size_t vb2_stats_bucket(uint64_t ns) {
+    size_t bucket = 63 - (size_t)__builtin_clzll(ns | 1);
+    return bucket < VB_STATS_BUCKETS ? bucket : VB_STATS_BUCKETS - 1;
+}
+
+// Only called from the thread that owns the histogram
+void vb2_stats_time(struct VB_Histogram *histogram, uint64_t ns) {
+    histogram->count[vb2_stats_bucket(ns)]++;
+    histogram->total_ns += ns;
+    if (ns > histogram->max_ns) {
+        histogram->max_ns = ns;
+    }
+}
+
+// Buffer writes, the writer thread counts them while the recorder may be reading the stats
+void vb2_stats_write(struct VB_Stats *stats, size_t bytes, uint64_t ns) {
+    __atomic_fetch_add(&stats->writes, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->bytes_written, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->write_ns.count[vb2_stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->write_ns.total_ns, ns, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&stats->write_ns.max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&stats->write_ns.max_ns, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+#endif
+
+// Snapshot of the counters, call it from the recording thread. Returns -1 if they were compiled out.
+int vb2r_get_stats(struct VB_Recorder *rec, struct VB_Stats *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifdef VB2_STATS_ENABLED
+    const uint64_t *from = (const uint64_t *)&rec->stats;
+    uint64_t *to = (uint64_t *)stats;
+    for (size_t i = 0; i < sizeof(*stats) / sizeof(uint64_t); i++) {
+        to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+    }
+    stats->stalls = rec->file.async.stalls;
+    return 0;
+#else
+    (void)rec;
+    return -1;
+#endif
+}
+
+void vb2r_reset_stats(struct VB_Recorder *rec) {
+    memset(&rec->stats, 0, sizeof(rec->stats));
+}
+
+// ***********************************************
+//              Clocks
+// ***********************************************
+uint64_t vb2_clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline int64_t vb2_clock_now(enum vb2_clock clock) {
+#ifdef VB_HAVE_TSC
+    if (clock == VB2_CLOCK_TSC) {
+        return (int64_t)__rdtsc();
+    }
+#endif
+    (void)clock;
+    return (int64_t)vb2_clock_ns(CLOCK_MONOTONIC_RAW);
+}
 
 // ***********************************************
 //         Magic Logging system
 // ***********************************************
 
-void vb_log_init(const char *filename) {
+void vb2_free_log_events(struct VB_Recorder *rec) {
+    free(rec->log.event_data);
+    free(rec->log.event_index);
+    rec->log.event_data          = NULL;
+    rec->log.event_size          = 0;
+    rec->log.event_data_capacity = 0;
+    rec->log.event_index         = NULL;
+    rec->log.event_count         = 0;
+    rec->log.event_capacity      = 0;
+    rec->log.events              = 0;
+}
+
+void vb2r_log_init(struct VB_Recorder *rec, const char *filename) {
     if (filename == NULL || strlen(filename) == 0) {
         return; // Invalid filename
     }
-    strncpy(vb_log.filename, filename, sizeof(vb_log.filename) - 1);
-    vb_log.filename[sizeof(vb_log.filename) - 1] = '\0'; // Ensure null termination
+    strncpy(rec->log.filename, filename, sizeof(rec->log.filename) - 1);
+    rec->log.filename[sizeof(rec->log.filename) - 1] = '\0'; // Ensure null termination
 
-    vb_log.fp = fopen(vb_log.filename, "w");
-    if (vb_log.fp == NULL) {
+    vb2_free_log_events(rec); // One or the other
+    rec->log.fp = fopen(rec->log.filename, "w");
+    if (rec->log.fp == NULL) {
         return; // Failed to open log file
     }
     
-    vb_log.level = VB_LOG_DEBUG; // Set default log level to DEBUG
-    vb_log.buffer[0]      = '\0'; // Initialize the log buffer
-    vb_log.buffer_offset  = 0; // Initialize the buffer offset to zero
-    vb_log.echo_to_stdout = 0; // Default to echo logs to stdout
-    vb_log.echo_to_stderr = 0; // Default to not echo logs to stderr
+    rec->log.level = VB_LOG_DEBUG; // Set default log level to DEBUG
+    rec->log.buffer[0]      = '\0'; // Initialize the log buffer
+    rec->log.buffer_offset  = 0; // Initialize the buffer offset to zero
+    rec->log.echo_to_stdout = 0; // Default to echo logs to stdout
+    rec->log.echo_to_stderr = 0; // Default to not echo logs to stderr
+    memset(rec->log.defined, 0, sizeof(rec->log.defined));
+    if (rec->log.binary) {
+        struct VB_Blog_Header header = { VB_BLOG_MAGIC, VB_BLOG_VERSION, 0 };
+        fwrite(&header, sizeof(header), 1, rec->log.fp);
+    }
+}
+
+void vb2r_log_set_echo(struct VB_Recorder *rec, int echo_stdout, int echo_stderr) {
+    rec->log.echo_to_stdout = (echo_stdout != 0); // Set whether to echo logs to stdout
+    rec->log.echo_to_stderr = (echo_stderr != 0); // Set whether to echo logs to stderr
 }
 
-void vb_log_set_echo(int echo_stdout, int echo_stderr) {
-    vb_log.echo_to_stdout = (echo_stdout != 0); // Set whether to echo logs to stdout
-    vb_log.echo_to_stderr = (echo_stderr != 0); // Set whether to echo logs to stderr
+void vb2r_log_set_level(struct VB_Recorder *rec, enum severity level) {
+    rec->log.level = level; // Set the current log level
 }
 
-void vb_log_set_level(enum severity level) {
-    vb_log.level = level; // Set the current log level
+void vb_clear_log_buffer(struct VB_Recorder *rec) {
+    rec->log.buffer[0] = '\0'; // Clear the log buffer
+    rec->log.buffer_offset = 0; // Reset the buffer offset
 }
 
-void vb_clear_log_buffer() {
-    vb_log.buffer[0] = '\0'; // Clear the log buffer
-    vb_log.buffer_offset = 0; // Reset the buffer offset
+// Moves the log buffer to the records of the "LOG" section
+void vb2_store_log_events(struct VB_Recorder *rec) {
+    size_t size = rec->log.event_size + rec->log.buffer_offset;
+    if (size > rec->log.event_data_capacity) {
+        size_t capacity = rec->log.event_data_capacity ? rec->log.event_data_capacity : VB_LOG_BUFFER_SIZE;
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        uint8_t *data = realloc(rec->log.event_data, capacity);
+        if (data == NULL) {
+            VB_DEBUG("Failed to grow the log events, %zu bytes dropped", rec->log.buffer_offset);
+            return;
+        }
+        rec->log.event_data          = data;
+        rec->log.event_data_capacity = capacity;
+    }
+    memcpy(rec->log.event_data + rec->log.event_size, rec->log.buffer, rec->log.buffer_offset);
+    rec->log.event_size = size;
+}
+
+// Index entry of the record about to be written at buffer_offset
+void vb2_index_log_event(struct VB_Recorder *rec) {
+    if (rec->log.event_count == rec->log.event_capacity) {
+        size_t capacity = rec->log.event_capacity ? rec->log.event_capacity * 2 : 1024;
+        struct VB_Log_Event *index = realloc(rec->log.event_index, capacity * sizeof(*index));
+        if (index == NULL) {
+            return; // The record is kept but cannot be looked up by tick
+        }
+        rec->log.event_index    = index;
+        rec->log.event_capacity = capacity;
+    }
+    struct VB_Log_Event *event = &rec->log.event_index[rec->log.event_count++];
+    event->tick   = rec->file.current_history;
+    event->time   = rec->file.clock != VB2_CLOCK_NONE ? vb2_clock_now(rec->file.clock) : 0;
+    event->offset = rec->log.event_size + rec->log.buffer_offset;
+}
+
+void vb_write_log_buffer(struct VB_Recorder *rec) {
+#ifdef VB2_STATS_ENABLED
+    uint64_t start = vb2_stats_now();
+    rec->stats.log_flushes++;
+    rec->stats.log_bytes += rec->log.buffer_offset;
+#endif
+    if (rec->log.events) {
+        vb2_store_log_events(rec);
+    } else {
+        fwrite(rec->log.buffer, 1, rec->log.buffer_offset, rec->log.fp); // Write the log buffer to the file
+        fflush(rec->log.fp); // Flush the file to ensure data is written
+    }
+    vb_clear_log_buffer(rec); // Clear the log buffer after writing
+#ifdef VB2_STATS_ENABLED
+    vb2_stats_time(&rec->stats.log_flush_ns, vb2_stats_now() - start);
+#endif
 }
 
-void vb_append_to_log_buffer(const char *fmt, ...) {
+void vb_append_to_log_buffer(struct VB_Recorder *rec, const char *fmt, ...) {
     va_list args;
     va_start(args, fmt);
-    int written = vsnprintf(vb_log.buffer + vb_log.buffer_offset, VB_LOG_BUFFER_SIZE - vb_log.buffer_offset, fmt, args);
+    int written = vsnprintf(rec->log.buffer + rec->log.buffer_offset, VB_LOG_BUFFER_SIZE - rec->log.buffer_offset, fmt, args);
     va_end(args);
-    vb_log.buffer_offset += written; // Update the buffer offset
+    rec->log.buffer_offset += written; // Update the buffer offset
 }
 
 
-void vb_log_write(enum severity level, size_t lineno, const char *file ,const char *fmt, ...) {
-    if (level < vb_log.level) {
+// ***********************************************
+//              Binary log
+// ***********************************************
+struct VB_Blog_Format vb2_blog_formats[VB_BLOG_MAX_FORMATS]; // Shared by every recorder, indexed by id
+uint32_t        vb2_blog_format_count = VB_BLOG_FIRST_ID;
+pthread_mutex_t vb2_blog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Argument types of a printf format, -1 if it has conversions a binary record cannot hold
+int vb2_blog_parse(const char *fmt, char *types) {
+    int count = 0;
+    for (const char *c = fmt; *c; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        c++;
+        if (*c == '%') {
+            continue;
+        }
+        c += strspn(c, "-+ #0'");
+        if (*c == '*') {
+            if (count == VB_BLOG_MAX_ARGS) return -1;
+            types[count++] = 'i';
+            c++;
+        }
+        c += strspn(c, "0123456789");
+        if (*c == '.') {
+            c++;
+            if (*c == '*') {
+                if (count == VB_BLOG_MAX_ARGS) return -1;
+                types[count++] = 'i';
+                c++;
+            }
+            c += strspn(c, "0123456789");
+        }
+        int wide = 0, length = 0;
+        while (*c && strchr("hlzjtLq", *c)) {
+            wide |= *c != 'h'; // Everything but h widens an integer to 64 bits
+            length = 1;
+            if (*c == 'L') {
+                return -1; // long double
+            }
+            c++;
+        }
+        if (count == VB_BLOG_MAX_ARGS || *c == '\0') {
+            return -1;
+        }
+        if (length && (*c == 'c' || *c == 's')) {
+            return -1; // wint_t and wchar_t strings
+        }
+        switch (*c) {
+            case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+                types[count++] = wide ? 'l' : 'i';
+                break;
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                types[count++] = 'd';
+                break;
+            case 's':
+                types[count++] = 's';
+                break;
+            case 'p':
+                types[count++] = 'p';
+                break;
+            default:
+                return -1; // %n and friends
+        }
+    }
+    return count;
+}
+
+// Called once per call site through VB_BLOG, fmt and file must be string literals
+uint32_t vb2_blog_register(const char *fmt, const char *file, uint32_t line) {
+    char types[VB_BLOG_MAX_ARGS];
+    int count = vb2_blog_parse(fmt, types);
+    if (count < 0) {
+        return VB_BLOG_TEXT; // Formatted on the spot instead
+    }
+    pthread_mutex_lock(&vb2_blog_lock);
+    uint32_t id = vb2_blog_format_count;
+    if (id < VB_BLOG_MAX_FORMATS) {
+        struct VB_Blog_Format *format = &vb2_blog_formats[id];
+        format->fmt       = fmt;
+        format->file      = file;
+        format->line      = line;
+        format->arg_count = (uint8_t)count;
+        memcpy(format->types, types, (size_t)count);
+        vb2_blog_format_count++;
+    } else {
+        id = VB_BLOG_TEXT;
+    }
+    pthread_mutex_unlock(&vb2_blog_lock);
+    return id;
+}
+
+void vb2r_log_set_binary(struct VB_Recorder *rec, int binary) {
+    if (rec->log.fp != NULL) {
+        VB_DEBUG("Log is already open, binary mode applies to the next log file");
+    }
+    rec->log.binary = binary;
+}
+
+uint8_t *vb2_blog_reserve(struct VB_Recorder *rec, uint32_t id, enum severity level) {
+    struct VB_Blog_Record record = { id, (uint8_t)level, 0, 0, rec->file.current_history };
+    uint8_t *at = (uint8_t *)rec->log.buffer + rec->log.buffer_offset;
+    memcpy(at, &record, sizeof(record));
+    if (rec->log.events) {
+        vb2_index_log_event(rec);
+    }
+    return at;
+}
+
+void vb2_blog_commit(struct VB_Recorder *rec, uint8_t *record, uint8_t *end) {
+    uint16_t size = (uint16_t)(end - record - sizeof(struct VB_Blog_Record));
+    memcpy(record + offsetof(struct VB_Blog_Record, size), &size, sizeof(size));
+    rec->log.buffer_offset = (size_t)(end - (uint8_t *)rec->log.buffer);
+    if (rec->log.buffer_offset > VB_LOG_BUFFER_SIZE) {
+        vb_write_log_buffer(rec);
+    }
+}
+
+// VB_BLOG_FORMAT record of a format id, returns its size. Fits in VB_LOG_BUFFER_OVERFLOW
+size_t vb2_blog_definition(uint32_t id, uint8_t *record) {
+    const struct VB_Blog_Format *format = &vb2_blog_formats[id];
+    size_t file_length = strnlen(format->file, 255);
+    size_t fmt_length  = strnlen(format->fmt, VB_LOG_BUFFER_OVERFLOW - 512);
+    struct VB_Blog_Record header = { VB_BLOG_FORMAT, VB_LOG_DEBUG, 0, 0, 0 };
+    uint8_t *at = record + sizeof(header);
+    memcpy(at, &id, 4);
+    memcpy(at + 4, &format->line, 4);
+    at[8] = format->arg_count;
+    at += 9;
+    memcpy(at, format->types, format->arg_count);
+    at += format->arg_count;
+    memcpy(at, format->file, file_length);
+    at[file_length] = '\0';
+    at += file_length + 1;
+    memcpy(at, format->fmt, fmt_length);
+    at[fmt_length] = '\0';
+    at += fmt_length + 1;
+    header.size = (uint16_t)(at - record - sizeof(header));
+    memcpy(record, &header, sizeof(header));
+    return (size_t)(at - record);
+}
+
+// Writes the definition of a format the first time this log file uses it
+void vb2_blog_define(struct VB_Recorder *rec, uint32_t id) {
+    if (rec->log.buffer_offset > VB_LOG_BUFFER_SIZE) {
+        vb_write_log_buffer(rec); // Make room, the overflow area holds the longest definition
+    }
+    rec->log.buffer_offset += vb2_blog_definition(id, (uint8_t *)rec->log.buffer + rec->log.buffer_offset);
+    if (rec->log.buffer_offset > VB_LOG_BUFFER_SIZE) {
+        vb_write_log_buffer(rec);
+    }
+}
+
+void vb2_blog_text(struct VB_Recorder *rec, enum severity level, size_t lineno, const char *file, const char *fmt, va_list args) {
+    size_t file_length = strnlen(file, 255);
+    uint8_t *record = vb2_blog_reserve(rec, VB_BLOG_TEXT, level);
+    uint8_t *at = record + sizeof(struct VB_Blog_Record);
+    uint32_t line = (uint32_t)lineno;
+    memcpy(at, &line, 4);
+    memcpy(at + 4, file, file_length);
+    at[4 + file_length] = '\0';
+    at += 5 + file_length;
+    size_t room = sizeof(rec->log.buffer) - (size_t)(at - (uint8_t *)rec->log.buffer);
+    int written = vsnprintf((char *)at, room, fmt, args);
+    at += written < 0 ? 0 : ((size_t)written < room ? (size_t)written : room - 1);
+    vb2_blog_commit(rec, record, at);
+}
+
+void vb2r_log_vwrite(struct VB_Recorder *rec, enum severity level, size_t lineno, const char *file ,const char *fmt, va_list args) {
+    if (level < rec->log.level) {
         return; // Log level is lower than the current level, do not log
     }
-    if (vb_log.fp == NULL) {
+    if (rec->log.fp == NULL && !rec->log.events) {
         return; // Log file is not open
     }
-    // vb_clear_log_buffer(); // Clear the log buffer before writing new data
+    if (rec->log.binary || rec->log.events) {
+        vb2_blog_text(rec, level, lineno, file, fmt, args);
+        return;
+    }
+    // vb_clear_log_buffer(rec); // Clear the log buffer before writing new data
     char counter[64] = "\0";
-    if(vb_file.fp != NULL) {
+    if(rec->file.fp != NULL) {
         counter[0] = '[';
-        int write_size = snprintf(counter + 1, sizeof(counter) - 2, "%zu", vb_file.current_history); // Write the block count to the counter
+        int write_size = snprintf(counter + 1, sizeof(counter) - 2, "%zu", rec->file.current_history); // Write the block count to the counter
         counter[write_size+1] = ']'; // Add closing bracket
         counter[write_size+2] = '\0'; // Null terminate the string
     }
     if(level == VB_LOG_DEBUG) {
-        vb_append_to_log_buffer("%6s DEBUG   %s[%zu]: ",counter , file, lineno);
+        vb_append_to_log_buffer(rec, "%6s DEBUG   %s[%zu]: ",counter , file, lineno);
     } else if(level == VB_LOG_INFO) {
-        vb_append_to_log_buffer("%6s INFO    %s[%zu]: ",counter , file, lineno);
+        vb_append_to_log_buffer(rec, "%6s INFO    %s[%zu]: ",counter , file, lineno);
     } else if(level == VB_LOG_WARNING) {
-        vb_append_to_log_buffer("%6s WARNING %s[%zu]: ",counter , file, lineno);
+        vb_append_to_log_buffer(rec, "%6s WARNING %s[%zu]: ",counter , file, lineno);
     } else if(level == VB_LOG_ERROR) {
-        vb_append_to_log_buffer("%6s ERROR   %s[%zu]: ",counter , file, lineno);
+        vb_append_to_log_buffer(rec, "%6s ERROR   %s[%zu]: ",counter , file, lineno);
     } else if(level == VB_LOG_FATAL) {
-        vb_append_to_log_buffer("%6s FATAL   %s[%zu]: ",counter , file, lineno);
+        vb_append_to_log_buffer(rec, "%6s FATAL   %s[%zu]: ",counter , file, lineno);
     }
 
-    va_list args;
-    va_start(args, fmt);
-    int written = vsnprintf(vb_log.buffer + vb_log.buffer_offset, VB_LOG_BUFFER_SIZE - vb_log.buffer_offset, fmt, args);
-    vb_log.buffer_offset += written; 
-    va_end(args);   
+    int written = vsnprintf(rec->log.buffer + rec->log.buffer_offset, VB_LOG_BUFFER_SIZE - rec->log.buffer_offset, fmt, args);
+    rec->log.buffer_offset += written; 
 
-    vb_append_to_log_buffer("\n"); // Append a newline at the end of the log entry
-    if (vb_log.echo_to_stdout) {
-        printf("%s", vb_log.buffer); // Echo the log to stdout if enabled
+    vb_append_to_log_buffer(rec, "\n"); // Append a newline at the end of the log entry
+    if (rec->log.echo_to_stdout) {
+        printf("%s", rec->log.buffer); // Echo the log to stdout if enabled
         // Must flush so not to duplicate the log
-        fwrite(vb_log.buffer, 1, vb_log.buffer_offset, vb_log.fp); // Write the log buffer to the file
-        fflush(vb_log.fp); // Flush the file to ensure data is written
-        vb_clear_log_buffer(); // Clear the log buffer after writing
+        vb_write_log_buffer(rec);
+    }
+    else if(rec->log.buffer_offset > VB_LOG_BUFFER_SIZE) { // Check if the buffer is full
+        vb_write_log_buffer(rec);
+    }
+}
+
+// Hot path of VB_BLOG: copies the raw arguments, no formatting
+void vb2r_blog_write(struct VB_Recorder *rec, enum severity level, uint32_t id, size_t lineno, const char *file, const char *fmt, ...) {
+    if (level < rec->log.level || (rec->log.fp == NULL && !rec->log.events)) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    if (!(rec->log.binary || rec->log.events) || id < VB_BLOG_FIRST_ID) {
+        vb2r_log_vwrite(rec, level, lineno, file, fmt, args); // Text log, or a format the registry could not take
+        va_end(args);
+        return;
     }
-    else if(vb_log.buffer_offset > VB_LOG_BUFFER_SIZE) { // Check if the buffer is full
-        fwrite(vb_log.buffer, 1, vb_log.buffer_offset, vb_log.fp); // Write the log buffer to the file
-        fflush(vb_log.fp); // Flush the file to ensure data is written
-        vb_clear_log_buffer(); // Clear the log buffer after writing
+    if (!(rec->log.defined[id / 8] & (1u << (id % 8)))) {
+        rec->log.defined[id / 8] |= (uint8_t)(1u << (id % 8));
+        if (!rec->log.events) {
+            vb2_blog_define(rec, id); // Log events save every definition in "LOGFMT" instead
+        }
+    }
+    const struct VB_Blog_Format *format = &vb2_blog_formats[id];
+    uint8_t *record = vb2_blog_reserve(rec, id, level);
+    uint8_t *at = record + sizeof(struct VB_Blog_Record);
+    for (size_t k = 0; k < format->arg_count; k++) {
+        switch (format->types[k]) {
+            case 'i': { int32_t v = va_arg(args, int); memcpy(at, &v, 4); at += 4; break; }
+            case 'l': { int64_t v = va_arg(args, long long); memcpy(at, &v, 8); at += 8; break; }
+            case 'd': { double  v = va_arg(args, double); memcpy(at, &v, 8); at += 8; break; }
+            case 'p': { uint64_t v = (uint64_t)(uintptr_t)va_arg(args, void *); memcpy(at, &v, 8); at += 8; break; }
+            default: {
+                const char *v = va_arg(args, const char *);
+                uint16_t length = v ? (uint16_t)strnlen(v, VB_BLOG_MAX_STRING) : 0;
+                memcpy(at, &length, 2);
+                memcpy(at + 2, v, length);
+                at += 2 + length;
+                break;
+            }
+        }
     }
+    va_end(args);
+    vb2_blog_commit(rec, record, at);
+}
+
+void vb2r_log_write(struct VB_Recorder *rec, enum severity level, size_t lineno, const char *file ,const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vb2r_log_vwrite(rec, level, lineno, file, fmt, args);
+    va_end(args);
 }
 
-void vb_log_flush() {
-    if (vb_log.fp == NULL) {
+void vb2r_log_flush(struct VB_Recorder *rec) {
+    if (rec->log.fp == NULL && !rec->log.events) {
         return; // Log file is not open
     }
-    if (vb_log.buffer_offset > 0) { // If there is data in the buffer
-        fwrite(vb_log.buffer, 1, vb_log.buffer_offset, vb_log.fp); // Write the log buffer to the file
-        fflush(vb_log.fp); // Flush the file to ensure data is written
-        vb_clear_log_buffer(); // Clear the log buffer after writing
+    if (rec->log.buffer_offset > 0) { // If there is data in the buffer
+        vb_write_log_buffer(rec);
     }
 }
 
-void vb_log_close() {
-    if (vb_log.fp != NULL) {
-        vb_log_flush(); // Flush any remaining data in the log buffer
-        fclose(vb_log.fp); // Close the log file
-        vb_log.fp = NULL; // Set the file pointer to NULL
+void vb2r_log_close(struct VB_Recorder *rec) {
+    if (rec->log.fp != NULL) {
+        vb2r_log_flush(rec); // Flush any remaining data in the log buffer
+        fclose(rec->log.fp); // Close the log file
+        rec->log.fp = NULL; // Set the file pointer to NULL
     }
-    vb_clear_log_buffer(); // Clear the log buffer
+    vb2_free_log_events(rec); // Saved by vb2r_end, dropped if the recording was not ended
+    vb_clear_log_buffer(rec); // Clear the log buffer
 }
     
 
 // ***********************************************
 // Telemetry recording system for variable buffers
 // ***********************************************
-void vb2_init() {
-    VB_DEBUG("Initializing variable buffer system");
-    memset(&vb_file, 0, sizeof(vb_file)); // Initialize the variable buffer file structure
+
+// ***********************************************
+//        Hot table used by vb2_record_all
+// ***********************************************
+void vb2_free_hot_table(struct VB_Recorder *rec) {
+    free(rec->file.hot.classes);
+    free(rec->file.hot.src);
+    free(rec->file.hot.dst);
+    free(rec->file.hot.block);
+    free(rec->file.hot.sampled);
+    free(rec->file.hot.last);
+    memset(&rec->file.hot, 0, sizeof(rec->file.hot));
 }
 
-int vb2_open(const char *filename) {
-    VB_DEBUG("Opening variable buffer file: %s", filename);
-    if (filename == NULL || strlen(filename) == 0) {
-        VB_DEBUG("Invalid filename provided");
-        return -1; // Invalid parameters
+int vb2_build_hot_table(struct VB_Recorder *rec) {
+    struct VB_Hot_Table *hot = &rec->file.hot;
+    size_t n = rec->file.block_count;
+    vb2_free_hot_table(rec);
+    if (n == 0) {
+        return 0; // Nothing to record
     }
-
-    strncpy(vb_file.filename, filename, sizeof(vb_file.filename) - 1);
-    vb_file.filename[sizeof(vb_file.filename) - 1] = '\0'; // Ensure null termination
-
-    if(vb_file.fp != NULL) {
-        fclose(vb_file.fp); // Close any previously opened file
-        vb_file.fp = NULL;
+    size_t sampled = 0, last_size = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (rec->file.blocks[i].sampling == VB_SAMPLED_VALUES) {
+            sampled++;
+            last_size += rec->file.blocks[i].var_size;
+        }
     }
-
-    vb_file.fp = fopen(vb_file.filename, "wb");
-    if (vb_file.fp == NULL) {
-        VB_DEBUG("Failed to open file: %s", vb_file.filename);
-        return -1; // Failed to open file
+    hot->classes = malloc(sizeof(struct VB_Hot_Class) * n); // At most one class per variable
+    hot->src     = malloc(sizeof(const void *) * n);
+    hot->dst     = malloc(sizeof(uint8_t *) * n);
+    hot->block   = malloc(sizeof(size_t) * n);
+    hot->sampled = malloc(sizeof(struct VB_Sampled) * (sampled ? sampled : 1));
+    hot->last    = malloc(last_size ? last_size : 1);
+    if (hot->classes == NULL || hot->src == NULL || hot->dst == NULL || hot->block == NULL || hot->sampled == NULL || hot->last == NULL) {
+        vb2_free_hot_table(rec);
+        return -1; // Memory allocation failed
     }
-
-    return 0; // Success
-}
-
-void vb2_enable_log(){
-    if( vb_file.fp == NULL) {
-        VB_DEBUG("Variable buffer file is not open, cannot enable logging");
-        return; // Variable buffer file is not open
+    // First pass counts the columns of each size, there are only a handful of distinct sizes
+    for (size_t i = 0; i < n; i++) {
+        if (rec->file.blocks[i].sampling != VB_SAMPLED_NONE) {
+            continue;
+        }
+        size_t c = 0;
+        while (c < hot->class_count && hot->classes[c].var_size != rec->file.blocks[i].var_size) {
+            c++;
+        }
+        if (c == hot->class_count) {
+            memset(&hot->classes[c], 0, sizeof(hot->classes[c]));
+            hot->classes[c].var_size = rec->file.blocks[i].var_size;
+            hot->class_count++;
+        }
+        hot->classes[c].count++;
     }
-    char accompanying_vb_text_log[4096+6];
-    snprintf(accompanying_vb_text_log, sizeof(accompanying_vb_text_log), "%s.log", vb_file.filename);
-    vb_log_init(accompanying_vb_text_log); // Initialize the log file with the accompanying log file name
-}
-
-void vb2_close() {
-    if (vb_file.fp != NULL) {
-        fclose(vb_file.fp);
-        vb_file.fp = NULL;
+    hot->dense_count = hot->class_count;
+    // A sampled column and its row index advance on their own, each gets a class of one column
+    uint8_t *last = hot->last;
+    for (size_t i = 0; i < n; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        if (block->sampling != VB_SAMPLED_VALUES) {
+            continue;
+        }
+        struct VB_Sampled *entry = &hot->sampled[hot->sampled_count++];
+        entry->values      = hot->class_count;
+        entry->index       = hot->class_count + 1;
+        entry->divisor     = block->divisor > 1 ? block->divisor : 1;
+        entry->countdown   = 1; // The first row of a file always gets a sample
+        entry->change_only = block->change_only;
+        entry->stored      = 0;
+        entry->deadband    = block->deadband;
+        entry->kind        = block->kind;
+        entry->last        = last;
+        last += block->var_size;
+        memset(&hot->classes[hot->class_count], 0, sizeof(struct VB_Hot_Class) * 2);
+        hot->classes[hot->class_count].var_size     = block->var_size;
+        hot->classes[hot->class_count].count        = 1;
+        hot->classes[hot->class_count + 1].var_size = rec->file.blocks[block->index].var_size;
+        hot->classes[hot->class_count + 1].count    = 1;
+        hot->class_count += 2;
     }
-    if (vb_file.blocks != NULL) {
-        free(vb_file.blocks);
-        vb_file.blocks = NULL;
+    // Second pass lays the classes out back to back, keeping registration order inside each class
+    size_t slot = 0;
+    for (size_t c = 0; c < hot->class_count; c++) {
+        hot->classes[c].src   = hot->src + slot;
+        hot->classes[c].dst   = hot->dst + slot;
+        hot->classes[c].block = hot->block + slot;
+        slot += hot->classes[c].count;
+        hot->classes[c].count = 0;
     }
+    size_t next = hot->dense_count;
+    for (size_t i = 0; i < n; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        if (block->sampling == VB_SAMPLED_INDEX) {
+            continue; // Follows its column
+        }
+        size_t c = 0;
+        if (block->sampling == VB_SAMPLED_VALUES) {
+            c = next;
+            next += 2;
+        } else {
+            while (hot->classes[c].var_size != block->var_size) {
+                c++;
+            }
+        }
+        struct VB_Hot_Class *hot_class = &hot->classes[c];
+        hot_class->src[hot_class->count]   = block->var_ptr;
+        hot_class->dst[hot_class->count]   = NULL; // Bound by vb2_alloc_staging
+        hot_class->block[hot_class->count] = i;
+        hot_class->count++;
+        if (block->sampling == VB_SAMPLED_VALUES) {
+            hot_class = &hot->classes[c + 1];
+            hot_class->src[0]   = rec->file.blocks[block->index].var_ptr;
+            hot_class->dst[0]   = NULL;
+            hot_class->block[0] = block->index;
+            hot_class->count    = 1;
+        }
+    }
+    return 0;
+}
+
+// ***********************************************
+//   Staging buffers and the async writer thread
+// ***********************************************
+int vb2_pwrite_all(int fd, const uint8_t *data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t written = pwrite(fd, data, size, (off_t)offset);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue; // Interrupted before anything was written, try again
+            }
+            return -1; // Write failed
+        }
+        data   += written;
+        size   -= (size_t)written;
+        offset += (size_t)written;
+    }
+    return 0;
+}
+
+void vb2_free_staging(struct VB_Recorder *rec) {
+    struct VB_Async *async = &rec->file.async;
+    free(rec->file.staging);
+    rec->file.staging = NULL;
+    for (size_t i = 0; i < async->grown_count; i++) {
+        free(async->grown[i]);
+    }
+    free(async->grown);
+    for (size_t c = 0; c < async->pool_count; c++) {
+        free(async->pools[c].free_buffers);
+    }
+    free(async->pools);
+    free(async->jobs);
+    async->grown         = NULL;
+    async->grown_count   = 0;
+    async->pools         = NULL;
+    async->pool_count    = 0;
+    async->jobs          = NULL;
+    async->job_capacity  = 0;
+    async->job_head      = 0;
+    async->job_count     = 0;
+}
+
+int vb2_alloc_staging(struct VB_Recorder *rec) {
+    struct VB_Async *async = &rec->file.async;
+    vb2_free_staging(rec);
+    if (rec->file.block_count == 0) {
+        return 0; // Nothing to stage
+    }
+    if (rec->file.map != NULL) {
+        // Samples go straight into the mapping, each class writes until the end of its columns
+        for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+            struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+            hot_class->limit = hot_class->var_size * rec->file.blocks[hot_class->block[0]].capacity;
+            for (size_t j = 0; j < hot_class->count; j++) {
+                hot_class->dst[j] = rec->file.map + rec->file.blocks[hot_class->block[j]].header.offset;
+            }
+        }
+        return 0;
+    }
+    size_t per_block = rec->file.write_mode == VB2_WRITE_ASYNC ? async->buffer_count : 1;
+    size_t bytes     = 0;
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        if (hot_class->var_size <= VB_MAX_VAR_SIZE) {
+            hot_class->limit  = VB_BUFFER_SIZE;
+            hot_class->stride = VB_STAGING_STRIDE;
+        } else {
+            // Wide columns flush whole rows, so the limit is a multiple of the row and nothing overflows
+            size_t rows = VB_WIDE_BUFFER_SIZE / hot_class->var_size;
+            hot_class->limit  = hot_class->var_size * (rows ? rows : 1);
+            hot_class->stride = VB_CHUNK_PREFIX + ((hot_class->limit + 7) & ~(size_t)7); // Keeps every buffer 8 byte aligned
+        }
+        bytes += hot_class->stride * hot_class->count * per_block;
+    }
+    rec->file.staging = malloc(bytes);
+    if (rec->file.staging == NULL) {
+        return -1; // Memory allocation failed
+    }
+    // Staging buffers follow hot table order so each class sweeps one contiguous run of memory,
+    // the spare buffers of async mode come after all of them
+    uint8_t *next = rec->file.staging;
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        for (size_t j = 0; j < hot_class->count; j++) {
+            hot_class->dst[j] = next + VB_CHUNK_PREFIX;
+            next += hot_class->stride;
+        }
+    }
+    if (rec->file.write_mode != VB2_WRITE_ASYNC) {
+        return 0;
+    }
+    // Every buffer can be either queued or free, so both sets are sized for all of them
+    size_t total = per_block * rec->file.block_count;
+    async->pools = calloc(rec->file.hot.class_count, sizeof(struct VB_Pool));
+    async->jobs  = malloc(sizeof(struct VB_Async_Job) * total);
+    if (async->pools == NULL || async->jobs == NULL) {
+        vb2_free_staging(rec);
+        return -1; // Memory allocation failed
+    }
+    async->pool_count   = rec->file.hot.class_count;
+    async->job_capacity = total;
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        struct VB_Pool *pool = &async->pools[c];
+        pool->stride        = hot_class->stride;
+        pool->free_capacity = hot_class->count * per_block;
+        pool->free_buffers  = malloc(sizeof(uint8_t *) * pool->free_capacity);
+        if (pool->free_buffers == NULL) {
+            vb2_free_staging(rec);
+            return -1; // Memory allocation failed
+        }
+        for (size_t i = hot_class->count; i < pool->free_capacity; i++) {
+            pool->free_buffers[pool->free_count++] = next + VB_CHUNK_PREFIX;
+            next += pool->stride;
+        }
+    }
+    return 0;
+}
+
+// ***********************************************
+//          Memory mapped write path
+// ***********************************************
+int vb2_map_file(struct VB_Recorder *rec, size_t size) {
+    if (size == 0) {
+        return -1; // Nothing to map
+    }
+    fflush(rec->file.fp); // Headers go through stdio, data goes through the mapping
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(rec->file.fp), 0);
+    if (map == MAP_FAILED) {
+        VB_DEBUG("Failed to map %zu bytes: %s", size, strerror(errno));
+        return -1;
+    }
+    rec->file.map      = (uint8_t *)map;
+    rec->file.map_size = size;
+    return 0;
+}
+
+void vb2_unmap_file(struct VB_Recorder *rec) {
+    if (rec->file.map != NULL) {
+        munmap(rec->file.map, rec->file.map_size); // Dirty pages stay in the page cache and reach the file
+        rec->file.map      = NULL;
+        rec->file.map_size = 0;
+    }
+}
+
+// Mapping of the VB_Live page of a live session, see vb2_live_start
+void vb2_live_unmap(struct VB_Recorder *rec) {
+    if (rec->file.live_page != NULL) {
+        munmap(rec->file.live_page, rec->file.live_page_size);
+        rec->file.live_page      = NULL;
+        rec->file.live_page_size = 0;
+        rec->file.live           = NULL;
+    }
+}
+
+// Starts writeback of rows [from, to) of every column and drops the finished pages
+// from the mapping, so the kernel's dirty page throttling never lands on vb2_record_all.
+// The mapping and descriptor are passed in, a rotation may switch files meanwhile.
+// Rows [from, to) of all columns are started as one range, sync_file_range only writes its dirty pages.
+// Pages are dropped column by column, each up to the page its write position is in, so the page every
+// column is still writing stays mapped and vb2_record_all does not fault it back in.
+void vb2_map_writeback_rows(struct VB_Recorder *rec, uint8_t *map, int fd, size_t from, size_t to) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t start = SIZE_MAX, end = 0;
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        size_t column_start = block->header.offset + from * block->var_size;
+        size_t column_end   = block->header.offset + to   * block->var_size;
+        start = column_start < start ? column_start : start;
+        end   = column_end > end ? column_end : end;
+    }
+    if (end <= start) {
+        return;
+    }
+#ifdef __linux__
+    sync_file_range(fd, (off_t)start, (off_t)(end - start), SYNC_FILE_RANGE_WRITE);
+#else
+    (void)fd;
+    msync(map + start / page * page, end - start / page * page, MS_ASYNC);
+#endif
+    if (rec->file.record_mode == VB2_RECORD_RING) {
+        return; // The next lap rewrites these pages, dropping them would only fault them back in
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        size_t first = (block->header.offset + from * block->var_size) / page * page;
+        size_t last  = (block->header.offset + to   * block->var_size) / page * page;
+        if (last > first) {
+            madvise(map + first, last - first, MADV_DONTNEED); // Shared mapping: dirty pages stay in the page cache
+        }
+    }
+}
+
+// Same as vb2_map_writeback_rows but takes tick counts, which wrap around in ring mode
+void vb2_map_writeback(struct VB_Recorder *rec, uint8_t *map, int fd, size_t from, size_t to) {
+    size_t max_history = rec->file.max_history;
+    if (to - from >= max_history) {
+        vb2_map_writeback_rows(rec, map, fd, 0, max_history); // Every row was rewritten
+        return;
+    }
+    size_t first = from % max_history;
+    size_t last  = to % max_history;
+    if (first < last) {
+        vb2_map_writeback_rows(rec, map, fd, first, last);
+    } else {
+        vb2_map_writeback_rows(rec, map, fd, first, max_history);
+        vb2_map_writeback_rows(rec, map, fd, 0, last);
+    }
+}
+
+void vb2r_set_mmap_writeback(struct VB_Recorder *rec, size_t interval_rows) {
+    if (rec->file.async.running) {
+        VB_DEBUG("Cannot change the writeback interval while recording");
+        return;
+    }
+    rec->file.writeback_interval = interval_rows;
+}
+
+void vb2_request_writeback(struct VB_Recorder *rec, size_t rows) {
+    struct VB_Async *async = &rec->file.async;
+    pthread_mutex_lock(&async->lock);
+    async->writeback_rows = rows; // The writer catches up from wherever it got to
+    pthread_cond_signal(&async->job_ready);
+    pthread_mutex_unlock(&async->lock);
+}
+
+static inline void vb2_live_store(struct VB_Recorder *rec, uint64_t rows) {
+    __atomic_store_n(&rec->file.live->rows, rows, __ATOMIC_RELEASE); // After the data, readers acquire it
+}
+
+void *vb2_async_writer(void *arg) {
+    struct VB_Recorder *rec = (struct VB_Recorder *)arg;
+    struct VB_Async *async = &rec->file.async;
+    pthread_mutex_lock(&async->lock);
+    for (;;) {
+        while (async->job_count == 0 && async->writeback_rows == async->synced_rows && !async->stop) {
+            pthread_cond_wait(&async->job_ready, &async->lock);
+        }
+        if (async->job_count == 0 && async->writeback_rows != async->synced_rows) {
+            size_t   from      = async->synced_rows;
+            size_t   to        = async->writeback_rows;
+            uint64_t rotations = async->rotations;
+            uint8_t *map       = rec->file.map; // Rotations switch files under the lock
+            int      fd        = fileno(rec->file.fp);
+            async->writing++;
+            pthread_mutex_unlock(&async->lock);
+
+            vb2_map_writeback(rec, map, fd, from, to);
+
+            pthread_mutex_lock(&async->lock);
+            if (async->rotations == rotations) {
+                async->synced_rows = to; // Otherwise the rows were those of the previous file
+            }
+            async->writing--;
+            pthread_cond_broadcast(&async->job_done);
+            continue;
+        }
+        if (async->job_count == 0) {
+            break; // Asked to stop and nothing is left to write
+        }
+        struct VB_Async_Job job = async->jobs[async->job_head];
+        async->job_head = (async->job_head + 1) % async->job_capacity;
+        async->job_count--;
+        async->writing++;
+        pthread_mutex_unlock(&async->lock);
+
+#ifdef VB2_STATS_ENABLED
+        uint64_t start = vb2_stats_now();
+#endif
+        if (vb2_pwrite_all(job.fd, job.buffer - job.lead, job.size, job.offset) != 0) {
+            VB_DEBUG("Writer thread failed to write %zu bytes at offset %zu", job.size, job.offset);
+        }
+#ifdef VB2_STATS_ENABLED
+        vb2_stats_write(&rec->stats, job.size, vb2_stats_now() - start);
+#endif
+
+        pthread_mutex_lock(&async->lock);
+        struct VB_Pool *pool = &async->pools[job.pool];
+        pool->free_buffers[pool->free_count++] = job.buffer;
+        async->writing--;
+        async->completed++;
+        if (async->job_count == 0 && async->live_rows != 0) {
+            vb2_live_store(rec, async->live_rows); // Everything queued before the request is written
+            async->live_rows = 0;
+        }
+        pthread_cond_broadcast(&async->job_done);
+    }
+    pthread_mutex_unlock(&async->lock);
+    return NULL;
+}
+
+int vb2_async_start(struct VB_Recorder *rec) {
+    struct VB_Async *async = &rec->file.async;
+    fflush(rec->file.fp); // Headers go through stdio, data goes through pwrite on the same descriptor
+    async->fd      = fileno(rec->file.fp);
+    async->stop    = 0;
+    async->writing = 0;
+    async->stalls  = 0;
+    async->dropped = 0;
+    async->writeback_rows = 0;
+    async->synced_rows    = 0;
+    async->live_rows      = 0;
+    async->submitted      = 0;
+    async->completed      = 0;
+    async->rotations      = 0;
+    pthread_mutex_init(&async->lock, NULL);
+    pthread_cond_init(&async->job_ready, NULL);
+    pthread_cond_init(&async->job_done, NULL);
+    if (pthread_create(&async->thread, NULL, vb2_async_writer, rec) != 0) {
+        VB_DEBUG("Failed to start the writer thread");
+        pthread_cond_destroy(&async->job_done);
+        pthread_cond_destroy(&async->job_ready);
+        pthread_mutex_destroy(&async->lock);
+        return -1;
+    }
+    async->running = 1;
+    return 0;
+}
+
+void vb2_async_drain(struct VB_Recorder *rec) {
+    struct VB_Async *async = &rec->file.async;
+    if (!async->running) {
+        return;
+    }
+    pthread_mutex_lock(&async->lock);
+    while (async->job_count > 0 || async->writing > 0 || async->writeback_rows != async->synced_rows) {
+        pthread_cond_wait(&async->job_done, &async->lock);
+    }
+    pthread_mutex_unlock(&async->lock);
+}
+
+void vb2_async_stop(struct VB_Recorder *rec) {
+    struct VB_Async *async = &rec->file.async;
+    if (!async->running) {
+        return;
+    }
+    pthread_mutex_lock(&async->lock);
+    async->stop = 1;
+    pthread_cond_signal(&async->job_ready);
+    pthread_mutex_unlock(&async->lock);
+    pthread_join(async->thread, NULL); // The writer drains the queue before it exits
+    pthread_cond_destroy(&async->job_done);
+    pthread_cond_destroy(&async->job_ready);
+    pthread_mutex_destroy(&async->lock);
+    async->running = 0;
+}
+
+int vb2_async_grow(struct VB_Recorder *rec, struct VB_Pool *pool) {
+    struct VB_Async *async = &rec->file.async;
+    uint8_t *buffer = malloc(pool->stride);
+    if (buffer == NULL) {
+        return -1; // Memory allocation failed
+    }
+    size_t capacity = async->job_capacity + 1;
+    uint8_t **grown = realloc(async->grown, sizeof(uint8_t *) * (async->grown_count + 1));
+    uint8_t **free_buffers = realloc(pool->free_buffers, sizeof(uint8_t *) * (pool->free_capacity + 1));
+    struct VB_Async_Job *jobs = malloc(sizeof(struct VB_Async_Job) * capacity);
+    if (grown != NULL) {
+        async->grown = grown;
+    }
+    if (free_buffers != NULL) {
+        pool->free_buffers = free_buffers;
+    }
+    if (grown == NULL || free_buffers == NULL || jobs == NULL) {
+        free(jobs);
+        free(buffer);
+        return -1; // Memory allocation failed
+    }
+    // Unroll the job ring into the larger array
+    for (size_t i = 0; i < async->job_count; i++) {
+        jobs[i] = async->jobs[(async->job_head + i) % async->job_capacity];
+    }
+    free(async->jobs);
+    async->jobs          = jobs;
+    async->job_head      = 0;
+    async->job_capacity  = capacity;
+    pool->free_capacity++;
+    async->grown[async->grown_count++]     = buffer;
+    pool->free_buffers[pool->free_count++] = buffer + VB_CHUNK_PREFIX;
+    return 0;
+}
+
+// Hands a full staging buffer of a hot class to the writer thread and swaps in a free one.
+// Returns 0 if the buffer was queued, -1 if it was dropped.
+int vb2_async_submit(struct VB_Recorder *rec, size_t hot_class, uint8_t **buffer, size_t lead, size_t size, size_t offset) {
+    struct VB_Async *async = &rec->file.async;
+    struct VB_Pool  *pool  = &async->pools[hot_class];
+    pthread_mutex_lock(&async->lock);
+    if (pool->free_count == 0) {
+        if (async->policy == VB2_ASYNC_DROP) {
+            async->dropped += size;
+            pthread_mutex_unlock(&async->lock);
+            return -1;
+        }
+        if (async->policy == VB2_ASYNC_GROW && vb2_async_grow(rec, pool) != 0) {
+            VB_DEBUG("Failed to grow the staging pool, waiting for the writer instead");
+        }
+        if (pool->free_count == 0) {
+            async->stalls++; // The writer has fallen behind and the recorder waits for it
+        }
+        while (pool->free_count == 0) {
+            pthread_cond_wait(&async->job_done, &async->lock);
+        }
+    }
+    size_t tail = (async->job_head + async->job_count) % async->job_capacity;
+    async->jobs[tail].buffer = *buffer;
+    async->jobs[tail].pool   = hot_class;
+    async->jobs[tail].lead   = lead;
+    async->jobs[tail].size   = size;
+    async->jobs[tail].offset = offset;
+    async->jobs[tail].fd     = async->fd;
+    async->job_count++;
+    async->submitted++;
+    *buffer = pool->free_buffers[--pool->free_count];
+    pthread_cond_signal(&async->job_ready);
+    pthread_mutex_unlock(&async->lock);
+    return 0;
+}
+
+// Marks samples of a column as discarded, merged with the previous range when they follow it
+void vb2_record_drop(struct VB_Recorder *rec, size_t block, size_t first_row, size_t rows) {
+    struct VB_File *file = &rec->file;
+    if (file->drop_count > 0) {
+        struct VB_Dropped *last = &file->drops[file->drop_count - 1];
+        if (last->block == block && last->first_row + last->rows == first_row) {
+            last->rows += rows;
+            return;
+        }
+    }
+    if (file->drop_count == file->drop_capacity) {
+        size_t capacity = file->drop_capacity ? file->drop_capacity * 2 : 64;
+        struct VB_Dropped *drops = realloc(file->drops, sizeof(struct VB_Dropped) * capacity);
+        if (drops == NULL) {
+            VB_DEBUG("Failed to grow the dropped ranges, %zu samples of %s are not marked", rows, file->blocks[block].header.name);
+            return;
+        }
+        file->drops         = drops;
+        file->drop_capacity = capacity;
+    }
+    file->drops[file->drop_count++] = (struct VB_Dropped){ block, first_row, rows };
+}
+
+size_t vb2r_async_stalls(struct VB_Recorder *rec) {
+    return rec->file.async.stalls;
+}
+
+size_t vb2r_async_dropped(struct VB_Recorder *rec) {
+    return rec->file.async.dropped;
+}
+
+// ***********************************************
+//          Chunks and sections
+// ***********************************************
+size_t vb2_align8(size_t offset) {
+    return (offset + 7) & ~(size_t)7;
+}
+
+// ***********************************************
+//          Column compression
+// ***********************************************
+uint8_t vb2_kind_for(const struct VB_Block_Proxy *block) {
+    if (strcmp(block->header.type, "int") == 0 && block->var_size == 4) {
+        return VB_KIND_INT;
+    }
+    if (strcmp(block->header.type, "long") == 0 && block->var_size == 8) {
+        return VB_KIND_LONG;
+    }
+    if (strcmp(block->header.type, "float") == 0 && block->var_size == 4) {
+        return VB_KIND_FLOAT;
+    }
+    if (strcmp(block->header.type, "double") == 0 && block->var_size == 8) {
+        return VB_KIND_DOUBLE;
+    }
+    return VB_KIND_OTHER;
+}
+
+uint8_t vb2_codec_for(const struct VB_Block_Proxy *block) {
+    switch (block->kind) {
+        case VB_KIND_INT:
+        case VB_KIND_LONG:
+            return VB_CODEC_DOD;
+        case VB_KIND_FLOAT:
+        case VB_KIND_DOUBLE:
+            return VB_CODEC_XOR;
+        default:
+            return VB_CODEC_NONE;
+    }
+}
+
+// Encodes rows samples of var_size (4 or 8) bytes into out, see the layout above.
+// Returns the encoded size, or 0 if it would not be smaller than the raw samples.
+size_t vb2_encode(uint8_t codec, const uint8_t *data, size_t rows, size_t var_size, uint64_t *samples, uint8_t *out) {
+    size_t   raw  = rows * var_size;
+    size_t   bits = var_size * 8;
+    uint64_t mask = bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+    uint64_t prev = 0, prev_delta = 0;
+    for (size_t i = 0; i < rows; i++) {
+        uint64_t value = 0;
+        memcpy(&value, data + i * var_size, var_size); // Little endian, zero extended
+        if (codec == VB_CODEC_XOR) {
+            samples[i] = value ^ prev;
+        } else {
+            uint64_t delta = (value - prev) & mask;
+            uint64_t dod   = (delta - prev_delta) & mask;
+            uint64_t sign  = (dod >> (bits - 1)) & 1;
+            samples[i] = ((dod << 1) ^ (sign ? mask : 0)) & mask; // Zigzag so small negatives stay small
+            prev_delta = delta;
+        }
+        prev = value;
+    }
+
+    uint8_t *modes = out;
+    size_t   size  = var_size;
+    size_t   bitmap_size = (rows + 7) / 8;
+    for (size_t k = 0; k < var_size; k++) {
+        size_t nonzero = 0;
+        for (size_t i = 0; i < rows; i++) {
+            nonzero += ((samples[i] >> (8 * k)) & 0xFF) != 0;
+        }
+        if (nonzero == 0) {
+            modes[k] = VB_PLANE_ZERO;
+            continue;
+        }
+        if (bitmap_size + nonzero < rows) {
+            modes[k] = VB_PLANE_SPARSE;
+            if (size + bitmap_size + nonzero >= raw) {
+                return 0; // Not worth it
+            }
+            uint8_t *bitmap = out + size;
+            uint8_t *bytes  = bitmap + bitmap_size;
+            memset(bitmap, 0, bitmap_size);
+            for (size_t i = 0; i < rows; i++) {
+                uint8_t byte = (uint8_t)(samples[i] >> (8 * k));
+                if (byte != 0) {
+                    bitmap[i / 8] |= (uint8_t)(1u << (i % 8));
+                    *bytes++ = byte;
+                }
+            }
+            size += bitmap_size + nonzero;
+        } else {
+            modes[k] = VB_PLANE_RAW;
+            if (size + rows >= raw) {
+                return 0; // Not worth it
+            }
+            for (size_t i = 0; i < rows; i++) {
+                out[size + i] = (uint8_t)(samples[i] >> (8 * k));
+            }
+            size += rows;
+        }
+    }
+    return size < raw ? size : 0;
+}
+
+void vb2r_set_compression(struct VB_Recorder *rec, int enabled) {
+    rec->file.compress = (enabled != 0);
+}
+
+int vb2_alloc_encoder(struct VB_Recorder *rec) {
+    free(rec->file.encode_samples);
+    free(rec->file.encode_out);
+    rec->file.encode_samples = NULL;
+    rec->file.encode_out     = NULL;
+    if (!rec->file.compress || rec->file.record_mode != VB2_RECORD_STREAM) {
+        return 0; // Fixed layouts reserve the raw size anyway
+    }
+    rec->file.encode_samples = malloc(sizeof(uint64_t) * VB_ENCODE_MAX_ROWS);
+    rec->file.encode_out     = malloc(VB_STAGING_SIZE);
+    if (rec->file.encode_samples == NULL || rec->file.encode_out == NULL) {
+        free(rec->file.encode_samples);
+        free(rec->file.encode_out);
+        rec->file.encode_samples = NULL; // vb2_write_chunk stores raw chunks without them
+        rec->file.encode_out     = NULL;
+        return -1; // Memory allocation failed
+    }
+    return 0;
+}
+
+// Appends one staged column to the end of the file as a chunk, the chunk header
+// is built in the prefix reserved in front of every staging buffer.
+void vb2_write_chunk(struct VB_Recorder *rec, struct VB_Hot_Class *hot_class, size_t j) {
+    uint8_t *data = hot_class->dst[j];
+    struct VB_Chunk_Header *chunk = (struct VB_Chunk_Header *)(data - VB_CHUNK_PREFIX);
+    chunk->block     = hot_class->block[j];
+    chunk->first_row = hot_class->flushed_rows;
+    chunk->rows      = hot_class->fill / hot_class->var_size;
+    chunk->size      = hot_class->fill;
+    uint8_t codec = rec->file.blocks[chunk->block].codec;
+    if (codec != VB_CODEC_NONE && rec->file.encode_out != NULL) {
+        size_t encoded = vb2_encode(codec, data, chunk->rows, hot_class->var_size, rec->file.encode_samples, rec->file.encode_out);
+        if (encoded > 0) {
+            memcpy(data, rec->file.encode_out, encoded); // Smaller than the samples, fits in the staging buffer
+            chunk->size = encoded;
+        }
+    }
+    size_t padded = vb2_align8(chunk->size);
+    memset(data + chunk->size, 0, padded - chunk->size); // Keeps the next chunk 8 byte aligned
+
+    if (rec->file.chunk_count == rec->file.chunk_capacity) {
+        size_t capacity = rec->file.chunk_capacity ? rec->file.chunk_capacity * 2 : 256;
+        struct VB_Chunk_Index *chunks = realloc(rec->file.chunks, sizeof(struct VB_Chunk_Index) * capacity);
+        if (chunks == NULL) {
+            VB_DEBUG("Failed to grow the chunk index, chunk %zu is only found by scanning", rec->file.chunk_count);
+        } else {
+            rec->file.chunks         = chunks;
+            rec->file.chunk_capacity = capacity;
+        }
+    }
+    int indexed = rec->file.chunk_count < rec->file.chunk_capacity;
+    if (indexed) {
+        rec->file.chunks[rec->file.chunk_count].chunk  = *chunk;
+        rec->file.chunks[rec->file.chunk_count].offset = rec->file.append_offset + VB_CHUNK_PREFIX;
+        rec->file.chunk_count++;
+    }
+
+    if (rec->file.async.running) {
+        if (vb2_async_submit(rec, (size_t)(hot_class - rec->file.hot.classes), &hot_class->dst[j], VB_CHUNK_PREFIX, VB_CHUNK_PREFIX + padded, rec->file.append_offset) != 0) {
+            rec->file.chunk_count -= (size_t)indexed; // The next chunk takes its place, first_row shows the gap
+            vb2_record_drop(rec, hot_class->block[j], chunk->first_row, chunk->rows);
+            return;
+        }
+    } else {
+#ifdef VB2_STATS_ENABLED
+        uint64_t start = vb2_stats_now();
+#endif
+        fseek(rec->file.fp, rec->file.append_offset, SEEK_SET);
+        fwrite(chunk, 1, VB_CHUNK_PREFIX + padded, rec->file.fp);
+#ifdef VB2_STATS_ENABLED
+        vb2_stats_write(&rec->stats, VB_CHUNK_PREFIX + padded, vb2_stats_now() - start);
+#endif
+    }
+    rec->file.append_offset += VB_CHUNK_PREFIX + padded;
+}
+
+// Appends a section after the data, only called once the writer thread is drained
+int vb2_append_section(struct VB_Recorder *rec, const char *tag, const void *data, size_t size) {
+    struct VB_Section *sections = realloc(rec->file.sections, sizeof(struct VB_Section) * (rec->file.section_count + 1));
+    if (sections == NULL) {
+        return -1; // Memory allocation failed
+    }
+    rec->file.sections = sections;
+    struct VB_Section *section = &rec->file.sections[rec->file.section_count++];
+    memset(section, 0, sizeof(*section));
+    memcpy(section->tag, tag, strnlen(tag, sizeof(section->tag))); // Not null terminated when 8 characters long
+    section->offset = vb2_align8(rec->file.append_offset);
+    section->size   = size;
+    fseek(rec->file.fp, section->offset, SEEK_SET);
+    fwrite(data, 1, size, rec->file.fp);
+    rec->file.append_offset = section->offset + size;
+    return 0;
+}
+
+void vb2_save_sections(struct VB_Recorder *rec) {
+    if (rec->file.section_count == 0) {
+        rec->file.section_table = 0;
+        return; // Nothing to point at
+    }
+    struct VB_Section_Table table = { rec->file.section_count };
+    rec->file.section_table = vb2_align8(rec->file.append_offset);
+    fseek(rec->file.fp, rec->file.section_table, SEEK_SET);
+    fwrite(&table, sizeof(table), 1, rec->file.fp);
+    fwrite(rec->file.sections, sizeof(struct VB_Section), rec->file.section_count, rec->file.fp);
+    rec->file.append_offset = rec->file.section_table + sizeof(table) + sizeof(struct VB_Section) * rec->file.section_count;
+}
+
+void vb2_free_sections(struct VB_Recorder *rec) {
+    free(rec->file.sections);
+    rec->file.sections      = NULL;
+    rec->file.section_count = 0;
+    rec->file.section_table = 0;
+}
+
+// ***********************************************
+//              Summary index
+// ***********************************************
+void vb2r_set_summary(struct VB_Recorder *rec, size_t rows, int pyramid) {
+    rec->file.summary_rows    = rows;
+    rec->file.summary_pyramid = pyramid;
+}
+
+void vb2_summarize(struct VB_Summary *entry, uint8_t kind, const uint8_t *data, size_t rows) {
+    double min = 0, max = 0, sum = 0;
+    for (size_t i = 0; i < rows; i++) {
+        double value;
+        switch (kind) {
+            case VB_KIND_INT:    { int32_t v; memcpy(&v, data + i * 4, 4); value = v; break; }
+            case VB_KIND_LONG:   { int64_t v; memcpy(&v, data + i * 8, 8); value = (double)v; break; }
+            case VB_KIND_FLOAT:  { float   v; memcpy(&v, data + i * 4, 4); value = v; break; }
+            default:             { double  v; memcpy(&v, data + i * 8, 8); value = v; break; }
+        }
+        if (i == 0 || value < min) {
+            min = value;
+        }
+        if (i == 0 || value > max) {
+            max = value;
+        }
+        sum += value;
+    }
+    entry->min  = min;
+    entry->max  = max;
+    entry->sum  = sum;
+    entry->rows = rows;
+}
+
+void vb2_summary_push(struct VB_Recorder *rec, const struct VB_Summary *entry) {
+    if (rec->file.summary_count == rec->file.summary_capacity) {
+        size_t capacity = rec->file.summary_capacity ? rec->file.summary_capacity * 2 : 256;
+        struct VB_Summary *summaries = realloc(rec->file.summaries, sizeof(struct VB_Summary) * capacity);
+        if (summaries == NULL) {
+            VB_DEBUG("Failed to grow the summary index, dropping an entry");
+            return;
+        }
+        rec->file.summaries        = summaries;
+        rec->file.summary_capacity = capacity;
+    }
+    rec->file.summaries[rec->file.summary_count++] = *entry;
+}
+
+// Summarizes the rows added to a class since the last call, split at multiples of summary_rows
+void vb2_summarize_class(struct VB_Recorder *rec, struct VB_Hot_Class *hot_class) {
+    size_t granule = rec->file.summary_rows;
+    if (granule == 0 || hot_class->summarized >= hot_class->fill) {
+        return;
+    }
+    size_t row  = hot_class->summarized / hot_class->var_size;
+    size_t rows = hot_class->fill / hot_class->var_size;
+    while (row < rows) {
+        size_t first = hot_class->flushed_rows + row; // dst row 0 is flushed_rows
+        size_t end   = row + granule - first % granule;
+        if (end > rows) {
+            end = rows;
+        }
+        for (size_t j = 0; j < hot_class->count; j++) {
+            struct VB_Block_Proxy *block = &rec->file.blocks[hot_class->block[j]];
+            if (block->kind == VB_KIND_OTHER || block->sampling != VB_SAMPLED_NONE) {
+                continue; // Sampled columns have no sample per row to summarize
+            }
+            struct VB_Summary entry = { .block = hot_class->block[j], .level = 0, .first_row = first };
+            vb2_summarize(&entry, block->kind, hot_class->dst[j] + row * hot_class->var_size, end - row);
+            vb2_summary_push(rec, &entry);
+        }
+        row = end;
+    }
+    hot_class->summarized = hot_class->fill;
+}
+
+// Ring mode: drops entries that only cover overwritten rows
+void vb2_summary_prune(struct VB_Recorder *rec, size_t oldest) {
+    size_t kept = 0;
+    for (size_t i = 0; i < rec->file.summary_count; i++) {
+        struct VB_Summary *entry = &rec->file.summaries[i];
+        if (entry->first_row + entry->rows > oldest) {
+            rec->file.summaries[kept++] = *entry;
+        }
+    }
+    rec->file.summary_count = kept;
+}
+
+int vb2_summary_compare(const void *a, const void *b) {
+    const struct VB_Summary *x = a, *y = b;
+    if (x->block != y->block) {
+        return x->block < y->block ? -1 : 1;
+    }
+    return x->first_row < y->first_row ? -1 : x->first_row > y->first_row;
+}
+
+// Ring mode: entries straddling the oldest row also cover overwritten rows, summarize what is left from the file
+void vb2_summary_trim(struct VB_Recorder *rec, size_t oldest) {
+    uint8_t buffer[VB_BUFFER_SIZE];
+    fflush(rec->file.fp);
+    for (size_t i = 0; i < rec->file.summary_count; i++) {
+        struct VB_Summary *entry = &rec->file.summaries[i];
+        if (entry->first_row >= oldest) {
+            continue;
+        }
+        struct VB_Block_Proxy *block = &rec->file.blocks[entry->block];
+        struct VB_Summary trimmed = { .block = entry->block, .level = 0, .first_row = oldest };
+        size_t left   = entry->first_row + entry->rows - oldest; // Rows still stored, never across the wrap
+        size_t offset = block->header.offset + (oldest % rec->file.max_history) * block->var_size;
+        while (left > 0) {
+            size_t rows = left < VB_BUFFER_SIZE / block->var_size ? left : VB_BUFFER_SIZE / block->var_size;
+            size_t size = rows * block->var_size;
+            struct VB_Summary part;
+            if (pread(fileno(rec->file.fp), buffer, size, (off_t)offset) != (ssize_t)size) {
+                break;
+            }
+            vb2_summarize(&part, block->kind, buffer, rows);
+            trimmed.min  = (trimmed.rows == 0 || part.min < trimmed.min) ? part.min : trimmed.min;
+            trimmed.max  = (trimmed.rows == 0 || part.max > trimmed.max) ? part.max : trimmed.max;
+            trimmed.sum += part.sum;
+            trimmed.rows += rows;
+            offset += size;
+            left   -= rows;
+        }
+        if (left > 0) {
+            VB_DEBUG("Could not re-read the rows of a summary entry, keeping it as is");
+            continue; // Min and max still bound the stored rows
+        }
+        *entry = trimmed;
+    }
+}
+
+// Appends the SUMMARY section and, if enabled, the PYRAMID section
+void vb2_save_summary(struct VB_Recorder *rec) {
+    size_t oldest = 0;
+    if (rec->file.record_mode == VB2_RECORD_RING && rec->file.current_history > rec->file.max_history) {
+        oldest = rec->file.current_history - rec->file.max_history;
+        vb2_summary_prune(rec, oldest);
+        vb2_summary_trim(rec, oldest);
+    }
+    struct VB_Summary *summaries = rec->file.summaries;
+    size_t count = rec->file.summary_count;
+    qsort(summaries, count, sizeof(struct VB_Summary), vb2_summary_compare);
+    for (size_t i = 0; i < count; i++) {
+        summaries[i].first_row -= oldest; // Rows as the reader numbers them
+    }
+    vb2_append_section(rec, "SUMMARY", summaries, sizeof(struct VB_Summary) * count);
+    if (!rec->file.summary_pyramid || count == 0) {
+        return;
+    }
+    // Every level is at most 1/VB_PYRAMID_FANOUT of the one below, the whole pyramid fits in count entries
+    struct VB_Summary *pyramid = malloc(sizeof(struct VB_Summary) * count);
+    if (pyramid == NULL) {
+        VB_DEBUG("Failed to allocate the pyramid");
+        return;
+    }
+    size_t size = 0;
+    for (size_t start = 0; start < count;) {
+        size_t end = start;
+        while (end < count && summaries[end].block == summaries[start].block) {
+            end++;
+        }
+        // Level n of this block is read from [from, to) and appended after it
+        const struct VB_Summary *from = summaries + start;
+        size_t below = end - start;
+        for (size_t level = 1; below > 1; level++) {
+            size_t first = size;
+            for (size_t i = 0; i < below; i += VB_PYRAMID_FANOUT) {
+                struct VB_Summary merged = from[i];
+                merged.level = level;
+                for (size_t k = i + 1; k < below && k < i + VB_PYRAMID_FANOUT; k++) {
+                    merged.min   = from[k].min < merged.min ? from[k].min : merged.min;
+                    merged.max   = from[k].max > merged.max ? from[k].max : merged.max;
+                    merged.sum  += from[k].sum;
+                    merged.rows  = from[k].first_row + from[k].rows - merged.first_row;
+                }
+                pyramid[size++] = merged;
+            }
+            from  = pyramid + first;
+            below = size - first;
+        }
+        start = end;
+    }
+    vb2_append_section(rec, "PYRAMID", pyramid, sizeof(struct VB_Summary) * size);
+    free(pyramid);
+}
+
+// Writes the staged samples of every column in the class, inline or through the writer thread
+void vb2_flush_class(struct VB_Recorder *rec, struct VB_Hot_Class *hot_class) {
+    vb2_summarize_class(rec, hot_class); // Before stream mode encodes the buffer in place
+    if (rec->file.map != NULL || hot_class->fill == 0) {
+        return; // Mapped columns are already in the file
+    }
+#ifdef VB2_STATS_ENABLED
+    uint64_t start = vb2_stats_now();
+#endif
+    for (size_t j = 0; j < hot_class->count; j++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[hot_class->block[j]];
+        if (rec->file.record_mode == VB2_RECORD_STREAM) {
+            vb2_write_chunk(rec, hot_class, j);
+            continue;
+        }
+        if (rec->file.async.running) {
+            if (vb2_async_submit(rec, (size_t)(hot_class - rec->file.hot.classes), &hot_class->dst[j], 0, hot_class->fill, block->offset) != 0) {
+                vb2_record_drop(rec, hot_class->block[j], hot_class->flushed_rows, hot_class->fill / hot_class->var_size);
+            }
+        } else {
+#ifdef VB2_STATS_ENABLED
+            uint64_t start = vb2_stats_now();
+#endif
+            fseek(rec->file.fp, block->offset, SEEK_SET); // Seek to the variable's offset in the file
+            fwrite(hot_class->dst[j], 1, hot_class->fill, rec->file.fp); // Write the buffer to the file
+#ifdef VB2_STATS_ENABLED
+            vb2_stats_write(&rec->stats, hot_class->fill, vb2_stats_now() - start);
+#endif
+        }
+        VB_DEBUG("Wrote %zu bytes to file for variable: %s", hot_class->fill, block->header.name);
+        block->offset += hot_class->fill; // Update the offset for the next write
+    }
+    hot_class->flushed_rows += hot_class->fill / hot_class->var_size;
+    hot_class->fill = 0; // Reset the buffer offset
+    hot_class->summarized = 0;
+#ifdef VB2_STATS_ENABLED
+    rec->stats.flushes++;
+    vb2_stats_time(&rec->stats.flush_ns, vb2_stats_now() - start);
+#endif
+}
+
+void vb2r_init(struct VB_Recorder *rec) {
+    VB_DEBUG("Initializing variable buffer system");
+    memset(&rec->file, 0, sizeof(rec->file)); // Initialize the variable buffer file structure
+    rec->file.async.buffer_count = VB_ASYNC_BUFFER_COUNT;
+}
+
+void vb2r_set_write_mode(struct VB_Recorder *rec, enum vb2_write_mode mode) {
+    if (rec->file.async.running) {
+        VB_DEBUG("Cannot change the write mode while the writer thread is running");
+        return;
+    }
+    rec->file.write_mode = mode;
+}
+
+void vb2r_set_async_policy(struct VB_Recorder *rec, enum vb2_async_policy policy, size_t buffer_count) {
+    if (rec->file.async.running) {
+        VB_DEBUG("Cannot change the async policy while the writer thread is running");
+        return;
+    }
+    rec->file.async.policy       = policy;
+    rec->file.async.buffer_count = buffer_count < 2 ? 2 : buffer_count; // Need at least one spare per variable
+}
+
+int vb2r_open(struct VB_Recorder *rec, const char *filename) {
+    VB_DEBUG("Opening variable buffer file: %s", filename);
+    if (filename == NULL || strlen(filename) == 0) {
+        VB_DEBUG("Invalid filename provided");
+        return -1; // Invalid parameters
+    }
+
+    if (vb2_session_dir[0] != '\0' && filename[0] != '/') {
+        int written = snprintf(rec->file.filename, sizeof(rec->file.filename), "%s/%s", vb2_session_dir, filename); // Recorders of one session share a directory
+        if (written < 0 || (size_t)written >= sizeof(rec->file.filename)) {
+            VB_DEBUG("Path too long in session directory: %s", filename);
+            return -1; // Invalid parameters
+        }
+    } else {
+        strncpy(rec->file.filename, filename, sizeof(rec->file.filename) - 1);
+        rec->file.filename[sizeof(rec->file.filename) - 1] = '\0'; // Ensure null termination
+    }
+
+    if(rec->file.fp != NULL) {
+        fclose(rec->file.fp); // Close any previously opened file
+        rec->file.fp = NULL;
+    }
+
+    rec->file.fp = fopen(rec->file.filename, "w+b"); // Readable too, MAP_SHARED needs it
+    if (rec->file.fp == NULL) {
+        VB_DEBUG("Failed to open file: %s", rec->file.filename);
+        return -1; // Failed to open file
+    }
+
+    return 0; // Success
+}
+
+void vb2r_enable_log(struct VB_Recorder *rec){
+    if( rec->file.fp == NULL) {
+        VB_DEBUG("Variable buffer file is not open, cannot enable logging");
+        return; // Variable buffer file is not open
+    }
+    char accompanying_vb_text_log[4096+6];
+    snprintf(accompanying_vb_text_log, sizeof(accompanying_vb_text_log), "%s.log", rec->file.filename);
+    vb2r_log_init(rec, accompanying_vb_text_log); // Initialize the log file with the accompanying log file name
+}
+
+// Log records are kept with the recording and saved as sections of the .vb2 file by vb2r_end
+void vb2r_enable_log_events(struct VB_Recorder *rec) {
+    if (rec->file.fp == NULL) {
+        VB_DEBUG("Variable buffer file is not open, cannot enable log events");
+        return;
+    }
+    vb2r_log_close(rec);
+    rec->log.events         = 1;
+    rec->log.level          = VB_LOG_DEBUG;
+    rec->log.echo_to_stdout = 0;
+    rec->log.echo_to_stderr = 0;
+    memset(rec->log.defined, 0, sizeof(rec->log.defined));
+}
+
+// "LOG", "LOGINDEX" and "LOGFMT" sections, see VB_Log_Event
+void vb2_save_log_events(struct VB_Recorder *rec) {
+    vb2r_log_flush(rec);
+    vb2_append_section(rec, "LOG", rec->log.event_data, rec->log.event_size);
+    vb2_append_section(rec, "LOGINDEX", rec->log.event_index, sizeof(struct VB_Log_Event) * rec->log.event_count);
+    size_t used = 0;
+    for (uint32_t id = VB_BLOG_FIRST_ID; id < VB_BLOG_MAX_FORMATS; id++) {
+        used += (rec->log.defined[id / 8] >> (id % 8)) & 1;
+    }
+    uint8_t *definitions = malloc(used * VB_LOG_BUFFER_OVERFLOW + 1);
+    if (definitions == NULL) {
+        VB_DEBUG("Failed to allocate the log formats");
+        return;
+    }
+    size_t size = 0;
+    for (uint32_t id = VB_BLOG_FIRST_ID; id < VB_BLOG_MAX_FORMATS; id++) {
+        if ((rec->log.defined[id / 8] >> (id % 8)) & 1) {
+            size += vb2_blog_definition(id, definitions + size);
+        }
+    }
+    vb2_append_section(rec, "LOGFMT", definitions, size);
+    free(definitions);
+}
+
+// ***********************************************
+//          Shared memory telemetry
+// ***********************************************
+// Publishes rows to the shm segment name (e.g. "/robot_telemetry") keeping the last slot_count
+// of them, configure before vb2_start. NULL or "" turns the sink off.
+int vb2r_set_shm(struct VB_Recorder *rec, const char *name, size_t slot_count) {
+    if (name == NULL || name[0] == '\0') {
+        rec->file.shm.name[0] = '\0';
+        return 0;
+    }
+    int length = snprintf(rec->file.shm.name, sizeof(rec->file.shm.name), "%s%s", name[0] == '/' ? "" : "/", name);
+    if (length < 0 || (size_t)length >= sizeof(rec->file.shm.name) || strchr(rec->file.shm.name + 1, '/') != NULL) {
+        rec->file.shm.name[0] = '\0';
+        return -1; // Not a valid shm name
+    }
+    size_t slots = 2;
+    while (slots < slot_count) {
+        slots <<= 1;
+    }
+    rec->file.shm.slot_count = slots;
+    return 0;
+}
+
+// Limits the sink to the selected variables, call before vb2_start
+int vb2r_shm_select(struct VB_Recorder *rec, const char *variable) {
+    char **selected = realloc(rec->file.shm.selected, sizeof(char *) * (rec->file.shm.selected_count + 1));
+    if (selected == NULL) {
+        return -1;
+    }
+    rec->file.shm.selected = selected;
+    selected[rec->file.shm.selected_count] = strdup(variable);
+    if (selected[rec->file.shm.selected_count] == NULL) {
+        return -1;
+    }
+    rec->file.shm.selected_count++;
+    return 0;
+}
+
+int vb2_shm_selected(const struct VB_Shm *shm, const char *name) {
+    if (shm->selected_count == 0) {
+        return 1;
+    }
+    for (size_t i = 0; i < shm->selected_count; i++) {
+        if (strcmp(shm->selected[i], name) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void vb2_shm_unmap(struct VB_Recorder *rec) {
+    struct VB_Shm *shm = &rec->file.shm;
+    if (shm->header != NULL) {
+        munmap(shm->header, shm->size);
+        shm->header = NULL;
+        shm->size   = 0;
+    }
+    free(shm->src);
+    free(shm->offset);
+    free(shm->var_size);
+    shm->src      = NULL;
+    shm->offset   = NULL;
+    shm->var_size = NULL;
+    shm->count    = 0;
+}
+
+// Creates a fresh segment for the session, consumers of the previous one see it ended
+int vb2_shm_start(struct VB_Recorder *rec) {
+    struct VB_Shm *shm = &rec->file.shm;
+    vb2_shm_unmap(rec);
+    size_t count = 0, row_size = 0;
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        count += vb2_shm_selected(shm, rec->file.blocks[i].header.name);
+    }
+    shm->src      = malloc(sizeof(*shm->src) * (count ? count : 1));
+    shm->offset   = malloc(sizeof(*shm->offset) * (count ? count : 1));
+    shm->var_size = malloc(sizeof(*shm->var_size) * (count ? count : 1));
+    if (shm->src == NULL || shm->offset == NULL || shm->var_size == NULL) {
+        vb2_shm_unmap(rec);
+        return -1;
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        if (vb2_shm_selected(shm, block->header.name)) {
+            shm->src[shm->count]      = block->var_ptr;
+            shm->offset[shm->count]   = row_size;
+            shm->var_size[shm->count] = block->var_size;
+            shm->count++;
+            row_size += block->var_size;
+        }
+    }
+    size_t slot_size = (sizeof(struct VB_Shm_Slot) + row_size + 7) & ~(size_t)7;
+    size_t slots     = sizeof(struct VB_Shm_Header) + sizeof(struct VB_Header) * count;
+    size_t size      = slots + slot_size * shm->slot_count;
+
+    shm_unlink(shm->name); // Readers still mapping the old segment keep it
+    int fd = shm_open(shm->name, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        vb2_shm_unmap(rec);
+        return -1;
+    }
+    void *map = MAP_FAILED;
+    if (ftruncate(fd, (off_t)size) == 0) {
+        map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd); // The mapping keeps the segment
+    if (map == MAP_FAILED) {
+        shm_unlink(shm->name);
+        vb2_shm_unmap(rec);
+        return -1;
+    }
+    shm->header = map;
+    shm->size   = size;
+    struct VB_Header *schema = (struct VB_Header *)(shm->header + 1);
+    for (size_t i = 0, j = 0; i < rec->file.block_count; i++) {
+        if (vb2_shm_selected(shm, rec->file.blocks[i].header.name)) {
+            schema[j]        = rec->file.blocks[i].header;
+            schema[j].offset = shm->offset[j];
+            schema[j].count  = 0;
+            j++;
+        }
+    }
+    memcpy(shm->header->magic, VB_SHM_MAGIC, sizeof(VB_SHM_MAGIC));
+    shm->header->version      = VB_SHM_VERSION;
+    shm->header->column_count = count;
+    shm->header->row_size     = row_size;
+    shm->header->slot_count   = shm->slot_count;
+    shm->header->slot_size    = slot_size;
+    shm->header->slots        = slots;
+    shm->header->clock        = rec->file.clock;
+    __atomic_store_n(&shm->header->state, VB_SHM_RECORDING, __ATOMIC_RELEASE); // Consumers wait for it before reading the layout
+    return 0;
+}
+
+// Copies the current values of the published variables into the next slot
+static inline void vb2_shm_publish(struct VB_Recorder *rec) {
+    struct VB_Shm *shm = &rec->file.shm;
+    uint64_t tick = rec->file.ticks; // Counts on across rotated files and rows a triggered capture leaves out
+    struct VB_Shm_Slot *slot = (struct VB_Shm_Slot *)((uint8_t *)shm->header + shm->header->slots +
+                                                      (tick & (shm->slot_count - 1)) * shm->header->slot_size);
+    uint8_t *row = (uint8_t *)(slot + 1);
+    __atomic_store_n(&slot->sequence, 2 * tick + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE); // The odd sequence is visible before any of the row changes
+    slot->tick = tick;
+    slot->time = rec->file.timestamp;
+    for (size_t j = 0; j < shm->count; j++) {
+        memcpy(row + shm->offset[j], shm->src[j], shm->var_size[j]);
+    }
+    __atomic_store_n(&slot->sequence, 2 * tick + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->header->head, tick + 1, __ATOMIC_RELEASE);
+}
+
+void vb2_shm_end(struct VB_Recorder *rec) {
+    if (rec->file.shm.header != NULL) {
+        __atomic_store_n(&rec->file.shm.header->state, VB_SHM_ENDED, __ATOMIC_RELEASE);
+        vb2_shm_unmap(rec); // The segment stays until the next session or vb2_close, consumers can read the last rows
+    }
+}
+
+void vb2_free_shm(struct VB_Recorder *rec) {
+    vb2_shm_end(rec);
+    if (rec->file.shm.name[0] != '\0') {
+        shm_unlink(rec->file.shm.name);
+    }
+    for (size_t i = 0; i < rec->file.shm.selected_count; i++) {
+        free(rec->file.shm.selected[i]);
+    }
+    free(rec->file.shm.selected);
+    memset(&rec->file.shm, 0, sizeof(rec->file.shm));
+}
+
+void vb2_free_compact_headers(struct VB_Recorder *rec) {
+    free(rec->file.compact_headers);
+    free(rec->file.strings);
+    rec->file.compact_headers = NULL;
+    rec->file.strings         = NULL;
+    rec->file.string_size     = 0;
+}
+
+void vb2_free_capture(struct VB_Recorder *rec) {
+    free(rec->file.capture.triggers);
+    free(rec->file.capture.history);
+    free(rec->file.capture.events);
+    memset(&rec->file.capture, 0, sizeof(rec->file.capture));
+}
+
+// Everything a recording holds, vb2_close and the spare files of a rotation release it
+void vb2_free_file(struct VB_Recorder *rec) {
+    vb2_async_stop(rec); // In case the session was never ended
+    vb2_unmap_file(rec);
+    vb2_live_unmap(rec);
+    vb2_free_shm(rec);
+    if (rec->file.fp != NULL) {
+        fclose(rec->file.fp);
+        rec->file.fp = NULL;
+    }
+    vb2_free_staging(rec); // Staging buffers point into nothing once the blocks are gone
+    vb2_free_hot_table(rec);
+    vb2_free_sections(rec);
+    free(rec->file.chunks);
+    rec->file.chunks         = NULL;
+    rec->file.chunk_count    = 0;
+    rec->file.chunk_capacity = 0;
+    free(rec->file.drops);
+    rec->file.drops         = NULL;
+    rec->file.drop_count    = 0;
+    rec->file.drop_capacity = 0;
+    free(rec->file.summaries);
+    rec->file.summaries        = NULL;
+    rec->file.summary_count    = 0;
+    rec->file.summary_capacity = 0;
+    free(rec->file.encode_samples);
+    free(rec->file.encode_out);
+    rec->file.encode_samples = NULL;
+    rec->file.encode_out     = NULL;
+    free(rec->file.fields); // Describe the blocks freed below
+    rec->file.fields      = NULL;
+    rec->file.field_count = 0;
+    vb2_free_compact_headers(rec);
+    vb2_free_capture(rec); // Triggers refer to the blocks
+    if (rec->file.blocks != NULL) {
+        free(rec->file.blocks);
+        rec->file.blocks = NULL;
+    }
+    rec->file.block_count    = 0;
+    rec->file.block_capacity = 0;
+}
+
+// Capacity hint, grows blocks once instead of letting registration grow it step by step
+int vb2r_reserve_variables(struct VB_Recorder *rec, size_t capacity) {
+    if (capacity <= rec->file.block_capacity) {
+        return 0;
+    }
+    struct VB_Block_Proxy *blocks = realloc(rec->file.blocks, sizeof(struct VB_Block_Proxy) * capacity);
+    if (blocks == NULL) {
+        return -1;
+    }
+    rec->file.blocks         = blocks;
+    rec->file.block_capacity = capacity;
+    return 0;
+}
+
+// Bytes of a type such as "double" or "double[1000]", 0 if the element type is not one the readers know
+size_t vb2_type_size(const char *type) {
+    static const struct { const char *name; size_t size; } elements[] = {
+        { "int", 4 }, { "long", 8 }, { "float", 4 }, { "double", 8 }, { "byte", 1 }
+    };
+    size_t length = strcspn(type, "[");
+    size_t count  = 1;
+    if (type[length] == '[') {
+        char *end;
+        count = strtoull(type + length + 1, &end, 10);
+        if (count == 0 || strcmp(end, "]") != 0) {
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); i++) {
+        if (strlen(elements[i].name) == length && strncmp(type, elements[i].name, length) == 0) {
+            return elements[i].size * count;
+        }
+    }
+    return 0;
+}
+
+void vb2r_add_variable(struct VB_Recorder *rec, const char *name, const char *unit, const char *description, const char *type, void *var_ptr, size_t var_size) {
+    VB_DEBUG("Adding variable: %s, unit: %s, description: %s, type: %s, size: %zu", name, unit, description, type, var_size);
+    if (name == NULL || unit == NULL || description == NULL || type == NULL || var_ptr == NULL || var_size == 0) {
+        return; // Invalid parameters
+    }
+    char wide_type[sizeof(((struct VB_Header *)0)->type)] = "";
+    if (strcmp(type, "struct") == 0) {
+        int length = snprintf(wide_type, sizeof(wide_type), "byte[%zu]", var_size); // Raw bytes, vb2_add_field describes them
+        if (length < 0 || (size_t)length >= sizeof(wide_type)) {
+            return; // Too large to describe
+        }
+    } else if (var_size > VB_MAX_VAR_SIZE && (vb2_type_size(type) != var_size || strlen(type) >= sizeof(wide_type))) {
+        VB_DEBUG("Type %s of %s does not describe its %zu bytes", type, name, var_size);
+        return; // Readers could not split the rows
+    }
+
+    if (rec->file.block_count == rec->file.block_capacity &&
+        vb2r_reserve_variables(rec, rec->file.block_capacity ? rec->file.block_capacity * 2 : 64) != 0) {
+        return; // Memory allocation failed
+    }
+
+    strncpy(rec->file.blocks[rec->file.block_count].header.name, name, sizeof(rec->file.blocks[rec->file.block_count].header.name) - 1);
+    rec->file.blocks[rec->file.block_count].header.name[sizeof(rec->file.blocks[rec->file.block_count].header.name) - 1] = '\0';
+    strncpy(rec->file.blocks[rec->file.block_count].header.unit, unit, sizeof(rec->file.blocks[rec->file.block_count].header.unit) - 1);
+    rec->file.blocks[rec->file.block_count].header.unit[sizeof(rec->file.blocks[rec->file.block_count].header.unit) - 1] = '\0';
+    strncpy(rec->file.blocks[rec->file.block_count].header.description, description, sizeof(rec->file.blocks[rec->file.block_count].header.description) - 1);
+    rec->file.blocks[rec->file.block_count].header.description[sizeof(rec->file.blocks[rec->file.block_count].header.description) - 1] = '\0';
+    strncpy(rec->file.blocks[rec->file.block_count].header.type, type, sizeof(rec->file.blocks[rec->file.block_count].header.type) - 1);
+    rec->file.blocks[rec->file.block_count].header.type[sizeof(rec->file.blocks[rec->file.block_count].header.type) - 1] = '\0';
+    if (wide_type[0] != '\0') {
+        memcpy(rec->file.blocks[rec->file.block_count].header.type, wide_type, sizeof(wide_type));
+    }
+    
+    rec->file.blocks[rec->file.block_count].var_ptr         = var_ptr;
+    rec->file.blocks[rec->file.block_count].var_size        = var_size;
+    rec->file.blocks[rec->file.block_count].offset          = 0; // Initialize offset to zero
+    rec->file.blocks[rec->file.block_count].sampling        = VB_SAMPLED_NONE;
+    rec->file.blocks[rec->file.block_count].change_only     = 0;
+    rec->file.blocks[rec->file.block_count].deadband        = 0;
+    rec->file.blocks[rec->file.block_count].divisor         = 0;
+
+    rec->file.block_count++;
+}
+
+// Registers count variables in one call, returns how many were accepted
+size_t vb2r_add_variables(struct VB_Recorder *rec, const struct VB_Variable *variables, size_t count) {
+    size_t needed = rec->file.block_count + count;
+    if (variables == NULL) {
+        return 0;
+    }
+    if (needed > rec->file.block_capacity &&
+        vb2r_reserve_variables(rec, needed > rec->file.block_capacity * 2 ? needed : rec->file.block_capacity * 2) != 0) {
+        return 0; // Memory allocation failed
+    }
+    size_t added = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t before = rec->file.block_count;
+        vb2r_add_variable(rec, variables[i].name, variables[i].unit, variables[i].description, variables[i].type, variables[i].var_ptr, variables[i].var_size);
+        added += rec->file.block_count - before;
+    }
+    return added;
+}
+
+// Describes a member of a struct column registered with type "struct", for structured reads
+void vb2r_add_field(struct VB_Recorder *rec, const char *variable, const char *field, const char *type, size_t offset) {
+    size_t i = rec->file.block_count;
+    while (i > 0 && strcmp(rec->file.blocks[i - 1].header.name, variable) != 0) {
+        i--;
+    }
+    size_t size = vb2_type_size(type);
+    if (i == 0 || size == 0 || offset + size > rec->file.blocks[i - 1].var_size || strlen(type) >= sizeof(((struct VB_Field *)0)->type)) {
+        VB_DEBUG("Field %s does not fit in variable %s", field, variable);
+        return;
+    }
+    struct VB_Field *fields = realloc(rec->file.fields, sizeof(struct VB_Field) * (rec->file.field_count + 1));
+    if (fields == NULL) {
+        return; // Memory allocation failed
+    }
+    rec->file.fields = fields;
+    struct VB_Field *entry = &fields[rec->file.field_count++];
+    memset(entry, 0, sizeof(*entry));
+    entry->block  = i - 1;
+    entry->offset = offset;
+    strncpy(entry->name, field, sizeof(entry->name) - 1);
+    strcpy(entry->type, type);
+}
+
+// Index of the variable registered as name, block_count if there is none
+size_t vb2_find_block(struct VB_Recorder *rec, const char *name) {
+    size_t i = 0;
+    while (i < rec->file.block_count && strcmp(rec->file.blocks[i].header.name, name) != 0) {
+        i++;
+    }
+    return i;
+}
+
+int vb2_field_compare(const void *a, const void *b) {
+    const struct VB_Field *x = a, *y = b;
+    if (x->block != y->block) {
+        return x->block < y->block ? -1 : 1;
+    }
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+// ***********************************************
+//              Headers
+// ***********************************************
+void vb2r_set_compact_headers(struct VB_Recorder *rec, int enabled) {
+    rec->file.compact = enabled != 0;
+}
+
+// Offset of string in the table. Repeats of the previous variable's field (runs of the same unit
+// or type) and empty strings share one entry.
+uint32_t vb2_intern(struct VB_Recorder *rec, const char *string, uint32_t previous) {
+    if (strcmp(rec->file.strings + previous, string) == 0) {
+        return previous;
+    }
+    size_t length = strlen(string) + 1;
+    uint32_t offset = (uint32_t)rec->file.string_size;
+    memcpy(rec->file.strings + offset, string, length);
+    rec->file.string_size += length;
+    return offset;
+}
+
+// Builds the compact headers and their string table once the types are final
+int vb2_build_compact_headers(struct VB_Recorder *rec) {
+    vb2_free_compact_headers(rec);
+    size_t count    = rec->file.block_count;
+    size_t capacity = 1; // The empty string
+    for (size_t i = 0; i < count; i++) {
+        const struct VB_Header *header = &rec->file.blocks[i].header;
+        capacity += strlen(header->name) + strlen(header->unit) + strlen(header->description) + strlen(header->type) + 4;
+    }
+    if (capacity > UINT32_MAX) {
+        return -1;
+    }
+    rec->file.compact_headers = calloc(count ? count : 1, sizeof(struct VB_Compact_Header));
+    rec->file.strings         = calloc(vb2_align8(capacity), 1); // Zeroed padding is saved with the table
+    if (rec->file.compact_headers == NULL || rec->file.strings == NULL) {
+        vb2_free_compact_headers(rec);
+        return -1;
+    }
+    rec->file.string_size = 1;
+    for (size_t i = 0; i < count; i++) {
+        const struct VB_Header *header = &rec->file.blocks[i].header;
+        struct VB_Compact_Header *entry = &rec->file.compact_headers[i];
+        const struct VB_Compact_Header *previous = i > 0 ? entry - 1 : entry; // entry is still all zero
+        entry->name        = vb2_intern(rec, header->name, previous->name);
+        entry->unit        = vb2_intern(rec, header->unit, previous->unit);
+        entry->description = vb2_intern(rec, header->description, previous->description);
+        entry->type        = vb2_intern(rec, header->type, previous->type);
+    }
+    return 0;
+}
+
+// Bytes in front of the data: master header, variable headers and the string table of compact headers
+size_t vb2_header_size(struct VB_Recorder *rec) {
+    if (rec->file.compact_headers != NULL) {
+        return sizeof(struct VB_Master_Header) + sizeof(struct VB_Compact_Header) * rec->file.block_count +
+               sizeof(size_t) + vb2_align8(rec->file.string_size);
+    }
+    return sizeof(struct VB_Header) * rec->file.block_count + sizeof(struct VB_Master_Header);
+}
+
+void vb2_save_var_headers(struct VB_Recorder *rec){
+    fseek(rec->file.fp, sizeof(struct VB_Master_Header), SEEK_SET); // Headers are back to back, one seek for all of them
+    if (rec->file.compact_headers != NULL) {
+        for (size_t i = 0; i < rec->file.block_count; i++) {
+            rec->file.compact_headers[i].offset = rec->file.blocks[i].header.offset;
+            rec->file.compact_headers[i].count  = rec->file.blocks[i].header.count;
+        }
+        fwrite(rec->file.compact_headers, sizeof(struct VB_Compact_Header), rec->file.block_count, rec->file.fp);
+        fwrite(&rec->file.string_size, sizeof(rec->file.string_size), 1, rec->file.fp);
+        fwrite(rec->file.strings, 1, vb2_align8(rec->file.string_size), rec->file.fp);
+        return;
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        fwrite(&rec->file.blocks[i].header, sizeof(struct VB_Header), 1, rec->file.fp); // Write the variable data to the file
+    }
+}
+
+void vb2_save_master_header(struct VB_Recorder *rec, size_t block_count, size_t max_history) {
+    VB_DEBUG("Saving master header with block count: %zu, max history: %zu", block_count, max_history);
+    strncpy(rec->file.master_header.magic, VB2_MAGIC, sizeof(rec->file.master_header.magic) - 1);
+    rec->file.master_header.magic[sizeof(rec->file.master_header.magic) - 1] = '\0'; // Ensure null termination
+    rec->file.master_header.block_count   = block_count;
+    rec->file.master_header.max_history   = max_history;
+    rec->file.master_header.version       = VB2_VERSION; // Set the version of the file format
+    rec->file.master_header.reserved[VB2_RESERVED_FLAGS] = 0;
+    rec->file.master_header.reserved[VB2_RESERVED_WRAP]  = 0;
+    rec->file.master_header.reserved[VB2_RESERVED_SECTIONS] = rec->file.section_table;
+    if (rec->file.record_mode == VB2_RECORD_STREAM) {
+        rec->file.master_header.reserved[VB2_RESERVED_FLAGS] |= VB2_FLAG_CHUNKED;
+    }
+    if (rec->file.clock != VB2_CLOCK_NONE) {
+        rec->file.master_header.reserved[VB2_RESERVED_FLAGS] |= VB2_FLAG_TIMESTAMP;
+    }
+    if (rec->file.compact_headers != NULL) {
+        rec->file.master_header.reserved[VB2_RESERVED_FLAGS] |= VB2_FLAG_COMPACT;
+    }
+    if (rec->file.live_offset != 0) {
+        rec->file.master_header.reserved[VB2_RESERVED_FLAGS] |= VB2_FLAG_LIVE;
+    }
+    if (rec->file.record_mode == VB2_RECORD_RING) {
+        rec->file.master_header.reserved[VB2_RESERVED_FLAGS] |= VB2_FLAG_RING;
+        if (rec->file.current_history > max_history) {
+            rec->file.master_header.reserved[VB2_RESERVED_WRAP] = rec->file.current_history % max_history;
+        }
+    }
+    fseek(rec->file.fp, 0, SEEK_SET);
+    fwrite(&rec->file.master_header, sizeof(rec->file.master_header), 1, rec->file.fp); // Write the master header to the file
+}
+
+// ***********************************************
+//              Timestamp column
+// ***********************************************
+void vb2r_enable_timestamps(struct VB_Recorder *rec, enum vb2_clock clock) {
+#ifndef VB_HAVE_TSC
+    if (clock == VB2_CLOCK_TSC) {
+        clock = VB2_CLOCK_MONOTONIC_RAW; // No counter to read on this architecture
+    }
+#endif
+    rec->file.clock = clock;
+}
+
+// Registers the timestamp column once, it is recorded like any other variable
+void vb2_add_time_column(struct VB_Recorder *rec) {
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        if (strcmp(rec->file.blocks[i].header.name, VB2_TIME_NAME) == 0) {
+            return; // Added by a previous session
+        }
+    }
+    vb2r_add_variable(rec, VB2_TIME_NAME, "ticks", "Clock at each vb2_record_all, see the CLOCK section", "long",
+                      &rec->file.timestamp, sizeof(rec->file.timestamp));
+}
+
+void vb2_start_clock(struct VB_Recorder *rec) {
+    struct VB_Clock_Info *info = &rec->file.clock_info;
+    info->source           = rec->file.clock;
+    info->start_realtime   = vb2_clock_ns(CLOCK_REALTIME);
+    rec->file.start_ns     = vb2_clock_ns(CLOCK_MONOTONIC_RAW);
+    info->start_ticks      = (size_t)vb2_clock_now(rec->file.clock);
+    info->ticks_per_second = 1e9;
+}
+
+void vb2_stop_clock(struct VB_Recorder *rec) {
+    struct VB_Clock_Info *info = &rec->file.clock_info;
+    if (info->source != VB2_CLOCK_TSC) {
+        return; // Already in ns
+    }
+    // Calibrate over the whole recording, the longer it ran the better the estimate
+    uint64_t ticks = (uint64_t)vb2_clock_now(VB2_CLOCK_TSC) - info->start_ticks;
+    uint64_t ns    = vb2_clock_ns(CLOCK_MONOTONIC_RAW) - rec->file.start_ns;
+    if (ns > 0) {
+        info->ticks_per_second = (double)ticks * 1e9 / (double)ns;
+    }
+}
+
+// ***********************************************
+//              Sampled columns
+// ***********************************************
+// Stores a sample of variable every divisor rows instead of every row, 0 or 1 restores that
+int vb2r_set_divisor(struct VB_Recorder *rec, const char *variable, size_t divisor) {
+    size_t i = vb2_find_block(rec, variable);
+    if (i == rec->file.block_count || strncmp(variable, VB2_ROW_PREFIX, strlen(VB2_ROW_PREFIX)) == 0) {
+        VB_DEBUG("Cannot sample %s, it is not a registered variable", variable);
+        return -1;
+    }
+    rec->file.blocks[i].divisor = divisor;
+    return 0;
+}
+
+// Stores a sample of variable only once it moved by more than deadband since the last one stored,
+// any change for 0 and for arrays and structs. A negative deadband stores every row again.
+int vb2r_set_change_only(struct VB_Recorder *rec, const char *variable, double deadband) {
+    size_t i = vb2_find_block(rec, variable);
+    if (i == rec->file.block_count || strncmp(variable, VB2_ROW_PREFIX, strlen(VB2_ROW_PREFIX)) == 0) {
+        VB_DEBUG("Cannot sample %s, it is not a registered variable", variable);
+        return -1;
+    }
+    rec->file.blocks[i].change_only = deadband >= 0;
+    rec->file.blocks[i].deadband    = deadband > 0 ? deadband : 0;
+    return 0;
+}
+
+// Unregisters the row index columns of earlier sessions whose column is no longer sampled,
+// recorded every row they would only hold the row number. Later columns move down one.
+void vb2_drop_row_columns(struct VB_Recorder *rec, int allowed) {
+    size_t prefix = strlen(VB2_ROW_PREFIX);
+    for (size_t i = rec->file.block_count; i-- > 0; ) {
+        if (strncmp(rec->file.blocks[i].header.name, VB2_ROW_PREFIX, prefix) != 0) {
+            continue;
+        }
+        size_t owner = vb2_find_block(rec, rec->file.blocks[i].header.name + prefix);
+        if (allowed && owner < rec->file.block_count && (rec->file.blocks[owner].divisor > 1 || rec->file.blocks[owner].change_only)) {
+            continue; // Still sampled, vb2_start_sampling reuses it
+        }
+        rec->file.block_count--;
+        memmove(&rec->file.blocks[i], &rec->file.blocks[i + 1], sizeof(struct VB_Block_Proxy) * (rec->file.block_count - i));
+        for (size_t f = 0; f < rec->file.field_count; f++) {
+            rec->file.fields[f].block -= rec->file.fields[f].block > i;
+        }
+        for (size_t t = 0; t < rec->file.capture.trigger_count; t++) {
+            rec->file.capture.triggers[t].block -= rec->file.capture.triggers[t].block > i;
+        }
+    }
+}
+
+// Marks the columns sampled this session and adds the row index column of each, before the layout is computed
+void vb2_start_sampling(struct VB_Recorder *rec) {
+    int allowed = rec->file.record_mode != VB2_RECORD_RING && rec->file.live_interval == 0;
+    vb2_drop_row_columns(rec, allowed);
+    size_t count = rec->file.block_count; // Row index columns still in use included
+    for (size_t i = 0; i < count; i++) {
+        rec->file.blocks[i].sampling = VB_SAMPLED_NONE;
+    }
+    for (size_t i = 0; i < count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        if ((block->divisor <= 1 && !block->change_only) || strncmp(block->header.name, VB2_ROW_PREFIX, strlen(VB2_ROW_PREFIX)) == 0) {
+            continue;
+        }
+        if (!allowed) {
+            VB_DEBUG("Recording %s every row, ring and live files keep every column at the same length", block->header.name);
+            continue;
+        }
+        char name[sizeof(block->header.name)];
+        size_t prefix = strlen(VB2_ROW_PREFIX), length = strlen(block->header.name);
+        if (prefix + length >= sizeof(name)) {
+            VB_DEBUG("Recording %s every row, its name leaves no room for the row index column", block->header.name);
+            continue;
+        }
+        memcpy(name, VB2_ROW_PREFIX, prefix);
+        memcpy(name + prefix, block->header.name, length + 1);
+        size_t index = vb2_find_block(rec, name);
+        if (index == rec->file.block_count) {
+            char description[sizeof(block->header.description)];
+            snprintf(description, sizeof(description), "Row of each sample of %.200s", block->header.name);
+            vb2r_add_variable(rec, name, "rows", description, "long", &rec->file.current_history, sizeof(rec->file.current_history));
+            if (index == rec->file.block_count) {
+                continue; // Memory allocation failed
+            }
+            block = &rec->file.blocks[i]; // Registering may have moved the blocks
+        }
+        block->sampling                     = VB_SAMPLED_VALUES;
+        block->index                        = index;
+        rec->file.blocks[index].sampling = VB_SAMPLED_INDEX;
+        rec->file.blocks[index].divisor  = block->divisor; // Reserves as many rows as the column
+    }
+}
+
+// Counts the samples stored in each sampled column of the file blocks describe, from the hot table
+void vb2_count_samples(struct VB_Recorder *rec, struct VB_Block_Proxy *blocks) {
+    for (size_t s = 0; s < rec->file.hot.sampled_count; s++) {
+        const struct VB_Sampled *entry = &rec->file.hot.sampled[s];
+        size_t classes[2] = { entry->values, entry->index };
+        for (size_t k = 0; k < 2; k++) {
+            const struct VB_Hot_Class *hot_class = &rec->file.hot.classes[classes[k]];
+            blocks[hot_class->block[0]].header.count = hot_class->flushed_rows + hot_class->fill / hot_class->var_size;
+        }
+    }
+}
+
+// Saves the "SAMPLED" section, readers align the sampled columns with the rows through it
+void vb2_save_sampling(struct VB_Recorder *rec, size_t rows) {
+    size_t count = 0;
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        count += rec->file.blocks[i].sampling == VB_SAMPLED_VALUES;
+    }
+    if (count == 0) {
+        return; // Every column has a sample per row
+    }
+    struct VB_Sampling *entries = malloc(sizeof(struct VB_Sampling) * count);
+    if (entries == NULL) {
+        VB_DEBUG("Failed to save the SAMPLED section");
+        return;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        const struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        if (block->sampling == VB_SAMPLED_VALUES) {
+            entries[n++] = (struct VB_Sampling){ i, block->index, block->divisor > 1 ? block->divisor : 1, block->change_only, block->deadband, rows };
+        }
+    }
+    vb2_append_section(rec, "SAMPLED", entries, sizeof(struct VB_Sampling) * count);
+    free(entries);
+}
+
+// ***********************************************
+//              Live tailing
+// ***********************************************
+void vb2r_set_live(struct VB_Recorder *rec, size_t interval_rows) {
+    rec->file.live_interval = interval_rows;
 }
 
-void vb2_add_variable(const char *name, const char *unit, const char *description, const char *type, void *var_ptr, uint8_t var_size) {
-    VB_DEBUG("Adding variable: %s, unit: %s, description: %s, type: %s, size: %d", name, unit, description, type, var_size);
-    if (name == NULL || unit == NULL || description == NULL || type == NULL || var_ptr == NULL || var_size <= 0 || var_size > VB_MAX_VAR_SIZE) {
-        return; // Invalid parameters
+// Maps the page holding VB_Live so rows can be published with a single atomic store
+int vb2_live_start(struct VB_Recorder *rec) {
+    size_t page  = (size_t)sysconf(_SC_PAGESIZE);
+    size_t first = rec->file.live_offset / page * page;
+    size_t size  = rec->file.live_offset + sizeof(struct VB_Live) - first;
+    void  *map   = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fileno(rec->file.fp), (off_t)first);
+    if (map == MAP_FAILED) {
+        return -1;
     }
+    rec->file.live_page      = map;
+    rec->file.live_page_size = size;
+    rec->file.live           = (struct VB_Live *)(rec->file.live_page + (rec->file.live_offset - first));
+    rec->file.live->interval = rec->file.live_interval;
+    rec->file.live->ended    = 0;
+    vb2_live_store(rec, 0);
+    fflush(rec->file.fp); // Readers that see the flag see the headers too
+    return 0;
+}
 
-    struct VB_Block_Proxy *new_block = realloc(vb_file.blocks, sizeof(struct VB_Block_Proxy) * (vb_file.block_count + 1));
-    if (new_block == NULL) {
-        return; // Memory allocation failed
+// Gets every recorded row into the file and publishes the row count. The async writer
+// publishes once it has written what is queued, so vb2_record_all never waits on it here.
+void vb2_live_publish(struct VB_Recorder *rec) {
+    uint64_t rows = rec->file.current_history;
+    if (rec->file.map != NULL) {
+        vb2_live_store(rec, rows); // Samples are stored straight into the shared mapping
+        return;
+    }
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        vb2_flush_class(rec, &rec->file.hot.classes[c]); // Partial buffers too
+    }
+    if (!rec->file.async.running) {
+        fflush(rec->file.fp); // From the stdio buffer into the page cache
+        vb2_live_store(rec, rows);
+        return;
     }
-    vb_file.blocks = new_block;
+    struct VB_Async *async = &rec->file.async;
+    pthread_mutex_lock(&async->lock);
+    if (async->job_count == 0 && async->writing == 0) {
+        vb2_live_store(rec, rows);
+    } else {
+        async->live_rows = rows;
+    }
+    pthread_mutex_unlock(&async->lock);
+}
 
-    strncpy(vb_file.blocks[vb_file.block_count].header.name, name, sizeof(vb_file.blocks[vb_file.block_count].header.name) - 1);
-    vb_file.blocks[vb_file.block_count].header.name[sizeof(vb_file.blocks[vb_file.block_count].header.name) - 1] = '\0';
-    strncpy(vb_file.blocks[vb_file.block_count].header.unit, unit, sizeof(vb_file.blocks[vb_file.block_count].header.unit) - 1);
-    vb_file.blocks[vb_file.block_count].header.unit[sizeof(vb_file.blocks[vb_file.block_count].header.unit) - 1] = '\0';
-    strncpy(vb_file.blocks[vb_file.block_count].header.description, description, sizeof(vb_file.blocks[vb_file.block_count].header.description) - 1);
-    vb_file.blocks[vb_file.block_count].header.description[sizeof(vb_file.blocks[vb_file.block_count].header.description) - 1] = '\0';
-    strncpy(vb_file.blocks[vb_file.block_count].header.type, type, sizeof(vb_file.blocks[vb_file.block_count].header.type) - 1);
-    vb_file.blocks[vb_file.block_count].header.type[sizeof(vb_file.blocks[vb_file.block_count].header.type) - 1] = '\0';
-    
-    vb_file.blocks[vb_file.block_count].var_ptr         = var_ptr;
-    vb_file.blocks[vb_file.block_count].var_size        = var_size;
-    vb_file.blocks[vb_file.block_count].offset          = 0; // Initialize offset to zero
-    vb_file.blocks[vb_file.block_count].buffer_offset   = 0; // Initialize offset to zero
+// Final update once the headers and sections are saved, readers switch to the header counts
+void vb2_live_end(struct VB_Recorder *rec) {
+    if (rec->file.live == NULL) {
+        return;
+    }
+    fflush(rec->file.fp);
+    vb2_live_store(rec, rec->file.current_history);
+    __atomic_store_n(&rec->file.live->ended, 1, __ATOMIC_RELEASE);
+    vb2_live_unmap(rec);
+}
+
+// ***********************************************
+//              Triggered capture
+// ***********************************************
+void vb2r_set_trigger_window(struct VB_Recorder *rec, size_t pre, size_t post) {
+    if (rec->file.capture.enabled) {
+        VB_DEBUG("Cannot change the trigger window while recording");
+        return;
+    }
+    rec->file.capture.pre        = pre;
+    rec->file.capture.post       = post;
+    rec->file.capture.configured = 1;
+}
+
+// Fires an event whenever the condition on variable starts to hold, returns the trigger's index
+int vb2r_add_trigger(struct VB_Recorder *rec, const char *variable, enum vb2_trigger_op op, double threshold) {
+    struct VB_Capture *capture = &rec->file.capture;
+    if (capture->enabled) {
+        VB_DEBUG("Cannot add triggers while recording");
+        return -1;
+    }
+    size_t i = vb2_find_block(rec, variable);
+    if (i == rec->file.block_count || vb2_kind_for(&rec->file.blocks[i]) == VB_KIND_OTHER) {
+        VB_DEBUG("Cannot trigger on %s, it is not a registered int, long, float or double", variable);
+        return -1;
+    }
+    struct VB_Trigger *triggers = realloc(capture->triggers, sizeof(struct VB_Trigger) * (capture->trigger_count + 1));
+    if (triggers == NULL) {
+        return -1; // Memory allocation failed
+    }
+    capture->triggers = triggers;
+    triggers[capture->trigger_count] = (struct VB_Trigger){ i, op, threshold, 0, 0 };
+    capture->configured = 1;
+    return (int)capture->trigger_count++;
+}
+
+void vb2r_trigger(struct VB_Recorder *rec) {
+    rec->file.capture.manual = 1; // Picked up by the next vb2_record_all
+}
 
-    vb_file.block_count++;
+size_t vb2r_trigger_events(struct VB_Recorder *rec) {
+    return rec->file.capture.total;
 }
 
-void vb2_save_var_headers(){
-    for (size_t i = 0; i < vb_file.block_count; i++) {
-        struct VB_Block_Proxy *block = &vb_file.blocks[i];
-        size_t header_offset = sizeof(struct VB_Header) * i + sizeof(struct VB_Master_Header); // Calculate the header offset for each block
-        fseek(vb_file.fp, header_offset, SEEK_SET);
-        fwrite(&block->header,sizeof(block->header), 1, vb_file.fp); // Write the variable data to the file
+// Sizes the pre-trigger ring for the hot table vb2_start built
+int vb2_capture_start(struct VB_Recorder *rec) {
+    struct VB_Capture *capture = &rec->file.capture;
+    if (rec->file.record_mode == VB2_RECORD_RING) {
+        VB_DEBUG("Triggered capture needs a linear or stream mode file, a ring would overwrite the windows");
+        return -1;
+    }
+    capture->row_size = 0;
+    for (size_t c = 0; c < rec->file.hot.dense_count; c++) {
+        capture->row_size += rec->file.hot.classes[c].var_size * rec->file.hot.classes[c].count;
+    }
+    for (size_t s = 0; s < rec->file.hot.sampled_count; s++) {
+        capture->row_size += rec->file.hot.classes[rec->file.hot.sampled[s].values].var_size; // Index columns are not kept
+    }
+    free(capture->history);
+    capture->history = NULL;
+    if (capture->pre > 0) {
+        capture->history = malloc(capture->row_size * capture->pre);
+        if (capture->history == NULL) {
+            return -1;
+        }
+    }
+    for (size_t t = 0; t < capture->trigger_count; t++) {
+        capture->triggers[t].active = 0; // A condition that holds on the first row fires
     }
+    capture->head        = 0;
+    capture->held        = 0;
+    capture->open        = 0;
+    capture->event_count = 0;
+    capture->total       = 0;
+    capture->enabled     = 1;
+    return 0;
 }
 
-void vb2_save_master_header(size_t block_count, size_t max_history) {
-    VB_DEBUG("Saving master header with block count: %zu, max history: %zu", block_count, max_history);
-    strncpy(vb_file.master_header.magic, VB2_MAGIC, sizeof(vb_file.master_header.magic) - 1);
-    vb_file.master_header.magic[sizeof(vb_file.master_header.magic) - 1] = '\0'; // Ensure null termination
-    vb_file.master_header.block_count   = block_count;
-    vb_file.master_header.max_history   = max_history;
-    vb_file.master_header.version       = VB2_VERSION; // Set the version of the file format
-    fseek(vb_file.fp, 0, SEEK_SET);
-    fwrite(&vb_file.master_header, sizeof(vb_file.master_header), 1, vb_file.fp); // Write the master header to the file
+void vb2_capture_event(struct VB_Recorder *rec, const struct VB_Trigger_Event *event) {
+    struct VB_Capture *capture = &rec->file.capture;
+    if (capture->event_count == capture->event_capacity) {
+        size_t capacity = capture->event_capacity ? capture->event_capacity * 2 : 64;
+        struct VB_Trigger_Event *events = realloc(capture->events, sizeof(struct VB_Trigger_Event) * capacity);
+        if (events == NULL) {
+            VB_DEBUG("Failed to grow the event table, the window is stored without its event");
+            return;
+        }
+        capture->events         = events;
+        capture->event_capacity = capacity;
+    }
+    capture->events[capture->event_count++] = *event;
+}
+
+// The window's last row is stored, its events get its extent
+void vb2_capture_close(struct VB_Recorder *rec) {
+    struct VB_Capture *capture = &rec->file.capture;
+    for (size_t e = capture->window_event; e < capture->event_count; e++) {
+        capture->events[e].first_row = capture->window_first;
+        capture->events[e].rows      = rec->file.current_history - capture->window_first;
+    }
+    capture->open = 0;
+}
+
+// Called by vb2_rotate before the switch. The events go to the old file with the part of an open
+// window recorded into it, the rest of the window continues in the new file under a copy of its
+// last event.
+void vb2_capture_rotate(struct VB_Recorder *rec, struct VB_Recorder *old) {
+    struct VB_Capture *capture = &rec->file.capture;
+    int    open         = capture->open && capture->remaining > 0;
+    size_t window_event = capture->window_event;
+    if (capture->open) {
+        vb2_capture_close(rec);
+    }
+    VB_SWAP(capture->events, old->file.capture.events);
+    VB_SWAP(capture->event_count, old->file.capture.event_count);
+    VB_SWAP(capture->event_capacity, old->file.capture.event_capacity);
+    if (open) {
+        capture->open         = 1;
+        capture->window_first = 0;
+        capture->window_event = 0;
+        if (window_event < old->file.capture.event_count) {
+            struct VB_Trigger_Event event = old->file.capture.events[old->file.capture.event_count - 1];
+            event.row       = 0;
+            event.continued = 1;
+            vb2_capture_event(rec, &event);
+        }
+    }
+}
+
+// ***********************************************
+//              File rotation
+// ***********************************************
+void vb2r_set_rotation(struct VB_Recorder *rec, size_t rows, size_t bytes, double seconds) {
+    if (rec->file.rotation.running) {
+        VB_DEBUG("Cannot change the rotation limits while recording");
+        return;
+    }
+    rec->file.rotation.rows  = rows;
+    rec->file.rotation.bytes = bytes;
+    rec->file.rotation.ns    = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+}
+
+size_t vb2r_rotation_stalls(struct VB_Recorder *rec) {
+    return rec->file.rotation.stalls;
+}
+
+// Saves what follows the rows of a file once they are all written: sections, their table and the
+// headers with the final counts. vb2_end does it for the last file, the rotation thread for the others.
+void vb2_finish_file(struct VB_Recorder *rec) {
+    vb2_unmap_file(rec); // Mapped samples are already in the page cache
+    size_t count = rec->file.current_history < rec->file.max_history ? rec->file.current_history : rec->file.max_history;
+    if (rec->file.record_mode == VB2_RECORD_STREAM) {
+        count = rec->file.current_history; // Unbounded
+        vb2_append_section(rec, "CHUNKS", rec->file.chunks, sizeof(struct VB_Chunk_Index) * rec->file.chunk_count);
+    }
+    if (rec->file.summary_rows > 0) {
+        vb2_save_summary(rec);
+    }
+    if (rec->file.field_count > 0) {
+        qsort(rec->file.fields, rec->file.field_count, sizeof(struct VB_Field), vb2_field_compare);
+        vb2_append_section(rec, "FIELDS", rec->file.fields, sizeof(struct VB_Field) * rec->file.field_count);
+    }
+    if (rec->file.clock != VB2_CLOCK_NONE) {
+        vb2_stop_clock(rec);
+        vb2_append_section(rec, "CLOCK", &rec->file.clock_info, sizeof(rec->file.clock_info));
+    }
+    if (rec->log.events) {
+        vb2_save_log_events(rec);
+    }
+    if (rec->file.capture.open) {
+        vb2_capture_close(rec); // Cut short by the end of the recording
+    }
+    if (rec->file.capture.event_count > 0) {
+        vb2_append_section(rec, "TRIGGERS", rec->file.capture.events, sizeof(struct VB_Trigger_Event) * rec->file.capture.event_count);
+    }
+    if (rec->file.drop_count > 0) {
+        vb2_append_section(rec, "DROPPED", rec->file.drops, sizeof(struct VB_Dropped) * rec->file.drop_count);
+    }
+    vb2_save_sampling(rec, count);
+    if (rec->file.rotation.enabled) {
+        struct VB_Segment segment = { rec->file.rotation.index, rec->file.rotation.first_row, rec->file.current_history, 0 };
+        vb2_append_section(rec, "SEGMENT", &segment, sizeof(segment));
+    }
+#ifdef VB2_STATS_ENABLED
+    struct VB_Stats stats;
+    vb2r_get_stats(rec, &stats);
+    vb2_append_section(rec, "STATS", &stats, sizeof(stats)); // Section writes are not counted in it
+#endif
+    if (rec->file.hot.sampled_count > 0) {
+        vb2_count_samples(rec, rec->file.blocks); // Spares got theirs when rotated away from
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        if (rec->file.blocks[i].sampling == VB_SAMPLED_NONE) {
+            rec->file.blocks[i].header.count = count; // Every other column gets a sample each tick
+        }
+    }
+    vb2_save_sections(rec); // Sections are complete, write the table the master header points to
+    vb2_save_var_headers(rec); // Save the variable headers to the file
+    vb2_save_master_header(rec, rec->file.block_count, rec->file.max_history); // Records the wrap position
+    vb2_live_end(rec);
+}
+
+// Frees a spare recorder of the rotation, removing its file if nothing was recorded into it
+void vb2_rotation_free(struct VB_Recorder *spare, int remove) {
+    if (remove && spare->file.fp != NULL) {
+        unlink(spare->file.filename);
+    }
+    vb2_free_file(spare);
+    vb2r_log_close(spare);
+    free(spare);
+}
+
+void vb2_rotation_free_layout(struct VB_Rotation *rotation) {
+    free(rotation->blocks);
+    free(rotation->fields);
+    free(rotation->compact_headers);
+    free(rotation->strings);
+    rotation->blocks          = NULL;
+    rotation->fields          = NULL;
+    rotation->compact_headers = NULL;
+    rotation->strings         = NULL;
+}
+
+// Opens file index of the rotation with the layout of the current one: headers saved, sized and
+// mapped like vb2_start does. Runs on the rotation thread, only reads the copies of vb2_rotation_start.
+struct VB_Recorder *vb2_rotation_prepare(struct VB_Recorder *rec, size_t index) {
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    struct VB_Recorder *spare = calloc(1, sizeof(struct VB_Recorder));
+    if (spare == NULL) {
+        return NULL;
+    }
+    vb2r_init(spare);
+    struct VB_File *file = &spare->file;
+    file->record_mode      = rec->file.record_mode; // Settings that stay put while recording
+    file->max_history      = rec->file.max_history;
+    file->clock            = rec->file.clock;
+    file->summary_rows     = rec->file.summary_rows;
+    file->summary_pyramid  = rec->file.summary_pyramid;
+    file->live_interval    = rec->file.live_interval;
+    file->live_offset      = rec->file.live_offset;
+    file->append_offset    = rotation->data_end;
+    file->rotation.enabled = 1;
+    file->rotation.index   = index;
+    file->blocks = malloc(sizeof(struct VB_Block_Proxy) * rotation->block_count);
+    if (file->blocks == NULL) {
+        vb2_rotation_free(spare, 0);
+        return NULL;
+    }
+    memcpy(file->blocks, rotation->blocks, sizeof(struct VB_Block_Proxy) * rotation->block_count);
+    file->block_count    = rotation->block_count;
+    file->block_capacity = rotation->block_count;
+    if (rotation->field_count > 0) {
+        file->fields = malloc(sizeof(struct VB_Field) * rotation->field_count);
+        if (file->fields == NULL) {
+            vb2_rotation_free(spare, 0);
+            return NULL;
+        }
+        memcpy(file->fields, rotation->fields, sizeof(struct VB_Field) * rotation->field_count);
+        file->field_count = rotation->field_count;
+    }
+    if (rotation->compact_headers != NULL) {
+        file->compact_headers = malloc(sizeof(struct VB_Compact_Header) * rotation->block_count);
+        file->strings         = malloc(vb2_align8(rotation->string_size));
+        if (file->compact_headers == NULL || file->strings == NULL) {
+            vb2_rotation_free(spare, 0);
+            return NULL;
+        }
+        memcpy(file->compact_headers, rotation->compact_headers, sizeof(struct VB_Compact_Header) * rotation->block_count);
+        memcpy(file->strings, rotation->strings, vb2_align8(rotation->string_size));
+        file->string_size = rotation->string_size;
+    }
+    int length = snprintf(file->filename, sizeof(file->filename), "%s.%04zu%s", rotation->stem, index, rotation->extension);
+    if (length < 0 || (size_t)length >= sizeof(file->filename)) {
+        vb2_rotation_free(spare, 0);
+        return NULL;
+    }
+    file->fp = fopen(file->filename, "w+b");
+    if (file->fp == NULL) {
+        VB_DEBUG("Failed to open file: %s", file->filename);
+        vb2_rotation_free(spare, 0);
+        return NULL;
+    }
+    vb2_save_var_headers(spare);
+    vb2_save_master_header(spare, file->block_count, file->max_history);
+    if (ftruncate(fileno(file->fp), (off_t)rotation->data_end) != 0 ||
+        (rotation->mapped && vb2_map_file(spare, rotation->data_end) != 0)) {
+        VB_DEBUG("Failed to size %s", file->filename);
+        vb2_rotation_free(spare, 1);
+        return NULL;
+    }
+    if (file->map != NULL) {
+        // Fault the first page of every column in here, not in the first vb2_record_all of the file
+        for (size_t i = 0; i < file->block_count; i++) {
+            file->map[file->blocks[i].header.offset] = 0;
+        }
+    }
+    if (file->live_offset != 0 && vb2_live_start(spare) != 0) {
+        file->live_offset = 0;
+        vb2_save_master_header(spare, file->block_count, file->max_history); // Without the flag
+    }
+    fflush(file->fp);
+    return spare;
+}
+
+// Saves a file the recording switched away from, once the writer thread is done with it
+void vb2_rotation_retire(struct VB_Recorder *rec, struct VB_Recorder *old) {
+    struct VB_Async *async = &rec->file.async;
+    if (async->running) {
+        pthread_mutex_lock(&async->lock);
+        // Jobs are written in queue order, a writeback may still be using the old mapping
+        while (async->completed < old->file.rotation.jobs || (old->file.map != NULL && async->writing > 0)) {
+            pthread_cond_wait(&async->job_done, &async->lock);
+        }
+        pthread_mutex_unlock(&async->lock);
+    }
+    vb2_finish_file(old);
+    vb2_rotation_free(old, 0);
+}
+
+// Keeps a spare file ready and saves the retired ones. The spare comes first so the next
+// rotation never waits behind saving a large file.
+void *vb2_rotation_thread(void *arg) {
+    struct VB_Recorder *rec = (struct VB_Recorder *)arg;
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    pthread_mutex_lock(&rotation->lock);
+    for (;;) {
+        if (rotation->spare == NULL && !rotation->failed && !rotation->stop) {
+            size_t index = rotation->index + 1;
+            pthread_mutex_unlock(&rotation->lock);
+
+            struct VB_Recorder *spare = vb2_rotation_prepare(rec, index);
+
+            pthread_mutex_lock(&rotation->lock);
+            rotation->spare  = spare;
+            rotation->failed = spare == NULL;
+            pthread_cond_signal(&rotation->ready);
+            continue;
+        }
+        if (rotation->retired_count > 0) {
+            struct VB_Recorder *old = rotation->retired[0];
+            rotation->retired_count--;
+            memmove(rotation->retired, rotation->retired + 1, sizeof(struct VB_Recorder *) * rotation->retired_count);
+            pthread_mutex_unlock(&rotation->lock);
+
+            vb2_rotation_retire(rec, old);
+
+            pthread_mutex_lock(&rotation->lock);
+            continue;
+        }
+        if (rotation->stop) {
+            break; // Every retired file is saved
+        }
+        pthread_cond_wait(&rotation->work, &rotation->lock);
+    }
+    struct VB_Recorder *spare = rotation->spare;
+    rotation->spare = NULL;
+    pthread_mutex_unlock(&rotation->lock);
+    if (spare != NULL) {
+        vb2_rotation_free(spare, 1); // Nothing was recorded into it
+    }
+    return NULL;
+}
+
+// Keeps a copy of the layout for the spares, derives the limits and starts the rotation thread
+int vb2_rotation_start(struct VB_Recorder *rec, size_t data_end) {
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    rotation->index     = 0;
+    rotation->first_row = 0;
+    rotation->stalls    = 0;
+    rotation->failed    = 0;
+    rotation->stop      = 0;
+    rotation->enabled   = 1;
+    rotation->data_end  = data_end;
+    rotation->mapped    = rec->file.map != NULL;
+    // run.vb2 rotates into run.0001.vb2, run.0002.vb2, ...
+    const char *name = strrchr(rec->file.filename, '/');
+    const char *dot  = strrchr(name ? name : rec->file.filename, '.');
+    size_t stem = (dot != NULL && strlen(dot) < sizeof(rotation->extension)) ? (size_t)(dot - rec->file.filename) : strlen(rec->file.filename);
+    memcpy(rotation->stem, rec->file.filename, stem);
+    rotation->stem[stem] = '\0';
+    strcpy(rotation->extension, rec->file.filename + stem);
+
+    vb2_rotation_free_layout(rotation);
+    rotation->block_count = rec->file.block_count;
+    rotation->field_count = rec->file.field_count;
+    rotation->string_size = rec->file.string_size;
+    rotation->blocks = malloc(sizeof(struct VB_Block_Proxy) * (rotation->block_count ? rotation->block_count : 1));
+    if (rotation->blocks == NULL) {
+        return -1;
+    }
+    memcpy(rotation->blocks, rec->file.blocks, sizeof(struct VB_Block_Proxy) * rotation->block_count);
+    if (rotation->field_count > 0) {
+        rotation->fields = malloc(sizeof(struct VB_Field) * rotation->field_count);
+        if (rotation->fields == NULL) {
+            vb2_rotation_free_layout(rotation);
+            return -1;
+        }
+        memcpy(rotation->fields, rec->file.fields, sizeof(struct VB_Field) * rotation->field_count);
+    }
+    if (rec->file.compact_headers != NULL) {
+        rotation->compact_headers = malloc(sizeof(struct VB_Compact_Header) * rotation->block_count);
+        rotation->strings         = malloc(vb2_align8(rotation->string_size));
+        if (rotation->compact_headers == NULL || rotation->strings == NULL) {
+            vb2_rotation_free_layout(rotation);
+            return -1;
+        }
+        memcpy(rotation->compact_headers, rec->file.compact_headers, sizeof(struct VB_Compact_Header) * rotation->block_count);
+        memcpy(rotation->strings, rec->file.strings, vb2_align8(rotation->string_size));
+    }
+
+    size_t row_size = 0;
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        row_size += rec->file.blocks[i].var_size;
+    }
+    rotation->limit_rows  = rotation->rows ? rotation->rows : SIZE_MAX;
+    rotation->limit_bytes = 0;
+    if (rotation->bytes > 0 && rec->file.record_mode == VB2_RECORD_STREAM) {
+        rotation->limit_bytes = rotation->bytes; // Chunks may be compressed, watch the file itself
+    } else if (rotation->bytes > 0 && row_size > 0) {
+        size_t rows = rotation->bytes / row_size;
+        rotation->limit_rows = rows == 0 ? 1 : (rows < rotation->limit_rows ? rows : rotation->limit_rows);
+    }
+    if (rec->file.record_mode == VB2_RECORD_LINEAR && rotation->limit_rows > rec->file.max_history) {
+        rotation->limit_rows = rec->file.max_history; // A full file rotates instead of dropping rows
+    }
+    rotation->deadline = rotation->ns ? vb2_clock_ns(VB_ROTATION_CLOCK) + rotation->ns : 0;
+
+    pthread_mutex_init(&rotation->lock, NULL);
+    pthread_cond_init(&rotation->work, NULL);
+    pthread_cond_init(&rotation->ready, NULL);
+    if (pthread_create(&rotation->thread, NULL, vb2_rotation_thread, rec) != 0) {
+        pthread_cond_destroy(&rotation->ready);
+        pthread_cond_destroy(&rotation->work);
+        pthread_mutex_destroy(&rotation->lock);
+        vb2_rotation_free_layout(rotation);
+        rotation->enabled = 0;
+        return -1;
+    }
+    rotation->running = 1;
+    return 0;
+}
+
+void vb2_rotation_stop(struct VB_Recorder *rec) {
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    if (!rotation->running) {
+        return;
+    }
+    pthread_mutex_lock(&rotation->lock);
+    rotation->stop = 1;
+    pthread_cond_signal(&rotation->work);
+    pthread_mutex_unlock(&rotation->lock);
+    pthread_join(rotation->thread, NULL); // Saves the retired files and removes the unused spare first
+    pthread_cond_destroy(&rotation->ready);
+    pthread_cond_destroy(&rotation->work);
+    pthread_mutex_destroy(&rotation->lock);
+    free(rotation->retired);
+    rotation->retired          = NULL;
+    rotation->retired_capacity = 0;
+    rotation->running          = 0;
+    vb2_rotation_free_layout(rotation);
+}
+
+static inline int vb2_rotation_due(struct VB_Recorder *rec) {
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    return rec->file.current_history >= rotation->limit_rows ||
+           (rotation->limit_bytes != 0 && rec->file.append_offset >= rotation->limit_bytes) ||
+           (rotation->deadline != 0 && vb2_clock_ns(VB_ROTATION_CLOCK) >= rotation->deadline);
+}
+
+// Switches the recording to the spare file between two rows. The rotation thread opened and sized it
+// and saves the old file afterwards, here the partly filled buffers go to the old file (queued in
+// async mode, nothing to do in mmap mode) and the per file state is swapped with the spare's.
+void vb2_rotate(struct VB_Recorder *rec) {
+    struct VB_Rotation *rotation = &rec->file.rotation;
+    pthread_mutex_lock(&rotation->lock);
+    if (rotation->spare == NULL && !rotation->failed) {
+        rotation->stalls++; // Rotating faster than files are prepared
+        while (rotation->spare == NULL && !rotation->failed) {
+            pthread_cond_wait(&rotation->ready, &rotation->lock);
+        }
+    }
+    struct VB_Recorder *spare = rotation->spare;
+    rotation->spare = NULL;
+    size_t index = rotation->index;
+    if (spare != NULL) {
+        rotation->index++; // Before the thread wakes up to name the next spare after it
+    }
+    pthread_mutex_unlock(&rotation->lock);
+    if (spare == NULL) {
+        VB_DEBUG("Failed to prepare the next file, recording on in %s", rec->file.filename);
+        rotation->limit_rows  = SIZE_MAX;
+        rotation->limit_bytes = 0;
+        rotation->deadline    = 0;
+        return;
+    }
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        vb2_flush_class(rec, &rec->file.hot.classes[c]); // Partly filled buffers belong to the old file
+    }
+    if (rec->log.events) {
+        vb2r_log_flush(rec); // So do the records logged so far
+    }
+    if (rec->file.capture.enabled) {
+        vb2_capture_rotate(rec, spare); // And the trigger events
+    }
+
+    struct VB_File  *file  = &rec->file;
+    struct VB_File  *old   = &spare->file;
+    struct VB_Async *async = &rec->file.async;
+    if (async->running) {
+        pthread_mutex_lock(&async->lock); // The writer thread reads the file, mapping and VB_Live under it
+    }
+    char filename[sizeof(file->filename)];
+    memcpy(filename, file->filename, sizeof(filename));
+    memcpy(file->filename, old->filename, sizeof(filename));
+    memcpy(old->filename, filename, sizeof(filename));
+    VB_SWAP(file->fp, old->fp);
+    VB_SWAP(file->master_header, old->master_header);
+    VB_SWAP(file->current_history, old->current_history);
+    VB_SWAP(file->map, old->map);
+    VB_SWAP(file->map_size, old->map_size);
+    VB_SWAP(file->append_offset, old->append_offset);
+    VB_SWAP(file->chunks, old->chunks);
+    VB_SWAP(file->chunk_count, old->chunk_count);
+    VB_SWAP(file->chunk_capacity, old->chunk_capacity);
+    VB_SWAP(file->drops, old->drops);
+    VB_SWAP(file->drop_count, old->drop_count);
+    VB_SWAP(file->drop_capacity, old->drop_capacity);
+    VB_SWAP(file->summaries, old->summaries);
+    VB_SWAP(file->summary_count, old->summary_count);
+    VB_SWAP(file->summary_capacity, old->summary_capacity);
+    VB_SWAP(file->clock_info, old->clock_info);
+    VB_SWAP(file->start_ns, old->start_ns);
+    VB_SWAP(file->live, old->live);
+    VB_SWAP(file->live_page, old->live_page);
+    VB_SWAP(file->live_page_size, old->live_page_size);
+    if (async->running) {
+        old->rotation.jobs    = async->submitted; // Written before the old file is saved
+        async->fd             = fileno(file->fp);
+        async->live_rows      = 0; // The old file's count is stored when it is saved
+        async->writeback_rows = 0;
+        async->synced_rows    = 0;
+        async->rotations++;
+        pthread_mutex_unlock(&async->lock);
+    }
+    if (rec->log.events) {
+        spare->log.events = 1;
+        VB_SWAP(rec->log.event_data, spare->log.event_data);
+        VB_SWAP(rec->log.event_size, spare->log.event_size);
+        VB_SWAP(rec->log.event_data_capacity, spare->log.event_data_capacity);
+        VB_SWAP(rec->log.event_index, spare->log.event_index);
+        VB_SWAP(rec->log.event_count, spare->log.event_count);
+        VB_SWAP(rec->log.event_capacity, spare->log.event_capacity);
+        memcpy(spare->log.defined, rec->log.defined, sizeof(spare->log.defined));
+    }
+    spare->stats = rec->stats; // Each file holds the counters of its own rows
+    old->async.stalls = async->stalls;
+    vb2r_reset_stats(rec);
+    old->rotation.index     = index;
+    old->rotation.first_row = rotation->first_row;
+    vb2_count_samples(rec, old->blocks); // Before the classes start over
+
+
+    // Rows start over at the top of every column
+    for (size_t i = 0; i < file->block_count; i++) {
+        file->blocks[i].offset = file->blocks[i].header.offset;
+    }
+    for (size_t c = 0; c < file->hot.class_count; c++) {
+        struct VB_Hot_Class *hot_class = &file->hot.classes[c];
+        hot_class->fill         = 0;
+        hot_class->flushed_rows = 0;
+        hot_class->summarized   = 0;
+        if (file->map != NULL) {
+            for (size_t j = 0; j < hot_class->count; j++) {
+                hot_class->dst[j] = file->map + file->blocks[hot_class->block[j]].header.offset;
+            }
+        }
+    }
+    for (size_t s = 0; s < file->hot.sampled_count; s++) {
+        file->hot.sampled[s].countdown = 1; // Every file starts with a sample of each column
+        file->hot.sampled[s].stored    = 0;
+    }
+    vb2_start_clock(rec);
+    if (rotation->ns) {
+        rotation->deadline = vb2_clock_ns(VB_ROTATION_CLOCK) + rotation->ns;
+    }
+
+    pthread_mutex_lock(&rotation->lock);
+    rotation->first_row += old->current_history;
+    if (rotation->retired_count == rotation->retired_capacity) {
+        size_t capacity = rotation->retired_capacity ? rotation->retired_capacity * 2 : 4;
+        struct VB_Recorder **retired = realloc(rotation->retired, sizeof(struct VB_Recorder *) * capacity);
+        if (retired == NULL) {
+            pthread_mutex_unlock(&rotation->lock);
+            VB_DEBUG("Failed to queue %s, saving it inline", old->filename);
+            vb2_rotation_retire(rec, spare);
+            return;
+        }
+        rotation->retired          = retired;
+        rotation->retired_capacity = capacity;
+    }
+    rotation->retired[rotation->retired_count++] = spare;
+    pthread_cond_signal(&rotation->work);
+    pthread_mutex_unlock(&rotation->lock);
 }
 
-void vb2_start(size_t max_history){
+void vb2r_close(struct VB_Recorder *rec) {
+    vb2_rotation_stop(rec); // Before the writer thread it waits on goes
+    vb2_free_file(rec);
+}
+
+void vb2r_start(struct VB_Recorder *rec, size_t max_history){
     VB_DEBUG("Starting recording session with max history: %zu", max_history);
-    size_t offset = sizeof(struct VB_Header) * vb_file.block_count + sizeof(struct VB_Master_Header); // Calculate the initial offset based on the number of blocks
-    vb_file.max_history = max_history; // Set the maximum history size
-    for (size_t i = 0; i < vb_file.block_count; i++) {
-        struct VB_Block_Proxy *block = &vb_file.blocks[i];
-        block->header.offset = offset;
+    if (rec->file.clock != VB2_CLOCK_NONE) {
+        vb2_add_time_column(rec); // Before the layout is computed
+    }
+    vb2_start_sampling(rec); // Adds the row index columns, also before the layout
+    rec->file.max_history = max_history; // Set the maximum history size
+    int stream = rec->file.record_mode == VB2_RECORD_STREAM; // Chunks are appended, nothing is reserved up front
+    int compress = stream && rec->file.compress;
+    if (vb2_alloc_encoder(rec) != 0) {
+        VB_DEBUG("Failed to allocate the encoder, chunks of this session are stored raw");
+        compress = 0; // Before the codecs go into the headers, the next session tries again
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        char *suffix = strchr(block->header.type, ':');
+        if (suffix != NULL) {
+            *suffix = '\0'; // Codec of a previous session
+        }
+        block->kind  = vb2_kind_for(block);
+        block->codec = compress ? vb2_codec_for(block) : VB_CODEC_NONE;
+        if (block->codec != VB_CODEC_NONE) {
+            size_t length = strlen(block->header.type);
+            snprintf(block->header.type + length, sizeof(block->header.type) - length, ":%s", block->codec == VB_CODEC_DOD ? "dod" : "xor");
+        }
+    }
+    vb2_free_compact_headers(rec); // Those of a previous session
+    if (rec->file.compact && vb2_build_compact_headers(rec) != 0) {
+        VB_DEBUG("Failed to build the string table, saving full headers");
+    }
+    size_t offset = vb2_header_size(rec); // Data starts after the headers
+    rec->file.live_offset = 0;
+    if (rec->file.live_interval > 0 && !stream) {
+        rec->file.live_offset = offset; // VB_Live goes between the headers and the data
+        offset += sizeof(struct VB_Live);
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
+        block->header.offset = stream ? 0 : offset;
         block->header.count = 0; // Assuming each variable is counted once
-        block->offset = offset; // Set the offset for the variable data
-        offset += block->var_size*max_history; // Update the offset for the next variable
+        block->offset = block->header.offset; // Set the offset for the variable data
+        block->capacity = max_history;
+        if (block->sampling != VB_SAMPLED_NONE && block->divisor > 1) {
+            block->capacity = (max_history + block->divisor - 1) / block->divisor; // At most one sample per divisor rows
+        }
+        if (!stream) {
+            offset += block->var_size*block->capacity; // Update the offset for the next variable
+        }
     }
-    vb2_save_var_headers(); // Save the variable headers to the file
-    vb2_save_master_header(vb_file.block_count, max_history); // Save the master header with the block count and max history
+    rec->file.append_offset = offset; // Chunks and sections go after the data
+    vb2_save_var_headers(rec); // Save the variable headers to the file
+    vb2_save_master_header(rec, rec->file.block_count, max_history); // Save the master header with the block count and max history
 
-    int s = ftruncate(fileno(vb_file.fp), offset); // Truncate the file to the new size
+    int s = ftruncate(fileno(rec->file.fp), offset); // Truncate the file to the new size
     if (s != 0) {
         VB_DEBUG("Failed to truncate file to size %zu", offset);
-        fclose(vb_file.fp);
-        vb_file.fp = NULL;
+        fclose(rec->file.fp);
+        rec->file.fp = NULL;
         return; // Failed to truncate the file
     }
+    if (rec->file.live_offset != 0 && vb2_live_start(rec) != 0) {
+        VB_DEBUG("Failed to map the live record, readers only see the file once it is ended");
+        rec->file.live_offset = 0;
+        vb2_save_master_header(rec, rec->file.block_count, max_history); // Without the flag
+    }
+
+    if (vb2_build_hot_table(rec) != 0) {
+        VB_DEBUG("Failed to allocate the hot table");
+        fclose(rec->file.fp);
+        rec->file.fp = NULL;
+        return; // Failed to allocate the hot table
+    }
+    if (rec->file.write_mode == VB2_WRITE_MMAP && !stream && vb2_map_file(rec, offset) != 0) {
+        VB_DEBUG("Falling back to staged writes");
+    }
+    if (vb2_alloc_staging(rec) != 0) {
+        VB_DEBUG("Failed to allocate staging buffers");
+        fclose(rec->file.fp);
+        rec->file.fp = NULL;
+        return; // Failed to allocate staging buffers
+    }
+    vb2_start_clock(rec);
+    if (rec->file.shm.name[0] != '\0' && vb2_shm_start(rec) != 0) {
+        VB_DEBUG("Failed to create the shm segment %s", rec->file.shm.name);
+    }
+    if (rec->file.write_mode == VB2_WRITE_ASYNC && vb2_async_start(rec) != 0) {
+        VB_DEBUG("Falling back to synchronous writes"); // vb2_write_block writes inline without a writer
+    }
+    if (rec->file.map != NULL && rec->file.writeback_interval > 0 && vb2_async_start(rec) != 0) {
+        VB_DEBUG("Leaving writeback to the kernel");
+    }
+    if (rec->file.capture.configured && vb2_capture_start(rec) != 0) {
+        VB_DEBUG("Failed to set up triggered capture, recording every row");
+    }
+    if ((rec->file.rotation.rows || rec->file.rotation.bytes || rec->file.rotation.ns) && vb2_rotation_start(rec, offset) != 0) {
+        VB_DEBUG("Failed to start the rotation thread, recording into a single file");
+    }
 }
 
-void vb2_flush_all() {
-    if (vb_file.fp == NULL || vb_file.blocks == NULL) {
+void vb2r_flush_all(struct VB_Recorder *rec) {
+    if (rec->file.fp == NULL || rec->file.blocks == NULL) {
         return; // File not open or no blocks to flush
     }
-    for (size_t i = 0; i < vb_file.block_count; i++) {
-        struct VB_Block_Proxy *block = &vb_file.blocks[i];
-        if (block->buffer_offset > 0) { // If there is data in the buffer
-            fseek(vb_file.fp, block->offset, SEEK_SET); // Seek to the variable's offset in the file
-            fwrite(block->buffer, 1, block->buffer_offset, vb_file.fp); // Write the buffer to the file
-            VB_DEBUG("Flushed %zu bytes to file for variable: %s", block->buffer_offset, block->header.name);
-            block->offset += block->buffer_offset; // Update the offset for the next write
-            block->buffer_offset = 0; // Reset the buffer offset
+    vb2_async_drain(rec); // Every spare buffer is free again, so the partial ones below never stall
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        vb2_flush_class(rec, &rec->file.hot.classes[c]);
+    }
+    vb2_async_drain(rec); // Wait for the partial buffers as well
+}
+
+void vb2r_set_record_mode(struct VB_Recorder *rec, enum vb2_record_mode mode) {
+    rec->file.record_mode = mode;
+}
+
+// Flushes every column and moves the write position back to the start of each column
+void vb2_wrap_all(struct VB_Recorder *rec) {
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        vb2_flush_class(rec, hot_class);
+        hot_class->flushed_rows += hot_class->fill / hot_class->var_size; // Staged classes are already empty
+        hot_class->fill       = 0; // Mapped columns restart at their base
+        hot_class->summarized = 0;
+    }
+    for (size_t i = 0; i < rec->file.block_count; i++) {
+        rec->file.blocks[i].offset = rec->file.blocks[i].header.offset;
+    }
+    if (rec->file.summary_count > 0) {
+        vb2_summary_prune(rec, rec->file.current_history - rec->file.max_history); // Keeps the index bounded
+    }
+}
+
+// Everything that follows a row once every column holds it
+static inline void vb2_row_stored(struct VB_Recorder *rec) {
+    rec->file.current_history++; // Increment the current history size
+    if (rec->file.record_mode == VB2_RECORD_RING && rec->file.current_history % rec->file.max_history == 0) {
+        vb2_wrap_all(rec); // Every column is full, start overwriting the oldest samples
+    }
+    if (rec->file.map != NULL && rec->file.async.running && rec->file.current_history % rec->file.writeback_interval == 0) {
+        vb2_request_writeback(rec, rec->file.current_history); // Kick writeback from the writer thread
+    }
+    if (rec->file.live != NULL && (rec->file.current_history % rec->file.live_interval == 0 || rec->file.current_history == rec->file.max_history)) {
+        vb2_live_publish(rec);
+    }
+    if (rec->file.rotation.running && !rec->file.capture.replaying && vb2_rotation_due(rec)) {
+        vb2_rotate(rec); // The row just recorded is the last of the old file
+    }
+}
+
+static inline double vb2_value_as_double(uint8_t kind, const void *value) {
+    switch (kind) {
+        case VB_KIND_INT:    { int32_t v; memcpy(&v, value, 4); return v; }
+        case VB_KIND_LONG:   { int64_t v; memcpy(&v, value, 8); return (double)v; }
+        case VB_KIND_FLOAT:  { float   v; memcpy(&v, value, 4); return v; }
+        default:             { double  v; memcpy(&v, value, 8); return v; }
+    }
+}
+
+static inline double vb2_trigger_value(const struct VB_Block_Proxy *block) {
+    return vb2_value_as_double(block->kind, block->var_ptr);
+}
+
+static inline int vb2_trigger_holds(const struct VB_Trigger *trigger, double value) {
+    switch (trigger->op) {
+        case VB2_TRIGGER_ABOVE: return value > trigger->threshold;
+        case VB2_TRIGGER_BELOW: return value < trigger->threshold;
+        case VB2_TRIGGER_EQUAL: return value == trigger->threshold;
+        default:                return value != trigger->threshold;
+    }
+}
+
+// Stores the sampled columns that are due on the row being recorded, with the row in their index
+// column. values holds the row packed in sampled order when it is replayed, NULL reads the sources.
+void vb2_store_sampled(struct VB_Recorder *rec, const uint8_t *values) {
+    struct VB_Hot_Table *hot = &rec->file.hot;
+    int64_t row = (int64_t)rec->file.current_history;
+    for (size_t s = 0; s < hot->sampled_count; s++) {
+        struct VB_Sampled   *entry  = &hot->sampled[s];
+        struct VB_Hot_Class *column = &hot->classes[entry->values];
+        const uint8_t *value = values != NULL ? values : (const uint8_t *)column->src[0];
+        if (values != NULL) {
+            values += column->var_size;
+        }
+        if (--entry->countdown > 0) {
+            continue; // Not due yet
+        }
+        entry->countdown = entry->divisor;
+        if (entry->change_only && entry->stored) {
+            int changed;
+            if (entry->kind == VB_KIND_OTHER || entry->deadband == 0) {
+                changed = memcmp(value, entry->last, column->var_size) != 0;
+            } else {
+                double delta = vb2_value_as_double(entry->kind, value) - vb2_value_as_double(entry->kind, entry->last);
+                changed = delta > entry->deadband || -delta > entry->deadband;
+            }
+            if (!changed) {
+                continue;
+            }
+        }
+        if (entry->change_only) {
+            memcpy(entry->last, value, column->var_size);
+        }
+        entry->stored = 1;
+        struct VB_Hot_Class *index = &hot->classes[entry->index];
+        memcpy(column->dst[0] + column->fill, value, column->var_size);
+        memcpy(index->dst[0] + index->fill, &row, sizeof(row));
+        column->fill += column->var_size;
+        index->fill  += sizeof(row);
+        if (column->fill >= column->limit) {
+            vb2_flush_class(rec, column);
+        }
+        if (index->fill >= index->limit) {
+            vb2_flush_class(rec, index);
+        }
+    }
+}
+
+// Copies the row being recorded into the pre-trigger ring, over the oldest once it holds pre rows
+void vb2_capture_push(struct VB_Recorder *rec) {
+    struct VB_Capture *capture = &rec->file.capture;
+    uint8_t *row = capture->history + capture->head * capture->row_size;
+    for (size_t c = 0; c < rec->file.hot.dense_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        for (size_t j = 0; j < hot_class->count; j++) {
+            memcpy(row, hot_class->src[j], hot_class->var_size);
+            row += hot_class->var_size;
+        }
+    }
+    for (size_t s = 0; s < rec->file.hot.sampled_count; s++) {
+        struct VB_Hot_Class *column = &rec->file.hot.classes[rec->file.hot.sampled[s].values];
+        memcpy(row, column->src[0], column->var_size); // Whether it is due is decided on replay
+        row += column->var_size;
+    }
+    capture->head = capture->head + 1 == capture->pre ? 0 : capture->head + 1;
+    if (capture->held < capture->pre) {
+        capture->held++;
+    }
+}
+
+// Stores the rows of the pre-trigger ring oldest first, as vb2_record_all stores the row being recorded
+void vb2_capture_replay(struct VB_Recorder *rec) {
+    struct VB_Capture *capture = &rec->file.capture;
+    size_t slot = capture->held > 0 ? (capture->head + capture->pre - capture->held) % capture->pre : 0;
+    for (size_t i = 0; i < capture->held; i++) {
+        if (rec->file.current_history >= rec->file.max_history && rec->file.record_mode == VB2_RECORD_LINEAR) {
+            break; // The file is full
+        }
+        const uint8_t *row = capture->history + slot * capture->row_size;
+        for (size_t c = 0; c < rec->file.hot.dense_count; c++) {
+            struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+            for (size_t j = 0; j < hot_class->count; j++) {
+                memcpy(hot_class->dst[j] + hot_class->fill, row, hot_class->var_size);
+                row += hot_class->var_size;
+            }
+            hot_class->fill += hot_class->var_size;
+            if (hot_class->fill >= hot_class->limit) {
+                vb2_flush_class(rec, hot_class);
+            }
+        }
+        if (rec->file.hot.sampled_count > 0) {
+            vb2_store_sampled(rec, row); // Before the row is counted, it goes in the index columns
+        }
+        vb2_row_stored(rec);
+        slot = slot + 1 == capture->pre ? 0 : slot + 1;
+    }
+    capture->held = 0;
+}
+
+// Evaluates the triggers on the row being recorded. Returns 1 if it belongs to a window and is to be
+// stored, after the pre-trigger rows of a window it opens, 0 if it only went into the pre-trigger ring.
+int vb2_capture_step(struct VB_Recorder *rec) {
+    struct VB_Capture *capture = &rec->file.capture;
+    int fired   = capture->manual;
+    int holding = 0;
+    for (size_t t = 0; t < capture->trigger_count; t++) {
+        struct VB_Trigger *trigger = &capture->triggers[t];
+        int holds = vb2_trigger_holds(trigger, vb2_trigger_value(&rec->file.blocks[trigger->block]));
+        trigger->fired  = holds && !trigger->active; // Events fire on the row a condition starts to hold
+        trigger->active = holds;
+        fired   |= trigger->fired;
+        holding |= holds;
+    }
+    if (fired || holding) {
+        if (!capture->open) {
+            if (rec->file.rotation.running && rec->file.current_history > 0 &&
+                rec->file.current_history + capture->held + 1 > rec->file.rotation.limit_rows) {
+                vb2_rotate(rec); // The pre-trigger rows and the event go to the next file together
+            }
+            capture->open         = 1;
+            capture->window_first = rec->file.current_history;
+            capture->window_event = capture->event_count;
+            capture->replaying    = 1;
+            vb2_capture_replay(rec);
+            capture->replaying    = 0;
+        }
+        capture->remaining = capture->post + 1; // This row and post more
+    }
+    if (!capture->open) {
+        if (capture->pre > 0) {
+            vb2_capture_push(rec);
+        }
+        return 0;
+    }
+    if (rec->file.current_history >= rec->file.max_history && rec->file.record_mode == VB2_RECORD_LINEAR) {
+        return 0; // The pre-trigger rows filled the file
+    }
+    if (fired) {
+        struct VB_Trigger_Event event = { rec->file.ticks - 1, rec->file.current_history, 0, 0, -1, -1, 0, 0, 0 };
+        if (capture->manual) {
+            vb2_capture_event(rec, &event);
+            capture->total++;
+            capture->manual = 0;
+        }
+        for (size_t t = 0; t < capture->trigger_count; t++) {
+            struct VB_Trigger *trigger = &capture->triggers[t];
+            if (trigger->fired) {
+                event.trigger = (int32_t)t;
+                event.block   = (int32_t)trigger->block;
+                event.value   = vb2_trigger_value(&rec->file.blocks[trigger->block]);
+                event.op      = trigger->op;
+                vb2_capture_event(rec, &event);
+                capture->total++;
+            }
         }
     }
+    capture->remaining--;
+    return 1;
 }
 
-void vb2_record_all() {
-    if (vb_file.fp == NULL || vb_file.blocks == NULL) {
+void vb2r_record_all(struct VB_Recorder *rec) {
+    if (rec->file.fp == NULL || rec->file.blocks == NULL) {
         return; // File not open or no blocks to record
     }
-    if (vb_file.current_history >= vb_file.max_history) {
+    if (rec->file.current_history >= rec->file.max_history && rec->file.record_mode == VB2_RECORD_LINEAR) {
         VB_DEBUG("Maximum history size reached, cannot record more data.");
+#ifdef VB2_STATS_ENABLED
+        rec->stats.dropped_rows++;
+#endif
         return; // Maximum history size reached
     }
-    for (size_t i = 0; i < vb_file.block_count; i++) {
-        struct VB_Block_Proxy *block = &vb_file.blocks[i];
-        VB_DEBUG("Recording variable: %s, size: %d, offset: %zu", block->header.name, (int)block->var_size, block->offset);
-        if (block->var_ptr != NULL && block->var_size > 0) {
-            memcpy(block->buffer + block->buffer_offset, block->var_ptr, block->var_size); // Copy the variable data to the buffer
-            block->buffer_offset += block->var_size; // Update the buffer offset for the next write
-            if (block->buffer_offset >= VB_BUFFER_SIZE) {
-                fseek(vb_file.fp, block->offset, SEEK_SET); // Seek to the variable's offset in the file
-                fwrite(block->buffer, 1, block->buffer_offset, vb_file.fp); // Write the buffer to the file
-                VB_DEBUG("Wrote %zu bytes to file for variable: %s", block->buffer_offset, block->header.name);
-                block->offset += block->buffer_offset; // Update the offset for the next write
-                block->buffer_offset = 0; // Reset the buffer offset if it exceeds the buffer size
-            }
-            block->header.count ++; // Increment the count of recorded data
+#ifdef VB2_STATS_ENABLED
+    uint64_t stats_start = (rec->stats.records & (VB2_STATS_SAMPLE - 1)) == 0 ? vb2_stats_now() : 0;
+#endif
+    if (rec->file.clock != VB2_CLOCK_NONE) {
+        rec->file.timestamp = vb2_clock_now(rec->file.clock); // Picked up by the VB2_TIME_NAME column below
+    }
+    if (rec->file.shm.header != NULL) {
+        vb2_shm_publish(rec); // Before flushing, the sink never waits on the file
+    }
+    rec->file.ticks++;
+    if (rec->file.capture.enabled && !vb2_capture_step(rec)) {
+        return; // Outside every window, the row only went into the pre-trigger ring
+    }
+    for (size_t c = 0; c < rec->file.hot.dense_count; c++) {
+        struct VB_Hot_Class *hot_class = &rec->file.hot.classes[c];
+        const void **src  = hot_class->src;
+        uint8_t    **dst  = hot_class->dst;
+        size_t       fill = hot_class->fill;
+        size_t       n    = hot_class->count;
+        // Constant sized copies compile down to a single load and store per column
+        switch (hot_class->var_size) {
+            case 8:
+                for (size_t j = 0; j < n; j++) {
+                    memcpy(dst[j] + fill, src[j], 8);
+                }
+                break;
+            case 4:
+                for (size_t j = 0; j < n; j++) {
+                    memcpy(dst[j] + fill, src[j], 4);
+                }
+                break;
+            default:
+                for (size_t j = 0; j < n; j++) {
+                    memcpy(dst[j] + fill, src[j], hot_class->var_size);
+                }
+                break;
+        }
+        hot_class->fill = fill + hot_class->var_size;
+        if (hot_class->fill >= hot_class->limit) {
+            vb2_flush_class(rec, hot_class); // Writes inline or queues for the writer thread
         }
     }
-    vb_file.current_history++; // Increment the current history size
+    if (rec->file.hot.sampled_count > 0) {
+        vb2_store_sampled(rec, NULL);
+    }
+    vb2_row_stored(rec);
+    if (rec->file.capture.open && rec->file.capture.remaining == 0) {
+        vb2_capture_close(rec); // That was the window's last row
+    }
+#ifdef VB2_STATS_ENABLED
+    if (stats_start != 0) {
+        vb2_stats_time(&rec->stats.record_ns, vb2_stats_now() - stats_start);
+    }
+    rec->stats.records++;
+#endif
 }
 
-void vb2_reset() {
+void vb2_reset(struct VB_Recorder *rec) {
     VB_DEBUG("Resetting variable buffer system");
-    vb_file.current_history = 0; // Reset the current history size
-    for(size_t i = 0; i < vb_file.block_count; i++) {
-        struct VB_Block_Proxy *block = &vb_file.blocks[i];
-        block->buffer_offset = 0; // Reset the buffer offset for each block
+    rec->file.current_history = 0; // Reset the current history size
+    for(size_t i = 0; i < rec->file.block_count; i++) {
+        struct VB_Block_Proxy *block = &rec->file.blocks[i];
         block->offset = block->header.offset; // Reset the offset to the initial value
         block->header.count = 0; // Reset the count of recorded data
-        block->buffer_offset = 0; // Reset the buffer offset
     }
+    for (size_t c = 0; c < rec->file.hot.class_count; c++) {
+        rec->file.hot.classes[c].fill = 0; // Reset the buffer offset
+        rec->file.hot.classes[c].flushed_rows = 0;
+        rec->file.hot.classes[c].summarized = 0;
+    }
+    rec->file.chunk_count = 0; // Keep the capacity for the next session
+    rec->file.drop_count  = 0;
+    rec->file.summary_count = 0;
+    vb2_free_sections(rec);
+    rec->file.rotation.enabled   = 0;
+    rec->file.rotation.index     = 0;
+    rec->file.rotation.first_row = 0;
+    rec->file.capture.enabled     = 0; // Triggers and window stay for the next session
+    rec->file.capture.open        = 0;
+    rec->file.capture.manual      = 0;
+    rec->file.capture.event_count = 0;
+    rec->file.ticks               = 0;
+    vb2r_reset_stats(rec); // Each file holds the counters of its own session
 }
 
-void vb2_end() {
-    VB_DEBUG("Ending recording session, current history: %zu, max history: %zu", vb_file.current_history, vb_file.max_history);
-    vb2_flush_all(); // Flush all recorded data to the file
-    vb2_save_var_headers(); // Save the variable headers to the file
-    vb2_reset(); // Reset the variable buffer system for the next recording session
+void vb2r_end(struct VB_Recorder *rec) {
+    VB_DEBUG("Ending recording session, current history: %zu, max history: %zu", rec->file.current_history, rec->file.max_history);
+    vb2r_flush_all(rec); // Flush all recorded data to the file
+    vb2_rotation_stop(rec); // Saves the files rotated away from, their buffers are written
+    vb2_async_stop(rec); // Join the writer thread, the queue is already drained
+    vb2_finish_file(rec);
+    fflush(rec->file.fp); // Readers see the finished file before the next session or vb2_close
+    vb2_shm_end(rec);
+    vb2_reset(rec); // Reset the variable buffer system for the next recording session
     // Safe to open new file or continue recording
-    vb_log_close(); // Close the log file
-}
\ No newline at end of file
+    vb2r_log_close(rec); // Close the log file
+}
+
+// ***********************************************
+//        Recorder instances and the default
+// ***********************************************
+struct VB_Recorder *vb2_recorder_create() {
+    struct VB_Recorder *rec = calloc(1, sizeof(struct VB_Recorder));
+    if (rec == NULL) {
+        return NULL; // Memory allocation failed
+    }
+    vb2r_init(rec);
+    return rec;
+}
+
+void vb2_recorder_destroy(struct VB_Recorder *rec) {
+    if (rec == NULL) {
+        return;
+    }
+    vb2r_close(rec);
+    vb2r_log_close(rec);
+    free(rec);
+}
+
+struct VB_Recorder *vb2_default() {
+    return &vb2_default_recorder;
+}
+
+int vb2_set_session_dir(const char *dir) {
+    if (dir == NULL || strlen(dir) == 0) {
+        vb2_session_dir[0] = '\0'; // Back to the working directory
+        return 0;
+    }
+    if (strlen(dir) >= sizeof(vb2_session_dir)) {
+        return -1; // Path too long
+    }
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        VB_DEBUG("Failed to create session directory %s: %s", dir, strerror(errno));
+        return -1;
+    }
+    strcpy(vb2_session_dir, dir);
+    return 0;
+}
+
+void vb2_init() { vb2r_init(&vb2_default_recorder); }
+void vb2_enable_log() { vb2r_enable_log(&vb2_default_recorder); }
+void vb2_enable_log_events() { vb2r_enable_log_events(&vb2_default_recorder); }
+int  vb2_open(const char *filename) { return vb2r_open(&vb2_default_recorder, filename); }
+void vb2_close() { vb2r_close(&vb2_default_recorder); }
+void vb2_add_variable(const char *name, const char *unit, const char *description, const char *type, void *var_ptr, size_t var_size) {
+    vb2r_add_variable(&vb2_default_recorder, name, unit, description, type, var_ptr, var_size);
+}
+size_t vb2_add_variables(const struct VB_Variable *variables, size_t count) { return vb2r_add_variables(&vb2_default_recorder, variables, count); }
+int  vb2_reserve_variables(size_t capacity) { return vb2r_reserve_variables(&vb2_default_recorder, capacity); }
+int  vb2_set_shm(const char *name, size_t slot_count) { return vb2r_set_shm(&vb2_default_recorder, name, slot_count); }
+int  vb2_shm_select(const char *variable) { return vb2r_shm_select(&vb2_default_recorder, variable); }
+void vb2_set_rotation(size_t rows, size_t bytes, double seconds) { vb2r_set_rotation(&vb2_default_recorder, rows, bytes, seconds); }
+size_t vb2_rotation_stalls() { return vb2r_rotation_stalls(&vb2_default_recorder); }
+void vb2_set_trigger_window(size_t pre, size_t post) { vb2r_set_trigger_window(&vb2_default_recorder, pre, post); }
+int vb2_add_trigger(const char *variable, enum vb2_trigger_op op, double threshold) { return vb2r_add_trigger(&vb2_default_recorder, variable, op, threshold); }
+void vb2_trigger() { vb2r_trigger(&vb2_default_recorder); }
+size_t vb2_trigger_events() { return vb2r_trigger_events(&vb2_default_recorder); }
+int vb2_set_divisor(const char *variable, size_t divisor) { return vb2r_set_divisor(&vb2_default_recorder, variable, divisor); }
+int vb2_set_change_only(const char *variable, double deadband) { return vb2r_set_change_only(&vb2_default_recorder, variable, deadband); }
+void vb2_set_live(size_t interval_rows) { vb2r_set_live(&vb2_default_recorder, interval_rows); }
+void vb2_set_compact_headers(int enabled) { vb2r_set_compact_headers(&vb2_default_recorder, enabled); }
+void vb2_add_field(const char *variable, const char *field, const char *type, size_t offset) {
+    vb2r_add_field(&vb2_default_recorder, variable, field, type, offset);
+}
+void vb2_start(size_t max_history) { vb2r_start(&vb2_default_recorder, max_history); }
+void vb2_record_all() { vb2r_record_all(&vb2_default_recorder); }
+void vb2_flush_all() { vb2r_flush_all(&vb2_default_recorder); }
+void vb2_end() { vb2r_end(&vb2_default_recorder); }
+void vb2_set_record_mode(enum vb2_record_mode mode) { vb2r_set_record_mode(&vb2_default_recorder, mode); }
+void vb2_set_write_mode(enum vb2_write_mode mode) { vb2r_set_write_mode(&vb2_default_recorder, mode); }
+void vb2_set_async_policy(enum vb2_async_policy policy, size_t buffer_count) { vb2r_set_async_policy(&vb2_default_recorder, policy, buffer_count); }
+size_t vb2_async_stalls() { return vb2r_async_stalls(&vb2_default_recorder); }
+size_t vb2_async_dropped() { return vb2r_async_dropped(&vb2_default_recorder); }
+void vb2_set_mmap_writeback(size_t interval_rows) { vb2r_set_mmap_writeback(&vb2_default_recorder, interval_rows); }
+void vb2_enable_timestamps(enum vb2_clock clock) { vb2r_enable_timestamps(&vb2_default_recorder, clock); }
+void vb2_set_summary(size_t rows, int pyramid) { vb2r_set_summary(&vb2_default_recorder, rows, pyramid); }
+int  vb2_get_stats(struct VB_Stats *stats) { return vb2r_get_stats(&vb2_default_recorder, stats); }
+void vb2_reset_stats() { vb2r_reset_stats(&vb2_default_recorder); }
+void vb2_set_compression(int enabled) { vb2r_set_compression(&vb2_default_recorder, enabled); }
+
+void vb_log_init(const char *filename) { vb2r_log_init(&vb2_default_recorder, filename); }
+void vb_log_set_echo(int echo_stdout, int echo_stderr) { vb2r_log_set_echo(&vb2_default_recorder, echo_stdout, echo_stderr); }
+void vb_log_set_level(enum severity level) { vb2r_log_set_level(&vb2_default_recorder, level); }
+void vb_log_write(enum severity level, size_t lineno, const char *file ,const char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vb2r_log_vwrite(&vb2_default_recorder, level, lineno, file, fmt, args);
+    va_end(args);
+}
+void vb_log_flush() { vb2r_log_flush(&vb2_default_recorder); }
+void vb_log_set_binary(int binary) { vb2r_log_set_binary(&vb2_default_recorder, binary); }
+void vb_log_close() { vb2r_log_close(&vb2_default_recorder); }
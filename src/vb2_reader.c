@@ -0,0 +1,1478 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vb2_reader.h"
+
+/*
+    Reader side of the variable buffer file format, see var_buffer_2.c for the layout.
+    The on-disk structures are repeated here so the reader does not depend on the writer.
+    Opening a file maps it, validates the master header and indexes the variable names;
+    no column data is touched until it is asked for.
+*/
+
+#ifdef VB2_DEBUG_ENABLED
+    #define VB_DEBUG(fmt, ...) printf("DEBUG[%d]: " fmt "\n", __LINE__, ##__VA_ARGS__)
+#else
+    #define VB_DEBUG(fmt, ...) (void)0 // No-op if debugging is disabled
+#endif
+
+#define VB2_READER_VERSION_MAJOR 1 // Files with another major version are rejected
+
+#define VB2_MAGIC "VB2"
+
+#define VB2_RESERVED_FLAGS    0
+#define VB2_RESERVED_WRAP     1
+#define VB2_RESERVED_SECTIONS 2
+
+#define VB_CODEC_NONE 0
+#define VB_CODEC_DOD  1
+#define VB_CODEC_XOR  2
+
+#define VB_PLANE_ZERO   0
+#define VB_PLANE_SPARSE 1
+#define VB_PLANE_RAW    2
+
+#pragma pack(push, 8)
+struct VB_Master_Header {
+    char     magic[4];
+    size_t   version;
+    size_t   block_count;
+    size_t   max_history;
+    size_t   reserved[3];
+};
+
+struct VB_Header {
+    char     name[256];
+    char     unit[32];
+    char     description[512];
+    char     type[16];
+    size_t   offset;
+    size_t   count;
+};
+
+struct VB_Compact_Header {
+    uint32_t name;
+    uint32_t unit;
+    uint32_t description;
+    uint32_t type;
+    size_t   offset;
+    size_t   count;
+};
+
+struct VB_Live {
+    uint64_t rows;
+    uint64_t interval;
+    uint64_t ended;
+    uint64_t reserved;
+};
+
+struct VB_Shm_Header {
+    char     magic[8];
+    uint64_t version;
+    uint64_t column_count;
+    uint64_t row_size;
+    uint64_t slot_count;
+    uint64_t slot_size;
+    uint64_t slots;
+    uint64_t clock;
+    uint64_t state;
+    uint64_t reserved[6];
+    uint64_t head;
+    uint64_t padding[7];
+};
+
+struct VB_Shm_Slot {
+    uint64_t sequence;
+    uint64_t tick;
+    int64_t  time;
+    uint64_t reserved;
+};
+
+struct VB_Chunk_Header {
+    size_t   block;
+    size_t   first_row;
+    size_t   rows;
+    size_t   size;
+};
+
+struct VB_Chunk_Index {
+    struct VB_Chunk_Header chunk;
+    size_t   offset;
+};
+
+struct VB_Section {
+    char     tag[8];
+    size_t   offset;
+    size_t   size;
+};
+
+struct VB_Blog_Header {
+    char     magic[8];
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct VB_Blog_Record {
+    uint32_t id;
+    uint8_t  level;
+    uint8_t  reserved;
+    uint16_t size;
+    uint64_t tick;
+};
+
+struct VB_Log_Event {
+    uint64_t tick;
+    int64_t  time;
+    uint64_t offset;
+};
+#pragma pack(pop)
+
+#define VB_SHM_MAGIC     "VB2SHM"
+#define VB_SHM_VERSION   1
+#define VB_SHM_RECORDING 1
+#define VB_SHM_ENDED     2
+
+#define VB_BLOG_MAGIC    "VB2BLOG"
+#define VB_BLOG_FORMAT   0
+#define VB_BLOG_TEXT     1
+#define VB_BLOG_MAX_ARGS 16
+
+struct vb2_rd_blog_format {
+    const char *fmt;                    // Point into the log data
+    const char *file;
+    uint32_t line;
+    uint8_t  arg_count;
+    const char *types;
+};
+
+// Format id -> definition, filled from VB_BLOG_FORMAT records
+struct vb2_rd_blog_table {
+    struct vb2_rd_blog_format *formats;
+    size_t   count;
+};
+
+struct VB2_Reader {
+    const uint8_t *map;                 // Read only mapping of the whole file
+    size_t   size;                      // Size of the mapping
+    const struct VB_Master_Header *master;
+    struct vb2_column *columns;         // Parsed headers
+    size_t  *offsets;                   // File offset of each column's data, 0 in stream mode
+    size_t   data_start;                // End of the headers, where stream mode chunks begin
+    uint32_t *hash;                     // Open addressing name index, column + 1, 0 = empty
+    size_t   hash_mask;                 // Capacity - 1, capacity is a power of two
+    const struct VB_Section *sections;  // Section table, NULL if the file has none
+    size_t   section_count;
+    size_t   wrap;                      // Ring mode: row of the oldest sample
+    // Live files, see vb2_reader_refresh
+    int      fd;                        // Kept open to remap the file once the recording ends, -1 otherwise
+    const struct VB_Live *live;         // In the mapping, NULL unless VB2_FLAG_LIVE
+    uint64_t live_rows;                 // Rows published at the last refresh
+    // Chunk index, built on the first chunk access
+    struct VB_Chunk_Index *chunks;      // Grouped by column, in row order
+    size_t  *chunk_start;               // block_count + 1 entries into chunks
+    int      chunks_indexed;
+    // Decode buffer for compressed chunks
+    uint8_t *decoded;
+    size_t   decoded_capacity;
+    // Log event formats, read from "LOGFMT" on the first event access
+    struct vb2_rd_blog_table log_formats;
+    int      log_indexed;
+};
+
+// ***********************************************
+//              Helpers
+// ***********************************************
+uint64_t vb2_rd_hash(const char *name) {
+    uint64_t hash = 0xcbf29ce484222325ull; // FNV-1a
+    while (*name) {
+        hash = (hash ^ (uint8_t)*name++) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Element type of "double", "double:xor" or "double[1000]", with the bytes and elements of a sample
+enum vb2_type vb2_rd_parse_type(const char *type, size_t *var_size, size_t *elements, uint8_t *codec) {
+    size_t length = strcspn(type, ":[");
+    enum vb2_type base = VB2_TYPE_UNKNOWN;
+    *var_size = 0;
+    *elements = 1;
+    if (length == 3 && strncmp(type, "int", 3) == 0) {
+        base = VB2_TYPE_INT; *var_size = 4;
+    } else if (length == 4 && strncmp(type, "long", 4) == 0) {
+        base = VB2_TYPE_LONG; *var_size = 8;
+    } else if (length == 5 && strncmp(type, "float", 5) == 0) {
+        base = VB2_TYPE_FLOAT; *var_size = 4;
+    } else if (length == 6 && strncmp(type, "double", 6) == 0) {
+        base = VB2_TYPE_DOUBLE; *var_size = 8;
+    } else if (length == 4 && strncmp(type, "byte", 4) == 0) {
+        base = VB2_TYPE_BYTE; *var_size = 1;
+    }
+    if (type[length] == '[') {
+        char *end;
+        *elements = strtoull(type + length + 1, &end, 10);
+        if (*elements == 0 || *end != ']' || *elements > SIZE_MAX / 8) {
+            *elements = 1;
+            *var_size = 0; // Unreadable shape
+            return VB2_TYPE_UNKNOWN;
+        }
+        *var_size *= *elements;
+        length = (size_t)(end + 1 - type);
+    }
+    *codec = VB_CODEC_NONE;
+    if (strcmp(type + length, ":dod") == 0) {
+        *codec = VB_CODEC_DOD;
+    } else if (strcmp(type + length, ":xor") == 0) {
+        *codec = VB_CODEC_XOR;
+    }
+    return base;
+}
+
+int vb2_rd_in_file(const vb2_reader *rd, size_t offset, size_t size) {
+    return offset <= rd->size && size <= rd->size - offset;
+}
+
+// Header strings are fixed size fields, refuse files where one is not terminated
+int vb2_rd_terminated(const char *field, size_t size) {
+    return memchr(field, '\0', size) != NULL;
+}
+
+int vb2_rd_index_names(vb2_reader *rd) {
+    size_t count    = rd->master->block_count;
+    size_t capacity = 16;
+    while (capacity < count * 2) {
+        capacity <<= 1;
+    }
+    rd->hash = calloc(capacity, sizeof(*rd->hash));
+    if (rd->hash == NULL) {
+        return -1;
+    }
+    rd->hash_mask = capacity - 1;
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = vb2_rd_hash(rd->columns[i].name) & rd->hash_mask;
+        while (rd->hash[slot] != 0) {
+            slot = (slot + 1) & rd->hash_mask;
+        }
+        rd->hash[slot] = (uint32_t)(i + 1);
+    }
+    return 0;
+}
+
+void vb2_rd_load_sections(vb2_reader *rd) {
+    size_t offset = rd->master->reserved[VB2_RESERVED_SECTIONS];
+    if (offset == 0 || !vb2_rd_in_file(rd, offset, sizeof(size_t))) {
+        return; // Older file, nothing appended, or the recording was not ended
+    }
+    size_t count;
+    memcpy(&count, rd->map + offset, sizeof(count));
+    if (count > rd->size / sizeof(struct VB_Section) || !vb2_rd_in_file(rd, offset + sizeof(size_t), count * sizeof(struct VB_Section))) {
+        return;
+    }
+    rd->sections      = (const struct VB_Section *)(rd->map + offset + sizeof(size_t));
+    rd->section_count = count;
+}
+
+// Full headers: fixed size string fields
+int vb2_rd_parse_headers(vb2_reader *rd) {
+    size_t count = rd->master->block_count;
+    const struct VB_Header *headers = (const struct VB_Header *)(rd->map + sizeof(struct VB_Master_Header));
+    if (!vb2_rd_in_file(rd, sizeof(struct VB_Master_Header), count * sizeof(struct VB_Header))) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        const struct VB_Header *header = &headers[i];
+        struct vb2_column *column = &rd->columns[i];
+        if (!vb2_rd_terminated(header->name, sizeof(header->name)) || !vb2_rd_terminated(header->unit, sizeof(header->unit)) ||
+            !vb2_rd_terminated(header->description, sizeof(header->description)) || !vb2_rd_terminated(header->type, sizeof(header->type))) {
+            return -1;
+        }
+        column->name        = header->name;
+        column->unit        = header->unit;
+        column->description = header->description;
+        column->type        = header->type;
+        column->count       = header->count;
+        rd->offsets[i]      = header->offset;
+    }
+    rd->data_start = sizeof(struct VB_Master_Header) + count * sizeof(struct VB_Header);
+    return 0;
+}
+
+// Compact headers (VB2_FLAG_COMPACT): string offsets into the table that follows them
+int vb2_rd_parse_compact(vb2_reader *rd) {
+    size_t count = rd->master->block_count;
+    size_t table = sizeof(struct VB_Master_Header) + count * sizeof(struct VB_Compact_Header);
+    size_t size;
+    if (!vb2_rd_in_file(rd, sizeof(struct VB_Master_Header), count * sizeof(struct VB_Compact_Header) + sizeof(size))) {
+        return -1;
+    }
+    memcpy(&size, rd->map + table, sizeof(size));
+    const char *strings = (const char *)rd->map + table + sizeof(size);
+    if (size == 0 || size > rd->size || !vb2_rd_in_file(rd, table + sizeof(size), (size + 7) & ~(size_t)7) || strings[size - 1] != '\0') {
+        return -1; // Every offset below size then points at a terminated string
+    }
+    const struct VB_Compact_Header *headers = (const struct VB_Compact_Header *)(rd->map + sizeof(struct VB_Master_Header));
+    for (size_t i = 0; i < count; i++) {
+        const struct VB_Compact_Header *header = &headers[i];
+        struct vb2_column *column = &rd->columns[i];
+        if (header->name >= size || header->unit >= size || header->description >= size || header->type >= size) {
+            return -1;
+        }
+        column->name        = strings + header->name;
+        column->unit        = strings + header->unit;
+        column->description = strings + header->description;
+        column->type        = strings + header->type;
+        column->count       = header->count;
+        rd->offsets[i]      = header->offset;
+    }
+    rd->data_start = table + sizeof(size) + ((size + 7) & ~(size_t)7);
+    return 0;
+}
+
+// Column counts and wrap of a live file that has published rows rows. A ring leaves out the oldest
+// interval rows, the writer may already be overwriting them.
+void vb2_rd_live_rows(vb2_reader *rd, uint64_t rows) {
+    size_t max_history = rd->master->max_history;
+    size_t stored      = rows < max_history ? (size_t)rows : max_history;
+    rd->wrap = 0;
+    if (rd->master->reserved[VB2_RESERVED_FLAGS] & VB2_FLAG_RING) {
+        size_t margin = rd->live->interval < max_history ? (size_t)rd->live->interval : max_history;
+        stored   = rows < max_history - margin ? (size_t)rows : max_history - margin;
+        rd->wrap = (size_t)((rows - stored) % max_history);
+    }
+    for (size_t i = 0; i < rd->master->block_count; i++) {
+        rd->columns[i].count = stored;
+    }
+    rd->live_rows = rows;
+}
+
+// Rows at the start of a live ring the writer may have overwritten since the last refresh, checked
+// once a copy is done: the writer stays within interval rows of the rows it published.
+size_t vb2_rd_live_lapped(const vb2_reader *rd, size_t stored) {
+    if (rd->live == NULL || !(rd->master->reserved[VB2_RESERVED_FLAGS] & VB2_FLAG_RING) || rd->fd < 0) {
+        return 0;
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // The copy is done before rows is read again
+    uint64_t rows        = __atomic_load_n(&rd->live->rows, __ATOMIC_RELAXED);
+    uint64_t max_history = rd->master->max_history;
+    uint64_t margin      = rd->live->interval < max_history ? rd->live->interval : max_history;
+    uint64_t oldest      = rd->live_rows - stored;                                      // Row the copy started from
+    uint64_t safe        = rows + margin > max_history ? rows + margin - max_history : 0; // Oldest row not being written
+    return safe > oldest ? (size_t)(safe - oldest) : 0;
+}
+
+// Parses the headers and sections of the current mapping
+int vb2_rd_load(vb2_reader *rd) {
+    size_t count = rd->master->block_count;
+    int parsed = (rd->master->reserved[VB2_RESERVED_FLAGS] & VB2_FLAG_COMPACT) ? vb2_rd_parse_compact(rd) : vb2_rd_parse_headers(rd);
+    if (parsed != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        struct vb2_column *column = &rd->columns[i];
+        column->base = vb2_rd_parse_type(column->type, &column->var_size, &column->elements, &column->codec);
+    }
+    rd->wrap = rd->master->reserved[VB2_RESERVED_WRAP];
+    rd->sections      = NULL;
+    rd->section_count = 0;
+    vb2_rd_load_sections(rd);
+    rd->live = NULL;
+    if (rd->master->reserved[VB2_RESERVED_FLAGS] & VB2_FLAG_LIVE) {
+        if (!vb2_rd_in_file(rd, rd->data_start, sizeof(struct VB_Live))) {
+            return -1;
+        }
+        rd->live = (const struct VB_Live *)(rd->map + rd->data_start);
+        if (!__atomic_load_n(&rd->live->ended, __ATOMIC_ACQUIRE)) {
+            vb2_rd_live_rows(rd, __atomic_load_n(&rd->live->rows, __ATOMIC_ACQUIRE)); // Header counts are not saved yet
+        } else {
+            rd->live_rows = rd->live->rows;
+        }
+    }
+    return 0;
+}
+
+// ***********************************************
+//              Open / Close
+// ***********************************************
+vb2_reader *vb2_reader_open(const char *filename) {
+    VB_DEBUG("Opening variable buffer file for reading: %s", filename);
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(struct VB_Master_Header)) {
+        close(fd);
+        return NULL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    vb2_reader *rd = calloc(1, sizeof(*rd));
+    if (rd == NULL) {
+        munmap(map, (size_t)st.st_size);
+        close(fd);
+        return NULL;
+    }
+    rd->fd     = fd;
+    rd->map    = map;
+    rd->size   = (size_t)st.st_size;
+    rd->master = (const struct VB_Master_Header *)rd->map;
+
+    size_t count = rd->master->block_count;
+    if (memcmp(rd->master->magic, VB2_MAGIC, sizeof(VB2_MAGIC)) != 0 ||
+        rd->master->version / 1000 != VB2_READER_VERSION_MAJOR ||
+        count > UINT32_MAX - 1 || count > rd->size / sizeof(struct VB_Compact_Header)) {
+        VB_DEBUG("Not a readable variable buffer file: %s", filename);
+        vb2_reader_close(rd);
+        return NULL;
+    }
+    rd->columns = calloc(count ? count : 1, sizeof(*rd->columns));
+    rd->offsets = calloc(count ? count : 1, sizeof(*rd->offsets));
+    if (rd->columns == NULL || rd->offsets == NULL) {
+        vb2_reader_close(rd);
+        return NULL;
+    }
+    if (vb2_rd_load(rd) != 0) {
+        VB_DEBUG("Damaged variable headers: %s", filename);
+        vb2_reader_close(rd);
+        return NULL;
+    }
+    if (vb2_rd_index_names(rd) != 0) {
+        vb2_reader_close(rd);
+        return NULL;
+    }
+    if (rd->live == NULL || rd->live->ended) {
+        close(rd->fd); // The mapping keeps the file referenced
+        rd->fd = -1;
+    }
+    return rd;
+}
+
+void vb2_reader_close(vb2_reader *rd) {
+    if (rd == NULL) {
+        return;
+    }
+    if (rd->map) {
+        munmap((void *)rd->map, rd->size);
+    }
+    if (rd->fd >= 0) {
+        close(rd->fd);
+    }
+    free(rd->columns);
+    free(rd->offsets);
+    free(rd->hash);
+    free(rd->chunks);
+    free(rd->chunk_start);
+    free(rd->decoded);
+    free(rd->log_formats.formats);
+    free(rd);
+}
+
+// ***********************************************
+//              Metadata
+// ***********************************************
+size_t vb2_reader_column_count(const vb2_reader *rd) {
+    return rd->master->block_count;
+}
+
+int vb2_reader_find(const vb2_reader *rd, const char *name) {
+    size_t slot = vb2_rd_hash(name) & rd->hash_mask;
+    while (rd->hash[slot] != 0) {
+        int col = (int)rd->hash[slot] - 1;
+        if (strcmp(rd->columns[col].name, name) == 0) {
+            return col;
+        }
+        slot = (slot + 1) & rd->hash_mask;
+    }
+    return -1;
+}
+
+const struct vb2_column *vb2_reader_column(const vb2_reader *rd, int col) {
+    if (col < 0 || (size_t)col >= rd->master->block_count) {
+        return NULL;
+    }
+    return &rd->columns[col];
+}
+
+size_t vb2_reader_flags(const vb2_reader *rd) {
+    return rd->master->reserved[VB2_RESERVED_FLAGS];
+}
+
+const void *vb2_reader_section(const vb2_reader *rd, const char *tag, size_t *size) {
+    for (size_t i = 0; i < rd->section_count; i++) {
+        const struct VB_Section *section = &rd->sections[i];
+        if (strncmp(section->tag, tag, sizeof(section->tag)) == 0 && vb2_rd_in_file(rd, section->offset, section->size)) {
+            if (size) {
+                *size = section->size;
+            }
+            return rd->map + section->offset;
+        }
+    }
+    return NULL;
+}
+
+// ***********************************************
+//              Fixed layout (linear and ring)
+// ***********************************************
+int vb2_reader_segments(const vb2_reader *rd, int col, struct vb2_view segments[2]) {
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    if (column == NULL || column->var_size == 0 || (vb2_reader_flags(rd) & VB2_FLAG_CHUNKED)) {
+        return -1;
+    }
+    int    ring  = (vb2_reader_flags(rd) & VB2_FLAG_RING) != 0;
+    size_t slots = ring ? rd->master->max_history : column->count; // A ring column always spans max_history rows
+    if (column->count > slots || !vb2_rd_in_file(rd, rd->offsets[col], slots * column->var_size)) {
+        return -1; // Truncated file
+    }
+    size_t wrap  = rd->wrap < slots ? rd->wrap : 0;
+    size_t older = column->count < slots - wrap ? column->count : slots - wrap;
+    const uint8_t *data = rd->map + rd->offsets[col];
+    segments[0] = (struct vb2_view){ data + wrap * column->var_size, older, column->var_size, column->base };
+    segments[1] = (struct vb2_view){ data, column->count - older, column->var_size, column->base };
+    return 0;
+}
+
+// ***********************************************
+//              Live files
+// ***********************************************
+long vb2_reader_refresh(vb2_reader *rd) {
+    if (rd->live == NULL) {
+        return -1;
+    }
+    uint64_t previous = rd->live_rows;
+    if (rd->fd < 0) {
+        return 0; // Already ended
+    }
+    if (!__atomic_load_n(&rd->live->ended, __ATOMIC_ACQUIRE)) {
+        vb2_rd_live_rows(rd, __atomic_load_n(&rd->live->rows, __ATOMIC_ACQUIRE));
+    } else {
+        // The file grew by the sections, map it again and take the saved headers
+        struct stat st;
+        void *map;
+        if (fstat(rd->fd, &st) != 0 || (size_t)st.st_size < rd->size ||
+            (map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, rd->fd, 0)) == MAP_FAILED) {
+            return -1;
+        }
+        munmap((void *)rd->map, rd->size);
+        rd->map    = map;
+        rd->size   = (size_t)st.st_size;
+        rd->master = (const struct VB_Master_Header *)rd->map;
+        free(rd->log_formats.formats); // Pointed into the old mapping
+        rd->log_formats.formats = NULL;
+        rd->log_formats.count   = 0;
+        rd->log_indexed         = 0;
+        if (vb2_rd_load(rd) != 0) {
+            return -1;
+        }
+        close(rd->fd);
+        rd->fd = -1;
+    }
+    uint64_t rows  = rd->live_rows - previous;
+    size_t   count = rd->master->block_count ? rd->columns[0].count : 0;
+    return (long)(rows < count ? rows : count);
+}
+
+int vb2_reader_live(const vb2_reader *rd) {
+    return rd->live != NULL && rd->fd >= 0;
+}
+
+// ***********************************************
+//              Chunked layout (stream mode)
+// ***********************************************
+// Walks the chunk headers of a file whose recording never reached vb2_end
+size_t vb2_rd_scan_chunks(vb2_reader *rd, struct VB_Chunk_Index **out) {
+    size_t count = 0, capacity = 0;
+    struct VB_Chunk_Index *entries = NULL;
+    size_t offset = rd->data_start;
+    while (vb2_rd_in_file(rd, offset, sizeof(struct VB_Chunk_Header))) {
+        struct VB_Chunk_Header chunk;
+        memcpy(&chunk, rd->map + offset, sizeof(chunk));
+        size_t data = offset + sizeof(chunk);
+        if (chunk.block >= rd->master->block_count || chunk.rows == 0 ||
+            chunk.rows > rd->size || chunk.size > chunk.rows * rd->columns[chunk.block].var_size || !vb2_rd_in_file(rd, data, chunk.size)) {
+            break; // Torn or unwritten chunk, everything before it is good
+        }
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct VB_Chunk_Index *grown = realloc(entries, capacity * sizeof(*entries));
+            if (grown == NULL) {
+                break;
+            }
+            entries = grown;
+        }
+        entries[count].chunk  = chunk;
+        entries[count].offset = data;
+        count++;
+        offset = data + ((chunk.size + 7) & ~(size_t)7);
+    }
+    *out = entries;
+    return count;
+}
+
+int vb2_rd_index_chunks(vb2_reader *rd) {
+    if (rd->chunks_indexed) {
+        return 0;
+    }
+    size_t blocks = rd->master->block_count;
+    size_t size   = 0;
+    const struct VB_Chunk_Index *entries = vb2_reader_section(rd, "CHUNKS", &size);
+    struct VB_Chunk_Index *scanned = NULL;
+    size_t count = size / sizeof(struct VB_Chunk_Index);
+    if (entries == NULL) {
+        count   = vb2_rd_scan_chunks(rd, &scanned);
+        entries = scanned;
+    }
+    rd->chunk_start = calloc(blocks + 1, sizeof(*rd->chunk_start));
+    rd->chunks      = malloc((count ? count : 1) * sizeof(*rd->chunks));
+    if (rd->chunk_start == NULL || rd->chunks == NULL) {
+        free(scanned);
+        return -1;
+    }
+    // Counting sort by column, chunks of one column are already in row order
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].chunk.block < blocks) {
+            rd->chunk_start[entries[i].chunk.block + 1]++;
+        }
+    }
+    for (size_t b = 0; b < blocks; b++) {
+        rd->chunk_start[b + 1] += rd->chunk_start[b];
+    }
+    size_t *fill = calloc(blocks ? blocks : 1, sizeof(*fill));
+    if (fill == NULL) {
+        free(scanned);
+        return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        size_t block = entries[i].chunk.block;
+        if (block < blocks) {
+            rd->chunks[rd->chunk_start[block] + fill[block]++] = entries[i];
+        }
+    }
+    free(fill);
+    free(scanned);
+    rd->chunks_indexed = 1;
+    return 0;
+}
+
+size_t vb2_reader_chunk_count(vb2_reader *rd, int col) {
+    if (vb2_reader_column(rd, col) == NULL || !(vb2_reader_flags(rd) & VB2_FLAG_CHUNKED) || vb2_rd_index_chunks(rd) != 0) {
+        return 0;
+    }
+    return rd->chunk_start[col + 1] - rd->chunk_start[col];
+}
+
+// Inverse of vb2_encode in var_buffer_2.c
+int vb2_rd_decode(uint8_t codec, const uint8_t *in, size_t in_size, size_t rows, size_t var_size, uint8_t *out) {
+    if (in_size < var_size) {
+        return -1;
+    }
+    const uint8_t *modes = in;
+    size_t pos = var_size;
+    size_t bitmap_size = (rows + 7) / 8;
+    memset(out, 0, rows * var_size);
+    for (size_t k = 0; k < var_size; k++) {
+        if (modes[k] == VB_PLANE_SPARSE) {
+            if (pos + bitmap_size > in_size) {
+                return -1;
+            }
+            const uint8_t *bitmap = in + pos;
+            pos += bitmap_size;
+            for (size_t i = 0; i < rows; i++) {
+                if (bitmap[i / 8] & (1u << (i % 8))) {
+                    if (pos >= in_size) {
+                        return -1;
+                    }
+                    out[i * var_size + k] = in[pos++];
+                }
+            }
+        } else if (modes[k] == VB_PLANE_RAW) {
+            if (pos + rows > in_size) {
+                return -1;
+            }
+            for (size_t i = 0; i < rows; i++) {
+                out[i * var_size + k] = in[pos + i];
+            }
+            pos += rows;
+        } else if (modes[k] != VB_PLANE_ZERO) {
+            return -1;
+        }
+    }
+    size_t   bits = var_size * 8;
+    uint64_t mask = bits == 64 ? ~(uint64_t)0 : (((uint64_t)1 << bits) - 1);
+    uint64_t prev = 0, prev_delta = 0;
+    for (size_t i = 0; i < rows; i++) {
+        uint64_t sample = 0;
+        memcpy(&sample, out + i * var_size, var_size); // Little endian, like the writer
+        uint64_t value;
+        if (codec == VB_CODEC_XOR) {
+            value = sample ^ prev;
+        } else {
+            uint64_t dod   = ((sample >> 1) ^ (0 - (sample & 1))) & mask; // Undo zigzag
+            uint64_t delta = (prev_delta + dod) & mask;
+            value      = (prev + delta) & mask;
+            prev_delta = delta;
+        }
+        memcpy(out + i * var_size, &value, var_size);
+        prev = value;
+    }
+    return 0;
+}
+
+int vb2_reader_chunk(vb2_reader *rd, int col, size_t i, struct vb2_view *view, size_t *first_row) {
+    if (i >= vb2_reader_chunk_count(rd, col)) {
+        return -1;
+    }
+    const struct vb2_column *column = &rd->columns[col];
+    const struct VB_Chunk_Index *entry = &rd->chunks[rd->chunk_start[col] + i];
+    size_t raw = entry->chunk.rows * column->var_size;
+    const void *data = rd->map + entry->offset;
+    if (entry->chunk.size < raw) {
+        if (raw > rd->decoded_capacity) {
+            uint8_t *grown = realloc(rd->decoded, raw);
+            if (grown == NULL) {
+                return -1;
+            }
+            rd->decoded          = grown;
+            rd->decoded_capacity = raw;
+        }
+        if (vb2_rd_decode(column->codec, rd->map + entry->offset, entry->chunk.size, entry->chunk.rows, column->var_size, rd->decoded) != 0) {
+            return -1;
+        }
+        data = rd->decoded;
+    }
+    *view = (struct vb2_view){ data, entry->chunk.rows, column->var_size, column->base };
+    if (first_row) {
+        *first_row = entry->chunk.first_row;
+    }
+    return 0;
+}
+
+// First chunk holding a row at or after row, by binary search on first_row
+size_t vb2_rd_find_chunk(const vb2_reader *rd, int col, size_t row) {
+    size_t lo = rd->chunk_start[col], hi = rd->chunk_start[col + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const struct VB_Chunk_Header *chunk = &rd->chunks[mid].chunk;
+        if (chunk->first_row + chunk->rows <= row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - rd->chunk_start[col];
+}
+
+// ***********************************************
+//              Range access
+// ***********************************************
+int vb2_reader_view(const vb2_reader *rd, int col, size_t first, size_t count, size_t step, struct vb2_view *view) {
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    if (column == NULL || step == 0) {
+        return -1;
+    }
+    size_t last = count ? first + (count - 1) * step : first; // Last row touched
+    struct vb2_view base;
+    if (vb2_reader_flags(rd) & VB2_FLAG_CHUNKED) {
+        vb2_reader *mutable_rd = (vb2_reader *)rd; // Building the chunk index is the only state change
+        size_t i = vb2_rd_find_chunk(rd, col, first);
+        if (i >= vb2_reader_chunk_count(mutable_rd, col)) {
+            return -1; // Past the last chunk
+        }
+        const struct VB_Chunk_Index *entry = &rd->chunks[rd->chunk_start[col] + i];
+        if (entry->chunk.size < entry->chunk.rows * column->var_size ||
+            first < entry->chunk.first_row || last >= entry->chunk.first_row + entry->chunk.rows) {
+            return -1; // Compressed or spans chunks, needs a copy
+        }
+        base  = (struct vb2_view){ rd->map + entry->offset, entry->chunk.rows, column->var_size, column->base };
+        first -= entry->chunk.first_row;
+        last  -= entry->chunk.first_row;
+    } else {
+        struct vb2_view segments[2];
+        if (vb2_reader_segments(rd, col, segments) != 0) {
+            return -1;
+        }
+        base = segments[0];
+        if (first >= segments[0].count) {
+            base   = segments[1];
+            first -= segments[0].count;
+            last  -= segments[0].count;
+        }
+    }
+    if (count > 0 && last >= base.count) {
+        return -1; // Past the end or across the ring wrap
+    }
+    *view = (struct vb2_view){ (const uint8_t *)base.data + first * base.stride, count, base.stride * step, base.type };
+    return 0;
+}
+
+size_t vb2_reader_read(vb2_reader *rd, int col, size_t first, size_t count, size_t step, void *out) {
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    if (column == NULL || step == 0) {
+        return 0;
+    }
+    uint8_t *dst  = out;
+    size_t   done = 0;
+    if (vb2_reader_flags(rd) & VB2_FLAG_CHUNKED) {
+        size_t chunks = vb2_reader_chunk_count(rd, col);
+        for (size_t i = chunks ? vb2_rd_find_chunk(rd, col, first) : 0; i < chunks && done < count; i++) {
+            struct vb2_view chunk;
+            size_t chunk_first;
+            if (vb2_reader_chunk(rd, col, i, &chunk, &chunk_first) != 0) {
+                break;
+            }
+            size_t row = first + done * step;
+            if (row < chunk_first) {
+                break; // Hole where a dropped buffer would have been
+            }
+            for (; done < count && row < chunk_first + chunk.count; done++, row += step) {
+                memcpy(dst + done * column->var_size, (const uint8_t *)chunk.data + (row - chunk_first) * chunk.stride, column->var_size);
+            }
+        }
+        return done;
+    }
+    struct vb2_view segments[2];
+    if (vb2_reader_segments(rd, col, segments) != 0) {
+        return 0;
+    }
+    for (size_t row = first; done < count && row < column->count; done++, row += step) {
+        const struct vb2_view *segment = row < segments[0].count ? &segments[0] : &segments[1];
+        size_t index = row < segments[0].count ? row : row - segments[0].count;
+        memcpy(dst + done * column->var_size, (const uint8_t *)segment->data + index * segment->stride, column->var_size);
+    }
+    if (done > 0 && first < vb2_rd_live_lapped(rd, column->count)) {
+        return 0; // The writer lapped the reader, some of the rows copied may be newer ones
+    }
+    return done;
+}
+
+// ***********************************************
+//              Summary index
+// ***********************************************
+const struct vb2_summary *vb2_reader_summary(const vb2_reader *rd, int col, size_t level, size_t *count) {
+    size_t size = 0;
+    const struct vb2_summary *entries = vb2_reader_section(rd, level == 0 ? "SUMMARY" : "PYRAMID", &size);
+    *count = 0;
+    if (entries == NULL || vb2_reader_column(rd, col) == NULL) {
+        return NULL;
+    }
+    // Entries are sorted by block then level, find the run of (col, level)
+    size_t n = size / sizeof(*entries), lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].block < (size_t)col || (entries[mid].block == (size_t)col && entries[mid].level < level)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    size_t end = lo;
+    while (end < n && entries[end].block == (size_t)col && entries[end].level == level) {
+        end++;
+    }
+    *count = end - lo;
+    return *count ? entries + lo : NULL;
+}
+
+// ***********************************************
+//              Binary log
+// ***********************************************
+// Whether a stored argument type can be passed to a conversion, the formats come from the file
+static int vb2_rd_blog_matches(char type, char conversion) {
+    switch (type) {
+        case 'i': case 'l': return strchr("diuxXoc", conversion) != NULL;
+        case 'd':           return strchr("fFeEgGaA", conversion) != NULL;
+        case 'p':           return conversion == 'p';
+        default:            return conversion == 's';
+    }
+}
+
+// Formats one conversion spec, e.g. "%-8.*f", with the argument at *at, returns the bytes consumed.
+// Stops without printing once the spec needs more than the arg_count arguments of the format, or
+// holds anything but flags, a width and a precision that fprintf could act on (%n, a wrong type).
+size_t vb2_rd_blog_conversion(const char *spec, size_t spec_length, const char *types, size_t arg_count, size_t *arg,
+                              const uint8_t *at, const uint8_t *end, FILE *out) {
+    char clean[64];
+    size_t n = 0;
+    const uint8_t *start = at;
+    for (size_t k = 0; k < spec_length && n < sizeof(clean) - 24; k++) {
+        char c = spec[k];
+        if (c == '*') {
+            if (*arg >= arg_count) {
+                return (size_t)(at - start);
+            }
+            int32_t star = 0;
+            if (types[*arg] == 'i' && at + 4 <= end) memcpy(&star, at, 4);
+            at += 4;
+            (*arg)++;
+            n += (size_t)snprintf(clean + n, sizeof(clean) - n, "%d", star);
+        } else if (k > 0 && k + 1 < spec_length && strchr("-+ #0'123456789.hlzjtq", c) == NULL) {
+            return (size_t)(at - start);
+        } else if (strchr("hlzjtq", c) == NULL) {
+            clean[n++] = c; // Length modifiers are replaced below to match the stored width
+        }
+    }
+    if (*arg >= arg_count) {
+        return (size_t)(at - start);
+    }
+    char conversion = clean[n - 1];
+    char type = types[*arg];
+    (*arg)++;
+    FILE *print = vb2_rd_blog_matches(type, conversion) ? out : NULL; // Otherwise the argument is skipped
+    if (type == 'l') {
+        clean[n - 1] = 'l';
+        clean[n++] = 'l';
+        clean[n++] = conversion;
+    }
+    clean[n] = '\0';
+    switch (type) {
+        case 'i': { int32_t v = 0;  if (at + 4 <= end) memcpy(&v, at, 4); if (print) fprintf(print, clean, v); at += 4; break; }
+        case 'l': { int64_t v = 0;  if (at + 8 <= end) memcpy(&v, at, 8); if (print) fprintf(print, clean, (long long)v); at += 8; break; }
+        case 'd': { double v = 0;   if (at + 8 <= end) memcpy(&v, at, 8); if (print) fprintf(print, clean, v); at += 8; break; }
+        case 'p': { uint64_t v = 0; if (at + 8 <= end) memcpy(&v, at, 8); if (print) fprintf(print, clean, (void *)(uintptr_t)v); at += 8; break; }
+        default: {
+            uint16_t length = 0;
+            if (at + 2 <= end) memcpy(&length, at, 2);
+            at += 2;
+            if (at + length > end) length = 0;
+            char text[256];
+            size_t kept = length < sizeof(text) - 1 ? length : sizeof(text) - 1; // The writer keeps 200 bytes, files may claim more
+            memcpy(text, at, kept);
+            text[kept] = '\0';
+            if (print) fprintf(print, clean, text);
+            at += length;
+            break;
+        }
+    }
+    return (size_t)(at - start);
+}
+
+void vb2_rd_blog_format(const struct vb2_rd_blog_format *format, const uint8_t *at, const uint8_t *end, FILE *out) {
+    size_t arg = 0;
+    for (const char *c = format->fmt; *c; c++) {
+        if (*c != '%') {
+            fputc(*c, out);
+            continue;
+        }
+        if (c[1] == '%') {
+            fputc('%', out);
+            c++;
+            continue;
+        }
+        const char *spec = c++;
+        while (*c && strchr("diuxXocfFeEgGaAsp", *c) == NULL) {
+            c++;
+        }
+        if (*c == '\0' || arg >= format->arg_count) {
+            return;
+        }
+        at += vb2_rd_blog_conversion(spec, (size_t)(c - spec + 1), format->types, format->arg_count, &arg, at, end, out);
+    }
+}
+
+int vb2_rd_blog_define(struct vb2_rd_blog_table *table, const uint8_t *payload, const uint8_t *next) {
+    uint32_t id, line;
+    if (next - payload < 9) {
+        return -1;
+    }
+    memcpy(&id, payload, 4);
+    memcpy(&line, payload + 4, 4);
+    if (id >= table->count) {
+        size_t count = (size_t)id + 64;
+        struct vb2_rd_blog_format *grown = realloc(table->formats, count * sizeof(*grown));
+        if (grown == NULL) {
+            return -1;
+        }
+        memset(grown + table->count, 0, (count - table->count) * sizeof(*grown));
+        table->formats = grown;
+        table->count   = count;
+    }
+    struct vb2_rd_blog_format *format = &table->formats[id];
+    format->line      = line;
+    format->arg_count = payload[8];
+    format->types     = (const char *)payload + 9;
+    format->file      = format->types + format->arg_count;
+    format->fmt       = NULL;
+    if (format->file < (const char *)next && format->arg_count <= VB_BLOG_MAX_ARGS) {
+        const char *fmt = format->file + strnlen(format->file, (size_t)((const char *)next - format->file)) + 1;
+        if (fmt < (const char *)next && memchr(fmt, '\0', (size_t)((const char *)next - fmt)) != NULL) {
+            format->fmt = fmt;
+        }
+    }
+    return 0;
+}
+
+// File and line of a text or format record, NULL if the record cannot be decoded
+const char *vb2_rd_blog_origin(const struct vb2_rd_blog_table *table, const struct VB_Blog_Record *record,
+                               const uint8_t *payload, const uint8_t *next, uint32_t *line) {
+    if (record->id == VB_BLOG_TEXT) {
+        if (next - payload < 5 || memchr(payload + 4, '\0', (size_t)(next - payload - 4)) == NULL) {
+            return NULL;
+        }
+        memcpy(line, payload, 4);
+        return (const char *)payload + 4;
+    }
+    if (record->id < table->count && table->formats[record->id].fmt != NULL) {
+        *line = table->formats[record->id].line;
+        return table->formats[record->id].file;
+    }
+    return NULL;
+}
+
+// The message of a text or format record
+void vb2_rd_blog_message(const struct vb2_rd_blog_table *table, const struct VB_Blog_Record *record,
+                         const uint8_t *payload, const uint8_t *next, FILE *out) {
+    uint32_t line;
+    const char *file = vb2_rd_blog_origin(table, record, payload, next, &line);
+    if (file == NULL) {
+        fprintf(out, "<undefined format %u>", record->id);
+    } else if (record->id == VB_BLOG_TEXT) {
+        const char *message = file + strlen(file) + 1;
+        fwrite(message, 1, (size_t)((const char *)next - message), out);
+    } else {
+        vb2_rd_blog_format(&table->formats[record->id], payload, next, out);
+    }
+}
+
+// Formats every record of a log, definitions included, returns the number of lines written
+size_t vb2_rd_blog_decode(struct vb2_rd_blog_table *table, const uint8_t *data, size_t size, FILE *out) {
+    static const char *levels[] = { "DEBUG  ", "INFO   ", "WARNING", "ERROR  ", "FATAL  " };
+    size_t records = 0;
+    const uint8_t *at = data, *end = data + size;
+    while (at + sizeof(struct VB_Blog_Record) <= end) {
+        struct VB_Blog_Record record;
+        memcpy(&record, at, sizeof(record));
+        const uint8_t *payload = at + sizeof(record);
+        const uint8_t *next = payload + record.size;
+        if (next > end) {
+            break; // Truncated, the process died before the log was flushed
+        }
+        at = next;
+        if (record.id == VB_BLOG_FORMAT) {
+            vb2_rd_blog_define(table, payload, next);
+            continue;
+        }
+        if (out != NULL) {
+            uint32_t line = 0;
+            const char *file = vb2_rd_blog_origin(table, &record, payload, next, &line);
+            char counter[32];
+            snprintf(counter, sizeof(counter), "[%llu]", (unsigned long long)record.tick);
+            fprintf(out, "%6s %s %s[%u]: ", counter, levels[record.level < 5 ? record.level : 0], file ? file : "?", line);
+            vb2_rd_blog_message(table, &record, payload, next, out);
+            fputc('\n', out);
+        }
+        records++;
+    }
+    return records;
+}
+
+long vb2_log_decode(FILE *in, FILE *out) {
+    struct VB_Blog_Header header;
+    if (fread(&header, sizeof(header), 1, in) != 1 || memcmp(header.magic, VB_BLOG_MAGIC, sizeof(VB_BLOG_MAGIC)) != 0) {
+        VB_DEBUG("Not a binary log");
+        return -1;
+    }
+    size_t size = 0, capacity = 1 << 16;
+    uint8_t *data = malloc(capacity);
+    size_t got;
+    if (data == NULL) {
+        return -1;
+    }
+    while ((got = fread(data + size, 1, capacity - size, in)) > 0) {
+        size += got;
+        if (size == capacity) {
+            capacity *= 2;
+            uint8_t *grown = realloc(data, capacity);
+            if (grown == NULL) {
+                free(data);
+                return -1;
+            }
+            data = grown;
+        }
+    }
+    struct vb2_rd_blog_table table = { NULL, 0 };
+    long records = (long)vb2_rd_blog_decode(&table, data, size, out);
+    free(table.formats);
+    free(data);
+    return records;
+}
+
+// ***********************************************
+//              Log events
+// ***********************************************
+const struct VB_Log_Event *vb2_rd_log_index(const vb2_reader *rd, size_t *count) {
+    size_t size = 0;
+    const struct VB_Log_Event *index = vb2_reader_section(rd, "LOGINDEX", &size);
+    *count = index ? size / sizeof(*index) : 0;
+    return index;
+}
+
+size_t vb2_reader_event_count(const vb2_reader *rd) {
+    size_t count;
+    vb2_rd_log_index(rd, &count);
+    return count;
+}
+
+size_t vb2_reader_event_range(const vb2_reader *rd, uint64_t first_tick, uint64_t last_tick, size_t *first) {
+    size_t count;
+    const struct VB_Log_Event *index = vb2_rd_log_index(rd, &count);
+    // Entries are in tick order, find the first at or after each end
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index[mid].tick < first_tick) lo = mid + 1; else hi = mid;
+    }
+    *first = lo;
+    hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index[mid].tick <= last_tick) lo = mid + 1; else hi = mid;
+    }
+    return lo - *first;
+}
+
+int vb2_reader_event(vb2_reader *rd, size_t i, struct vb2_event *event, char *message, size_t size) {
+    size_t count, log_size, formats_size;
+    const struct VB_Log_Event *index = vb2_rd_log_index(rd, &count);
+    const uint8_t *log = vb2_reader_section(rd, "LOG", &log_size);
+    if (i >= count || log == NULL || index[i].offset + sizeof(struct VB_Blog_Record) > log_size) {
+        return -1;
+    }
+    if (!rd->log_indexed) {
+        const uint8_t *formats = vb2_reader_section(rd, "LOGFMT", &formats_size);
+        if (formats != NULL) {
+            vb2_rd_blog_decode(&rd->log_formats, formats, formats_size, NULL);
+        }
+        rd->log_indexed = 1;
+    }
+    struct VB_Blog_Record record;
+    memcpy(&record, log + index[i].offset, sizeof(record));
+    const uint8_t *payload = log + index[i].offset + sizeof(record);
+    const uint8_t *next = payload + record.size;
+    if (next > log + log_size) {
+        return -1;
+    }
+    event->tick  = index[i].tick;
+    event->time  = index[i].time;
+    event->level = record.level;
+    event->line  = 0;
+    event->file  = vb2_rd_blog_origin(&rd->log_formats, &record, payload, next, &event->line);
+    if (message != NULL && size > 0) {
+        FILE *out = fmemopen(message, size, "w");
+        if (out == NULL) {
+            message[0] = '\0';
+            return 0;
+        }
+        vb2_rd_blog_message(&rd->log_formats, &record, payload, next, out);
+        fclose(out);
+        message[size - 1] = '\0';
+    }
+    return 0;
+}
+
+// ***********************************************
+//              Struct fields
+// ***********************************************
+const struct vb2_field *vb2_reader_fields(const vb2_reader *rd, int col, size_t *count) {
+    size_t size = 0;
+    const struct vb2_field *fields = vb2_reader_section(rd, "FIELDS", &size);
+    *count = 0;
+    if (fields == NULL || vb2_reader_column(rd, col) == NULL) {
+        return NULL;
+    }
+    size_t n = size / sizeof(*fields), first = 0;
+    while (first < n && fields[first].block < (size_t)col) {
+        first++; // Sorted by block, and structs rarely have many members
+    }
+    size_t end = first;
+    while (end < n && fields[end].block == (size_t)col) {
+        end++;
+    }
+    for (size_t i = first; i < end; i++) {
+        if (!vb2_rd_terminated(fields[i].name, sizeof(fields[i].name)) || !vb2_rd_terminated(fields[i].type, sizeof(fields[i].type))) {
+            return NULL;
+        }
+    }
+    *count = end - first;
+    return *count ? fields + first : NULL;
+}
+
+const struct vb2_trigger_event *vb2_reader_triggers(const vb2_reader *rd, size_t *count) {
+    size_t size = 0;
+    const struct vb2_trigger_event *events = vb2_reader_section(rd, "TRIGGERS", &size);
+    *count = events ? size / sizeof(*events) : 0;
+    return *count ? events : NULL;
+}
+
+const struct vb2_dropped *vb2_reader_dropped(const vb2_reader *rd, size_t *count) {
+    size_t size = 0;
+    const struct vb2_dropped *ranges = vb2_reader_section(rd, "DROPPED", &size);
+    *count = ranges ? size / sizeof(*ranges) : 0;
+    return *count ? ranges : NULL;
+}
+
+const struct vb2_sampling *vb2_reader_sampling(const vb2_reader *rd, int col) {
+    size_t size = 0;
+    const struct vb2_sampling *entries = vb2_reader_section(rd, "SAMPLED", &size);
+    if (entries == NULL || vb2_reader_column(rd, col) == NULL) {
+        return NULL;
+    }
+    for (size_t i = 0; i < size / sizeof(*entries); i++) {
+        if (entries[i].block == (size_t)col) {
+            return vb2_reader_column(rd, (int)entries[i].index) != NULL ? &entries[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+size_t vb2_reader_aligned_count(const vb2_reader *rd, int col) {
+    const struct vb2_sampling *sampling = vb2_reader_sampling(rd, col);
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    return sampling ? sampling->rows : column ? column->count : 0;
+}
+
+#define VB2_ALIGNED_BATCH 1024 // Samples read at once, in chunks they are usually decoded once per batch
+
+size_t vb2_reader_read_aligned(vb2_reader *rd, int col, size_t first, size_t count, void *out) {
+    const struct vb2_sampling *sampling = vb2_reader_sampling(rd, col);
+    if (sampling == NULL) {
+        return vb2_reader_read(rd, col, first, count, 1, out);
+    }
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    int    index   = (int)sampling->index;
+    size_t samples = vb2_reader_column(rd, index)->count;
+    if (first >= sampling->rows || samples == 0) {
+        return 0;
+    }
+    if (count > sampling->rows - first) {
+        count = sampling->rows - first;
+    }
+    // Last sample taken on or before first, every file starts with one on row 0
+    size_t low = 0, high = samples;
+    while (high - low > 1) {
+        size_t  middle = low + (high - low) / 2;
+        int64_t row    = 0;
+        vb2_reader_read(rd, index, middle, 1, 1, &row);
+        if ((uint64_t)row <= first) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+    int64_t  rows[VB2_ALIGNED_BATCH];
+    uint8_t *values = malloc(column->var_size * (VB2_ALIGNED_BATCH + 1));
+    if (values == NULL) {
+        return 0;
+    }
+    uint8_t *held   = values + column->var_size * VB2_ALIGNED_BATCH; // Sample repeated until the next one
+    uint8_t *dst    = out;
+    size_t   loaded = 0, loaded_count = 0, done = 0;
+    for (size_t k = low; done < count; k++) {
+        if (k >= loaded + loaded_count) {
+            loaded       = k;
+            loaded_count = vb2_reader_read(rd, index, k, VB2_ALIGNED_BATCH, 1, rows);
+            if (loaded_count == 0 || vb2_reader_read(rd, col, k, loaded_count, 1, values) < loaded_count) {
+                break; // Truncated column
+            }
+        }
+        memcpy(held, values + (k - loaded) * column->var_size, column->var_size);
+        // Rows up to the next sample, or to the end
+        size_t end = first + count;
+        if (k + 1 < samples) {
+            int64_t next = 0;
+            if (k + 1 < loaded + loaded_count) {
+                next = rows[k + 1 - loaded];
+            } else {
+                vb2_reader_read(rd, index, k + 1, 1, 1, &next);
+            }
+            if ((uint64_t)next < end) {
+                end = (size_t)next;
+            }
+        }
+        for (; first + done < end; done++) {
+            memcpy(dst + done * column->var_size, held, column->var_size);
+        }
+    }
+    free(values);
+    return done;
+}
+
+// ***********************************************
+//          Shared memory telemetry
+// ***********************************************
+struct VB2_Shm_Reader {
+    const struct VB_Shm_Header *header; // Read only mapping of the segment
+    size_t   size;
+    struct vb2_column *columns;         // Schema, count is unused
+    size_t  *offsets;                   // Offset of each column in the row
+};
+
+vb2_shm_reader *vb2_shm_open(const char *name) {
+    char path[256];
+    int length = snprintf(path, sizeof(path), "%s%s", name[0] == '/' ? "" : "/", name);
+    if (length < 0 || (size_t)length >= sizeof(path)) {
+        return NULL;
+    }
+    int fd = shm_open(path, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(struct VB_Shm_Header)) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd); // The mapping keeps the segment
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+    vb2_shm_reader *shm = calloc(1, sizeof(*shm));
+    if (shm == NULL) {
+        munmap(map, (size_t)st.st_size);
+        return NULL;
+    }
+    shm->header = map;
+    shm->size   = (size_t)st.st_size;
+    const struct VB_Shm_Header *header = shm->header;
+    size_t count = header->column_count;
+    if (__atomic_load_n(&header->state, __ATOMIC_ACQUIRE) == 0 || // Still being laid out
+        memcmp(header->magic, VB_SHM_MAGIC, sizeof(VB_SHM_MAGIC)) != 0 || header->version != VB_SHM_VERSION ||
+        count > shm->size / sizeof(struct VB_Header) || header->slots < sizeof(*header) + count * sizeof(struct VB_Header) ||
+        header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0 ||
+        header->slot_size < sizeof(struct VB_Shm_Slot) + header->row_size ||
+        header->slot_count > (shm->size - header->slots) / header->slot_size) {
+        vb2_shm_close(shm);
+        return NULL;
+    }
+    shm->columns = calloc(count ? count : 1, sizeof(*shm->columns));
+    shm->offsets = calloc(count ? count : 1, sizeof(*shm->offsets));
+    if (shm->columns == NULL || shm->offsets == NULL) {
+        vb2_shm_close(shm);
+        return NULL;
+    }
+    const struct VB_Header *schema = (const struct VB_Header *)(header + 1);
+    for (size_t i = 0; i < count; i++) {
+        struct vb2_column *column = &shm->columns[i];
+        if (!vb2_rd_terminated(schema[i].name, sizeof(schema[i].name)) || !vb2_rd_terminated(schema[i].unit, sizeof(schema[i].unit)) ||
+            !vb2_rd_terminated(schema[i].description, sizeof(schema[i].description)) || !vb2_rd_terminated(schema[i].type, sizeof(schema[i].type))) {
+            vb2_shm_close(shm);
+            return NULL;
+        }
+        column->name        = schema[i].name;
+        column->unit        = schema[i].unit;
+        column->description = schema[i].description;
+        column->type        = schema[i].type;
+        column->base        = vb2_rd_parse_type(column->type, &column->var_size, &column->elements, &column->codec);
+        shm->offsets[i]     = schema[i].offset;
+        if (column->var_size > header->row_size || shm->offsets[i] > header->row_size - column->var_size) {
+            vb2_shm_close(shm);
+            return NULL;
+        }
+    }
+    return shm;
+}
+
+void vb2_shm_close(vb2_shm_reader *shm) {
+    if (shm == NULL) {
+        return;
+    }
+    munmap((void *)shm->header, shm->size);
+    free(shm->columns);
+    free(shm->offsets);
+    free(shm);
+}
+
+size_t vb2_shm_column_count(const vb2_shm_reader *shm) {
+    return shm->header->column_count;
+}
+
+int vb2_shm_find(const vb2_shm_reader *shm, const char *name) {
+    for (size_t i = 0; i < shm->header->column_count; i++) {
+        if (strcmp(shm->columns[i].name, name) == 0) {
+            return (int)i; // Dashboards pick a few columns once
+        }
+    }
+    return -1;
+}
+
+const struct vb2_column *vb2_shm_column(const vb2_shm_reader *shm, int col, size_t *offset) {
+    if (col < 0 || (size_t)col >= shm->header->column_count) {
+        return NULL;
+    }
+    if (offset) {
+        *offset = shm->offsets[col];
+    }
+    return &shm->columns[col];
+}
+
+size_t vb2_shm_row_size(const vb2_shm_reader *shm) {
+    return shm->header->row_size;
+}
+
+int vb2_shm_ended(const vb2_shm_reader *shm) {
+    return __atomic_load_n(&shm->header->state, __ATOMIC_ACQUIRE) == VB_SHM_ENDED;
+}
+
+// Copies row tick out of its slot, -1 if it was overwritten or changed while copying
+int vb2_rd_shm_copy(const vb2_shm_reader *shm, uint64_t tick, struct vb2_shm_row *info, void *row) {
+    const struct VB_Shm_Header *header = shm->header;
+    const struct VB_Shm_Slot *slot = (const struct VB_Shm_Slot *)((const uint8_t *)header + header->slots +
+                                                                  (tick & (header->slot_count - 1)) * header->slot_size);
+    uint64_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+    if (sequence != 2 * tick + 2) {
+        return -1;
+    }
+    struct vb2_shm_row copied = { slot->tick, slot->time };
+    memcpy(row, slot + 1, header->row_size);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE); // The copy is done before the sequence is checked again
+    if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) != sequence) {
+        return -1;
+    }
+    if (info) {
+        *info = copied;
+    }
+    return 0;
+}
+
+int vb2_shm_latest(vb2_shm_reader *shm, struct vb2_shm_row *info, void *row) {
+    for (int attempt = 0; attempt < 4; attempt++) {
+        uint64_t head = __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+        if (head == 0) {
+            return -1;
+        }
+        if (vb2_rd_shm_copy(shm, head - 1, info, row) == 0) {
+            return 0;
+        }
+    }
+    return -1; // The recorder lapped the slot every time
+}
+
+size_t vb2_shm_read(vb2_shm_reader *shm, uint64_t *cursor, struct vb2_shm_row *info, void *rows, size_t max_rows, uint64_t *missed) {
+    uint64_t head  = __atomic_load_n(&shm->header->head, __ATOMIC_ACQUIRE);
+    uint64_t first = *cursor;
+    uint64_t lost  = 0;
+    if (head > shm->header->slot_count && first < head - shm->header->slot_count) {
+        lost  = head - shm->header->slot_count - first; // Already overwritten
+        first = head - shm->header->slot_count;
+    }
+    size_t copied = 0;
+    uint64_t tick = first;
+    for (; tick < head && copied < max_rows; tick++) {
+        if (vb2_rd_shm_copy(shm, tick, info ? &info[copied] : NULL, (uint8_t *)rows + copied * shm->header->row_size) != 0) {
+            lost++; // Overwritten while we got here
+            continue;
+        }
+        copied++;
+    }
+    *cursor = tick;
+    if (missed) {
+        *missed = lost;
+    }
+    return copied;
+}
@@ -0,0 +1,292 @@
+#include <var_buffer_2.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+    Benchmark of vb2_record_all.
+    Every configuration (variable count x variable size x history length x write mode) records
+    history rows into a fresh file, timing each vb2_record_all call on its own, then ends the session.
+    Reports per call latency percentiles in ns and the sustained rate in bytes/s, counting the time
+    vb2_end needs to get the data into the file.
+
+    make bench
+    make bench BENCH_ARGS="--vars 10,1000 --modes sync,mmap --format json --out results.json"
+*/
+
+#define BENCH_MAX_LIST 16
+
+struct Bench_Config {
+    size_t vars[BENCH_MAX_LIST],    var_count;
+    size_t sizes[BENCH_MAX_LIST],   size_count;
+    size_t history[BENCH_MAX_LIST], history_count;
+    enum vb2_write_mode modes[BENCH_MAX_LIST]; size_t mode_count;
+    enum vb2_record_mode record_mode;
+    int    repeat;                  // Runs per configuration, the median run is reported
+    const char *format;             // "text", "csv" or "json"
+    const char *out;                // Output file, stdout if NULL
+    const char *dir;                // Directory of the recorded files
+};
+
+struct Bench_Result {
+    size_t vars, size, history;
+    enum vb2_write_mode mode;
+    double p50, p99, p999, max, mean; // ns per vb2_record_all
+    double record_bytes_per_s;      // Bytes copied per second inside vb2_record_all
+    double sustained_bytes_per_s;   // Including vb2_end
+};
+
+static const char *bench_mode_names[] = { "sync", "async", "mmap" };
+static const char *bench_record_names[] = { "linear", "ring", "stream" };
+
+static inline uint64_t bench_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int bench_compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static double bench_percentile(const uint32_t *sorted, size_t count, double p) {
+    size_t index = (size_t)(p * (double)(count - 1) + 0.5);
+    return sorted[index];
+}
+
+// Cost of the two clock reads around every call, subtracted from the latencies
+static uint32_t bench_timer_overhead(void) {
+    uint32_t samples[1001];
+    for (size_t i = 0; i < 1001; i++) {
+        uint64_t start = bench_now_ns();
+        samples[i] = (uint32_t)(bench_now_ns() - start);
+    }
+    qsort(samples, 1001, sizeof(samples[0]), bench_compare_u32);
+    return samples[500];
+}
+
+static int bench_run(const struct Bench_Config *config, size_t vars, size_t size, size_t history,
+                     enum vb2_write_mode mode, uint32_t overhead, uint32_t *latency, struct Bench_Result *result) {
+    char filename[4096];
+    snprintf(filename, sizeof(filename), "%s/bench_vb2_%d.vb2", config->dir, (int)getpid());
+    uint8_t *values = calloc(vars, 8);
+    vb2_recorder *rec = vb2_recorder_create();
+    if (values == NULL || rec == NULL || vb2r_open(rec, filename) != 0) {
+        fprintf(stderr, "Cannot record to %s\n", filename);
+        free(values);
+        vb2_recorder_destroy(rec);
+        return -1;
+    }
+    char name[32];
+    for (size_t i = 0; i < vars; i++) {
+        snprintf(name, sizeof(name), "var_%zu", i);
+        vb2r_add_variable(rec, name, "", "", size == 8 ? VB2_DOUBLE : VB2_FLOAT, values + i * 8, (uint8_t)size);
+    }
+    vb2r_set_write_mode(rec, mode);
+    vb2r_set_record_mode(rec, config->record_mode);
+    vb2r_start(rec, history);
+
+    uint64_t begin = bench_now_ns();
+    for (size_t row = 0; row < history; row++) {
+        for (size_t i = 0; i < vars; i += 64) {
+            values[i * 8] = (uint8_t)row; // Touch a few variables so the data is not constant
+        }
+        uint64_t start = bench_now_ns();
+        vb2r_record_all(rec);
+        uint64_t elapsed = bench_now_ns() - start;
+        latency[row] = elapsed > overhead ? (uint32_t)(elapsed - overhead) : 0;
+    }
+    uint64_t recorded = bench_now_ns();
+    vb2r_end(rec);
+    uint64_t ended = bench_now_ns();
+    vb2_recorder_destroy(rec);
+    unlink(filename);
+    free(values);
+
+    double total = 0;
+    for (size_t row = 0; row < history; row++) {
+        total += latency[row];
+    }
+    qsort(latency, history, sizeof(latency[0]), bench_compare_u32);
+    double bytes = (double)vars * (double)size * (double)history;
+    *result = (struct Bench_Result){
+        .vars = vars, .size = size, .history = history, .mode = mode,
+        .p50  = bench_percentile(latency, history, 0.50),
+        .p99  = bench_percentile(latency, history, 0.99),
+        .p999 = bench_percentile(latency, history, 0.999),
+        .max  = latency[history - 1],
+        .mean = total / (double)history,
+        .record_bytes_per_s    = bytes / ((double)(recorded - begin) * 1e-9),
+        .sustained_bytes_per_s = bytes / ((double)(ended - begin) * 1e-9),
+    };
+    return 0;
+}
+
+static int bench_compare_p50(const void *a, const void *b) {
+    double x = ((const struct Bench_Result *)a)->p50, y = ((const struct Bench_Result *)b)->p50;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_print(FILE *out, const char *format, const struct Bench_Result *r, int first) {
+    if (strcmp(format, "csv") == 0) {
+        if (first) {
+            fprintf(out, "vars,size,history,mode,p50_ns,p99_ns,p999_ns,max_ns,mean_ns,record_bytes_per_s,sustained_bytes_per_s\n");
+        }
+        fprintf(out, "%zu,%zu,%zu,%s,%.0f,%.0f,%.0f,%.0f,%.1f,%.0f,%.0f\n", r->vars, r->size, r->history,
+                bench_mode_names[r->mode], r->p50, r->p99, r->p999, r->max, r->mean, r->record_bytes_per_s, r->sustained_bytes_per_s);
+    } else if (strcmp(format, "json") == 0) {
+        fprintf(out, "%s    {\"vars\": %zu, \"size\": %zu, \"history\": %zu, \"mode\": \"%s\", \"p50_ns\": %.0f, \"p99_ns\": %.0f, "
+                "\"p999_ns\": %.0f, \"max_ns\": %.0f, \"mean_ns\": %.1f, \"record_bytes_per_s\": %.0f, \"sustained_bytes_per_s\": %.0f}",
+                first ? "" : ",\n", r->vars, r->size, r->history, bench_mode_names[r->mode],
+                r->p50, r->p99, r->p999, r->max, r->mean, r->record_bytes_per_s, r->sustained_bytes_per_s);
+    } else {
+        if (first) {
+            fprintf(out, "%6s %4s %8s %6s %9s %9s %9s %10s %10s %12s %12s\n", "vars", "size", "history", "mode",
+                    "p50 ns", "p99 ns", "p99.9 ns", "max ns", "mean ns", "record MB/s", "total MB/s");
+        }
+        fprintf(out, "%6zu %4zu %8zu %6s %9.0f %9.0f %9.0f %10.0f %10.1f %12.1f %12.1f\n", r->vars, r->size, r->history,
+                bench_mode_names[r->mode], r->p50, r->p99, r->p999, r->max, r->mean,
+                r->record_bytes_per_s / 1e6, r->sustained_bytes_per_s / 1e6);
+    }
+}
+
+static size_t bench_parse_list(const char *arg, size_t *list) {
+    size_t count = 0;
+    char *end;
+    while (*arg && count < BENCH_MAX_LIST) {
+        list[count++] = strtoull(arg, &end, 10);
+        arg = *end == ',' ? end + 1 : end;
+        if (end == arg && *arg) {
+            break; // Not a number
+        }
+    }
+    return count;
+}
+
+static size_t bench_parse_modes(const char *arg, enum vb2_write_mode *modes) {
+    size_t count = 0;
+    while (*arg && count < BENCH_MAX_LIST) {
+        size_t length = strcspn(arg, ",");
+        for (size_t m = 0; m < 3; m++) {
+            if (strlen(bench_mode_names[m]) == length && strncmp(arg, bench_mode_names[m], length) == 0) {
+                modes[count++] = (enum vb2_write_mode)m;
+            }
+        }
+        arg += arg[length] == ',' ? length + 1 : length;
+    }
+    return count;
+}
+
+static void bench_usage(const char *program) {
+    printf("Usage: %s [options]\n"
+           "  --vars N,N,...      Variable counts (default 10,100,1000)\n"
+           "  --sizes N,N,...     Variable sizes in bytes, 4 or 8 (default 4,8)\n"
+           "  --history N,N,...   Rows recorded per run (default 10000,100000)\n"
+           "  --modes M,M,...     Write modes sync,async,mmap (default all)\n"
+           "  --record MODE       Record mode linear, ring or stream (default linear)\n"
+           "  --repeat N          Runs per configuration, the median is reported (default 3)\n"
+           "  --format FORMAT     text, csv or json (default text)\n"
+           "  --out FILE          Write the results to FILE instead of stdout\n"
+           "  --dir DIR           Directory of the recorded files (default /tmp)\n", program);
+}
+
+int main(int argc, char **argv) {
+    struct Bench_Config config = {
+        .vars = {10, 100, 1000}, .var_count = 3,
+        .sizes = {4, 8}, .size_count = 2,
+        .history = {10000, 100000}, .history_count = 2,
+        .modes = {VB2_WRITE_SYNC, VB2_WRITE_ASYNC, VB2_WRITE_MMAP}, .mode_count = 3,
+        .record_mode = VB2_RECORD_LINEAR,
+        .repeat = 3, .format = "text", .out = NULL, .dir = "/tmp",
+    };
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : "";
+        if (strcmp(argv[i], "--vars") == 0) {
+            config.var_count = bench_parse_list(value, config.vars); i++;
+        } else if (strcmp(argv[i], "--sizes") == 0) {
+            config.size_count = bench_parse_list(value, config.sizes); i++;
+        } else if (strcmp(argv[i], "--history") == 0) {
+            config.history_count = bench_parse_list(value, config.history); i++;
+        } else if (strcmp(argv[i], "--modes") == 0) {
+            config.mode_count = bench_parse_modes(value, config.modes); i++;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            for (int m = 0; m < 3; m++) {
+                if (strcmp(value, bench_record_names[m]) == 0) {
+                    config.record_mode = (enum vb2_record_mode)m;
+                }
+            }
+            i++;
+        } else if (strcmp(argv[i], "--repeat") == 0) {
+            config.repeat = atoi(value) > 0 ? atoi(value) : 1; i++;
+        } else if (strcmp(argv[i], "--format") == 0) {
+            config.format = value; i++;
+        } else if (strcmp(argv[i], "--out") == 0) {
+            config.out = value; i++;
+        } else if (strcmp(argv[i], "--dir") == 0) {
+            config.dir = value; i++;
+        } else {
+            bench_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    for (size_t s = 0; s < config.size_count; s++) {
+        if (config.sizes[s] != 4 && config.sizes[s] != 8) {
+            fprintf(stderr, "Variable sizes must be 4 or 8\n");
+            return 1;
+        }
+    }
+
+    FILE *out = config.out ? fopen(config.out, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Cannot write %s\n", config.out);
+        return 1;
+    }
+    size_t longest = 0;
+    for (size_t h = 0; h < config.history_count; h++) {
+        longest = config.history[h] > longest ? config.history[h] : longest;
+    }
+    uint32_t *latency = malloc(sizeof(uint32_t) * (longest ? longest : 1));
+    struct Bench_Result *runs = malloc(sizeof(struct Bench_Result) * (size_t)config.repeat);
+    if (latency == NULL || runs == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    uint32_t overhead = bench_timer_overhead();
+    if (strcmp(config.format, "json") == 0) {
+        fprintf(out, "{\n  \"timer_overhead_ns\": %u,\n  \"record_mode\": \"%s\",\n  \"results\": [\n", overhead, bench_record_names[config.record_mode]);
+    } else if (strcmp(config.format, "text") == 0) {
+        fprintf(out, "record mode %s, timer overhead %u ns subtracted, median of %d runs\n", bench_record_names[config.record_mode], overhead, config.repeat);
+    }
+    int first = 1;
+    for (size_t v = 0; v < config.var_count; v++) {
+        for (size_t s = 0; s < config.size_count; s++) {
+            for (size_t h = 0; h < config.history_count; h++) {
+                for (size_t m = 0; m < config.mode_count; m++) {
+                    if (config.history[h] == 0) {
+                        continue;
+                    }
+                    int done = 0;
+                    for (int r = 0; r < config.repeat; r++) {
+                        done += bench_run(&config, config.vars[v], config.sizes[s], config.history[h], config.modes[m], overhead, latency, &runs[done]) == 0;
+                    }
+                    if (done == 0) {
+                        return 1;
+                    }
+                    qsort(runs, (size_t)done, sizeof(runs[0]), bench_compare_p50);
+                    bench_print(out, config.format, &runs[done / 2], first);
+                    fflush(out);
+                    first = 0;
+                }
+            }
+        }
+    }
+    if (strcmp(config.format, "json") == 0) {
+        fprintf(out, "\n  ]\n}\n");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    free(runs);
+    free(latency);
+    return 0;
+}
@@ -0,0 +1,1159 @@
+#include <var_buffer_2.h>
+#include <vb2_reader.h>
+#include <vb2_schema.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/*
+    Round trip tests of the recorder features.
+    Every test records a file with known values and reads it back through the C reader. The files
+    are left in the test directory for testing/test_reader.py, which checks them with the Python reader.
+
+    make test
+    ./test_features [directory] [test name ...]   // A fresh directory in /tmp by default, every test
+*/
+
+static int test_failures;
+
+#define TEST_CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "  %s:%d: %s: %s\n", __FILE__, __LINE__, __func__, #cond); \
+            test_failures++; \
+        } \
+    } while (0)
+
+static const char *test_mode_names[] = { "sync", "async", "mmap" };
+
+// ***********************************************
+//              Recorded values
+// ***********************************************
+// Row k of the standard columns, testing/test_reader.py computes the same values
+struct Test_Row {
+    int    i;
+    long   l;
+    float  f;
+    double d;
+};
+
+static void test_set(struct Test_Row *row, long k) {
+    row->i = (int)(k * 3 - 7);
+    row->l = k * 1000003L;
+    row->f = (float)k * 0.5f;
+    row->d = (double)k / 7.0;
+}
+
+static void test_track(vb2_recorder *rec, struct Test_Row *row) {
+    vb2r_track_variable(rec, &row->i, "i", "", "int column", VB2_INT);
+    vb2r_track_variable(rec, &row->l, "l", "", "long column", VB2_LONG);
+    vb2r_track_variable(rec, &row->f, "f", "", "float column", VB2_FLOAT);
+    vb2r_track_variable(rec, &row->d, "d", "", "double column", VB2_DOUBLE);
+}
+
+// Records rows k = 0 .. rows - 1 of the standard columns
+static void test_record(vb2_recorder *rec, struct Test_Row *row, long rows) {
+    for (long k = 0; k < rows; k++) {
+        test_set(row, k);
+        vb2r_record_all(rec);
+    }
+}
+
+// Checks that rows [first, first + count) of the standard columns of an open file hold k = first_k ..
+static void test_check_rows(vb2_reader *rd, size_t first, size_t count, long first_k) {
+    const char *names[] = { "i", "l", "f", "d" };
+    struct Test_Row *rows = calloc(count ? count : 1, sizeof(struct Test_Row));
+    void *out = malloc((count ? count : 1) * sizeof(double));
+    TEST_CHECK(rows != NULL && out != NULL);
+    if (rows == NULL || out == NULL) {
+        free(rows);
+        free(out);
+        return;
+    }
+    for (size_t r = 0; r < count; r++) {
+        test_set(&rows[r], first_k + (long)r);
+    }
+    for (size_t c = 0; c < 4; c++) {
+        int col = vb2_reader_find(rd, names[c]);
+        TEST_CHECK(col >= 0);
+        if (col < 0) {
+            continue;
+        }
+        TEST_CHECK(vb2_reader_read(rd, col, first, count, 1, out) == count);
+        size_t wrong = 0;
+        for (size_t r = 0; r < count; r++) {
+            switch (c) {
+                case 0:  wrong += ((int *)out)[r] != rows[r].i;    break;
+                case 1:  wrong += ((long *)out)[r] != rows[r].l;   break;
+                case 2:  wrong += ((float *)out)[r] != rows[r].f;  break;
+                default: wrong += ((double *)out)[r] != rows[r].d; break;
+            }
+        }
+        TEST_CHECK(wrong == 0);
+    }
+    free(rows);
+    free(out);
+}
+
+// Opens filename and checks that it holds exactly count rows of the standard columns from k = first_k
+static void test_check_file(const char *filename, size_t count, long first_k) {
+    vb2_reader *rd = vb2_reader_open(filename);
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count == count);
+    test_check_rows(rd, 0, count, first_k);
+    vb2_reader_close(rd);
+}
+
+// Whether filename is mapped into this process, a mapped recording that fell back to staged writes is not
+static int test_mapped(const char *filename) {
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps == NULL) {
+        return 1; // Nothing to check against
+    }
+    char line[4096];
+    size_t length = strlen(filename);
+    int mapped = 0;
+    while (!mapped && fgets(line, sizeof(line), maps) != NULL) {
+        const char *name = strrchr(line, '/');
+        mapped = name != NULL && strncmp(name + 1, filename, length) == 0 && name[1 + length] == '\n';
+    }
+    fclose(maps);
+    return mapped;
+}
+
+// ***********************************************
+//              Tests
+// ***********************************************
+// Linear files in every write mode, rows past max_history are dropped. Mapped files start writeback as they go
+static void test_linear(void) {
+    for (int mode = VB2_WRITE_SYNC; mode <= VB2_WRITE_MMAP; mode++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "linear_%s.vb2", test_mode_names[mode]);
+        struct Test_Row row;
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        test_track(rec, &row);
+        vb2r_set_write_mode(rec, (enum vb2_write_mode)mode);
+        if (mode == VB2_WRITE_MMAP) {
+            vb2r_set_mmap_writeback(rec, 256);
+        }
+        vb2r_start(rec, 5000);
+        TEST_CHECK(test_mapped(filename) == (mode == VB2_WRITE_MMAP));
+        test_record(rec, &row, 5100);
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+        test_check_file(filename, 5000, 0);
+    }
+}
+
+// Every async policy with many columns behind one writer. Whatever DROP discards is listed in the
+// DROPPED section, every other sample reads back, and only BLOCK ever waits.
+#define TEST_ASYNC_COLUMNS 200
+#define TEST_ASYNC_ROWS    5000
+
+static void test_async_policies(void) {
+    static const char *names[] = { "block", "drop", "grow" };
+    static long columns[TEST_ASYNC_COLUMNS], values[TEST_ASYNC_ROWS];
+    for (int policy = VB2_ASYNC_BLOCK; policy <= VB2_ASYNC_GROW; policy++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "async_%s.vb2", names[policy]);
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        for (size_t c = 0; c < TEST_ASYNC_COLUMNS; c++) {
+            char name[16];
+            snprintf(name, sizeof(name), "c%zu", c);
+            vb2r_add_variable(rec, name, "", "", VB2_LONG, &columns[c], sizeof(long));
+        }
+        vb2r_set_write_mode(rec, VB2_WRITE_ASYNC);
+        vb2r_set_async_policy(rec, (enum vb2_async_policy)policy, 2);
+        vb2r_start(rec, TEST_ASYNC_ROWS);
+        for (long k = 0; k < TEST_ASYNC_ROWS; k++) {
+            for (size_t c = 0; c < TEST_ASYNC_COLUMNS; c++) {
+                columns[c] = k * TEST_ASYNC_COLUMNS + (long)c;
+            }
+            vb2r_record_all(rec);
+        }
+        vb2r_end(rec);
+        size_t stalls = vb2r_async_stalls(rec), dropped = vb2r_async_dropped(rec);
+        vb2_recorder_destroy(rec);
+        TEST_CHECK(policy == VB2_ASYNC_DROP || dropped == 0);
+        TEST_CHECK(policy == VB2_ASYNC_BLOCK || stalls == 0);
+
+        vb2_reader *rd = vb2_reader_open(filename);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        size_t count = 0, marked = 0, wrong = 0;
+        const struct vb2_dropped *ranges = vb2_reader_dropped(rd, &count);
+        for (size_t i = 0; i < count; i++) {
+            marked += ranges[i].rows * sizeof(long);
+        }
+        TEST_CHECK(marked == dropped);
+        for (int col = 0; col < TEST_ASYNC_COLUMNS; col++) {
+            TEST_CHECK(vb2_reader_column(rd, col)->count == TEST_ASYNC_ROWS);
+            vb2_reader_read(rd, col, 0, TEST_ASYNC_ROWS, 1, values);
+            for (size_t k = 0; k < TEST_ASYNC_ROWS; k++) {
+                int hole = 0;
+                for (size_t i = 0; i < count; i++) {
+                    hole |= ranges[i].block == (size_t)col && k >= ranges[i].first_row && k < ranges[i].first_row + ranges[i].rows;
+                }
+                wrong += !hole && values[k] != (long)k * TEST_ASYNC_COLUMNS + col;
+            }
+        }
+        TEST_CHECK(wrong == 0);
+        vb2_reader_close(rd);
+    }
+}
+
+// Rings keep the last max_history rows in recording order, also with mapped writeback
+static void test_ring(void) {
+    for (int mode = VB2_WRITE_SYNC; mode <= VB2_WRITE_MMAP; mode++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "ring_%s.vb2", test_mode_names[mode]);
+        struct Test_Row row;
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        test_track(rec, &row);
+        vb2r_set_write_mode(rec, (enum vb2_write_mode)mode);
+        vb2r_set_record_mode(rec, VB2_RECORD_RING);
+        if (mode == VB2_WRITE_MMAP) {
+            vb2r_set_mmap_writeback(rec, 256);
+        }
+        vb2r_start(rec, 1000);
+        test_record(rec, &row, 3517);
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+        test_check_file(filename, 1000, 2517);
+    }
+}
+
+// Stream mode with the delta of delta and xor codecs
+static void test_stream_codecs(void) {
+    for (int compress = 0; compress <= 1; compress++) {
+        const char *filename = compress ? "stream_compressed.vb2" : "stream.vb2";
+        struct Test_Row row;
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        test_track(rec, &row);
+        vb2r_set_record_mode(rec, VB2_RECORD_STREAM);
+        vb2r_set_compression(rec, compress);
+        vb2r_start(rec, 0);
+        test_record(rec, &row, 20000);
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+
+        vb2_reader *rd = vb2_reader_open(filename);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        TEST_CHECK(vb2_reader_flags(rd) & VB2_FLAG_CHUNKED);
+        TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "l"))->codec == (compress ? 1 : 0));
+        TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->codec == (compress ? 2 : 0));
+        TEST_CHECK(vb2_reader_chunk_count(rd, vb2_reader_find(rd, "d")) > 1);
+        TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count == 20000);
+        test_check_rows(rd, 0, 20000, 0);
+        test_check_rows(rd, 12345, 100, 12345); // Starts inside a chunk
+        vb2_reader_close(rd);
+    }
+}
+
+static void test_timestamps(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "timestamps.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_enable_timestamps(rec, VB2_CLOCK_MONOTONIC_RAW);
+    vb2r_start(rec, 1000);
+    test_record(rec, &row, 1000);
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("timestamps.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    TEST_CHECK(vb2_reader_flags(rd) & VB2_FLAG_TIMESTAMP);
+    size_t size = 0;
+    TEST_CHECK(vb2_reader_section(rd, "CLOCK", &size) != NULL && size > 0);
+    int64_t time[1000];
+    TEST_CHECK(vb2_reader_read(rd, vb2_reader_find(rd, VB2_TIME_NAME), 0, 1000, 1, time) == 1000);
+    size_t backwards = 0;
+    for (size_t r = 1; r < 1000; r++) {
+        backwards += time[r] < time[r - 1];
+    }
+    TEST_CHECK(backwards == 0 && time[0] > 0);
+    test_check_rows(rd, 0, 1000, 0);
+    vb2_reader_close(rd);
+}
+
+struct Test_Pose {
+    double x, y;
+    float  q[3];
+    int    id;
+};
+
+// Array and struct columns, with the members of the struct described
+static void test_wide(void) {
+    double arr[3];
+    struct Test_Pose pose;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "wide.vb2") == 0);
+    vb2r_track_variable(rec, &arr, "arr", "", "", VB2_ARRAY(VB2_DOUBLE, 3));
+    vb2r_track_variable(rec, &pose, "pose", "", "", VB2_STRUCT);
+    vb2r_track_field(rec, &pose, "pose", x, VB2_DOUBLE);
+    vb2r_track_field(rec, &pose, "pose", q, VB2_ARRAY(VB2_FLOAT, 3));
+    vb2r_track_field(rec, &pose, "pose", id, VB2_INT);
+    vb2r_start(rec, 500);
+    for (long k = 0; k < 500; k++) {
+        for (int j = 0; j < 3; j++) {
+            arr[j]    = (double)k + j * 0.25;
+            pose.q[j] = (float)(k - j);
+        }
+        pose.x  = (double)k;
+        pose.y  = (double)-k;
+        pose.id = (int)k;
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("wide.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    const struct vb2_column *column = vb2_reader_column(rd, vb2_reader_find(rd, "arr"));
+    TEST_CHECK(column->elements == 3 && column->base == VB2_TYPE_DOUBLE);
+    struct vb2_view view;
+    TEST_CHECK(vb2_reader_view(rd, vb2_reader_find(rd, "arr"), 0, 500, 1, &view) == 0);
+    TEST_CHECK(vb2_view_row(view, double, 321)[2] == 321.5);
+    TEST_CHECK(vb2_reader_view(rd, vb2_reader_find(rd, "pose"), 0, 500, 1, &view) == 0);
+    TEST_CHECK(vb2_view_row(view, struct Test_Pose, 77)->id == 77 && vb2_view_row(view, struct Test_Pose, 77)->q[2] == 75.0f);
+    size_t count = 0;
+    const struct vb2_field *fields = vb2_reader_fields(rd, vb2_reader_find(rd, "pose"), &count);
+    TEST_CHECK(count == 3 && fields != NULL);
+    if (count == 3) {
+        TEST_CHECK(strcmp(fields[1].name, "q") == 0 && fields[1].offset == offsetof(struct Test_Pose, q));
+    }
+    vb2_reader_close(rd);
+}
+
+// Level 0 entries cover their rows exactly
+static void test_summary(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "summary.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_set_summary(rec, 100, 1);
+    vb2r_start(rec, 10000);
+    test_record(rec, &row, 10000);
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("summary.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    size_t count = 0, covered = 0, wrong = 0;
+    const struct vb2_summary *entries = vb2_reader_summary(rd, vb2_reader_find(rd, "i"), 0, &count);
+    TEST_CHECK(entries != NULL && count >= 100); // Split where a staging buffer ends inside a run
+    for (size_t e = 0; e < count; e++) {
+        struct Test_Row first, last;
+        test_set(&first, (long)entries[e].first_row);
+        test_set(&last, (long)(entries[e].first_row + entries[e].rows - 1));
+        wrong   += entries[e].min != first.i || entries[e].max != last.i;
+        covered += entries[e].rows;
+    }
+    TEST_CHECK(wrong == 0 && covered == 10000);
+    TEST_CHECK(vb2_reader_summary(rd, vb2_reader_find(rd, "i"), 1, &count) != NULL && count > 0);
+    vb2_reader_close(rd);
+}
+
+// Many variables registered in bulk and saved with compact headers
+static void test_compact(void) {
+    enum { count = 2000 };
+    static double values[count];
+    static char names[count][16];
+    vb2_variable variables[count];
+    for (size_t v = 0; v < count; v++) {
+        snprintf(names[v], sizeof(names[v]), "v%zu", v);
+        variables[v] = (vb2_variable){ names[v], "m", "", VB2_DOUBLE, &values[v], sizeof(values[v]) };
+    }
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "compact.vb2") == 0);
+    TEST_CHECK(vb2r_add_variables(rec, variables, count) == count);
+    vb2r_set_compact_headers(rec, 1);
+    vb2r_start(rec, 100);
+    for (long k = 0; k < 100; k++) {
+        for (size_t v = 0; v < count; v++) {
+            values[v] = (double)(k * count + (long)v);
+        }
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("compact.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    TEST_CHECK(vb2_reader_flags(rd) & VB2_FLAG_COMPACT);
+    TEST_CHECK(vb2_reader_column_count(rd) == count);
+    int col = vb2_reader_find(rd, "v1234");
+    double value = 0;
+    TEST_CHECK(col >= 0 && strcmp(vb2_reader_column(rd, col)->unit, "m") == 0);
+    TEST_CHECK(vb2_reader_read(rd, col, 42, 1, 1, &value) == 1 && value == 42.0 * count + 1234);
+    vb2_reader_close(rd);
+}
+
+// Rotated files hold consecutive rows and a SEGMENT section each
+static void test_rotation(void) {
+    for (int mode = VB2_WRITE_SYNC; mode <= VB2_WRITE_MMAP; mode++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "rotation_%s.vb2", test_mode_names[mode]);
+        struct Test_Row row;
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        test_track(rec, &row);
+        vb2r_set_write_mode(rec, (enum vb2_write_mode)mode);
+        vb2r_set_rotation(rec, 1000, 0, 0);
+        vb2r_start(rec, 1000);
+        test_record(rec, &row, 4500);
+        vb2r_end(rec);
+        vb2r_close(rec);
+        vb2_recorder_destroy(rec);
+
+        for (size_t index = 0; index < 5; index++) {
+            char name[64];
+            snprintf(name, sizeof(name), index ? "rotation_%s.%04zu.vb2" : "rotation_%s.vb2", test_mode_names[mode], index);
+            vb2_reader *rd = vb2_reader_open(name);
+            TEST_CHECK(rd != NULL);
+            if (rd == NULL) {
+                continue;
+            }
+            size_t size = 0;
+            const struct vb2_segment *segment = vb2_reader_section(rd, "SEGMENT", &size);
+            TEST_CHECK(segment != NULL && segment->index == index && segment->first_row == index * 1000);
+            size_t rows = index < 4 ? 1000 : 500;
+            TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count == rows);
+            test_check_rows(rd, 0, rows, (long)index * 1000);
+            vb2_reader_close(rd);
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "rotation_%s.0005.vb2", test_mode_names[mode]);
+        TEST_CHECK(access(name, F_OK) != 0); // The spare prepared for a fifth rotation is removed
+    }
+}
+
+// Rotating every 10 rows keeps the rotation thread busy with the files just retired while the next
+// rotations take their spares, every file must still get a name and SEGMENT index of its own
+static void test_rotation_fast(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "rotation_fast.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_set_write_mode(rec, VB2_WRITE_ASYNC);
+    vb2r_set_rotation(rec, 10, 0, 0);
+    vb2r_start(rec, 10);
+    test_record(rec, &row, 295);
+    vb2r_end(rec);
+    vb2r_close(rec);
+    vb2_recorder_destroy(rec);
+
+    char name[64];
+    for (size_t index = 0; index < 30; index++) {
+        snprintf(name, sizeof(name), index ? "rotation_fast.%04zu.vb2" : "rotation_fast.vb2", index);
+        vb2_reader *rd = vb2_reader_open(name);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        size_t size = 0;
+        const struct vb2_segment *segment = vb2_reader_section(rd, "SEGMENT", &size);
+        TEST_CHECK(segment != NULL && segment->index == index && segment->first_row == index * 10);
+        test_check_rows(rd, 0, index < 29 ? 10 : 5, (long)index * 10);
+        vb2_reader_close(rd);
+    }
+    TEST_CHECK(access("rotation_fast.0030.vb2", F_OK) != 0);
+}
+
+// Windows of 10 rows before and 20 after a fault that holds for one row every 1000
+static void test_capture(void) {
+    struct Test_Row row;
+    int fault = 0;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "capture.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_track_variable(rec, &fault, "fault", "", "", VB2_INT);
+    vb2r_set_trigger_window(rec, 10, 20);
+    TEST_CHECK(vb2r_add_trigger(rec, "fault", VB2_TRIGGER_NOT_EQUAL, 0) == 0);
+    vb2r_start(rec, 10000);
+    for (long k = 0; k < 5000; k++) {
+        test_set(&row, k);
+        fault = k % 1000 == 500;
+        vb2r_record_all(rec);
+    }
+    TEST_CHECK(vb2r_trigger_events(rec) == 5);
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("capture.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    size_t count = 0;
+    const struct vb2_trigger_event *events = vb2_reader_triggers(rd, &count);
+    TEST_CHECK(events != NULL && count == 5);
+    TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count == 5 * 31);
+    for (size_t e = 0; e < count; e++) {
+        TEST_CHECK(events[e].tick == e * 1000 + 500 && events[e].first_row == e * 31);
+        TEST_CHECK(events[e].row == events[e].first_row + 10 && events[e].rows == 31 && events[e].value == 1);
+        test_check_rows(rd, (size_t)events[e].first_row, 31, (long)(e * 1000 + 490));
+    }
+    vb2_reader_close(rd);
+}
+
+// A column stored every 4 rows and one stored on change, read back aligned with the rows
+static void test_sampling(void) {
+    struct Test_Row row;
+    int mode = 0;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "sampling.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_track_variable(rec, &mode, "mode", "", "", VB2_INT);
+    TEST_CHECK(vb2r_set_divisor(rec, "d", 4) == 0);
+    TEST_CHECK(vb2r_set_change_only(rec, "mode", 0) == 0);
+    TEST_CHECK(vb2r_set_divisor(rec, "missing", 4) == -1);
+    vb2r_start(rec, 1000);
+    for (long k = 0; k < 1000; k++) {
+        test_set(&row, k);
+        mode = (int)(k / 300);
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("sampling.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    int d = vb2_reader_find(rd, "d"), m = vb2_reader_find(rd, "mode");
+    TEST_CHECK(vb2_reader_column(rd, d)->count == 250 && vb2_reader_column(rd, m)->count == 4);
+    TEST_CHECK(vb2_reader_find(rd, VB2_ROW_PREFIX "d") >= 0);
+    TEST_CHECK(vb2_reader_sampling(rd, d) != NULL && vb2_reader_sampling(rd, d)->divisor == 4);
+    TEST_CHECK(vb2_reader_aligned_count(rd, d) == 1000);
+    static double values[1000];
+    static int modes[1000];
+    TEST_CHECK(vb2_reader_read_aligned(rd, d, 0, 1000, values) == 1000);
+    TEST_CHECK(vb2_reader_read_aligned(rd, m, 0, 1000, modes) == 1000);
+    size_t wrong = 0;
+    for (long k = 0; k < 1000; k++) {
+        wrong += values[k] != (double)(k - k % 4) / 7.0 || modes[k] != (int)(k / 300);
+    }
+    TEST_CHECK(wrong == 0);
+    TEST_CHECK(vb2_reader_read_aligned(rd, d, 601, 10, values) == 10 && values[0] == 600 / 7.0 && values[3] == 604 / 7.0);
+    vb2_reader_close(rd);
+}
+
+// A session recording every row after a sampled one drops the row index column, a third brings it back
+static void test_resampling(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "resampling.vb2") == 0);
+    test_track(rec, &row);
+    size_t divisors[3] = { 4, 1, 5 }, rows[3] = { 100, 200, 300 };
+    for (size_t session = 0; session < 3; session++) {
+        TEST_CHECK(vb2r_set_divisor(rec, "d", divisors[session]) == 0);
+        vb2r_start(rec, rows[session]);
+        test_record(rec, &row, (long)rows[session]);
+        vb2r_end(rec);
+
+        vb2_reader *rd = vb2_reader_open("resampling.vb2");
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            break;
+        }
+        int d = vb2_reader_find(rd, "d"), index = vb2_reader_find(rd, VB2_ROW_PREFIX "d");
+        TEST_CHECK(vb2_reader_column_count(rd) == (divisors[session] > 1 ? 5 : 4));
+        TEST_CHECK((index >= 0) == (divisors[session] > 1));
+        TEST_CHECK(vb2_reader_column(rd, d)->count == (rows[session] + divisors[session] - 1) / divisors[session]);
+        TEST_CHECK(vb2_reader_aligned_count(rd, d) == rows[session]);
+        if (divisors[session] == 1) {
+            test_check_rows(rd, 0, rows[session], 0);
+        }
+        vb2_reader_close(rd);
+    }
+    vb2_recorder_destroy(rec);
+}
+
+// A column sampled every 3 rows in a rotation, each file starts with a sample of its own
+static void test_sampled_files(void) {
+    struct Test_Row row;
+    long slow = 0;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "sampled_files.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_track_variable(rec, &slow, "slow", "", "", VB2_LONG);
+    TEST_CHECK(vb2r_set_divisor(rec, "slow", 3) == 0);
+    vb2r_set_rotation(rec, 1000, 0, 0);
+    vb2r_start(rec, 1000);
+    for (long k = 0; k < 2500; k++) {
+        test_set(&row, k);
+        slow = k;
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    for (size_t index = 0; index < 3; index++) {
+        char name[64];
+        snprintf(name, sizeof(name), index ? "sampled_files.%04zu.vb2" : "sampled_files.vb2", index);
+        vb2_reader *rd = vb2_reader_open(name);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        size_t rows = index < 2 ? 1000 : 500;
+        int column = vb2_reader_find(rd, "slow");
+        TEST_CHECK(vb2_reader_aligned_count(rd, column) == rows && vb2_reader_column(rd, column)->count == (rows + 2) / 3);
+        static long values[1000];
+        TEST_CHECK(vb2_reader_read_aligned(rd, column, 0, rows, values) == rows);
+        size_t wrong = 0;
+        for (size_t r = 0; r < rows; r++) {
+            wrong += values[r] != (long)(index * 1000 + r - r % 3);
+        }
+        TEST_CHECK(wrong == 0);
+        vb2_reader_close(rd);
+    }
+}
+
+// A reader follows a linear file while it is recorded
+static void test_live(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "live.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_set_live(rec, 100);
+    vb2r_start(rec, 5000);
+    vb2_reader *rd = NULL;
+    size_t seen = 0;
+    for (long k = 0; k < 5000; k++) {
+        test_set(&row, k);
+        vb2r_record_all(rec);
+        if (k % 733 != 0) {
+            continue;
+        }
+        if (rd == NULL) {
+            rd = vb2_reader_open("live.vb2");
+            TEST_CHECK(rd != NULL && vb2_reader_live(rd));
+        } else {
+            TEST_CHECK(vb2_reader_refresh(rd) >= 0);
+        }
+        size_t count = vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count;
+        TEST_CHECK(count == (size_t)(k + 1) / 100 * 100 && count >= seen);
+        test_check_rows(rd, 0, count, 0);
+        seen = count;
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+    TEST_CHECK(vb2_reader_refresh(rd) >= 0 && !vb2_reader_live(rd));
+    TEST_CHECK(vb2_reader_column(rd, vb2_reader_find(rd, "d"))->count == 5000);
+    test_check_rows(rd, 0, 5000, 0);
+    vb2_reader_close(rd);
+}
+
+// A reader of a live ring that falls behind gets nothing back for the rows the writer lapped
+static void test_live_ring(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "live_ring.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_set_record_mode(rec, VB2_RECORD_RING);
+    vb2r_set_live(rec, 100);
+    vb2r_start(rec, 1000);
+    long k = 0;
+    for (; k < 2500; k++) {
+        test_set(&row, k);
+        vb2r_record_all(rec);
+    }
+    vb2_reader *rd = vb2_reader_open("live_ring.vb2");
+    TEST_CHECK(rd != NULL && vb2_reader_live(rd));
+    if (rd == NULL) {
+        vb2_recorder_destroy(rec);
+        return;
+    }
+    int col = vb2_reader_find(rd, "l");
+    TEST_CHECK(vb2_reader_column(rd, col)->count == 900);
+    test_check_rows(rd, 0, 900, 1600);
+    for (; k < 2800; k++) {
+        test_set(&row, k);
+        vb2r_record_all(rec);
+    }
+    static long values[900];
+    TEST_CHECK(vb2_reader_read(rd, col, 0, 900, 1, values) == 0);
+    TEST_CHECK(vb2_reader_read(rd, col, 300, 600, 1, values) == 600 && values[0] == 1900 * 1000003L);
+    TEST_CHECK(vb2_reader_refresh(rd) == 300);
+    test_check_rows(rd, 0, 900, 1900);
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+    TEST_CHECK(vb2_reader_refresh(rd) >= 0 && !vb2_reader_live(rd));
+    test_check_rows(rd, 0, 1000, 1800);
+    vb2_reader_close(rd);
+}
+
+// A consumer of the shared memory ring sees the latest row and every row it keeps up with
+static void test_shm(void) {
+    char name[64];
+    snprintf(name, sizeof(name), "vb2_test_%d", (int)getpid());
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "shm.vb2") == 0);
+    test_track(rec, &row);
+    TEST_CHECK(vb2r_set_shm(rec, name, 64) == 0);
+    TEST_CHECK(vb2r_shm_select(rec, "l") == 0);
+    vb2r_start(rec, 1000);
+    vb2_shm_reader *shm = vb2_shm_open(name);
+    TEST_CHECK(shm != NULL);
+    if (shm == NULL) {
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+        return;
+    }
+    size_t offset = 0;
+    TEST_CHECK(vb2_shm_column_count(shm) == 1 && vb2_shm_column(shm, vb2_shm_find(shm, "l"), &offset) != NULL);
+    uint64_t cursor = 0, missed = 0;
+    size_t read = 0, wrong = 0;
+    struct vb2_shm_row info[64];
+    uint8_t rows[64 * 64];
+    for (long k = 0; k < 1000; k++) {
+        test_set(&row, k);
+        vb2r_record_all(rec);
+        if (k % 50 == 49) {
+            size_t n = vb2_shm_read(shm, &cursor, info, rows, 64, &missed);
+            for (size_t r = 0; r < n; r++) {
+                long l;
+                memcpy(&l, rows + r * vb2_shm_row_size(shm) + offset, sizeof(l));
+                wrong += l != (long)(info[r].tick * 1000003);
+            }
+            read += n;
+        }
+    }
+    long latest = 0;
+    TEST_CHECK(vb2_shm_latest(shm, info, rows) == 0);
+    memcpy(&latest, rows + offset, sizeof(latest));
+    TEST_CHECK(info[0].tick == 999 && latest == 999 * 1000003L);
+    TEST_CHECK(read == 1000 && missed == 0 && wrong == 0);
+    vb2r_end(rec);
+    TEST_CHECK(vb2_shm_ended(shm));
+    vb2_shm_close(shm);
+    vb2r_close(rec);
+    vb2_recorder_destroy(rec);
+}
+
+// Binary log records saved in the file, indexed by tick
+static void test_log_events(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "events.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_enable_log_events(rec);
+    vb2r_start(rec, 1000);
+    for (long k = 0; k < 1000; k++) {
+        test_set(&row, k);
+        if (k % 100 == 0) {
+            VBR_BLOG(rec, VB_LOG_WARNING, "row %ld of %s at %.2f", k, "events", row.d);
+        }
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("events.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    TEST_CHECK(vb2_reader_event_count(rd) == 10);
+    size_t first = 0;
+    TEST_CHECK(vb2_reader_event_range(rd, 250, 450, &first) == 2 && first == 3);
+    struct vb2_event event;
+    char message[128];
+    TEST_CHECK(vb2_reader_event(rd, 3, &event, message, sizeof(message)) == 0);
+    TEST_CHECK(event.tick == 300 && event.level == VB_LOG_WARNING && event.file != NULL);
+    TEST_CHECK(strcmp(message, "row 300 of events at 42.86") == 0);
+    vb2_reader_close(rd);
+}
+
+// The .log file of binary logging decodes to the lines a text log would hold
+static void test_binary_log(void) {
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "blog.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_log_set_binary(rec, 1);
+    vb2r_enable_log(rec);
+    vb2r_start(rec, 100);
+    for (long k = 0; k < 100; k++) {
+        test_set(&row, k);
+        VBR_BLOG(rec, VB_LOG_INFO, "k=%ld i=%d name=%s", k, row.i, "blog");
+        vb2r_record_all(rec);
+    }
+    vb2r_end(rec);
+    vb2r_log_close(rec);
+    vb2_recorder_destroy(rec);
+
+    FILE *in = fopen("blog.vb2.log", "rb"), *out = tmpfile();
+    TEST_CHECK(in != NULL && out != NULL);
+    if (in == NULL || out == NULL) {
+        return;
+    }
+    TEST_CHECK(vb2_log_decode(in, out) == 100);
+    char text[1 << 16];
+    rewind(out);
+    size_t size = fread(text, 1, sizeof(text) - 1, out);
+    text[size] = '\0';
+    TEST_CHECK(strstr(text, "k=57 i=164 name=blog") != NULL);
+    fclose(in);
+    fclose(out);
+
+    // Wide characters and long double fall back to text formatted on the spot, id 1
+    TEST_CHECK(vb2_blog_register("%5.*f %lu %s", __FILE__, __LINE__) > 1);
+    TEST_CHECK(vb2_blog_register("%lc", __FILE__, __LINE__) == 1 && vb2_blog_register("%ls", __FILE__, __LINE__) == 1);
+    TEST_CHECK(vb2_blog_register("%Lf", __FILE__, __LINE__) == 1);
+}
+
+// Appends a binary log record, id 0 defines format id with the types of its arguments
+static size_t test_blog_record(uint8_t *at, uint32_t id, const void *payload, size_t size) {
+    struct { uint32_t id; uint8_t level, reserved; uint16_t size; uint64_t tick; } record = { id, VB_LOG_INFO, 0, (uint16_t)size, 1 };
+    memcpy(at, &record, sizeof(record));
+    memcpy(at + sizeof(record), payload, size);
+    return sizeof(record) + size;
+}
+
+static size_t test_blog_define(uint8_t *at, uint32_t id, const char *types, const char *fmt) {
+    uint8_t payload[256];
+    uint32_t line = 7;
+    size_t count = strlen(types), size = 9;
+    memcpy(payload, &id, 4);
+    memcpy(payload + 4, &line, 4);
+    payload[8] = (uint8_t)count;
+    memcpy(payload + size, types, count);
+    size += count;
+    memcpy(payload + size, "crafted.c", 10);
+    size += 10;
+    memcpy(payload + size, fmt, strlen(fmt) + 1);
+    size += strlen(fmt) + 1;
+    return test_blog_record(at, 0, payload, size);
+}
+
+// A log whose records claim more than the writer ever stores decodes without overrunning anything
+static void test_blog_untrusted(void) {
+    static uint8_t log[16384];
+    struct { char magic[8]; uint32_t version, reserved; } header = { "VB2BLOG", 1, 0 };
+    size_t size = 0;
+    memcpy(log, &header, sizeof(header));
+    size += sizeof(header);
+    uint8_t text[2 + 4000];
+    uint16_t length = 4000;
+    memcpy(text, &length, 2);
+    memset(text + 2, 'A', 4000);
+    size += test_blog_define(log + size, 2, "s", "big %s end");
+    size += test_blog_record(log + size, 2, text, sizeof(text));        // Longer than any %s the writer keeps
+    size += test_blog_define(log + size, 3, "", "star %*d end");
+    size += test_blog_record(log + size, 3, "", 0);                      // More conversions than arguments
+    size += test_blog_define(log + size, 4, "i", "int as %s end");
+    size += test_blog_record(log + size, 4, "\1\0\0\0", 4);            // Argument type and conversion disagree
+    size += test_blog_define(log + size, 5, "p", "store %n%p end");
+    size += test_blog_record(log + size, 5, "\0\0\0\0\0\0\0\0", 8);
+    FILE *in = fopen("untrusted.log", "w+b"), *out = tmpfile();
+    TEST_CHECK(in != NULL && out != NULL);
+    if (in == NULL || out == NULL) {
+        return;
+    }
+    fwrite(log, 1, size, in);
+    rewind(in);
+    TEST_CHECK(vb2_log_decode(in, out) == 4);
+    char decoded[8192], expected[300];
+    rewind(out);
+    size_t got = fread(decoded, 1, sizeof(decoded) - 1, out);
+    decoded[got] = '\0';
+    memset(expected, 'A', 255);
+    memcpy(expected + 255, " end", 5);
+    TEST_CHECK(strstr(decoded, expected) != NULL && strstr(decoded, "AAAA" "A end") != NULL);
+    TEST_CHECK(strstr(decoded, "star \n") != NULL);                   // Decoding stops at the missing argument
+    TEST_CHECK(strstr(decoded, "int as  end") != NULL);
+    TEST_CHECK(strstr(decoded, "store ") != NULL);
+    fclose(in);
+    fclose(out);
+}
+
+#define TEST_ROBOT_SCHEMA(X, A) \
+    X(double, position, "m", "Joint position") \
+    X(int,    state,    "",  "Controller state") \
+    A(float,  joints, 4, "rad", "Joint angles")
+VB2_SCHEMA(test_robot, TEST_ROBOT_SCHEMA)
+
+// A schema snapshot recorded as one struct column with a field per member
+static void test_schema(void) {
+    double position = 0;
+    int state = 0;
+    float joints[4] = { 0 };
+    struct test_robot_snapshot snapshot;
+    struct test_robot_sources sources = { &position, &state, &joints };
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "schema.vb2") == 0);
+    test_robot_track(rec, "robot", &snapshot);
+    vb2r_start(rec, 200);
+    for (long k = 0; k < 200; k++) {
+        position  = (double)k * 0.5;
+        state     = (int)(k % 3);
+        joints[3] = (float)k;
+        test_robot_record(rec, &snapshot, &sources);
+    }
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("schema.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    int col = vb2_reader_find(rd, "robot");
+    size_t count = 0;
+    TEST_CHECK(vb2_reader_fields(rd, col, &count) != NULL && count == 3);
+    struct vb2_view view;
+    TEST_CHECK(vb2_reader_view(rd, col, 0, 200, 1, &view) == 0);
+    const struct test_robot_snapshot *last = vb2_view_row(view, struct test_robot_snapshot, 199);
+    TEST_CHECK(last->position == 99.5 && last->state == 1 && last->joints[3] == 199.0f);
+    vb2_reader_close(rd);
+}
+
+// Self instrumentation counts stored and dropped rows and saves a STATS section when compiled in
+// (make test STATS=1), and reports nothing otherwise
+static void test_stats(void) {
+    struct Test_Row row;
+    vb2_stats stats;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, "stats.vb2") == 0);
+    test_track(rec, &row);
+    vb2r_start(rec, 1000);
+    test_record(rec, &row, 1100);
+    int enabled = vb2r_get_stats(rec, &stats) == 0;
+#ifdef VB2_STATS_ENABLED
+    TEST_CHECK(enabled && stats.records == 1000 && stats.dropped_rows == 100);
+#else
+    TEST_CHECK(!enabled && stats.records == 0);
+#endif
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+
+    vb2_reader *rd = vb2_reader_open("stats.vb2");
+    TEST_CHECK(rd != NULL);
+    if (rd == NULL) {
+        return;
+    }
+    size_t size = 0;
+    TEST_CHECK((vb2_reader_section(rd, "STATS", &size) != NULL) == enabled);
+    test_check_rows(rd, 0, 1000, 0);
+    vb2_reader_close(rd);
+}
+
+// Recorders on their own threads, each in a write mode of its own and with its own length
+#define TEST_RECORDERS 4
+
+static void *test_recorder_thread(void *arg) {
+    size_t t = (size_t)arg;
+    char filename[64];
+    snprintf(filename, sizeof(filename), "recorder_%zu.vb2", t);
+    struct Test_Row row;
+    vb2_recorder *rec = vb2_recorder_create();
+    TEST_CHECK(vb2r_open(rec, filename) == 0);
+    test_track(rec, &row);
+    vb2r_set_write_mode(rec, (enum vb2_write_mode)(t % 3));
+    vb2r_start(rec, 1000 * (t + 1));
+    test_record(rec, &row, 1000 * (long)(t + 1));
+    vb2r_end(rec);
+    vb2_recorder_destroy(rec);
+    return NULL;
+}
+
+static void test_recorders(void) {
+    pthread_t threads[TEST_RECORDERS];
+    for (size_t t = 0; t < TEST_RECORDERS; t++) {
+        TEST_CHECK(pthread_create(&threads[t], NULL, test_recorder_thread, (void *)t) == 0);
+    }
+    for (size_t t = 0; t < TEST_RECORDERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    for (size_t t = 0; t < TEST_RECORDERS; t++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "recorder_%zu.vb2", t);
+        test_check_file(filename, 1000 * (t + 1), 0);
+    }
+}
+
+// Int and double columns registered alternately. The record loop copies each size as a group, every
+// column must still read back its own values
+#define TEST_CLASS_PAIRS 50
+#define TEST_CLASS_ROWS  300
+
+static void test_size_classes(void) {
+    static int ints[TEST_CLASS_PAIRS], int_values[TEST_CLASS_ROWS];
+    static double doubles[TEST_CLASS_PAIRS], double_values[TEST_CLASS_ROWS];
+    for (int mode = VB2_WRITE_SYNC; mode <= VB2_WRITE_MMAP; mode++) {
+        char filename[64];
+        snprintf(filename, sizeof(filename), "classes_%s.vb2", test_mode_names[mode]);
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        for (size_t p = 0; p < TEST_CLASS_PAIRS; p++) {
+            char name[16];
+            snprintf(name, sizeof(name), "i%zu", p);
+            vb2r_track_variable(rec, &ints[p], name, "", "", VB2_INT);
+            snprintf(name, sizeof(name), "d%zu", p);
+            vb2r_track_variable(rec, &doubles[p], name, "", "", VB2_DOUBLE);
+        }
+        vb2r_set_write_mode(rec, (enum vb2_write_mode)mode);
+        vb2r_start(rec, TEST_CLASS_ROWS);
+        for (long k = 0; k < TEST_CLASS_ROWS; k++) {
+            for (size_t p = 0; p < TEST_CLASS_PAIRS; p++) {
+                ints[p]    = (int)(k * TEST_CLASS_PAIRS + (long)p);
+                doubles[p] = -0.25 * (double)ints[p];
+            }
+            vb2r_record_all(rec);
+        }
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+
+        vb2_reader *rd = vb2_reader_open(filename);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        TEST_CHECK(vb2_reader_column_count(rd) == 2 * TEST_CLASS_PAIRS);
+        size_t wrong = 0;
+        for (size_t p = 0; p < TEST_CLASS_PAIRS; p++) {
+            char name[16];
+            snprintf(name, sizeof(name), "i%zu", p);
+            TEST_CHECK(vb2_reader_read(rd, vb2_reader_find(rd, name), 0, TEST_CLASS_ROWS, 1, int_values) == TEST_CLASS_ROWS);
+            snprintf(name, sizeof(name), "d%zu", p);
+            TEST_CHECK(vb2_reader_read(rd, vb2_reader_find(rd, name), 0, TEST_CLASS_ROWS, 1, double_values) == TEST_CLASS_ROWS);
+            for (long k = 0; k < TEST_CLASS_ROWS; k++) {
+                int expected = (int)(k * TEST_CLASS_PAIRS + (long)p);
+                wrong += int_values[k] != expected || double_values[k] != -0.25 * (double)expected;
+            }
+        }
+        TEST_CHECK(wrong == 0);
+        vb2_reader_close(rd);
+    }
+}
+
+// Zero copy views of a linear file and of a ring that wrapped, the ring also as its two segments
+static void test_views(void) {
+    for (int ring = 0; ring <= 1; ring++) {
+        const char *filename = ring ? "views_ring.vb2" : "views.vb2";
+        long first_k = ring ? 300 : 0;
+        struct Test_Row row;
+        vb2_recorder *rec = vb2_recorder_create();
+        TEST_CHECK(vb2r_open(rec, filename) == 0);
+        test_track(rec, &row);
+        if (ring) {
+            vb2r_set_record_mode(rec, VB2_RECORD_RING);
+        }
+        vb2r_start(rec, 1000);
+        test_record(rec, &row, 1000 + first_k);
+        vb2r_end(rec);
+        vb2_recorder_destroy(rec);
+        test_check_file(filename, 1000, first_k);
+
+        vb2_reader *rd = vb2_reader_open(filename);
+        TEST_CHECK(rd != NULL);
+        if (rd == NULL) {
+            continue;
+        }
+        TEST_CHECK(!(vb2_reader_flags(rd) & VB2_FLAG_RING) == !ring);
+        int col = vb2_reader_find(rd, "d");
+        struct vb2_view view, segments[2];
+        TEST_CHECK(vb2_reader_view(rd, col, 10, 100, 3, &view) == 0);
+        TEST_CHECK(view.count == 100 && vb2_view_at(view, double, 99) == (double)(first_k + 307) / 7.0);
+        TEST_CHECK(vb2_reader_view(rd, col, 600, 200, 1, &view) == (ring ? -1 : 0)); // Crosses the wrap of the ring
+        TEST_CHECK(vb2_reader_segments(rd, col, segments) == 0);
+        TEST_CHECK(segments[0].count == 1000 - (size_t)first_k && segments[1].count == (size_t)first_k);
+        TEST_CHECK(vb2_view_at(segments[0], double, 0) == (double)first_k / 7.0);
+        TEST_CHECK(!ring || vb2_view_at(segments[1], double, 0) == 1000 / 7.0);
+        vb2_reader_close(rd);
+    }
+}
+
+// ***********************************************
+//              Runner
+// ***********************************************
+struct Test_Case {
+    const char *name;
+    void (*run)(void);
+};
+
+static const struct Test_Case test_cases[] = {
+    { "linear",         test_linear },
+    { "ring",           test_ring },
+    { "async_policies", test_async_policies },
+    { "stream_codecs",  test_stream_codecs },
+    { "timestamps",     test_timestamps },
+    { "wide",           test_wide },
+    { "summary",        test_summary },
+    { "compact",        test_compact },
+    { "rotation",       test_rotation },
+    { "rotation_fast",  test_rotation_fast },
+    { "capture",        test_capture },
+    { "sampling",       test_sampling },
+    { "resampling",     test_resampling },
+    { "sampled_files",  test_sampled_files },
+    { "live",           test_live },
+    { "live_ring",      test_live_ring },
+    { "shm",            test_shm },
+    { "log_events",     test_log_events },
+    { "binary_log",     test_binary_log },
+    { "blog_untrusted", test_blog_untrusted },
+    { "schema",         test_schema },
+    { "stats",          test_stats },
+    { "recorders",      test_recorders },
+    { "size_classes",   test_size_classes },
+    { "views",          test_views },
+};
+
+int main(int argc, char **argv) {
+    char dir[64] = "/tmp/vb2_test.XXXXXX";
+    if (argc > 1) {
+        snprintf(dir, sizeof(dir), "%s", argv[1]);
+    } else if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+    if (chdir(dir) != 0) {
+        perror(dir);
+        return 1;
+    }
+    int failed = 0;
+    for (size_t t = 0; t < sizeof(test_cases) / sizeof(test_cases[0]); t++) {
+        int selected = argc <= 2;
+        for (int a = 2; a < argc; a++) {
+            selected |= strcmp(argv[a], test_cases[t].name) == 0;
+        }
+        if (!selected) {
+            continue;
+        }
+        int before = test_failures;
+        test_cases[t].run();
+        printf("%-16s %s\n", test_cases[t].name, test_failures == before ? "ok" : "FAILED");
+        failed += test_failures != before;
+    }
+    printf("%d failed, files in %s\n", failed, dir);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,152 @@
+"""
+Checks the files testing/test_features.c leaves behind through py/vb2_reader.py.
+
+    make test
+    python3 testing/test_reader.py test_output
+"""
+import os
+import subprocess
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+sys.path.insert(0, os.path.join(ROOT, 'py'))
+try:
+    import numpy as np
+except ImportError:
+    np = None
+
+failures = []
+
+def check(condition, what):
+    if not condition:
+        failures.append(what)
+
+def expected(k):
+    """ Row k of the standard columns, as test_set() in test_features.c records it. """
+    k = np.asarray(k, dtype=np.int64)
+    return {'i': (k * 3 - 7).astype(np.int32), 'l': k * 1000003, 'f': k.astype(np.float32) * np.float32(0.5), 'd': k / 7.0}
+
+def check_rows(name, data, k):
+    for column, values in expected(k).items():
+        check(np.array_equal(np.asarray(data[column]), values), f"{name}: {column}")
+
+def open_reader(directory, name):
+    reader = VB2Reader(os.path.join(directory, name))
+    reader.open()
+    return reader
+
+def test_files(directory):
+    for mode in ('sync', 'async', 'mmap'):
+        check_rows(f"linear_{mode}", open_reader(directory, f"linear_{mode}.vb2"), np.arange(5000))
+        check_rows(f"ring_{mode}", open_reader(directory, f"ring_{mode}.vb2"), np.arange(2517, 3517))
+    for name in ('stream', 'stream_compressed'):
+        reader = open_reader(directory, name + '.vb2')
+        check_rows(name, reader, np.arange(20000))
+        check(np.array_equal(reader.rows('d', 12345, 12445), expected(np.arange(12345, 12445))['d']), f"{name}: rows()")
+
+    for policy in ('block', 'drop', 'grow'):
+        reader = open_reader(directory, f"async_{policy}.vb2")
+        dropped = reader.dropped()
+        check(policy == 'drop' or len(dropped) == 0, f"async_{policy}: DROPPED section")
+        kept = np.ones(5000, dtype=bool)
+        for entry in dropped[dropped['block'] == 7]:
+            kept[int(entry['first_row']):int(entry['first_row'] + entry['rows'])] = False
+        check(np.array_equal(reader['c7'][kept], (np.arange(5000) * 200 + 7)[kept]), f"async_{policy}: rows kept")
+
+    reader = open_reader(directory, 'timestamps.vb2')
+    seconds = reader.times()
+    check(len(seconds) == 1000 and np.all(np.diff(seconds) >= 0), "timestamps: times()")
+
+    reader = open_reader(directory, 'wide.vb2')
+    check(reader['arr'].shape == (500, 3) and reader['arr'][321][2] == 321.5, "wide: array column")
+    pose = reader['pose']
+    check(pose['id'][77] == 77 and pose['q'][77][2] == 75.0, "wide: struct fields")
+
+    reader = open_reader(directory, 'summary.vb2')
+    summary = reader.summary('i')
+    check(summary['rows'].sum() == 10000 and summary['max'].max() == 9999 * 3 - 7, "summary: level 0")
+
+    reader = open_reader(directory, 'compact.vb2')
+    check(len(reader.vars) == 2000 and reader['v1234'][42] == 42 * 2000 + 1234, "compact: headers")
+
+    for mode in ('sync', 'async', 'mmap'):
+        for index in range(5):
+            name = f"rotation_{mode}.{index:04d}.vb2" if index else f"rotation_{mode}.vb2"
+            segment = open_reader(directory, name).segment
+            check(segment is not None and segment.index == index and segment.first_row == index * 1000, f"{name}: SEGMENT")
+        dataset = VB2Dataset(os.path.join(directory, f"rotation_{mode}*.vb2"))
+        dataset.open()
+        check(len(dataset.readers) == 5 and len(dataset['d']) == 4500, f"rotation_{mode}: dataset length")
+        check_rows(f"rotation_{mode}", {c: dataset[c][:] for c in 'ilfd'}, np.arange(4500))
+        check(np.array_equal(dataset['l'][995:1005], expected(np.arange(995, 1005))['l']), f"rotation_{mode}: slice across files")
+        dataset.close()
+
+    reader = open_reader(directory, 'capture.vb2')
+    events = reader.trigger_events()
+    check(list(events['tick']) == [500, 1500, 2500, 3500, 4500], "capture: events")
+    check(reader.variable_name(int(events['block'][0])) == 'fault', "capture: trigger variable")
+    check(np.array_equal(reader.trigger_window('l', 2), expected(np.arange(2490, 2521))['l']), "capture: window")
+
+    reader = open_reader(directory, 'sampling.vb2')
+    k = np.arange(1000)
+    check(set(reader.sampling) == {'d', 'mode'}, "sampling: SAMPLED section")
+    check(np.array_equal(reader.aligned('d'), (k - k % 4) / 7.0), "sampling: divisor")
+    check(np.array_equal(reader.aligned('mode'), k // 300), "sampling: change only")
+    check(np.array_equal(reader.aligned('d', 601, 611), (np.arange(601, 611) // 4 * 4) / 7.0), "sampling: range")
+
+    dataset = VB2Dataset(os.path.join(directory, "sampled_files*.vb2"))
+    dataset.open()
+    k = np.arange(2500)
+    check(len(dataset['slow']) == 2500 and not any(name.startswith(VB2_ROW_PREFIX) for name in dataset.vars), "sampled_files: dataset columns")
+    check(np.array_equal(dataset['slow'][:], k - k % 1000 % 3), "sampled_files: aligned across files")
+    check(np.array_equal(dataset['slow'][995:1010:2], np.arange(995, 1010, 2) - np.arange(995, 1010, 2) % 1000 % 3), "sampled_files: slice")
+    dataset.close()
+
+    stats = open_reader(directory, 'stats.vb2').stats
+    check(stats is None or (stats.records == 1000 and stats.dropped_rows == 100), "stats: STATS section")
+
+    reader = open_reader(directory, 'live.vb2')
+    check_rows("live", reader, np.arange(5000))
+
+    reader = open_reader(directory, 'events.vb2')
+    events = reader.events(250, 450)
+    check([e[0] for e in events] == [300, 400] and events[0][5] == "row 300 of events at 42.86", "log_events: events()")
+
+    check(any("k=57 i=164 name=blog" in line for line in read_binary_log(os.path.join(directory, 'blog.vb2.log'))), "binary_log")
+
+    reader = open_reader(directory, 'schema.vb2')
+    robot = reader['robot']
+    check(robot['position'][199] == 99.5 and robot['joints'][199][3] == 199.0, "schema: snapshot")
+
+def test_export(directory):
+    """ tools/vb2_export, in blocks small enough that several threads share every file. """
+    export = os.path.join(ROOT, 'tools', 'vb2_export')
+    if not os.path.exists(export):
+        return
+    csv = os.path.join(directory, 'export.csv')
+    subprocess.run([export, '--block', '100', '--threads', '4', os.path.join(directory, 'linear_sync.vb2'), csv], check=True)
+    data = np.genfromtxt(csv, delimiter=',', names=True)
+    check(data.dtype.names == ('i', 'l', 'f', 'd') and len(data) == 5000, "export: csv columns")
+    check_rows("export: csv", {c: data[c].astype(v.dtype) for c, v in expected(np.arange(5000)).items()}, np.arange(5000))
+
+    npy = os.path.join(directory, 'export_npy')
+    subprocess.run([export, '--format', 'npy', '--block', '1000', '--threads', '4', '--rows', '5000:15000',
+                    os.path.join(directory, 'stream_compressed.vb2'), npy], check=True)
+    check_rows("export: npy", {c: np.load(os.path.join(npy, c + '.npy')) for c in 'ilfd'}, np.arange(5000, 15000))
+
+    header = subprocess.run([export, '--vars', 'arr,pose', os.path.join(directory, 'wide.vb2'), '-'],
+                            check=True, capture_output=True, text=True).stdout.splitlines()[0]
+    check(header == "arr[0],arr[1],arr[2],pose.x,pose.q[0],pose.q[1],pose.q[2],pose.id", "export: wide columns")
+
+if __name__ == '__main__':
+    if np is None:
+        print("numpy is not installed, skipping the Python reader tests")
+        sys.exit(0)
+    from vb2_reader import VB2Reader, VB2Dataset, VB2_ROW_PREFIX, read_binary_log
+    directory = sys.argv[1] if len(sys.argv) > 1 else 'test_output'
+    test_files(directory)
+    test_export(directory)
+    for failure in failures:
+        print(f"  {failure}")
+    print(f"python reader: {len(failures)} failed")
+    sys.exit(1 if failures else 0)
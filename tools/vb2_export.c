@@ -0,0 +1,667 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vb2_reader.h"
+
+/*
+    Exports a VB2 file to CSV, or to a directory of .npy files with one column each.
+    The work is cut into blocks of rows (and of columns for .npy) that worker threads claim in turn.
+    Every worker maps the file with its own reader, so memory stays at a block per thread whatever
+    the size of the file. CSV blocks are formatted in parallel and written in row order, .npy
+    blocks go straight to their place in the column's file.
+
+    Usage: vb2_export [options] test.vb2 out.csv
+           vb2_export --format npy --vars position,velocity --time 10:20 test.vb2 out_dir
+    Arrays become one CSV column per element ("name[0]"), described struct columns one per member
+    ("name.member"), other struct columns and byte arrays a hex string. Sampled variables
+    (vb2_set_divisor, vb2_set_change_only) repeat their last sample on the rows in between.
+*/
+
+#define EXPORT_BLOCK_BYTES (8u << 20) // Memory a thread works through at a time
+
+// "CLOCK" section, see VB_Clock_Info in var_buffer_2.c
+struct Export_Clock {
+    size_t   source;
+    size_t   start_ticks;
+    size_t   start_realtime;
+    double   ticks_per_second;
+};
+
+// One CSV value: an element of a column, of a member of a struct column, or a whole raw row as hex
+struct Export_Cell {
+    size_t        column;               // Index in Export.columns
+    size_t        offset;               // Of the element in the row
+    enum vb2_type type;
+    size_t        hex;                  // Bytes printed as hex, 0 for numbers
+};
+
+struct Export {
+    const char *filename;
+    const char *output;
+    int         npy;                    // Directory of .npy files instead of CSV
+    int        *columns;                // Selected column indices
+    size_t      column_count;
+    size_t     *rows;                   // Rows of each selected column in [first, last)
+    size_t      first, last;            // Row range
+    size_t      block_rows;
+    size_t      blocks;                 // Row blocks
+    size_t      jobs;                   // blocks, times column_count for .npy
+    size_t      next;                   // Next job to claim
+    struct Export_Cell *cells;          // CSV only
+    size_t      cell_count;
+    size_t      row_text;               // Upper bound of a formatted CSV row
+    // CSV blocks are written in order
+    FILE           *out;
+    pthread_mutex_t lock;
+    pthread_cond_t  turn;
+    size_t          written;            // Blocks written so far
+    int             failed;
+    // .npy files, one per selected column
+    int            *fds;
+    size_t         *data_offsets;       // End of each file's header
+};
+
+static enum vb2_type export_parse_type(const char *type, size_t *elements) {
+    size_t length = strcspn(type, "[");
+    static const char *names[] = { "", "int", "long", "float", "double", "byte" };
+    enum vb2_type base = VB2_TYPE_UNKNOWN;
+    for (int t = VB2_TYPE_INT; t <= VB2_TYPE_BYTE; t++) {
+        if (strlen(names[t]) == length && strncmp(type, names[t], length) == 0) {
+            base = (enum vb2_type)t;
+        }
+    }
+    *elements = type[length] == '[' ? strtoull(type + length + 1, NULL, 10) : 1;
+    return base;
+}
+
+static size_t export_type_size(enum vb2_type type) {
+    switch (type) {
+        case VB2_TYPE_INT:    return 4;
+        case VB2_TYPE_LONG:   return 8;
+        case VB2_TYPE_FLOAT:  return 4;
+        case VB2_TYPE_DOUBLE: return 8;
+        case VB2_TYPE_BYTE:   return 1;
+        default:              return 0;
+    }
+}
+
+static const char *export_npy_descr(enum vb2_type type) {
+    switch (type) {
+        case VB2_TYPE_INT:    return "<i4";
+        case VB2_TYPE_LONG:   return "<i8";
+        case VB2_TYPE_FLOAT:  return "<f4";
+        case VB2_TYPE_DOUBLE: return "<f8";
+        default:              return "|u1";
+    }
+}
+
+// ***********************************************
+//              Selection
+// ***********************************************
+static int export_select(struct Export *ex, const vb2_reader *rd, const char *vars) {
+    size_t count = vb2_reader_column_count(rd);
+    ex->columns = malloc(sizeof(int) * (count ? count : 1));
+    if (ex->columns == NULL) {
+        return -1;
+    }
+    if (vars == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            if (strncmp(vb2_reader_column(rd, (int)i)->name, VB2_ROW_PREFIX, strlen(VB2_ROW_PREFIX)) != 0) {
+                ex->columns[ex->column_count++] = (int)i; // Row index columns are only needed to align
+            }
+        }
+        return 0;
+    }
+    while (*vars) {
+        size_t length = strcspn(vars, ",");
+        char name[256];
+        snprintf(name, sizeof(name), "%.*s", (int)length, vars);
+        int col = vb2_reader_find(rd, name);
+        if (col < 0) {
+            fprintf(stderr, "No variable %s in %s\n", name, ex->filename);
+            return -1;
+        }
+        if (ex->column_count < count) {
+            ex->columns[ex->column_count++] = col;
+        }
+        vars += vars[length] == ',' ? length + 1 : length;
+    }
+    return 0;
+}
+
+// First row whose timestamp is at or after seconds, by binary search on the "__time" column
+static size_t export_find_time(vb2_reader *rd, int time_col, const struct Export_Clock *clock, double seconds) {
+    size_t lo = 0, hi = vb2_reader_column(rd, time_col)->count;
+    int64_t target = (int64_t)clock->start_ticks + (int64_t)(seconds * clock->ticks_per_second);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int64_t ticks = 0;
+        vb2_reader_read(rd, time_col, mid, 1, 1, &ticks);
+        if (ticks < target) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static int export_time_range(struct Export *ex, vb2_reader *rd, double t0, double t1) {
+    int time_col = vb2_reader_find(rd, "__time");
+    if (time_col < 0) {
+        fprintf(stderr, "%s was recorded without timestamps\n", ex->filename);
+        return -1;
+    }
+    struct Export_Clock clock = { .ticks_per_second = 1e9 };
+    size_t size = 0;
+    const void *section = vb2_reader_section(rd, "CLOCK", &size);
+    if (section != NULL && size >= sizeof(clock)) {
+        memcpy(&clock, section, sizeof(clock));
+    } else {
+        int64_t first = 0;
+        vb2_reader_read(rd, time_col, 0, 1, 1, &first);
+        clock.start_ticks = (size_t)first;
+    }
+    ex->first = export_find_time(rd, time_col, &clock, t0);
+    ex->last  = export_find_time(rd, time_col, &clock, t1);
+    return 0;
+}
+
+// ***********************************************
+//              CSV
+// ***********************************************
+static int export_add_cell(struct Export *ex, size_t column, size_t offset, enum vb2_type type, size_t hex) {
+    if ((ex->cell_count & (ex->cell_count - 1)) == 0) { // Grows at powers of two
+        struct Export_Cell *cells = realloc(ex->cells, sizeof(struct Export_Cell) * (ex->cell_count ? ex->cell_count * 2 : 1));
+        if (cells == NULL) {
+            return -1;
+        }
+        ex->cells = cells;
+    }
+    ex->cells[ex->cell_count++] = (struct Export_Cell){ .column = column, .offset = offset, .type = type, .hex = hex };
+    ex->row_text += hex ? hex * 2 + 1 : 32; // "%.17g" of a double and the separator fit in 32
+    return 0;
+}
+
+// Lays the selected columns out as CSV cells and writes the header line
+static int export_csv_cells(struct Export *ex, const vb2_reader *rd) {
+    for (size_t c = 0; c < ex->column_count; c++) {
+        int col = ex->columns[c];
+        const struct vb2_column *column = vb2_reader_column(rd, col);
+        size_t field_count = 0;
+        const struct vb2_field *fields = vb2_reader_fields(rd, col, &field_count);
+        for (size_t f = 0; f < field_count; f++) {
+            size_t elements;
+            enum vb2_type type = export_parse_type(fields[f].type, &elements);
+            for (size_t e = 0; e < elements && type != VB2_TYPE_UNKNOWN; e++) {
+                if (export_add_cell(ex, c, fields[f].offset + e * export_type_size(type), type, 0) != 0) {
+                    return -1;
+                }
+                fprintf(ex->out, "%s%s.%s", ex->cell_count > 1 ? "," : "", column->name, fields[f].name);
+                if (elements > 1) {
+                    fprintf(ex->out, "[%zu]", e);
+                }
+            }
+        }
+        if (field_count > 0) {
+            continue;
+        }
+        int raw = column->base == VB2_TYPE_BYTE && column->var_size > 1; // Undescribed struct or byte array
+        size_t elements = raw ? 1 : column->elements;
+        for (size_t e = 0; e < elements; e++) {
+            if (export_add_cell(ex, c, e * export_type_size(column->base), column->base, raw ? column->var_size : 0) != 0) {
+                return -1;
+            }
+            fprintf(ex->out, "%s%s", ex->cell_count > 1 ? "," : "", column->name);
+            if (elements > 1) {
+                fprintf(ex->out, "[%zu]", e);
+            }
+        }
+    }
+    fputc('\n', ex->out);
+    ex->row_text += 1;
+    return 0;
+}
+
+static char *export_format_long(char *at, int64_t value) {
+    char digits[24];
+    size_t n = 0;
+    uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+    do {
+        digits[n++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *at++ = '-';
+    }
+    while (n) {
+        *at++ = digits[--n];
+    }
+    return at;
+}
+
+static char *export_format_cell(char *at, const struct Export_Cell *cell, const uint8_t *value) {
+    static const char hex[] = "0123456789abcdef";
+    if (cell->hex) {
+        for (size_t i = 0; i < cell->hex; i++) {
+            *at++ = hex[value[i] >> 4];
+            *at++ = hex[value[i] & 15];
+        }
+        return at;
+    }
+    switch (cell->type) {
+        case VB2_TYPE_INT: {
+            int32_t v;
+            memcpy(&v, value, sizeof(v));
+            return export_format_long(at, v);
+        }
+        case VB2_TYPE_LONG: {
+            int64_t v;
+            memcpy(&v, value, sizeof(v));
+            return export_format_long(at, v);
+        }
+        case VB2_TYPE_FLOAT: {
+            float v;
+            memcpy(&v, value, sizeof(v));
+            return at + sprintf(at, "%.9g", (double)v); // Round trips
+        }
+        case VB2_TYPE_DOUBLE: {
+            double v;
+            memcpy(&v, value, sizeof(v));
+            return at + sprintf(at, "%.17g", v);
+        }
+        case VB2_TYPE_BYTE:
+            return export_format_long(at, *value);
+        default:
+            return at;
+    }
+}
+
+// Reads the rows of a block column by column, formats them and writes them once the blocks before are out
+static int export_csv_block(struct Export *ex, vb2_reader *rd, size_t block, uint8_t **data, char *text) {
+    size_t first = ex->first + block * ex->block_rows;
+    size_t rows  = ex->last - first < ex->block_rows ? ex->last - first : ex->block_rows;
+    size_t read[ex->column_count ? ex->column_count : 1];
+    for (size_t c = 0; c < ex->column_count; c++) {
+        read[c] = vb2_reader_read_aligned(rd, ex->columns[c], first, rows, data[c]);
+    }
+    char *at = text;
+    for (size_t row = 0; row < rows; row++) {
+        for (size_t i = 0; i < ex->cell_count; i++) {
+            const struct Export_Cell *cell = &ex->cells[i];
+            if (i > 0) {
+                *at++ = ',';
+            }
+            if (row < read[cell->column]) { // Empty past the end of a shorter column
+                size_t var_size = vb2_reader_column(rd, ex->columns[cell->column])->var_size;
+                at = export_format_cell(at, cell, data[cell->column] + row * var_size + cell->offset);
+            }
+        }
+        *at++ = '\n';
+    }
+
+    pthread_mutex_lock(&ex->lock);
+    while (ex->written != block) {
+        pthread_cond_wait(&ex->turn, &ex->lock);
+    }
+    if (!ex->failed && fwrite(text, 1, (size_t)(at - text), ex->out) != (size_t)(at - text)) {
+        ex->failed = 1;
+    }
+    ex->written++;
+    pthread_cond_broadcast(&ex->turn);
+    pthread_mutex_unlock(&ex->lock);
+    return 0;
+}
+
+// ***********************************************
+//              .npy
+// ***********************************************
+// Writes the header of a column's file, padded so the data starts on a 64 byte boundary
+static int export_npy_header(struct Export *ex, const vb2_reader *rd, size_t c) {
+    int col = ex->columns[c];
+    const struct vb2_column *column = vb2_reader_column(rd, col);
+    char descr[4096];
+    size_t length = 0, field_count = 0;
+    const struct vb2_field *fields = vb2_reader_fields(rd, col, &field_count);
+    if (field_count > 0) {
+        // Structured records, padding as unnamed void fields as numpy writes them
+        size_t offset = 0;
+        length += (size_t)snprintf(descr, sizeof(descr), "[");
+        for (size_t f = 0; f < field_count && length < sizeof(descr); f++) {
+            size_t elements;
+            enum vb2_type type = export_parse_type(fields[f].type, &elements);
+            if (fields[f].offset > offset) {
+                length += (size_t)snprintf(descr + length, sizeof(descr) - length, "('', '|V%zu'), ", fields[f].offset - offset);
+            }
+            if (length < sizeof(descr)) {
+                length += (size_t)snprintf(descr + length, sizeof(descr) - length, elements > 1 ? "('%s', '%s', (%zu,)), " : "('%s', '%s'), ",
+                                           fields[f].name, export_npy_descr(type), elements);
+            }
+            offset = fields[f].offset + elements * export_type_size(type);
+        }
+        if (column->var_size > offset && length < sizeof(descr)) {
+            length += (size_t)snprintf(descr + length, sizeof(descr) - length, "('', '|V%zu'), ", column->var_size - offset);
+        }
+        if (length < sizeof(descr)) {
+            snprintf(descr + length, sizeof(descr) - length, "]");
+        }
+    } else {
+        snprintf(descr, sizeof(descr), "'%s'", export_npy_descr(column->base));
+    }
+    size_t elements = field_count > 0 ? 0 : column->base == VB2_TYPE_BYTE ? column->var_size : column->elements;
+    char header[sizeof(descr) + 128];
+    int size = elements > 1 ? snprintf(header + 10, sizeof(header) - 10, "{'descr': %s, 'fortran_order': False, 'shape': (%zu, %zu), }", descr, ex->rows[c], elements)
+                            : snprintf(header + 10, sizeof(header) - 10, "{'descr': %s, 'fortran_order': False, 'shape': (%zu,), }", descr, ex->rows[c]);
+    size_t total = (10 + (size_t)size + 1 + 63) / 64 * 64;
+    if ((size_t)size >= sizeof(header) - 10 || total > sizeof(header)) {
+        fprintf(stderr, "Type of %s is too long for a .npy header\n", column->name);
+        return -1;
+    }
+    memcpy(header, "\x93NUMPY\x01\x00", 8);
+    header[8] = (char)((total - 10) & 0xff);
+    header[9] = (char)((total - 10) >> 8);
+    memset(header + 10 + size, ' ', total - 10 - (size_t)size - 1);
+    header[total - 1] = '\n';
+    ex->data_offsets[c] = total;
+    if (pwrite(ex->fds[c], header, total, 0) != (ssize_t)total ||
+        ftruncate(ex->fds[c], (off_t)(total + ex->rows[c] * column->var_size)) != 0) {
+        fprintf(stderr, "Cannot write the file of %s: %s\n", column->name, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static int export_npy_open(struct Export *ex, const vb2_reader *rd) {
+    if (mkdir(ex->output, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Cannot create %s: %s\n", ex->output, strerror(errno));
+        return -1;
+    }
+    ex->fds          = malloc(sizeof(int) * ex->column_count);
+    ex->data_offsets = malloc(sizeof(size_t) * ex->column_count);
+    if (ex->fds == NULL || ex->data_offsets == NULL) {
+        return -1;
+    }
+    for (size_t c = 0; c < ex->column_count; c++) {
+        char path[4096], name[256];
+        snprintf(name, sizeof(name), "%s", vb2_reader_column(rd, ex->columns[c])->name);
+        for (char *p = name; *p; p++) {
+            *p = *p == '/' ? '_' : *p;
+        }
+        snprintf(path, sizeof(path), "%s/%s.npy", ex->output, name);
+        ex->fds[c] = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (ex->fds[c] < 0) {
+            fprintf(stderr, "Cannot create %s: %s\n", path, strerror(errno));
+            ex->column_count = c; // Close the ones opened so far
+            return -1;
+        }
+        if (export_npy_header(ex, rd, c) != 0) {
+            ex->column_count = c + 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Rows of one column in a block, written at their place in the column's file
+static int export_npy_block(struct Export *ex, vb2_reader *rd, size_t job, uint8_t *data) {
+    size_t c     = job / ex->blocks;
+    size_t first = (job % ex->blocks) * ex->block_rows;
+    if (first >= ex->rows[c]) {
+        return 0; // Column ends before the block
+    }
+    size_t rows     = ex->rows[c] - first < ex->block_rows ? ex->rows[c] - first : ex->block_rows;
+    size_t var_size = vb2_reader_column(rd, ex->columns[c])->var_size;
+    size_t bytes    = vb2_reader_read_aligned(rd, ex->columns[c], ex->first + first, rows, data) * var_size;
+    if (pwrite(ex->fds[c], data, bytes, (off_t)(ex->data_offsets[c] + first * var_size)) != (ssize_t)bytes) {
+        __atomic_store_n(&ex->failed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+    return 0;
+}
+
+// ***********************************************
+//              Workers
+// ***********************************************
+static void *export_worker(void *arg) {
+    struct Export *ex = arg;
+    vb2_reader *rd = vb2_reader_open(ex->filename); // Readers decode chunks into a buffer of their own
+    size_t row_size = 0;
+    for (size_t c = 0; c < ex->column_count; c++) {
+        row_size += vb2_reader_column(rd, ex->columns[c])->var_size;
+    }
+    uint8_t *buffer = malloc(ex->npy ? row_size * ex->block_rows : (row_size + ex->row_text) * ex->block_rows);
+    uint8_t *data[ex->column_count ? ex->column_count : 1];
+    for (size_t c = 0, at = 0; c < ex->column_count && buffer != NULL; c++) {
+        data[c] = buffer + at * ex->block_rows;
+        at += vb2_reader_column(rd, ex->columns[c])->var_size;
+    }
+    for (;;) {
+        size_t job = __atomic_fetch_add(&ex->next, 1, __ATOMIC_RELAXED);
+        if (job >= ex->jobs) {
+            break;
+        }
+        if (rd == NULL || buffer == NULL) {
+            __atomic_store_n(&ex->failed, 1, __ATOMIC_RELAXED);
+            if (!ex->npy) {
+                pthread_mutex_lock(&ex->lock); // Keep the blocks after this one moving
+                while (ex->written != job) {
+                    pthread_cond_wait(&ex->turn, &ex->lock);
+                }
+                ex->written++;
+                pthread_cond_broadcast(&ex->turn);
+                pthread_mutex_unlock(&ex->lock);
+            }
+            continue;
+        }
+        if (ex->npy) {
+            export_npy_block(ex, rd, job, data[job / ex->blocks]);
+        } else {
+            export_csv_block(ex, rd, job, data, (char *)buffer + row_size * ex->block_rows);
+        }
+    }
+    free(buffer);
+    vb2_reader_close(rd);
+    return NULL;
+}
+
+static void export_run(struct Export *ex, long threads) {
+    pthread_mutex_init(&ex->lock, NULL);
+    pthread_cond_init(&ex->turn, NULL);
+    pthread_t workers[threads];
+    long started = 0;
+    for (; started < threads; started++) {
+        if (pthread_create(&workers[started], NULL, export_worker, ex) != 0) {
+            break;
+        }
+    }
+    if (started == 0) {
+        export_worker(ex); // No threads, do it all here
+    }
+    for (long t = 0; t < started; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    pthread_cond_destroy(&ex->turn);
+    pthread_mutex_destroy(&ex->lock);
+}
+
+static void export_usage(const char *program) {
+    printf("Usage: %s [options] <file.vb2> <output>\n"
+           "  --format FORMAT     csv (output is a file, - for stdout) or npy (output is a directory) (default csv)\n"
+           "  --vars NAME,...     Variables to export (default all)\n"
+           "  --rows FIRST:LAST   Rows [FIRST, LAST), FIRST: to the end (default all)\n"
+           "  --time T0:T1        Rows recorded in [T0, T1) seconds since vb2_start, needs timestamps\n"
+           "  --threads N         Worker threads, 1 to 4096 (default one per core)\n"
+           "  --block N           Rows per block (default sized to about 8 MB per thread)\n", program);
+}
+
+// Unsigned decimal at the start of text, *end is past it. -1 if there is none or it overflows.
+static int export_number(const char *text, const char **end, size_t *value) {
+    if (*text < '0' || *text > '9') {
+        return -1; // strtoull would take a sign or spaces
+    }
+    char *after;
+    errno = 0;
+    unsigned long long number = strtoull(text, &after, 10);
+    if (errno != 0 || number > SIZE_MAX) {
+        return -1;
+    }
+    *value = (size_t)number;
+    *end   = after;
+    return 0;
+}
+
+// FIRST:LAST or FIRST: (to the end), FIRST < LAST
+static int export_row_range(const char *text, size_t *first, size_t *last) {
+    const char *end;
+    if (export_number(text, &end, first) != 0 || *end != ':') {
+        return -1;
+    }
+    *last = SIZE_MAX;
+    if (end[1] != '\0' && (export_number(end + 1, &end, last) != 0 || *end != '\0')) {
+        return -1;
+    }
+    return *first < *last ? 0 : -1;
+}
+
+// T0:T1 or T0: in seconds, T0 < T1
+static int export_time_span(const char *text, double *t0, double *t1) {
+    char *end;
+    *t0 = strtod(text, &end);
+    if (end == text || *end != ':') {
+        return -1;
+    }
+    const char *second = end + 1;
+    *t1 = 1e300;
+    if (*second != '\0') {
+        *t1 = strtod(second, &end);
+        if (end == second || *end != '\0') {
+            return -1;
+        }
+    }
+    return *t0 < *t1 ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+    struct Export ex = { .last = SIZE_MAX };
+    const char *format = "csv", *vars = NULL, *end;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t block = 0, count = 0;
+    double t0 = 0, t1 = 0;
+    int positional = 0, rows = 0, times = 0, valid = 1;
+    for (int i = 1; i < argc; i++) {
+        const char *value = i + 1 < argc ? argv[i + 1] : "";
+        if (strcmp(argv[i], "--format") == 0) {
+            format = value; i++;
+        } else if (strcmp(argv[i], "--vars") == 0) {
+            vars = value; i++;
+        } else if (strcmp(argv[i], "--rows") == 0) {
+            rows  = 1; i++;
+            valid = valid && export_row_range(value, &ex.first, &ex.last) == 0;
+        } else if (strcmp(argv[i], "--time") == 0) {
+            times = 1; i++;
+            valid = valid && export_time_span(value, &t0, &t1) == 0;
+        } else if (strcmp(argv[i], "--threads") == 0) {
+            valid   = valid && export_number(value, &end, &count) == 0 && *end == '\0' && count > 0 && count <= 4096;
+            threads = (long)count; i++;
+        } else if (strcmp(argv[i], "--block") == 0) {
+            valid = valid && export_number(value, &end, &block) == 0 && *end == '\0' && block > 0;
+            i++;
+        } else if (argv[i][0] != '-' || strcmp(argv[i], "-") == 0) {
+            if (positional == 0) {
+                ex.filename = argv[i];
+            } else {
+                ex.output = argv[i];
+            }
+            positional++;
+        } else {
+            export_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 2;
+        }
+    }
+    if (!valid || positional != 2 || (strcmp(format, "csv") != 0 && strcmp(format, "npy") != 0)) {
+        export_usage(argv[0]);
+        return 2;
+    }
+    ex.npy = strcmp(format, "npy") == 0;
+    threads = threads > 0 ? threads : 1;
+
+    vb2_reader *rd = vb2_reader_open(ex.filename);
+    if (rd == NULL) {
+        fprintf(stderr, "Cannot read %s\n", ex.filename);
+        return 1;
+    }
+    int status = 1;
+    if (export_select(&ex, rd, vars) != 0) {
+        goto done;
+    }
+    if (!rows && times && export_time_range(&ex, rd, t0, t1) != 0) {
+        goto done;
+    }
+    size_t longest = 0, row_size = 0;
+    ex.rows = calloc(ex.column_count ? ex.column_count : 1, sizeof(size_t));
+    if (ex.rows == NULL) {
+        goto done;
+    }
+    for (size_t c = 0; c < ex.column_count; c++) {
+        const struct vb2_column *column = vb2_reader_column(rd, ex.columns[c]);
+        size_t count = vb2_reader_aligned_count(rd, ex.columns[c]); // Sampled columns are held to a row each
+        size_t last  = count < ex.last ? count : ex.last;
+        ex.rows[c] = last > ex.first ? last - ex.first : 0;
+        longest = ex.rows[c] > longest ? ex.rows[c] : longest;
+        row_size += column->var_size;
+    }
+    ex.last = ex.first + longest;
+
+    if (ex.npy) {
+        if (export_npy_open(&ex, rd) != 0) {
+            goto done;
+        }
+    } else {
+        ex.out = strcmp(ex.output, "-") == 0 ? stdout : fopen(ex.output, "w");
+        if (ex.out == NULL) {
+            fprintf(stderr, "Cannot write %s: %s\n", ex.output, strerror(errno));
+            goto done;
+        }
+        if (export_csv_cells(&ex, rd) != 0) {
+            goto done;
+        }
+    }
+    size_t block_bytes = ex.npy ? row_size : row_size + ex.row_text;
+    ex.block_rows = block ? block : EXPORT_BLOCK_BYTES / (block_bytes ? block_bytes : 1);
+    ex.block_rows = ex.block_rows ? ex.block_rows : 1;
+    ex.blocks = (longest + ex.block_rows - 1) / ex.block_rows;
+    ex.jobs   = ex.npy ? ex.blocks * ex.column_count : ex.blocks;
+    if ((size_t)threads > ex.jobs) {
+        threads = ex.jobs ? (long)ex.jobs : 1;
+    }
+
+    export_run(&ex, threads);
+    status = ex.failed ? 1 : 0;
+    if (ex.failed) {
+        fprintf(stderr, "Failed to export %s\n", ex.filename);
+    }
+
+done:
+    if (ex.out != NULL && ex.out != stdout && fclose(ex.out) != 0) {
+        status = 1;
+    } else if (ex.out == stdout) {
+        fflush(stdout);
+    }
+    for (size_t c = 0; ex.fds != NULL && c < ex.column_count; c++) {
+        close(ex.fds[c]);
+    }
+    free(ex.fds);
+    free(ex.data_offsets);
+    free(ex.cells);
+    free(ex.rows);
+    free(ex.columns);
+    vb2_reader_close(rd);
+    return status;
+}
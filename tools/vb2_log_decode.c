@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "vb2_reader.h"
+
+/*
+    Formats a binary log written with vb2_log_set_binary(1) into text.
+    Usage: vb2_log_decode test.vb2.log [out.txt]
+*/
+
+int main(int argc, char **argv) {
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        fprintf(stderr, "Usage: %s <file.log> [output]\n", argv[0]);
+        return 2;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        perror(argv[2]);
+        fclose(in);
+        return 1;
+    }
+    long records = vb2_log_decode(in, out);
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (records < 0) {
+        fprintf(stderr, "%s is not a binary log\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}